@@ -0,0 +1,56 @@
+###############################################################################
+##  BENCH FLAGS                                                      		 ##
+###############################################################################
+
+BENCH_CFLAGS = -I$(TARGET_INCL)
+
+ifeq ($(OS),Darwin)
+BENCH_LDFLAGS = -lssl -lcrypto -lpthread -lm
+else
+BENCH_LDFLAGS = -lssl -lcrypto -lpthread -lm -lrt
+endif
+
+BENCH_DEPS =
+BENCH_DEPS += $(TARGET_LIB)/libaerospike-common.a
+
+###############################################################################
+##  BENCH OBJECTS                                                     		 ##
+###############################################################################
+
+# Each source file in src/bench is a standalone benchmark program.
+BENCH_SOURCE = $(wildcard $(SOURCE_BENCH)/*.c)
+
+BENCH_OBJECT = $(patsubst %.c,%.o,$(subst $(SOURCE_BENCH)/,$(TARGET_BENCH)/,$(BENCH_SOURCE)))
+
+BENCH_PROGRAMS = $(patsubst %.o,%,$(BENCH_OBJECT))
+
+###############################################################################
+##  BENCH TARGETS                                                     		 ##
+###############################################################################
+
+# Run all benchmarks, or just one via: make bench BENCH=queue_contention
+.PHONY: bench
+bench: bench-build
+ifdef BENCH
+	$(TARGET_BENCH)/$(BENCH)
+else
+	@for b in $(BENCH_PROGRAMS); do echo "=== $$b"; $$b || exit 1; done
+endif
+
+.PHONY: bench-build
+bench-build: $(BENCH_PROGRAMS)
+
+.PHONY: bench-clean
+bench-clean:
+	@rm -rf $(TARGET_BENCH)
+
+.PRECIOUS: $(TARGET_BENCH)/%.o
+
+$(TARGET_BENCH)/%.o: CFLAGS = $(BENCH_CFLAGS)
+$(TARGET_BENCH)/%.o: $(SOURCE_BENCH)/%.c $(SOURCE_BENCH)/bench.h | modules build prepare
+	$(object)
+
+$(TARGET_BENCH)/%: CFLAGS = $(BENCH_CFLAGS)
+$(TARGET_BENCH)/%: LDFLAGS = $(BENCH_DEPS) $(BENCH_LDFLAGS)
+$(TARGET_BENCH)/%: $(TARGET_BENCH)/%.o $(BENCH_DEPS) | modules build prepare
+	$(executable)
@@ -48,6 +48,7 @@ SOURCE_PATH = $(SOURCE)
 SOURCE_MAIN = $(SOURCE_PATH)/main
 SOURCE_INCL = $(SOURCE_PATH)/include
 SOURCE_TEST = $(SOURCE_PATH)/test
+SOURCE_BENCH = $(SOURCE_PATH)/bench
 
 VPATH = $(SOURCE_MAIN) $(SOURCE_INCL)
 
@@ -90,6 +91,7 @@ TARGET_M4	= $(TARGET_BASE)/m4
 TARGET_SRC 	= $(TARGET_BASE)/src
 TARGET_INCL = $(TARGET_BASE)/include
 TARGET_TEST = $(TARGET_BASE)/test
+TARGET_BENCH = $(TARGET_BASE)/bench
 
 ###############################################################################
 ##  FUNCTIONS                                                                ##
@@ -24,6 +24,7 @@ TEST_AEROSPIKE += test.c
 TEST_AEROSPIKE += test_common.c
 TEST_AEROSPIKE += types/*.c
 TEST_AEROSPIKE += msgpack/*.c
+TEST_AEROSPIKE += citrusleaf/*.c
 
 TEST_SOURCE = $(wildcard $(addprefix $(SOURCE_TEST)/, $(TEST_AEROSPIKE)))
 
@@ -0,0 +1,192 @@
+/*
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+/*
+ * Allocation-heavy paths under each cf_malloc() backend - the C library
+ * called directly, the C library behind cf_hook_alloc() hooks (the cost of
+ * the indirection alone), and the built-in caching allocator. Threads each
+ * unpack a msgpack'd map of strings, integers and a list with
+ * as_unpack_val() and destroy the result, then churn cf_queue create, push
+ * and destroy, then cf_malloc() and cf_free() mixed small sizes.
+ *
+ * Usage: alloc_backends [threads] (default 4)
+ */
+
+#include <aerospike/as_arraylist.h>
+#include <aerospike/as_hashmap.h>
+#include <aerospike/as_integer.h>
+#include <aerospike/as_msgpack.h>
+#include <aerospike/as_serializer.h>
+#include <aerospike/as_string.h>
+#include <citrusleaf/alloc.h>
+#include <citrusleaf/cf_queue.h>
+#include <string.h>
+
+#include "bench.h"
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+	const char* name;
+	cf_alloc_hooks* hooks;
+} backend;
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define N_UNPACKS 20000
+#define N_QUEUES 20000
+#define N_MALLOCS 2000000
+
+/******************************************************************************
+ * GLOBALS
+ *****************************************************************************/
+
+static uint8_t* g_packed;
+static uint32_t g_packed_sz;
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static void* libc_malloc(size_t sz, cf_alloc_arena arena) { return malloc(sz); }
+static void* libc_calloc(size_t nmemb, size_t sz, cf_alloc_arena arena) { return calloc(nmemb, sz); }
+static void* libc_realloc(void* ptr, size_t sz, cf_alloc_arena arena) { return realloc(ptr, sz); }
+static void* libc_valloc(size_t sz, cf_alloc_arena arena) { return valloc(sz); }
+
+static cf_alloc_hooks g_libc_hooks = {
+	.malloc = libc_malloc,
+	.calloc = libc_calloc,
+	.realloc = libc_realloc,
+	.valloc = libc_valloc,
+	.free = free
+};
+
+static void
+pack_sample()
+{
+	as_hashmap* m = as_hashmap_new(64);
+	as_arraylist* l = as_arraylist_new(16, 16);
+	as_serializer ser;
+	as_buffer b;
+
+	for (int i = 0; i < 40; i++) {
+		char key[32];
+		sprintf(key, "bin-name-%d", i);
+		as_hashmap_set(m, (as_val*)as_string_new_strdup(key), (as_val*)as_integer_new(i * 1000));
+		as_arraylist_append_str(l, key);
+	}
+	as_hashmap_set(m, (as_val*)as_string_new_strdup("list"), (as_val*)l);
+
+	as_msgpack_init(&ser);
+	as_buffer_init(&b);
+	as_serializer_serialize(&ser, (as_val*)m, &b);
+
+	g_packed = malloc(b.size);
+	memcpy(g_packed, b.data, b.size);
+	g_packed_sz = b.size;
+
+	as_buffer_destroy(&b);
+	as_serializer_destroy(&ser);
+	as_hashmap_destroy(m);
+}
+
+static void*
+unpack_run(void* udata)
+{
+	for (int i = 0; i < N_UNPACKS; i++) {
+		as_unpacker pk = { .buffer = g_packed, .offset = 0, .length = (int)g_packed_sz };
+		as_val* v = NULL;
+
+		as_unpack_val(&pk, &v);
+		as_val_destroy(v);
+	}
+	return NULL;
+}
+
+static void*
+queue_run(void* udata)
+{
+	for (int i = 0; i < N_QUEUES; i++) {
+		cf_queue* q = cf_queue_create(sizeof(uint64_t), false);
+
+		for (uint64_t j = 0; j < 100; j++) {
+			cf_queue_push(q, &j);
+		}
+		cf_queue_destroy(q);
+	}
+	return NULL;
+}
+
+static void*
+malloc_run(void* udata)
+{
+	void* held[256] = { NULL };
+
+	for (uint32_t i = 0; i < N_MALLOCS; i++) {
+		uint32_t j = (i * 97) & 255;
+
+		cf_free(held[j]);
+		held[j] = cf_malloc(8 + ((i * 13) % 500));
+	}
+
+	for (int j = 0; j < 256; j++) {
+		cf_free(held[j]);
+	}
+	return NULL;
+}
+
+/******************************************************************************
+ * MAIN
+ *****************************************************************************/
+
+int
+main(int argc, char* argv[])
+{
+	uint32_t n_threads = argc > 1 ? (uint32_t)atoi(argv[1]) : 4;
+	backend backends[] = {
+			{ "libc", NULL },
+			{ "libc-hooks", &g_libc_hooks },
+			{ "cache", cf_alloc_cache_hooks() }
+	};
+
+	pack_sample();
+
+	printf("%-12s %14s %14s %14s\n", "backend", "unpack K/s", "queue K/s", "malloc M/s");
+
+	for (int round = 0; round < 2; round++) {
+		for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+			cf_hook_alloc(backends[b].hooks);
+
+			uint64_t unpack_us = bench_run_threads(n_threads, unpack_run, NULL, 0);
+			uint64_t queue_us = bench_run_threads(n_threads, queue_run, NULL, 0);
+			uint64_t malloc_us = bench_run_threads(n_threads, malloc_run, NULL, 0);
+
+			cf_hook_alloc(NULL);
+
+			printf("%-12s %14.1f %14.1f %14.2f\n", backends[b].name,
+					bench_mops((uint64_t)n_threads * N_UNPACKS, unpack_us) * 1000.0,
+					bench_mops((uint64_t)n_threads * N_QUEUES, queue_us) * 1000.0,
+					bench_mops((uint64_t)n_threads * N_MALLOCS, malloc_us));
+		}
+	}
+
+	free(g_packed);
+	return 0;
+}
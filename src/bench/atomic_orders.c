@@ -0,0 +1,201 @@
+/*
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/*
+ * What the explicit memory orders save over the full-barrier calls. Single
+ * threaded loops time a counter bump, a flag store and an as_val-style
+ * reserve/release pair each way - the old way being the locked op or plain
+ * store followed by smb_mb(), as cf_rc and friends did. Then two threads
+ * hand a payload back and forth through a flag, once with relaxed accesses
+ * and once with release/acquire, and count payloads seen half written. On
+ * x86 both come out clean, since the hardware orders stores anyway and only
+ * the compiler could reorder the relaxed ones. On weakly ordered targets the
+ * relaxed handoff is expected to tear and the release/acquire one must not.
+ *
+ * Usage: atomic_orders [ops] (default 20000000)
+ */
+
+#include <citrusleaf/cf_atomic.h>
+#include <sched.h>
+
+#include "bench.h"
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+	cf_atomic32 seq;
+	uint32_t payload[8];
+	int load_mo;
+	int store_mo;
+	uint32_t torn;
+} mailbox;
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define N_HANDOFFS 200000
+
+/******************************************************************************
+ * GLOBALS
+ *****************************************************************************/
+
+static cf_atomic32 g_word;
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static double
+ns_per_op(uint64_t start_ns, uint64_t ops)
+{
+	return (double)(cf_getns() - start_ns) / (double)ops;
+}
+
+static void
+wait_for(mailbox* m, uint32_t seq)
+{
+	while (cf_atomic32_load(&m->seq, m->load_mo) != seq) {
+		sched_yield();
+	}
+}
+
+static void*
+publish_run(void* udata)
+{
+	mailbox* m = udata;
+
+	for (uint32_t r = 1; r <= N_HANDOFFS; r++) {
+		wait_for(m, (r - 1) * 2);
+
+		for (int i = 0; i < 8; i++) {
+			m->payload[i] = r;
+		}
+		cf_atomic32_store(&m->seq, (r * 2) - 1, m->store_mo);
+	}
+	return NULL;
+}
+
+static void*
+consume_run(void* udata)
+{
+	mailbox* m = udata;
+
+	for (uint32_t r = 1; r <= N_HANDOFFS; r++) {
+		wait_for(m, (r * 2) - 1);
+
+		for (int i = 0; i < 8; i++) {
+			if (m->payload[i] != r) {
+				m->torn++;
+				break;
+			}
+		}
+		cf_atomic32_store(&m->seq, r * 2, m->store_mo);
+	}
+	return NULL;
+}
+
+static uint32_t
+handoff(int load_mo, int store_mo)
+{
+	static mailbox m;
+	pthread_t publisher;
+	pthread_t consumer;
+
+	m = (mailbox){ .load_mo = load_mo, .store_mo = store_mo };
+
+	pthread_create(&consumer, NULL, consume_run, &m);
+	pthread_create(&publisher, NULL, publish_run, &m);
+	pthread_join(publisher, NULL);
+	pthread_join(consumer, NULL);
+
+	return m.torn;
+}
+
+/******************************************************************************
+ * MAIN
+ *****************************************************************************/
+
+int
+main(int argc, char* argv[])
+{
+	uint64_t ops = argc > 1 ? (uint64_t)atoll(argv[1]) : 20000000;
+	uint64_t start;
+
+	printf("%-32s %10s\n", "op", "ns/op");
+
+	for (int round = 0; round < 2; round++) {
+		start = cf_getns();
+		for (uint64_t i = 0; i < ops; i++) {
+			cf_atomic32_incr(&g_word);
+			smb_mb();
+		}
+		printf("%-32s %10.2f\n", "add + smb_mb", ns_per_op(start, ops));
+
+		start = cf_getns();
+		for (uint64_t i = 0; i < ops; i++) {
+			cf_atomic32_fetch_add(&g_word, 1, CF_ATOMIC_RELAXED);
+		}
+		printf("%-32s %10.2f\n", "fetch_add relaxed", ns_per_op(start, ops));
+
+		start = cf_getns();
+		for (uint64_t i = 0; i < ops; i++) {
+			cf_atomic32_set(&g_word, (uint32_t)i);
+			smb_mb();
+		}
+		printf("%-32s %10.2f\n", "set + smb_mb", ns_per_op(start, ops));
+
+		start = cf_getns();
+		for (uint64_t i = 0; i < ops; i++) {
+			cf_atomic32_store(&g_word, (uint32_t)i, CF_ATOMIC_SEQ_CST);
+		}
+		printf("%-32s %10.2f\n", "store seq_cst", ns_per_op(start, ops));
+
+		start = cf_getns();
+		for (uint64_t i = 0; i < ops; i++) {
+			cf_atomic32_store(&g_word, (uint32_t)i, CF_ATOMIC_RELEASE);
+		}
+		printf("%-32s %10.2f\n", "store release", ns_per_op(start, ops));
+
+		start = cf_getns();
+		for (uint64_t i = 0; i < ops; i++) {
+			smb_mb();
+			cf_atomic32_incr(&g_word);
+			smb_mb();
+			cf_atomic32_decr(&g_word);
+		}
+		printf("%-32s %10.2f\n", "reserve/release + smb_mb", ns_per_op(start, ops));
+
+		start = cf_getns();
+		for (uint64_t i = 0; i < ops; i++) {
+			cf_atomic32_fetch_add(&g_word, 1, CF_ATOMIC_RELAXED);
+
+			if (cf_atomic32_fetch_add(&g_word, -1, CF_ATOMIC_RELEASE) == 1) {
+				cf_atomic_fence(CF_ATOMIC_ACQUIRE);
+			}
+		}
+		printf("%-32s %10.2f\n", "reserve relaxed/release release", ns_per_op(start, ops));
+	}
+
+	printf("\n%-32s %10s\n", "handoff", "torn");
+	printf("%-32s %10u\n", "relaxed", handoff(CF_ATOMIC_RELAXED, CF_ATOMIC_RELAXED));
+	printf("%-32s %10u\n", "release/acquire", handoff(CF_ATOMIC_ACQUIRE, CF_ATOMIC_RELEASE));
+
+	return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+#pragma once
+
+/*
+ * Tiny helpers shared by the standalone benchmark programs in src/bench.
+ * Each benchmark prints one row per configuration so runs can be diffed.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <citrusleaf/cf_clock.h>
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef void* (*bench_thread_fn)(void* udata);
+
+/******************************************************************************
+ * INLINE FUNCTIONS
+ *****************************************************************************/
+
+/**
+ * Run n_threads copies of fn, each with &udata[i * udata_sz], and return the
+ * wall-clock time in microseconds from first start to last join.
+ */
+static inline uint64_t
+bench_run_threads(uint32_t n_threads, bench_thread_fn fn, void* udata, size_t udata_sz)
+{
+	pthread_t threads[n_threads];
+	uint64_t start = cf_getus();
+
+	for (uint32_t i = 0; i < n_threads; i++) {
+		if (pthread_create(&threads[i], NULL, fn, (uint8_t*)udata + (i * udata_sz)) != 0) {
+			fprintf(stderr, "failed to start bench thread %u\n", i);
+			exit(1);
+		}
+	}
+
+	for (uint32_t i = 0; i < n_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	return cf_getus() - start;
+}
+
+static inline double
+bench_mops(uint64_t ops, uint64_t us)
+{
+	return us == 0 ? 0.0 : (double)ops / (double)us;
+}
+
+static inline int
+bench_cmp_u64(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/**
+ * Sorts samples in place and returns the requested percentile (0-100).
+ */
+static inline uint64_t
+bench_percentile(uint64_t* samples, size_t n, double pct)
+{
+	if (n == 0) {
+		return 0;
+	}
+	qsort(samples, n, sizeof(uint64_t), bench_cmp_u64);
+	size_t i = (size_t)((pct / 100.0) * (double)(n - 1));
+	return samples[i];
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/*
+ * Threads bumping one shared count, as a single atomic and as a cf_counter,
+ * then what shash_get_size() and cf_rchash_get_size() cost on MT_MANYLOCK
+ * tables of growing size now that they read a cf_counter rather than walk
+ * every bucket.
+ *
+ * Usage: counter_contention [threads] (default 4)
+ */
+
+#include <citrusleaf/alloc.h>
+#include <citrusleaf/cf_counter.h>
+#include <citrusleaf/cf_rchash.h>
+#include <citrusleaf/cf_shash.h>
+
+#include "bench.h"
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define N_ADDS (10 * 1000 * 1000)
+#define N_SIZE_CALLS 1000
+
+/******************************************************************************
+ * GLOBALS
+ *****************************************************************************/
+
+static cf_atomic64 g_count;
+static cf_counter* g_counter;
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static void*
+atomic_run(void* udata)
+{
+	for (int i = 0; i < N_ADDS; i++) {
+		cf_atomic64_fetch_add(&g_count, 1, CF_ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static void*
+counter_run(void* udata)
+{
+	for (int i = 0; i < N_ADDS; i++) {
+		cf_counter_add(g_counter, 1);
+	}
+	return NULL;
+}
+
+static uint32_t
+key_hash(void* key)
+{
+	return (uint32_t)(*(uint64_t*)key * 0x9E3779B97F4A7C15ULL >> 32);
+}
+
+static uint32_t
+rc_key_hash(void* key, uint32_t key_len)
+{
+	return key_hash(key);
+}
+
+/******************************************************************************
+ * MAIN
+ *****************************************************************************/
+
+int
+main(int argc, char* argv[])
+{
+	uint32_t n_threads = argc > 1 ? (uint32_t)atoi(argv[1]) : 4;
+
+	g_counter = cf_counter_create(0);
+
+	printf("%-12s %12s\n", "adds", "M/s");
+
+	for (int round = 0; round < 2; round++) {
+		uint64_t atomic_us = bench_run_threads(n_threads, atomic_run, NULL, 0);
+		uint64_t counter_us = bench_run_threads(n_threads, counter_run, NULL, 0);
+
+		printf("%-12s %12.2f\n", "atomic", bench_mops((uint64_t)n_threads * N_ADDS, atomic_us));
+		printf("%-12s %12.2f\n", "cf_counter", bench_mops((uint64_t)n_threads * N_ADDS, counter_us));
+	}
+
+	printf("\n%-12s %16s %16s\n", "buckets", "shash size us", "rchash size us");
+
+	for (uint32_t n = 1024; n <= 1024 * 1024; n *= 32) {
+		shash* h;
+		cf_rchash* rh;
+		uint64_t v = 0;
+
+		shash_create(&h, key_hash, sizeof(uint64_t), sizeof(uint64_t), n, SHASH_CR_MT_MANYLOCK);
+		cf_rchash_create(&rh, rc_key_hash, NULL, sizeof(uint64_t), n, CF_RCHASH_CR_MT_MANYLOCK);
+
+		for (uint64_t k = 0; k < n; k++) {
+			shash_put(h, &k, &v);
+			cf_rchash_put(rh, &k, sizeof(k), cf_rc_alloc(sizeof(uint64_t)));
+		}
+
+		uint64_t start = cf_getns();
+
+		for (int i = 0; i < N_SIZE_CALLS; i++) {
+			v += shash_get_size(h);
+		}
+
+		double shash_us = (double)(cf_getns() - start) / N_SIZE_CALLS / 1000.0;
+
+		start = cf_getns();
+
+		for (int i = 0; i < N_SIZE_CALLS; i++) {
+			v += cf_rchash_get_size(rh);
+		}
+
+		double rchash_us = (double)(cf_getns() - start) / N_SIZE_CALLS / 1000.0;
+
+		printf("%-12u %16.3f %16.3f\n", n, shash_us, rchash_us);
+
+		shash_destroy(h);
+		cf_rchash_destroy(rh);
+	}
+
+	cf_counter_destroy(g_counter);
+	return 0;
+}
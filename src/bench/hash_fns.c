@@ -0,0 +1,192 @@
+/*
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/*
+ * Speed and bucket spread of the built-in cf_hash functions against what
+ * callers roll themselves - ptr_hash_fn's truncation and a byte-at-a-time
+ * FNV-1a loop - over the key shapes our tables actually hold: heap pointers,
+ * sequential ids, cf_digests and short strings. Each row hashes as many keys
+ * as buckets (load 1) and prints a chain length histogram - a good hash leaves
+ * about 37% of buckets empty and very few chains past 4.
+ *
+ * Usage: hash_fns [log2 buckets] (default 16)
+ */
+
+#include <string.h>
+
+#include <citrusleaf/alloc.h>
+#include <citrusleaf/cf_digest.h>
+#include <citrusleaf/cf_hash.h>
+
+#include "bench.h"
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+	const char* name;
+	cf_hash_fn fn;
+	bool digest_only;
+} hash;
+
+typedef struct {
+	const char* name;
+	uint8_t* keys;
+	size_t key_sz;		// stride - strings are NUL-padded
+	bool strings;
+} shape;
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define MAX_CHAIN 8
+#define N_ROUNDS 20
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+// What ptr_hash_fn does, for any key - the first 4 bytes.
+static uint32_t
+trunc_hash(const void* key, size_t key_len)
+{
+	uint32_t h = 0;
+	memcpy(&h, key, key_len < 4 ? key_len : 4);
+	return h;
+}
+
+static uint32_t
+fnv1a_hash(const void* key, size_t key_len)
+{
+	uint32_t h = 2166136261u;
+
+	for (size_t i = 0; i < key_len; i++) {
+		h = (h ^ ((const uint8_t*)key)[i]) * 16777619u;
+	}
+	return h;
+}
+
+static const hash HASHES[] = {
+	{ "trunc", trunc_hash, false },
+	{ "fnv1a", fnv1a_hash, false },
+	{ "crc32c", cf_hash_crc32c, false },
+	{ "wy32", cf_hash_wy32, false },
+	{ "digest", cf_hash_digest, true }
+};
+
+#define N_HASHES (sizeof(HASHES) / sizeof(hash))
+
+static inline size_t
+key_len(const shape* s, const uint8_t* key)
+{
+	return s->strings ? strlen((const char*)key) : s->key_sz;
+}
+
+static void
+run(const shape* s, const hash* hf, uint32_t n)
+{
+	uint32_t* counts = calloc(n, sizeof(uint32_t));
+	uint32_t hist[MAX_CHAIN + 1] = { 0 };
+	uint32_t max = 0;
+	uint32_t sink = 0;
+
+	uint64_t start = cf_getns();
+
+	for (int r = 0; r < N_ROUNDS; r++) {
+		for (uint32_t i = 0; i < n; i++) {
+			const uint8_t* key = s->keys + (i * s->key_sz);
+			sink += hf->fn(key, key_len(s, key));
+		}
+	}
+
+	double ns = (double)(cf_getns() - start) / ((double)n * N_ROUNDS);
+
+	for (uint32_t i = 0; i < n; i++) {
+		const uint8_t* key = s->keys + (i * s->key_sz);
+		uint32_t b = hf->fn(key, key_len(s, key)) & (n - 1);
+
+		counts[b]++;
+	}
+
+	for (uint32_t b = 0; b < n; b++) {
+		hist[counts[b] < MAX_CHAIN ? counts[b] : MAX_CHAIN]++;
+
+		if (counts[b] > max) {
+			max = counts[b];
+		}
+	}
+
+	printf("%-8s %-8s %7.2fns", s->name, hf->name, ns + (sink == 0xdeadbeef ? 1 : 0));
+
+	for (int c = 0; c <= MAX_CHAIN; c++) {
+		printf(" %6.2f%%", 100.0 * hist[c] / n);
+	}
+
+	printf(" %8u\n", max);
+	free(counts);
+}
+
+/******************************************************************************
+ * MAIN
+ *****************************************************************************/
+
+int
+main(int argc, char* argv[])
+{
+	uint32_t n = 1u << (argc > 1 ? atoi(argv[1]) : 16);
+
+	shape shapes[4] = {
+		{ "ptr", malloc(n * 8), 8, false },
+		{ "id", malloc(n * 8), 8, false },
+		{ "digest", malloc(n * sizeof(cf_digest)), sizeof(cf_digest), false },
+		{ "string", calloc(n, 32), 32, true }
+	};
+
+	// Real heap pointers, as a table of allocations would hold.
+	for (uint32_t i = 0; i < n; i++) {
+		uint64_t ptr = (uint64_t)cf_malloc(48);
+		uint64_t id = i;
+
+		memcpy(shapes[0].keys + (i * 8), &ptr, 8);
+		memcpy(shapes[1].keys + (i * 8), &id, 8);
+
+		char* str = (char*)shapes[3].keys + (i * 32);
+		int len = sprintf(str, "user:%u", i * 7919);
+
+		cf_digest_compute(str, len, (cf_digest*)(shapes[2].keys + (i * sizeof(cf_digest))));
+	}
+
+	printf("%-8s %-8s %9s", "key", "hash", "per key");
+
+	for (int c = 0; c <= MAX_CHAIN; c++) {
+		printf(" %6d%s", c, c == MAX_CHAIN ? "+" : " ");
+	}
+
+	printf(" %8s\n", "longest");
+
+	for (int s = 0; s < 4; s++) {
+		for (size_t h = 0; h < N_HASHES; h++) {
+			if (! HASHES[h].digest_only || shapes[s].key_sz == sizeof(cf_digest)) {
+				run(&shapes[s], &HASHES[h], n);
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/*
+ * Throughput of cf_queue_push_n/cf_queue_pop_n against the single-element
+ * calls, for one producer handing batches to one consumer.
+ */
+
+#include <citrusleaf/cf_queue.h>
+
+#include "bench.h"
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+	void* fn;
+	void* udata;
+} elem;
+
+typedef struct {
+	cf_queue* q;
+	uint32_t batch;
+	bool use_batch_calls;
+	bool producer;
+} worker;
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define TOTAL_ELEMS (4 * 1024 * 1024)
+#define MAX_BATCH 1024
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static void*
+run_producer(void* udata)
+{
+	worker* w = udata;
+	elem batch[MAX_BATCH] = {{ 0 }};
+
+	for (uint32_t n = 0; n < TOTAL_ELEMS; n += w->batch) {
+		if (w->use_batch_calls) {
+			cf_queue_push_n(w->q, batch, w->batch);
+		}
+		else {
+			for (uint32_t i = 0; i < w->batch; i++) {
+				cf_queue_push(w->q, &batch[i]);
+			}
+		}
+	}
+	return NULL;
+}
+
+static void*
+run_consumer(void* udata)
+{
+	worker* w = udata;
+	elem batch[MAX_BATCH];
+	uint32_t n = 0;
+
+	while (n < TOTAL_ELEMS) {
+		if (w->use_batch_calls) {
+			int rv = cf_queue_pop_n(w->q, batch, w->batch, CF_QUEUE_FOREVER);
+
+			if (rv > 0) {
+				n += rv;
+			}
+		}
+		else if (cf_queue_pop(w->q, &batch[0], CF_QUEUE_FOREVER) == CF_QUEUE_OK) {
+			n++;
+		}
+	}
+	return NULL;
+}
+
+static void*
+run_role(void* udata)
+{
+	worker* w = udata;
+	return w->producer ? run_producer(w) : run_consumer(w);
+}
+
+static double
+run(uint32_t batch, bool use_batch_calls)
+{
+	cf_queue* q = cf_queue_create(sizeof(elem), true);
+	worker w[2];
+
+	for (int i = 0; i < 2; i++) {
+		w[i].q = q;
+		w[i].batch = batch;
+		w[i].use_batch_calls = use_batch_calls;
+		w[i].producer = (i == 0);
+	}
+
+	uint64_t us = bench_run_threads(2, run_role, w, sizeof(worker));
+
+	cf_queue_destroy(q);
+	return bench_mops(TOTAL_ELEMS, us);
+}
+
+/******************************************************************************
+ * MAIN
+ *****************************************************************************/
+
+int
+main(int argc, char* argv[])
+{
+	printf("%8s %16s %16s %8s\n", "batch", "single Melem/s", "batch Melem/s", "speedup");
+
+	for (uint32_t batch = 1; batch <= MAX_BATCH; batch *= 4) {
+		double single = run(batch, false);
+		double batched = run(batch, true);
+		printf("%8u %16.2f %16.2f %8.2f\n", batch, single, batched, single == 0 ? 0 : batched / single);
+	}
+	return 0;
+}
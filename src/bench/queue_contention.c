@@ -0,0 +1,114 @@
+/*
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/*
+ * Contention benchmark - mutex cf_queue versus CF_QUEUE_LOCKFREE ring.
+ * Every thread is both a producer and a consumer: it pushes one element and
+ * then pops one, so both ends of the queue are hammered at once.
+ */
+
+#include <citrusleaf/cf_queue.h>
+
+#include "bench.h"
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+	void* fn;
+	void* udata;
+} elem;
+
+typedef struct {
+	cf_queue* q;
+	uint64_t n_ops;
+	uint64_t n_empty;
+} worker;
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define TOTAL_OPS (4 * 1000 * 1000)
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static void*
+run_worker(void* udata)
+{
+	worker* w = udata;
+	elem e = { .fn = w, .udata = NULL };
+
+	for (uint64_t i = 0; i < w->n_ops; i++) {
+		if (cf_queue_push(w->q, &e) != CF_QUEUE_OK) {
+			fprintf(stderr, "push failed\n");
+			exit(1);
+		}
+		while (cf_queue_pop(w->q, &e, CF_QUEUE_NOWAIT) != CF_QUEUE_OK) {
+			w->n_empty++;
+		}
+	}
+	return NULL;
+}
+
+static double
+run(const char* name, uint32_t n_threads)
+{
+	cf_queue* q;
+
+	if (name[0] == 'l') {
+		q = cf_queue_create_bounded(sizeof(elem), 1024, CF_QUEUE_LOCKFREE);
+	}
+	else {
+		q = cf_queue_create(sizeof(elem), true);
+	}
+
+	worker workers[n_threads];
+
+	for (uint32_t i = 0; i < n_threads; i++) {
+		workers[i].q = q;
+		workers[i].n_ops = TOTAL_OPS / n_threads;
+		workers[i].n_empty = 0;
+	}
+
+	uint64_t us = bench_run_threads(n_threads, run_worker, workers, sizeof(worker));
+
+	cf_queue_destroy(q);
+
+	// A push and a pop per iteration.
+	return bench_mops(2 * (TOTAL_OPS / n_threads) * n_threads, us);
+}
+
+/******************************************************************************
+ * MAIN
+ *****************************************************************************/
+
+int
+main(int argc, char* argv[])
+{
+	printf("%8s %14s %14s %8s\n", "threads", "mutex Mops/s", "lockfree Mops/s", "ratio");
+
+	for (uint32_t n = 1; n <= 64; n *= 2) {
+		double m = run("mutex", n);
+		double l = run("lockfree", n);
+		printf("%8u %14.2f %14.2f %8.2f\n", n, m, l, m == 0 ? 0 : l / m);
+	}
+	return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/*
+ * Producer to consumer handoff - one producer feeding 1..8 blocked consumers,
+ * either trickling elements in with the consumers parked (idle) or pushing
+ * flat out (saturated). Reports context switches per element, a proxy for
+ * the futex wait/wake syscalls, and the p50/p99 push-to-pop latency.
+ */
+
+#include <sched.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <citrusleaf/cf_queue.h>
+
+#include "bench.h"
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+	cf_queue* q;
+	bool producer;
+	bool idle;
+	uint32_t n_consumers;
+	uint64_t* lat_ns;
+	uint64_t n_lat;
+} worker;
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define IDLE_ELEMS (20 * 1000)
+#define IDLE_GAP_US 50
+#define SATURATED_ELEMS (1000 * 1000)
+#define MAX_CONSUMERS 8
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static void*
+run_producer(worker* w, uint64_t n_elems)
+{
+	for (uint64_t i = 0; i < n_elems; i++) {
+		uint64_t now = cf_getns();
+
+		while (cf_queue_push(w->q, &now) != CF_QUEUE_OK) {
+			// the lock-free ring is bounded - let the consumers catch up
+			sched_yield();
+		}
+		if (w->idle) {
+			usleep(IDLE_GAP_US);
+		}
+	}
+
+	// A zero timestamp tells one consumer to stop.
+	uint64_t stop = 0;
+
+	for (uint32_t i = 0; i < w->n_consumers; i++) {
+		while (cf_queue_push(w->q, &stop) != CF_QUEUE_OK) {
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+static void*
+run_consumer(worker* w)
+{
+	uint64_t sent;
+
+	while (true) {
+		if (cf_queue_pop(w->q, &sent, CF_QUEUE_FOREVER) != CF_QUEUE_OK) {
+			continue;
+		}
+		if (sent == 0) {
+			break;
+		}
+		w->lat_ns[w->n_lat++] = cf_getns() - sent;
+	}
+	return NULL;
+}
+
+static void*
+run_role(void* udata)
+{
+	worker* w = udata;
+	return w->producer ?
+			run_producer(w, w->idle ? IDLE_ELEMS : SATURATED_ELEMS) :
+			run_consumer(w);
+}
+
+static uint64_t
+n_context_switches()
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return (uint64_t)(ru.ru_nvcsw + ru.ru_nivcsw);
+}
+
+static void
+run(const char* name, bool idle, uint32_t n_consumers)
+{
+	cf_queue* q;
+
+	if (name[0] == 'l') {
+		q = cf_queue_create_bounded(sizeof(uint64_t), 4096, CF_QUEUE_LOCKFREE);
+	}
+	else {
+		q = cf_queue_create(sizeof(uint64_t), true);
+	}
+
+	uint64_t n_elems = idle ? IDLE_ELEMS : SATURATED_ELEMS;
+	uint32_t n_threads = n_consumers + 1;
+	worker w[n_threads];
+
+	for (uint32_t i = 0; i < n_threads; i++) {
+		w[i].q = q;
+		w[i].producer = (i == 0);
+		w[i].idle = idle;
+		w[i].n_consumers = n_consumers;
+		w[i].lat_ns = i == 0 ? NULL : malloc(n_elems * sizeof(uint64_t));
+		w[i].n_lat = 0;
+	}
+
+	uint64_t csw = n_context_switches();
+	uint64_t us = bench_run_threads(n_threads, run_role, w, sizeof(worker));
+
+	csw = n_context_switches() - csw;
+
+	// Gather every consumer's samples into the first consumer's array.
+	uint64_t* lat = w[1].lat_ns;
+	uint64_t n_lat = w[1].n_lat;
+
+	for (uint32_t i = 2; i < n_threads; i++) {
+		for (uint64_t j = 0; j < w[i].n_lat; j++) {
+			lat[n_lat++] = w[i].lat_ns[j];
+		}
+	}
+
+	uint64_t p50 = bench_percentile(lat, n_lat, 50);
+	uint64_t p99 = bench_percentile(lat, n_lat, 99);
+
+	printf("%10s %10s %10u %10.2f %10.3f %10lu %10lu\n", name, idle ? "idle" : "saturated",
+			n_consumers, bench_mops(n_elems, us), (double)csw / (double)n_elems,
+			p50, p99);
+
+	for (uint32_t i = 1; i < n_threads; i++) {
+		free(w[i].lat_ns);
+	}
+	cf_queue_destroy(q);
+}
+
+/******************************************************************************
+ * MAIN
+ *****************************************************************************/
+
+int
+main(int argc, char* argv[])
+{
+	printf("%10s %10s %10s %10s %10s %10s %10s\n", "queue", "regime", "consumers",
+			"Melem/s", "csw/elem", "p50 ns", "p99 ns");
+
+	for (int idle = 1; idle >= 0; idle--) {
+		for (uint32_t n = 1; n <= MAX_CONSUMERS; n *= 2) {
+			run("mutex", idle, n);
+			run("lockfree", idle, n);
+		}
+	}
+	return 0;
+}
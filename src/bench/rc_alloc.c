@@ -0,0 +1,192 @@
+/*
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/*
+ * cf_rc reserve/release pairs and alloc/free cycles, against the scheme
+ * cf_rc used to have - regions straight from malloc(), and a full fence on
+ * top of every locked add. Pairs run on a region private to each thread,
+ * then on one region all threads share; cycles keep a window of regions of
+ * mixed sizes live, freeing each on its last release. Biased regions stay
+ * unshared throughout.
+ *
+ * Usage: rc_alloc [threads] (default 4)
+ */
+
+#include <citrusleaf/alloc.h>
+#include <citrusleaf/cf_atomic.h>
+
+#include "bench.h"
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+	const char* name;
+	void* (*alloc)(size_t sz);
+	int (*reserve)(void* addr);
+	int (*release)(void* addr);
+	int (*releaseandfree)(void* addr);
+} scheme;
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define N_PAIRS (10 * 1000 * 1000)
+#define N_CYCLES (2 * 1000 * 1000)
+#define WINDOW 256
+
+/******************************************************************************
+ * GLOBALS
+ *****************************************************************************/
+
+static const scheme* g_scheme;
+static void* g_shared;
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static void*
+legacy_alloc(size_t sz)
+{
+	uint8_t* addr = malloc(sizeof(cf_rc_counter) + sz);
+
+	if (addr) {
+		cf_atomic32_set((cf_atomic32*)addr, 1);
+		addr += sizeof(cf_rc_counter);
+	}
+	return addr;
+}
+
+static int
+legacy_reserve(void* addr)
+{
+	int i = (int)cf_atomic32_add((cf_atomic32*)addr - 1, 1);
+
+	smb_mb();
+	return i;
+}
+
+static int
+legacy_release(void* addr)
+{
+	smb_mb();
+	return (int)cf_atomic32_decr((cf_atomic32*)addr - 1);
+}
+
+static int
+legacy_releaseandfree(void* addr)
+{
+	int c = legacy_release(addr);
+
+	if (c == 0) {
+		free((void*)((cf_atomic32*)addr - 1));
+	}
+	return c;
+}
+
+static const scheme g_schemes[] = {
+		{ "malloc+mfence", legacy_alloc, legacy_reserve, legacy_release, legacy_releaseandfree },
+		{ "cf_rc", cf_rc_alloc, cf_rc_reserve, cf_rc_release, cf_rc_releaseandfree },
+		{ "cf_rc-biased", cf_rc_alloc_biased, cf_rc_reserve, cf_rc_release, cf_rc_releaseandfree }
+};
+
+static void
+pairs(void* o)
+{
+	for (uint32_t i = 0; i < N_PAIRS; i++) {
+		g_scheme->reserve(o);
+		g_scheme->release(o);
+	}
+}
+
+static void*
+private_run(void* udata)
+{
+	void* o = g_scheme->alloc(sizeof(uint64_t));
+
+	pairs(o);
+	g_scheme->releaseandfree(o);
+	return NULL;
+}
+
+static void*
+shared_run(void* udata)
+{
+	pairs(g_shared);
+	return NULL;
+}
+
+static void*
+cycle_run(void* udata)
+{
+	void* held[WINDOW] = { NULL };
+
+	for (uint32_t i = 0; i < N_CYCLES; i++) {
+		uint32_t j = (i * 97) & (WINDOW - 1);
+
+		if (held[j]) {
+			g_scheme->releaseandfree(held[j]);
+		}
+		held[j] = g_scheme->alloc(8 + ((i * 13) % 200));
+	}
+
+	for (int j = 0; j < WINDOW; j++) {
+		if (held[j]) {
+			g_scheme->releaseandfree(held[j]);
+		}
+	}
+	return NULL;
+}
+
+/******************************************************************************
+ * MAIN
+ *****************************************************************************/
+
+int
+main(int argc, char* argv[])
+{
+	uint32_t n_threads = argc > 1 ? (uint32_t)atoi(argv[1]) : 4;
+
+	printf("%-14s %16s %16s %16s\n", "scheme", "private M/s", "shared M/s", "cycles M/s");
+
+	for (int round = 0; round < 2; round++) {
+		for (size_t s = 0; s < sizeof(g_schemes) / sizeof(g_schemes[0]); s++) {
+			g_scheme = &g_schemes[s];
+
+			uint64_t private_us = bench_run_threads(n_threads, private_run, NULL, 0);
+
+			// A biased region can't be shared, so the plain one stands in.
+			g_shared = s == 0 ? legacy_alloc(sizeof(uint64_t)) : cf_rc_alloc(sizeof(uint64_t));
+
+			uint64_t shared_us = bench_run_threads(n_threads, shared_run, NULL, 0);
+
+			g_scheme->releaseandfree(g_shared);
+
+			uint64_t cycle_us = bench_run_threads(n_threads, cycle_run, NULL, 0);
+
+			printf("%-14s %16.2f %16.2f %16.2f\n", g_scheme->name,
+					bench_mops((uint64_t)n_threads * N_PAIRS, private_us),
+					bench_mops((uint64_t)n_threads * N_PAIRS, shared_us),
+					bench_mops((uint64_t)n_threads * N_CYCLES, cycle_us));
+		}
+	}
+
+	return 0;
+}
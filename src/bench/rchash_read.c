@@ -0,0 +1,144 @@
+/*
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/*
+ * Read-heavy cf_rchash - each thread does 95% gets and 5% puts replacing an
+ * existing key, with 1 to 64 threads. Compares the locked get path with
+ * CF_RCHASH_CR_LOCKFREE_READ, for both lock modes. Locked gets serialize on
+ * the stripe (or big) lock's cache line; lock-free gets only touch their own
+ * reader slot.
+ */
+
+#include <citrusleaf/alloc.h>
+#include <citrusleaf/cf_rchash.h>
+
+#include "bench.h"
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+	cf_rchash* h;
+	uint64_t seed;
+	uint64_t found;
+} worker;
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define N_KEYS 100000
+#define N_OPS 2000000	// split across the threads
+#define PUT_PCT 5
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static uint32_t
+key_hash_fn(void* key, uint32_t key_len)
+{
+	uint64_t k = *(uint64_t*)key * 0x9E3779B97F4A7C15ULL;
+	return (uint32_t)(k >> 32);
+}
+
+static uint64_t
+next_rand(uint64_t* seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+	return *seed;
+}
+
+static uint32_t g_n_ops;
+
+static void*
+worker_run(void* udata)
+{
+	worker* w = udata;
+
+	for (uint32_t i = 0; i < g_n_ops; i++) {
+		uint64_t r = next_rand(&w->seed);
+		uint64_t k = (r >> 8) % N_KEYS;
+
+		if ((r & 0xff) < (256 * PUT_PCT) / 100) {
+			cf_rchash_put(w->h, &k, sizeof(k), cf_rc_alloc(sizeof(uint64_t)));
+			continue;
+		}
+
+		void* o;
+
+		if (cf_rchash_get(w->h, &k, sizeof(k), &o) == CF_RCHASH_OK) {
+			w->found++;
+
+			if (cf_rc_release(o) == 0) {
+				cf_rc_free(o);
+			}
+		}
+	}
+	return NULL;
+}
+
+static double
+run(uint32_t flags, uint32_t n_threads)
+{
+	cf_rchash* h;
+	worker workers[n_threads];
+
+	if (cf_rchash_create(&h, key_hash_fn, NULL, sizeof(uint64_t), N_KEYS, flags) != CF_RCHASH_OK) {
+		fprintf(stderr, "failed to create rchash\n");
+		exit(1);
+	}
+
+	for (uint64_t k = 0; k < N_KEYS; k++) {
+		cf_rchash_put(h, &k, sizeof(k), cf_rc_alloc(sizeof(uint64_t)));
+	}
+
+	for (uint32_t i = 0; i < n_threads; i++) {
+		workers[i] = (worker){ .h = h, .seed = 88172645463325252ULL + i };
+	}
+
+	g_n_ops = N_OPS / n_threads;
+
+	uint64_t us = bench_run_threads(n_threads, worker_run, workers, sizeof(worker));
+
+	cf_rchash_destroy(h);
+	return bench_mops((uint64_t)g_n_ops * n_threads, us);
+}
+
+/******************************************************************************
+ * MAIN
+ *****************************************************************************/
+
+int
+main(int argc, char* argv[])
+{
+	printf("%8s %14s %14s %14s %14s\n", "threads", "manylock M/s", "+lockfree M/s",
+			"biglock M/s", "+lockfree M/s");
+
+	for (uint32_t n = 1; n <= 64; n *= 2) {
+		printf("%8u %14.2f %14.2f %14.2f %14.2f\n", n,
+				run(CF_RCHASH_CR_MT_MANYLOCK, n),
+				run(CF_RCHASH_CR_MT_MANYLOCK | CF_RCHASH_CR_LOCKFREE_READ, n),
+				run(CF_RCHASH_CR_MT_BIGLOCK, n),
+				run(CF_RCHASH_CR_MT_BIGLOCK | CF_RCHASH_CR_LOCKFREE_READ, n));
+	}
+
+	return 0;
+}
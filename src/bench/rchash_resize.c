@@ -0,0 +1,133 @@
+/*
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/*
+ * Lookup latency in a cf_rchash as it grows from 1K entries, with the table
+ * created at 1K buckets. With CF_RCHASH_CR_RESIZE the table doubles and
+ * migrates a few buckets per operation, so get latency should stay flat and
+ * the slowest put should stay far below the cost of rehashing everything.
+ * The fixed-size table shows what the chains cost without it.
+ *
+ * Usage: rchash_resize [max entries] (default 10M - 100M needs ~8GB)
+ */
+
+#include <citrusleaf/alloc.h>
+#include <citrusleaf/cf_rchash.h>
+
+#include "bench.h"
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define INITIAL_BUCKETS 1024
+#define N_SAMPLES 20000
+
+// Beyond this the fixed-size table's chains make the run crawl.
+#define MAX_FIXED 1000000
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static uint32_t
+key_hash_fn(void* key, uint32_t key_len)
+{
+	uint64_t k = *(uint64_t*)key * 0x9E3779B97F4A7C15ULL;
+	return (uint32_t)(k >> 32);
+}
+
+static uint64_t
+next_rand(uint64_t* seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+	return *seed;
+}
+
+static void
+grow(const char* label, uint32_t flags, uint64_t max_entries, uint64_t* samples)
+{
+	cf_rchash* h;
+	uint64_t seed = 88172645463325252ULL;
+	uint64_t n = 0;
+
+	if (cf_rchash_create(&h, key_hash_fn, NULL, sizeof(uint64_t), INITIAL_BUCKETS, flags) != CF_RCHASH_OK) {
+		fprintf(stderr, "failed to create rchash\n");
+		exit(1);
+	}
+
+	for (uint64_t target = 1000; target <= max_entries; target *= 10) {
+		uint64_t put_max_ns = 0;
+		uint64_t start_us = cf_getus();
+
+		for (; n < target; n++) {
+			void* o = cf_rc_alloc(sizeof(uint64_t));
+			uint64_t start_ns = cf_getns();
+
+			cf_rchash_put(h, &n, sizeof(n), o);
+
+			uint64_t put_ns = cf_getns() - start_ns;
+
+			if (put_ns > put_max_ns) {
+				put_max_ns = put_ns;
+			}
+		}
+
+		uint64_t put_us = cf_getus() - start_us;
+
+		for (uint32_t i = 0; i < N_SAMPLES; i++) {
+			uint64_t k = next_rand(&seed) % n;
+			void* o;
+			uint64_t start_ns = cf_getns();
+
+			cf_rchash_get(h, &k, sizeof(k), &o);
+			samples[i] = cf_getns() - start_ns;
+			cf_rc_release(o);
+		}
+
+		printf("%-8s %10lu %10u %10.2f %8luns %8luns %8luns %10luus\n", label, n, h->table_len,
+				bench_mops(target < 10000 ? target : target - target / 10, put_us),
+				bench_percentile(samples, N_SAMPLES, 50),
+				bench_percentile(samples, N_SAMPLES, 99),
+				bench_percentile(samples, N_SAMPLES, 100),
+				put_max_ns / 1000);
+	}
+
+	cf_rchash_destroy(h);
+}
+
+/******************************************************************************
+ * MAIN
+ *****************************************************************************/
+
+int
+main(int argc, char* argv[])
+{
+	uint64_t max_entries = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000000;
+	uint64_t* samples = malloc(N_SAMPLES * sizeof(uint64_t));
+
+	printf("%-8s %10s %10s %10s %10s %10s %10s %12s\n", "table", "entries", "buckets",
+			"put M/s", "get p50", "get p99", "get max", "put max");
+
+	grow("resize", CF_RCHASH_CR_RESIZE | CF_RCHASH_CR_MT_MANYLOCK, max_entries, samples);
+	grow("fixed", CF_RCHASH_CR_MT_MANYLOCK, max_entries < MAX_FIXED ? max_entries : MAX_FIXED, samples);
+
+	free(samples);
+	return 0;
+}
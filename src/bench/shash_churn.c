@@ -0,0 +1,132 @@
+/*
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+/*
+ * Chain element churn. Threads each keep putting and deleting their own keys
+ * in a shared MT_MANYLOCK table with a quarter as many buckets as keys, so
+ * most puts allocate a chain element and most deletes free one - once with
+ * an allocation each, once with SHASH_CR_SLAB. Prints the put + delete rate,
+ * then how long shash_deleteall() and shash_destroy() take on the full table.
+ *
+ * Usage: shash_churn [threads] [log2 keys per thread] (default 4, 16)
+ */
+
+#include <citrusleaf/cf_shash.h>
+
+#include "bench.h"
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+	shash* h;
+	uint32_t base;
+	uint32_t n_keys;
+} churner;
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define N_ROUNDS 20
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static uint32_t
+key_hash_fn(void* key)
+{
+	return *(uint32_t*)key * 2654435761u;
+}
+
+static void*
+churn_run(void* udata)
+{
+	churner* c = udata;
+
+	for (int r = 0; r < N_ROUNDS; r++) {
+		for (uint32_t k = c->base; k < c->base + c->n_keys; k++) {
+			uint64_t v = k;
+			shash_put(c->h, &k, &v);
+		}
+
+		for (uint32_t k = c->base; k < c->base + c->n_keys; k++) {
+			shash_delete(c->h, &k);
+		}
+	}
+	return NULL;
+}
+
+static void
+run(const char* label, uint flags, uint32_t n_threads, uint32_t n_keys)
+{
+	churner c[n_threads];
+	shash* h;
+
+	if (shash_create(&h, key_hash_fn, sizeof(uint32_t), sizeof(uint64_t), (n_threads * n_keys) / 4, SHASH_CR_MT_MANYLOCK | flags) != SHASH_OK) {
+		fprintf(stderr, "failed to create shash\n");
+		exit(1);
+	}
+
+	for (uint32_t i = 0; i < n_threads; i++) {
+		c[i] = (churner){ .h = h, .base = i * n_keys, .n_keys = n_keys };
+	}
+
+	uint64_t us = bench_run_threads(n_threads, churn_run, c, sizeof(churner));
+	uint64_t ops = (uint64_t)n_threads * n_keys * N_ROUNDS * 2;
+
+	for (uint32_t k = 0; k < n_threads * n_keys; k++) {
+		uint64_t v = k;
+		shash_put(h, &k, &v);
+	}
+
+	uint64_t start_us = cf_getus();
+	shash_deleteall(h);
+	uint64_t deleteall_us = cf_getus() - start_us;
+
+	for (uint32_t k = 0; k < n_threads * n_keys; k++) {
+		uint64_t v = k;
+		shash_put(h, &k, &v);
+	}
+
+	start_us = cf_getus();
+	shash_destroy(h);
+	uint64_t destroy_us = cf_getus() - start_us;
+
+	printf("%-8s %12.2f %12.2f %12.2f\n", label, bench_mops(ops, us),
+			(double)deleteall_us / 1000.0, (double)destroy_us / 1000.0);
+}
+
+/******************************************************************************
+ * MAIN
+ *****************************************************************************/
+
+int
+main(int argc, char* argv[])
+{
+	uint32_t n_threads = argc > 1 ? (uint32_t)atoi(argv[1]) : 4;
+	uint32_t n_keys = 1 << (argc > 2 ? atoi(argv[2]) : 16);
+
+	printf("%-8s %12s %12s %12s\n", "alloc", "M ops/s", "deleteall ms", "destroy ms");
+
+	run("malloc", 0, n_threads, n_keys);
+	run("slab", SHASH_CR_SLAB, n_threads, n_keys);
+	run("malloc", 0, n_threads, n_keys);
+	run("slab", SHASH_CR_SLAB, n_threads, n_keys);
+	return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/*
+ * Batched shash lookups against one get at a time, on tables well past the
+ * last level cache, so nearly every lookup misses. shash_get() stalls on one
+ * miss at a time; shash_get_many() prefetches a batch's buckets before
+ * resolving any, so their misses overlap. Prints ns per key for single gets
+ * and for each batch size, and the speedup.
+ *
+ * Usage: shash_many [log2 entries] (default 23)
+ */
+
+#include <citrusleaf/alloc.h>
+#include <citrusleaf/cf_shash.h>
+
+#include "bench.h"
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define N_LOOKUPS (1 << 21)
+#define MAX_BATCH 1024
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static uint64_t
+next_rand(uint64_t* seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+	return *seed;
+}
+
+static void
+run(const char* label, uint32_t flags, uint32_t n_entries, uint64_t* keys)
+{
+	shash* h;
+	uint64_t values[MAX_BATCH];
+	int results[MAX_BATCH];
+
+	if (shash_create(&h, NULL, sizeof(uint64_t), sizeof(uint64_t), n_entries, flags | SHASH_CR_HASH_WY) != SHASH_OK) {
+		fprintf(stderr, "failed to create shash\n");
+		exit(1);
+	}
+
+	for (uint64_t k = 0; k < n_entries; k++) {
+		shash_put(h, &k, &k);
+	}
+
+	uint64_t start_ns = cf_getns();
+
+	for (uint32_t i = 0; i < N_LOOKUPS; i++) {
+		shash_get(h, &keys[i], &values[0]);
+	}
+
+	double single_ns = (double)(cf_getns() - start_ns) / N_LOOKUPS;
+
+	printf("%-10s %8s %8.1f\n", label, "single", single_ns);
+
+	for (uint32_t batch = 8; batch <= MAX_BATCH; batch *= 2) {
+		start_ns = cf_getns();
+
+		for (uint32_t i = 0; i < N_LOOKUPS; i += batch) {
+			if (shash_get_many(h, &keys[i], batch, values, results) != SHASH_OK) {
+				fprintf(stderr, "lookup failed\n");
+				exit(1);
+			}
+		}
+
+		double batch_ns = (double)(cf_getns() - start_ns) / N_LOOKUPS;
+
+		printf("%-10s %8u %8.1f %8.2fx\n", label, batch, batch_ns, single_ns / batch_ns);
+	}
+
+	shash_destroy(h);
+}
+
+/******************************************************************************
+ * MAIN
+ *****************************************************************************/
+
+int
+main(int argc, char* argv[])
+{
+	uint32_t n_entries = 1 << (argc > 1 ? atoi(argv[1]) : 23);
+	uint64_t* keys = malloc(N_LOOKUPS * sizeof(uint64_t));
+	uint64_t seed = 88172645463325252ULL;
+
+	for (uint32_t i = 0; i < N_LOOKUPS; i++) {
+		keys[i] = next_rand(&seed) % n_entries;
+	}
+
+	printf("%-10s %8s %8s %9s\n", "table", "batch", "ns/key", "speedup");
+
+	run("biglock", SHASH_CR_MT_BIGLOCK, n_entries, keys);
+	run("manylock", SHASH_CR_MT_MANYLOCK | SHASH_CR_RESIZE, n_entries, keys);
+	run("open", SHASH_CR_MT_MANYLOCK | SHASH_CR_OPEN, n_entries, keys);
+
+	free(keys);
+	return 0;
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/*
+ * Memory per entry, probe lengths and get latency for a digest-keyed shash
+ * filled to 90% load, chained versus SHASH_CR_OPEN. Chained tables pay a
+ * separately allocated element (with in_use flag and next pointer) for every
+ * collision, open tables keep everything inline and pay empty slots instead.
+ * Probe length is elements compared for chained tables, 16-slot groups
+ * scanned for open ones.
+ *
+ * Usage: shash_open [log2 slots] (default 20 - 1M buckets or slots)
+ */
+
+#include <string.h>
+
+#include <citrusleaf/cf_shash.h>
+
+#include "bench.h"
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+	uint8_t digest[20];
+} key;
+
+typedef struct {
+	uint64_t generation;
+	uint32_t void_time;
+	uint32_t size;
+} value;
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define N_SAMPLES 100000
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+// Digests are already random - like the server, just use the first bytes.
+static uint32_t
+key_hash_fn(void* k)
+{
+	uint32_t h;
+	memcpy(&h, k, sizeof(h));
+	return h;
+}
+
+static void
+make_key(key* k, uint64_t i)
+{
+	uint64_t x = (i + 1) * 0x9E3779B97F4A7C15ULL;
+
+	for (int j = 0; j < 20; j += 4) {
+		x ^= x >> 29;
+		x *= 0xBF58476D1CE4E5B9ULL;
+		uint32_t w = (uint32_t)(x >> 32);
+		memcpy(&k->digest[j], &w, 4);
+	}
+}
+
+static void
+fill(const char* label, uint32_t flags, uint32_t n_slots, uint64_t* samples)
+{
+	shash* h;
+	shash_stats stats;
+	key k;
+	value v = { 0 };
+
+	// Open tables are sized for 7/8 load - ask for exactly n_slots either way.
+	uint32_t sz = flags & SHASH_CR_OPEN ? n_slots / 8 * 7 : n_slots;
+
+	if (shash_create(&h, key_hash_fn, sizeof(key), sizeof(value), sz, flags) != SHASH_OK) {
+		fprintf(stderr, "failed to create shash\n");
+		exit(1);
+	}
+
+	uint32_t target = (uint32_t)(n_slots * 0.9);
+	uint64_t start = cf_getus();
+
+	for (uint32_t i = 0; i < target; i++) {
+		make_key(&k, i);
+		v.generation = i;
+
+		if (shash_put(h, &k, &v) != SHASH_OK) {
+			fprintf(stderr, "%s: put %u failed\n", label, i);
+			exit(1);
+		}
+	}
+
+	uint64_t put_us = cf_getus() - start;
+	uint64_t seed = 88172645463325252ULL;
+
+	for (uint32_t i = 0; i < N_SAMPLES; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 7;
+		seed ^= seed << 17;
+		make_key(&k, seed % target);
+
+		uint64_t start_ns = cf_getns();
+		shash_get(h, &k, &v);
+		samples[i] = cf_getns() - start_ns;
+	}
+
+	shash_get_stats(h, &stats);
+
+	printf("%-8s %10u %10u %8.2f %10.1f %10.2f %10u %10.2f %8luns %8luns\n", label,
+			stats.elements, stats.slots, (double)stats.elements / stats.slots,
+			(double)stats.bytes / stats.elements, stats.probe_mean, stats.probe_max,
+			bench_mops(target, put_us),
+			bench_percentile(samples, N_SAMPLES, 50),
+			bench_percentile(samples, N_SAMPLES, 99));
+
+	shash_destroy(h);
+}
+
+/******************************************************************************
+ * MAIN
+ *****************************************************************************/
+
+int
+main(int argc, char* argv[])
+{
+	uint32_t n_slots = 1u << (argc > 1 ? atoi(argv[1]) : 20);
+	uint64_t* samples = malloc(N_SAMPLES * sizeof(uint64_t));
+
+	printf("%-8s %10s %10s %8s %10s %10s %10s %10s %10s %10s\n", "table", "entries", "slots",
+			"load", "bytes/ent", "probe avg", "probe max", "put M/s", "get p50", "get p99");
+
+	fill("chained", SHASH_CR_MT_MANYLOCK, n_slots, samples);
+	fill("open", SHASH_CR_OPEN | SHASH_CR_MT_MANYLOCK, n_slots, samples);
+	fill("chained1", 0, n_slots, samples);
+	fill("open1", SHASH_CR_OPEN, n_slots, samples);
+
+	free(samples);
+	return 0;
+}
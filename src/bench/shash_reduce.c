@@ -0,0 +1,197 @@
+/*
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/*
+ * How long a periodic sweep freezes writers. A writer thread keeps replacing
+ * values in a biglocked table while the main thread sweeps it, once with the
+ * serial reduce - which holds the biglock for the whole walk - and once with
+ * the parallel reduce, which takes it a bucket at a time. Prints the sweep
+ * time, and the writer's put rate and latency while sweeps run.
+ *
+ * Usage: shash_reduce [pool threads] [log2 entries] (default 4, 20)
+ */
+
+#include <aerospike/as_thread_pool.h>
+#include <citrusleaf/alloc.h>
+#include <citrusleaf/cf_atomic.h>
+#include <citrusleaf/cf_rchash.h>
+#include <citrusleaf/cf_shash.h>
+
+#include "bench.h"
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+	shash* sh;
+	cf_rchash* rh;
+	uint32_t n_keys;
+	cf_atomic32 done;
+	uint64_t* samples;
+	size_t n_samples;
+} table;
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define N_SWEEPS 5
+#define MAX_SAMPLES (1 << 24)
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static uint32_t
+key_hash_fn(void* key)
+{
+	return *(uint32_t*)key * 2654435761u;
+}
+
+static int
+sum_cb(void* key, void* value, void* udata)
+{
+	*(uint64_t*)udata += *(uint64_t*)value;
+	return 0;
+}
+
+static int
+rc_sum_cb(void* key, uint32_t keylen, void* object, void* udata)
+{
+	*(uint64_t*)udata += *(uint32_t*)key;
+	return CF_RCHASH_OK;
+}
+
+static void
+sum_combine(void* udata, void* part_udata)
+{
+	*(uint64_t*)udata += *(uint64_t*)part_udata;
+}
+
+static void*
+writer_run(void* udata)
+{
+	table* t = udata;
+	uint32_t k = 0;
+
+	while (cf_atomic32_get(t->done) == 0 && t->n_samples < MAX_SAMPLES) {
+		uint64_t v = k;
+		uint64_t start_ns = cf_getns();
+
+		if (t->sh) {
+			shash_put(t->sh, &k, &v);
+		}
+		else {
+			cf_rchash_put(t->rh, &k, sizeof(k), cf_rc_alloc(sizeof(uint64_t)));
+		}
+
+		t->samples[t->n_samples++] = cf_getns() - start_ns;
+		k = (k + 7919) % t->n_keys;
+	}
+	return NULL;
+}
+
+static void
+sweep(const char* label, table* t, as_thread_pool* pool, bool parallel)
+{
+	pthread_t thread;
+	uint64_t sum = 0;
+
+	t->n_samples = 0;
+	t->done = 0;
+	pthread_create(&thread, NULL, writer_run, t);
+
+	uint64_t start_us = cf_getus();
+
+	for (int i = 0; i < N_SWEEPS; i++) {
+		if (t->sh) {
+			parallel ?
+					shash_reduce_parallel(t->sh, sum_cb, &sum, sizeof(sum), sum_combine, pool, pool->thread_size * 4) :
+					shash_reduce(t->sh, sum_cb, &sum);
+		}
+		else {
+			parallel ?
+					cf_rchash_reduce_parallel(t->rh, rc_sum_cb, &sum, sizeof(sum), sum_combine, pool, pool->thread_size * 4) :
+					cf_rchash_reduce(t->rh, rc_sum_cb, &sum);
+		}
+	}
+
+	uint64_t sweep_us = cf_getus() - start_us;
+
+	cf_atomic32_set(&t->done, 1);
+	pthread_join(thread, NULL);
+
+	printf("%-8s %-10s %10.2fms %10.2f %8luns %8luns %10luus\n", label, parallel ? "parallel" : "serial",
+			(double)sweep_us / 1000.0 / N_SWEEPS, bench_mops(t->n_samples, sweep_us),
+			bench_percentile(t->samples, t->n_samples, 50),
+			bench_percentile(t->samples, t->n_samples, 99),
+			bench_percentile(t->samples, t->n_samples, 100) / 1000);
+}
+
+/******************************************************************************
+ * MAIN
+ *****************************************************************************/
+
+int
+main(int argc, char* argv[])
+{
+	uint32_t n_threads = argc > 1 ? (uint32_t)atoi(argv[1]) : 4;
+	uint32_t n_keys = 1 << (argc > 2 ? atoi(argv[2]) : 20);
+	as_thread_pool pool;
+	table t = { .n_keys = n_keys, .samples = malloc(MAX_SAMPLES * sizeof(uint64_t)) };
+
+	if (as_thread_pool_init(&pool, n_threads) != 0) {
+		fprintf(stderr, "failed to start pool\n");
+		exit(1);
+	}
+
+	printf("%-8s %-10s %12s %10s %10s %10s %12s\n", "table", "reduce", "sweep", "put M/s",
+			"put p50", "put p99", "put max");
+
+	if (shash_create(&t.sh, key_hash_fn, sizeof(uint32_t), sizeof(uint64_t), n_keys, SHASH_CR_MT_BIGLOCK) != SHASH_OK) {
+		fprintf(stderr, "failed to create shash\n");
+		exit(1);
+	}
+
+	for (uint32_t k = 0; k < n_keys; k++) {
+		uint64_t v = k;
+		shash_put(t.sh, &k, &v);
+	}
+
+	sweep("shash", &t, &pool, false);
+	sweep("shash", &t, &pool, true);
+	shash_destroy(t.sh);
+	t.sh = NULL;
+
+	if (cf_rchash_create(&t.rh, NULL, NULL, sizeof(uint32_t), n_keys, CF_RCHASH_CR_MT_BIGLOCK | CF_RCHASH_CR_HASH_WY) != CF_RCHASH_OK) {
+		fprintf(stderr, "failed to create rchash\n");
+		exit(1);
+	}
+
+	for (uint32_t k = 0; k < n_keys; k++) {
+		cf_rchash_put(t.rh, &k, sizeof(k), cf_rc_alloc(sizeof(uint64_t)));
+	}
+
+	sweep("rchash", &t, &pool, false);
+	sweep("rchash", &t, &pool, true);
+	cf_rchash_destroy(t.rh);
+
+	as_thread_pool_destroy(&pool);
+	free(t.samples);
+	return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/*
+ * Timer churn through as_thread_pool - with a growing number of timers
+ * pending, the cost of scheduling, of schedule-then-cancel pairs (a timeout
+ * that's cancelled when the response comes) and of cancelling. Per-op cost
+ * should stay flat as the wheel fills. Then how late short timers fire.
+ */
+
+#include <unistd.h>
+
+#include <aerospike/as_thread_pool.h>
+#include <citrusleaf/cf_atomic.h>
+
+#include "bench.h"
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+	uint64_t due_us;
+	uint64_t late_us;
+	cf_atomic32* n_fired;
+} timed;
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define N_CHURN 1000000
+#define N_FIRE 10000
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static void
+nop_task(void* udata)
+{
+}
+
+static void
+timed_task(void* udata)
+{
+	timed* t = udata;
+
+	t->late_us = cf_getus() - t->due_us;
+	cf_atomic32_incr(t->n_fired);
+}
+
+static uint64_t
+next_rand(uint64_t* seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+	return *seed;
+}
+
+static void
+churn(uint32_t n_pending, as_thread_pool_timer* handles)
+{
+	as_thread_pool pool;
+	uint64_t seed = 88172645463325252ULL;
+
+	if (as_thread_pool_init(&pool, 2) != 0) {
+		fprintf(stderr, "failed to start pool\n");
+		exit(1);
+	}
+
+	// Pending timers are 10 seconds to an hour out, so none fire.
+	uint64_t start = cf_getus();
+
+	for (uint32_t i = 0; i < n_pending; i++) {
+		handles[i] = as_thread_pool_schedule(&pool, nop_task, NULL, 10000000 + (next_rand(&seed) % 3590000000ULL));
+	}
+
+	uint64_t schedule_us = cf_getus() - start;
+
+	start = cf_getus();
+
+	for (uint32_t i = 0; i < N_CHURN; i++) {
+		as_thread_pool_timer t = as_thread_pool_schedule(&pool, nop_task, NULL, 1000 + (next_rand(&seed) % 5000000));
+		as_thread_pool_cancel(&pool, t);
+	}
+
+	uint64_t churn_us = cf_getus() - start;
+
+	start = cf_getus();
+
+	for (uint32_t i = 0; i < n_pending; i++) {
+		as_thread_pool_cancel(&pool, handles[i]);
+	}
+
+	uint64_t cancel_us = cf_getus() - start;
+
+	as_thread_pool_destroy(&pool);
+
+	printf("%10u %14.2f %14.2f %14.2f\n", n_pending,
+			n_pending ? bench_mops(n_pending, schedule_us) : 0.0,
+			bench_mops(N_CHURN, churn_us),
+			n_pending ? bench_mops(n_pending, cancel_us) : 0.0);
+}
+
+static void
+lateness()
+{
+	as_thread_pool pool;
+	cf_atomic32 n_fired = 0;
+	timed* timers = malloc(N_FIRE * sizeof(timed));
+	uint64_t* late = malloc(N_FIRE * sizeof(uint64_t));
+	uint64_t seed = 88172645463325252ULL;
+
+	if (as_thread_pool_init(&pool, 2) != 0) {
+		fprintf(stderr, "failed to start pool\n");
+		exit(1);
+	}
+
+	for (uint32_t i = 0; i < N_FIRE; i++) {
+		uint64_t delay_us = 1000 + (next_rand(&seed) % 200000);
+
+		timers[i].n_fired = &n_fired;
+		timers[i].due_us = cf_getus() + delay_us;
+		as_thread_pool_schedule(&pool, timed_task, &timers[i], delay_us);
+	}
+
+	while (cf_atomic32_get(n_fired) < N_FIRE) {
+		usleep(1000);
+	}
+
+	as_thread_pool_destroy(&pool);
+
+	for (uint32_t i = 0; i < N_FIRE; i++) {
+		late[i] = timers[i].late_us;
+	}
+
+	printf("\n%10s %10s %10s %10s\n", "timers", "late p50", "late p99", "late max");
+	printf("%10u %8luus %8luus %8luus\n", N_FIRE,
+			bench_percentile(late, N_FIRE, 50),
+			bench_percentile(late, N_FIRE, 99),
+			bench_percentile(late, N_FIRE, 100));
+
+	free(late);
+	free(timers);
+}
+
+/******************************************************************************
+ * MAIN
+ *****************************************************************************/
+
+int
+main(int argc, char* argv[])
+{
+	as_thread_pool_timer* handles = malloc(1000000 * sizeof(as_thread_pool_timer));
+
+	printf("%10s %14s %14s %14s\n", "pending", "schedule M/s", "churn Mpair/s", "cancel M/s");
+
+	for (uint32_t n = 0; n <= 1000000; n = n ? n * 10 : 1000) {
+		churn(n, handles);
+	}
+
+	lateness();
+
+	free(handles);
+	return 0;
+}
@@ -16,6 +16,7 @@
  */
 #pragma once
 
+#include <citrusleaf/cf_counter.h>
 #include <citrusleaf/cf_queue.h>
 #include <pthread.h>
 
@@ -27,6 +28,155 @@ extern "C" {
  *	TYPES
  *****************************************************************************/
 	
+/**
+ *	@private
+ *	How worker threads get their tasks.
+ */
+typedef enum as_thread_pool_mode_e {
+	/**
+	 *	All tasks go through the one shared dispatch queue.
+	 */
+	AS_THREAD_POOL_SHARED_QUEUE,
+
+	/**
+	 *	Each worker has its own deque. Tasks queued from a worker thread go on
+	 *	that worker's deque and run newest first, idle workers steal the oldest
+	 *	tasks from busy ones, and tasks queued from other threads go through
+	 *	the shared dispatch queue.
+	 */
+	AS_THREAD_POOL_WORK_STEALING
+} as_thread_pool_mode;
+
+/**
+ *	@private
+ *	Where worker threads run. Each thread started takes the lowest free
+ *	placement slot and shrinking stops the threads in the highest, so after
+ *	any sequence of resizes the running threads still sit where the policy
+ *	puts them.
+ */
+typedef enum as_thread_pool_placement_e {
+	/**
+	 *	Leave it to the OS scheduler.
+	 */
+	AS_THREAD_POOL_PLACE_ANY,
+
+	/**
+	 *	Slot i is pinned to cpus[i % n_cpus] of the config.
+	 */
+	AS_THREAD_POOL_PLACE_CPUS,
+
+	/**
+	 *	Slots fill every CPU of the first NUMA node, then the next node.
+	 */
+	AS_THREAD_POOL_PLACE_COMPACT,
+
+	/**
+	 *	Slots go round-robin across NUMA nodes, one CPU each.
+	 */
+	AS_THREAD_POOL_PLACE_SCATTER,
+
+	/**
+	 *	Slots go round-robin across NUMA nodes, free to run on any CPU of
+	 *	their node.
+	 */
+	AS_THREAD_POOL_PLACE_NODE
+} as_thread_pool_placement;
+
+/**
+ *	@private
+ *	What as_thread_pool_queue_task() does when a bounded pool's queue is at
+ *	its limit.
+ */
+typedef enum as_thread_pool_overflow_e {
+	/**
+	 *	Wait for room. The pool's own threads run the task themselves rather
+	 *	than wait, as waiting on themselves could deadlock.
+	 */
+	AS_THREAD_POOL_BLOCK,
+
+	/**
+	 *	Fail with -3, like cf_queue_push_limit().
+	 */
+	AS_THREAD_POOL_REJECT,
+
+	/**
+	 *	Run the task in the calling thread.
+	 */
+	AS_THREAD_POOL_CALLER_RUNS
+} as_thread_pool_overflow;
+
+/**
+ *	@private
+ *	Thread pool statistics.
+ */
+typedef struct as_thread_pool_stats_s {
+	/**
+	 *	Tasks queued and not yet started.
+	 */
+	uint32_t depth;
+
+	/**
+	 *	Tasks queued.
+	 */
+	uint64_t admitted;
+
+	/**
+	 *	Tasks turned away at the limit, whether failed or run by the caller.
+	 */
+	uint64_t rejected;
+
+	/**
+	 *	Of the rejected tasks, those run by the caller.
+	 */
+	uint64_t caller_ran;
+} as_thread_pool_stats;
+
+/**
+ *	@private
+ *	Thread pool configuration, for as_thread_pool_init_config(). Initialize
+ *	with as_thread_pool_config_init() and set the fields wanted.
+ */
+typedef struct as_thread_pool_config_s {
+	uint32_t thread_size;
+	as_thread_pool_mode mode;
+	as_thread_pool_placement placement;
+
+	/**
+	 *	CPU ids for AS_THREAD_POOL_PLACE_CPUS.
+	 */
+	const uint32_t* cpus;
+	uint32_t n_cpus;
+
+	/**
+	 *	Thread stack size in bytes, 0 for the default.
+	 */
+	size_t stack_size;
+
+	/**
+	 *	Threads are named "<prefix>-<slot>" (truncated to 15 characters) if
+	 *	set.
+	 */
+	const char* name_prefix;
+
+	/**
+	 *	Split the pool into a sub-pool per NUMA node, each with its own
+	 *	dispatch queue. A task goes to the queue of the node it's queued from,
+	 *	and a worker only takes another node's tasks when its own queue is
+	 *	empty. Shared queue mode only.
+	 */
+	bool node_queues;
+
+	/**
+	 *	Most tasks queued and not yet started, 0 for no limit.
+	 */
+	uint32_t queue_limit;
+
+	/**
+	 *	What to do with a task queued at the limit.
+	 */
+	as_thread_pool_overflow overflow;
+} as_thread_pool_config;
+
 /**
  *	@private
  *	Thread pool.
@@ -35,8 +185,26 @@ struct as_thread_pool {
 	pthread_mutex_t lock;
 	cf_queue* dispatch_queue;
 	cf_queue* complete_queue;
+	struct as_thread_pool_ws* ws;
+	struct as_thread_pool_place* place;
+	struct as_thread_pool_timers* timers;
 	uint32_t thread_size;
 	uint32_t initialized;
+
+	// Bounded submission, and counters for all pools.
+	cf_atomic32 depth;
+	uint32_t queue_limit;
+	as_thread_pool_overflow overflow;
+	cf_atomic32 n_blocked;
+	bool closing;
+	pthread_mutex_t limit_lock;
+	pthread_cond_t limit_cond;
+	cf_counter* n_admitted;
+	cf_counter* n_rejected;
+	cf_counter* n_caller_ran;
+	
+	// What as_thread_pool_get_stats() reports once the counters are gone.
+	as_thread_pool_stats closed_stats;
 };
 	
 typedef struct as_thread_pool as_thread_pool;
@@ -47,6 +215,41 @@ typedef struct as_thread_pool as_thread_pool;
  */
 typedef void (*as_task_fn)(void* user_data);
 
+/**
+ *	@private
+ *	Result of a task submitted with as_thread_pool_submit(). Futures are
+ *	recycled, so each one must be released exactly once with
+ *	as_future_release().
+ */
+typedef struct as_future as_future;
+
+/**
+ *	@private
+ *	Handle for a task scheduled with as_thread_pool_schedule(), or 0 if it
+ *	couldn't be scheduled. Handles aren't reused, so a stale one is safe to
+ *	cancel.
+ */
+typedef uint64_t as_thread_pool_timer;
+
+/**
+ *	@private
+ *	Task function callback that produces a result.
+ */
+typedef void* (*as_future_fn)(void* user_data);
+
+/**
+ *	@private
+ *	Continuation callback, passed the result of the future it follows.
+ */
+typedef void* (*as_future_then_fn)(void* result, void* user_data);
+
+/**
+ *	@private
+ *	Partition callback for as_thread_pool_run_partitions(), called once with
+ *	each partition index.
+ */
+typedef void (*as_partition_fn)(void* user_data, uint32_t partition);
+
 /******************************************************************************
  *	FUNCTIONS
  *****************************************************************************/
@@ -64,6 +267,31 @@ typedef void (*as_task_fn)(void* user_data);
 int
 as_thread_pool_init(as_thread_pool* pool, uint32_t thread_size);
 
+/**
+ *	@private
+ *	Initialize thread pool in the given mode and start thread_size threads.
+ *	Returns as as_thread_pool_init().
+ */
+int
+as_thread_pool_init_mode(as_thread_pool* pool, uint32_t thread_size, as_thread_pool_mode mode);
+
+/**
+ *	@private
+ *	Set config to defaults - no threads, shared queue, no placement, no queue
+ *	limit.
+ */
+void
+as_thread_pool_config_init(as_thread_pool_config* config);
+
+/**
+ *	@private
+ *	Initialize thread pool from config and start its threads. Returns as
+ *	as_thread_pool_init(), or:
+ *	-4 : Invalid config
+ */
+int
+as_thread_pool_init_config(as_thread_pool* pool, const as_thread_pool_config* config);
+
 /**
  *	@private
  *	Resize number of running threads in thread pool.
@@ -79,16 +307,136 @@ as_thread_pool_resize(as_thread_pool* pool, uint32_t thread_size);
 
 /**
  *	@private
- *	Queue a task onto thread pool.
+ *	Queue a task onto thread pool. A bounded pool at its limit blocks, fails
+ *	or runs the task in the caller, as configured.
  *
  *	Returns:
  *	0  : Success
- *	-1 : No threads are running to process task.
+ *	-1 : No threads are running to process task, or pool is being destroyed
  *	-2 : Failed to push task onto dispatch queue
+ *	-3 : Queue is at its limit
  */
 int
 as_thread_pool_queue_task(as_thread_pool* pool, as_task_fn task_fn, void* udata);
 
+/**
+ *	@private
+ *	Get thread pool statistics. Each is a snapshot, they're not taken
+ *	together.
+ */
+void
+as_thread_pool_get_stats(as_thread_pool* pool, as_thread_pool_stats* stats);
+
+/**
+ *	@private
+ *	Queue a task onto thread pool after delay_us microseconds. Timers have
+ *	millisecond resolution and never fire early. Adding and cancelling are
+ *	O(1) - pending timers sit in a hierarchical timing wheel, driven by a
+ *	timer thread the pool starts on first use. A firing is queued even past
+ *	a bounded pool's queue_limit. Pending timers are dropped when the pool is
+ *	destroyed.
+ */
+as_thread_pool_timer
+as_thread_pool_schedule(as_thread_pool* pool, as_task_fn task_fn, void* udata, uint64_t delay_us);
+
+/**
+ *	@private
+ *	Queue a task onto thread pool after delay_us microseconds, then every
+ *	period_us microseconds until cancelled. Firings are on a fixed schedule,
+ *	so a late one doesn't push back the next.
+ */
+as_thread_pool_timer
+as_thread_pool_schedule_periodic(as_thread_pool* pool, as_task_fn task_fn, void* udata, uint64_t delay_us, uint64_t period_us);
+
+/**
+ *	@private
+ *	Cancel a scheduled task. A task already queued to run still runs. A
+ *	periodic task may cancel itself.
+ *
+ *	Returns:
+ *	0  : Success
+ *	-1 : Not pending - already fired or cancelled
+ */
+int
+as_thread_pool_cancel(as_thread_pool* pool, as_thread_pool_timer timer);
+
+/**
+ *	@private
+ *	Queue a task onto thread pool, returning a future for its result, or NULL
+ *	if no threads are running or the task couldn't be queued.
+ */
+as_future*
+as_thread_pool_submit(as_thread_pool* pool, as_future_fn fn, void* udata);
+
+/**
+ *	@private
+ *	Wait for the future's task to finish and return its result.
+ */
+void*
+as_future_wait(as_future* future);
+
+/**
+ *	@private
+ *	Wait at most ms_wait milliseconds (forever if negative) for the future.
+ *
+ *	Returns:
+ *	0  : Success - result (if not NULL) is set
+ *	-1 : Timed out
+ */
+int
+as_future_wait_timeout(as_future* future, int ms_wait, void** result);
+
+/**
+ *	@private
+ *	Wait at most ms_wait milliseconds (forever if negative) for all the futures.
+ *
+ *	Returns:
+ *	0  : Success
+ *	-1 : Timed out
+ */
+int
+as_future_wait_all(as_future** futures, uint32_t n_futures, int ms_wait);
+
+/**
+ *	@private
+ *	Wait at most ms_wait milliseconds (forever if negative) for any of the
+ *	futures. Returns the index of a finished future, or -1 on timeout.
+ */
+int
+as_future_wait_any(as_future** futures, uint32_t n_futures, int ms_wait);
+
+/**
+ *	@private
+ *	Queue fn onto the future's pool to run with the future's result once it
+ *	finishes, returning a future for fn's result. A future takes only one
+ *	continuation - returns NULL if it already has one.
+ */
+as_future*
+as_future_then(as_future* future, as_future_then_fn fn, void* udata);
+
+/**
+ *	@private
+ *	Give up the caller's hold on a future. It's recycled once its task has
+ *	also finished with it.
+ */
+void
+as_future_release(as_future* future);
+
+/**
+ *	@private
+ *	Call fn for each partition index below n_partitions, spread over the
+ *	pool's threads and the calling thread, and return once every call has
+ *	returned. The caller works through partitions too, so this finishes even
+ *	if the pool is NULL, has no threads, rejects tasks or is busy - including
+ *	when called from one of the pool's own tasks.
+ *
+ *	Returns:
+ *	0  : Success
+ *	-1 : Out of memory - fn wasn't called
+ */
+int
+as_thread_pool_run_partitions(as_thread_pool* pool, as_partition_fn fn, void* udata, uint32_t n_partitions);
+
 /**
  *	@private
  *	Destroy thread pool.
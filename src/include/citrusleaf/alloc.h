@@ -36,12 +36,65 @@ static inline uint32_t ptr_hash_fn(void *key) {
     return (uint32_t) * (uint64_t *) key;
 }
 
+/*
+ *  Arena tags - call sites of the busier subsystems say whose memory they
+ *  want, so an allocator installed with cf_hook_alloc() can keep each in its
+ *  own arena. Plain cf_malloc() and friends use CF_ALLOC_ARENA_DEFAULT.
+ */
+typedef enum {
+	CF_ALLOC_ARENA_DEFAULT,
+	CF_ALLOC_ARENA_MSGPACK,
+	CF_ALLOC_ARENA_HASHMAP,
+	CF_ALLOC_ARENA_QUEUE,
+	CF_ALLOC_ARENA_RC,
+	CF_ALLOC_N_ARENAS
+} cf_alloc_arena;
+
 #ifdef ENHANCED_ALLOC
 
 #include "enhanced_alloc.h"
 
+#define cf_malloc_arena(_sz, _arena) cf_malloc(_sz)
+#define cf_calloc_arena(_nmemb, _sz, _arena) cf_calloc(_nmemb, _sz)
+#define cf_realloc_arena(_ptr, _sz, _arena) cf_realloc(_ptr, _sz)
+#define cf_strndup_arena(_s, _n, _arena) cf_strndup(_s, _n)
+
 #else // !defined(ENHANCED_ALLOC)
 
+/*
+ *  A runtime-installable allocator behind cf_malloc() and friends. With no
+ *  hooks installed (the default) they call the C library directly.
+ *
+ *  Install hooks before anything is allocated through cf_malloc(), and never
+ *  swap them while anything allocated through the old ones is still live -
+ *  cf_free() hands every pointer to the current free hook. The hooks must be
+ *  thread safe. cf_rc_alloc() memory doesn't go through them - it always
+ *  comes from the built-in allocator below, in CF_ALLOC_ARENA_RC.
+ */
+typedef struct cf_alloc_hooks_s {
+    void *(*malloc)(size_t sz, cf_alloc_arena arena);
+    void *(*calloc)(size_t nmemb, size_t sz, cf_alloc_arena arena);
+    // Keeps ptr's arena if it has to move it.
+    void *(*realloc)(void *ptr, size_t sz, cf_alloc_arena arena);
+    // Page aligned.
+    void *(*valloc)(size_t sz, cf_alloc_arena arena);
+    void (*free)(void *p);
+} cf_alloc_hooks;
+
+extern cf_alloc_hooks *g_alloc_hooks;
+
+static inline void cf_hook_alloc(cf_alloc_hooks *hooks) {
+    g_alloc_hooks = hooks;
+}
+
+/*
+ *  The built-in allocator to install with cf_hook_alloc() - size classes up
+ *  to 4KB, each with a per-thread cache in front of a per-arena free list,
+ *  and the C library for anything bigger. Memory it has cached is reused
+ *  but never returned to the system.
+ */
+cf_alloc_hooks *cf_alloc_cache_hooks(void);
+
 /*
  *  CF Memory Allocation-Related Functions:
  *
@@ -56,6 +109,11 @@ void *cf_strndup(const char *s, size_t n);
 void *cf_valloc(size_t sz);
 void cf_free(void *p);
 
+void *cf_malloc_arena(size_t sz, cf_alloc_arena arena);
+void *cf_calloc_arena(size_t nmemb, size_t sz, cf_alloc_arena arena);
+void *cf_realloc_arena(void *ptr, size_t sz, cf_alloc_arena arena);
+void *cf_strndup_arena(const char *s, size_t n, cf_alloc_arena arena);
+
 /*
  * The "cf_rc_*()" Functions:  Reference Counting Allocation:
  *
@@ -71,6 +129,18 @@ void cf_free(void *p);
  * cf_rc_release() releases an already-held reservation.  It is possible to
  * call cf_rc_release() on a region without first acquiring a reservation.
  * This will result in undefined behavior.
+ *
+ * Regions are pooled by size class in the built-in caching allocator, with
+ * a cf_rc_hdr in front of each, so the data is 8-byte aligned. Reserving is
+ * a relaxed increment and releasing a release-ordered decrement - the
+ * release that drops the count to zero also acquires, so whoever frees the
+ * region sees every other holder's writes.
+ *
+ * A region from cf_rc_alloc_biased() starts out owned by the allocating
+ * thread, which reserves and releases it with plain loads and stores. Only
+ * that thread may touch the count until it calls cf_rc_share(), which it
+ * must do before the region can reach another thread - through a cf_rchash,
+ * a queue or anything else. From then on the region counts like any other.
  */
 
 typedef cf_atomic32 cf_rc_counter;
@@ -81,6 +151,8 @@ typedef struct {
 } cf_rc_hdr;
 
 void *cf_rc_alloc(size_t sz);
+void *cf_rc_alloc_biased(size_t sz);
+void cf_rc_share(void *addr);
 void cf_rc_free(void *addr);
 cf_atomic_int_t cf_rc_count(void *addr);
 int cf_rc_reserve(void *addr);
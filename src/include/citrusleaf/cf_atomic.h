@@ -37,6 +37,20 @@
  * Increment-unless: test a value b against an atomic integer a.  If they
  * are NOT equal, add x to a, and return non-zero; if they ARE equal, return
  * zero 
+ *
+ * cf_atomicX_load, cf_atomicX_store, cf_atomicX_fetch_add, cf_atomicX_cas_mo
+ * The same operations with an explicit memory order, one of the
+ * CF_ATOMIC_* orders below. The calls above are all full barriers - except
+ * cf_atomicX_get/set, which order nothing - so a counter nobody synchronizes
+ * through should use these with CF_ATOMIC_RELAXED, a flag published with a
+ * release store should be read with an acquire load, and so on. On x86 a
+ * load or a store short of seq_cst is a plain mov and an add or cas one
+ * locked instruction, with no fence on top; weakly ordered targets get the
+ * barriers each order needs, and no more.
+ *
+ * cf_atomic_fence
+ * A fence of the given order, e.g. the acquire taken before freeing an object
+ * whose count was dropped with a release decrement.
  **/
 
 #include <stdint.h>
@@ -179,6 +193,161 @@ typedef uint64_t cf_atomic_int_t; // the point here is a type of the same size a
 
 #endif // CF_WINDOWS
 
+/******************************************************************************
+ * ORDERED FUNCTIONS
+ *****************************************************************************/
+
+#ifdef CF_WINDOWS
+
+// MSVC volatile accesses are acquire loads and release stores on x86, and the
+// interlocked calls full barriers, so the orders only ask for what's there.
+#define CF_ATOMIC_RELAXED 0
+#define CF_ATOMIC_ACQUIRE 2
+#define CF_ATOMIC_RELEASE 3
+#define CF_ATOMIC_ACQ_REL 4
+#define CF_ATOMIC_SEQ_CST 5
+
+static inline uint32_t cf_atomic32_load(cf_atomic32 *a, int mo) {
+	return(*a);
+}
+
+static inline void cf_atomic32_store(cf_atomic32 *a, uint32_t b, int mo) {
+	if (mo == CF_ATOMIC_SEQ_CST) {
+		_InterlockedExchange((volatile long *)a, (long)b);
+	}
+	else {
+		*a = b;
+	}
+}
+
+static inline uint32_t cf_atomic32_fetch_add(cf_atomic32 *a, int32_t b, int mo) {
+	return((uint32_t)_InterlockedExchangeAdd((volatile long *)a, b));
+}
+
+static inline uint32_t cf_atomic32_cas_mo(cf_atomic32 *a, uint32_t b, uint32_t x, int mo) {
+	return((uint32_t)_InterlockedCompareExchange((volatile long *)a, (long)x, (long)b));
+}
+
+#ifdef MARCH_x86_64
+
+static inline uint64_t cf_atomic64_load(cf_atomic64 *a, int mo) {
+	return(*a);
+}
+
+static inline void cf_atomic64_store(cf_atomic64 *a, uint64_t b, int mo) {
+	if (mo == CF_ATOMIC_SEQ_CST) {
+		_InterlockedExchange64((LONGLONG *)a, (LONGLONG)b);
+	}
+	else {
+		*a = b;
+	}
+}
+
+static inline uint64_t cf_atomic64_fetch_add(cf_atomic64 *a, int64_t b, int mo) {
+	return((uint64_t)_InterlockedExchangeAdd64((LONGLONG *)a, b));
+}
+
+static inline uint64_t cf_atomic64_cas_mo(cf_atomic64 *a, uint64_t b, uint64_t x, int mo) {
+	return((uint64_t)_InterlockedCompareExchange64((LONGLONG *)a, (LONGLONG)x, (LONGLONG)b));
+}
+
+#endif // ifdef MARCH_x86_64
+
+static inline void cf_atomic_fence(int mo) {
+	if (mo == CF_ATOMIC_SEQ_CST) {
+		MemoryBarrier();
+	}
+	else {
+		_ReadWriteBarrier();
+	}
+}
+
+#else // ifndef CF_WINDOWS
+
+#define CF_ATOMIC_RELAXED __ATOMIC_RELAXED
+#define CF_ATOMIC_ACQUIRE __ATOMIC_ACQUIRE
+#define CF_ATOMIC_RELEASE __ATOMIC_RELEASE
+#define CF_ATOMIC_ACQ_REL __ATOMIC_ACQ_REL
+#define CF_ATOMIC_SEQ_CST __ATOMIC_SEQ_CST
+
+// Loads take relaxed, acquire or seq_cst, stores relaxed, release or seq_cst.
+// The rest take any order - a failed cas_mo loads with the strongest order
+// a load may have that's no stronger than mo.
+
+static inline uint32_t cf_atomic32_load(cf_atomic32 *a, int mo) {
+	return(__atomic_load_n(a, mo));
+}
+
+static inline void cf_atomic32_store(cf_atomic32 *a, uint32_t b, int mo) {
+	__atomic_store_n(a, b, mo);
+}
+
+static inline uint32_t cf_atomic32_fetch_add(cf_atomic32 *a, int32_t b, int mo) {
+	return(__atomic_fetch_add(a, (uint32_t)b, mo));
+}
+
+static inline int cf_atomic_fail_order(int mo) {
+	return(mo == CF_ATOMIC_RELEASE ? CF_ATOMIC_RELAXED : (mo == CF_ATOMIC_ACQ_REL ? CF_ATOMIC_ACQUIRE : mo));
+}
+
+static inline uint32_t cf_atomic32_cas_mo(cf_atomic32 *a, uint32_t b, uint32_t x, int mo) {
+	__atomic_compare_exchange_n(a, &b, x, 0, mo, cf_atomic_fail_order(mo));
+	return(b);
+}
+
+#ifdef MARCH_x86_64
+
+static inline uint64_t cf_atomic64_load(cf_atomic64 *a, int mo) {
+	return(__atomic_load_n(a, mo));
+}
+
+static inline void cf_atomic64_store(cf_atomic64 *a, uint64_t b, int mo) {
+	__atomic_store_n(a, b, mo);
+}
+
+static inline uint64_t cf_atomic64_fetch_add(cf_atomic64 *a, int64_t b, int mo) {
+	return(__atomic_fetch_add(a, (uint64_t)b, mo));
+}
+
+static inline uint64_t cf_atomic64_cas_mo(cf_atomic64 *a, uint64_t b, uint64_t x, int mo) {
+	__atomic_compare_exchange_n(a, &b, x, 0, mo, cf_atomic_fail_order(mo));
+	return(b);
+}
+
+#endif // ifdef MARCH_x86_64
+
+static inline void cf_atomic_fence(int mo) {
+	__atomic_thread_fence(mo);
+}
+
+#endif // ifdef CF_WINDOWS
+
+#ifdef MARCH_x86_64
+
+#define cf_atomic_p_load(_a, _mo) cf_atomic64_load(_a, _mo)
+#define cf_atomic_p_store(_a, _b, _mo) cf_atomic64_store(_a, _b, _mo)
+#define cf_atomic_p_fetch_add(_a, _b, _mo) cf_atomic64_fetch_add(_a, _b, _mo)
+#define cf_atomic_p_cas_mo(_a, _b, _x, _mo) cf_atomic64_cas_mo(_a, _b, _x, _mo)
+
+#define cf_atomic_int_load(_a, _mo) cf_atomic64_load(_a, _mo)
+#define cf_atomic_int_store(_a, _b, _mo) cf_atomic64_store(_a, _b, _mo)
+#define cf_atomic_int_fetch_add(_a, _b, _mo) cf_atomic64_fetch_add(_a, _b, _mo)
+#define cf_atomic_int_cas_mo(_a, _b, _x, _mo) cf_atomic64_cas_mo(_a, _b, _x, _mo)
+
+#else // ifndef MARCH_x86_64
+
+#define cf_atomic_p_load(_a, _mo) cf_atomic32_load(_a, _mo)
+#define cf_atomic_p_store(_a, _b, _mo) cf_atomic32_store(_a, _b, _mo)
+#define cf_atomic_p_fetch_add(_a, _b, _mo) cf_atomic32_fetch_add(_a, _b, _mo)
+#define cf_atomic_p_cas_mo(_a, _b, _x, _mo) cf_atomic32_cas_mo(_a, _b, _x, _mo)
+
+#define cf_atomic_int_load(_a, _mo) cf_atomic32_load(_a, _mo)
+#define cf_atomic_int_store(_a, _b, _mo) cf_atomic32_store(_a, _b, _mo)
+#define cf_atomic_int_fetch_add(_a, _b, _mo) cf_atomic32_fetch_add(_a, _b, _mo)
+#define cf_atomic_int_cas_mo(_a, _b, _x, _mo) cf_atomic32_cas_mo(_a, _b, _x, _mo)
+
+#endif // ifdef MARCH_x86_64
+
 /******************************************************************************
  * FUNCTIONS
  *****************************************************************************/
@@ -45,6 +45,10 @@ static const char cf_LogTable256[] =
 extern int cf_bits_find_last_set(uint32_t c);
 extern int cf_bits_find_last_set_64(uint64_t c);
 
+// Smallest power of 2 that's at least per_cpu per online CPU, but no more
+// than max - for sizing lock stripes, counter shards and the like.
+extern uint32_t cf_pow2_per_cpu(uint32_t per_cpu, uint32_t max);
+
 /******************************************************************************
  * INLINE FUNCTIONS
  ******************************************************************************/
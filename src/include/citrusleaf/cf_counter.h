@@ -0,0 +1,117 @@
+/* 
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+#pragma once
+
+/*
+ * A statistics counter split into shards, each on its own cache line, so
+ * threads adding to it don't bounce one line between cores. Adds go to the
+ * shard picked by a per-thread index - threads only share a shard once there
+ * are more of them than shards - and a read sums every shard, so it costs
+ * O(shards) rather than anything proportional to what's being counted.
+ *
+ * A read taken while adds are going on sees each shard at a different
+ * moment, so it may be off by the adds in flight, and even come out below
+ * zero when one thread's decrement lands before another's increment.
+ */
+
+#include <stdint.h>
+
+#include <citrusleaf/cf_atomic.h>
+#include <citrusleaf/cf_types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/******************************************************************************
+ * CONSTANTS
+ ******************************************************************************/
+
+#define CF_COUNTER_LINE_SZ 64
+
+/**
+ * memory comes from malloc() instead of cf_malloc()
+ */
+#define CF_COUNTER_UNTRACKED 0x01
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+
+typedef struct cf_counter_shard_s {
+	cf_atomic_int		n;
+	uint8_t				pad[CF_COUNTER_LINE_SZ - sizeof(cf_atomic_int)];
+} cf_counter_shard;
+
+struct cf_counter_s {
+	uint				flags;
+	uint32_t			n_shards;		// power of 2
+	cf_counter_shard *	shards;			// line aligned, inside mem
+	void *				mem;
+};
+
+typedef struct cf_counter_s cf_counter;
+
+/******************************************************************************
+ * GLOBALS
+ ******************************************************************************/
+
+// Which shard of every counter the thread adds to - 0 until its first add.
+extern __thread uint32_t g_counter_thread;
+
+/******************************************************************************
+ * FUNCTIONS
+ ******************************************************************************/
+
+/**
+ * Create a counter at zero, with a few shards per core. Returns NULL if out
+ * of memory.
+ */
+cf_counter *cf_counter_create(uint flags);
+
+void cf_counter_destroy(cf_counter *c);
+
+uint32_t cf_counter_thread_assign(void);
+
+/**
+ * Add n, which may be negative. Orders nothing but the count itself.
+ */
+static inline void cf_counter_add(cf_counter *c, int64_t n) {
+	uint32_t t = g_counter_thread;
+
+	if (t == 0) {
+		t = cf_counter_thread_assign();
+	}
+
+	cf_atomic_int_fetch_add(&c->shards[t & (c->n_shards - 1)].n, n, CF_ATOMIC_RELAXED);
+}
+
+/**
+ * The sum of every shard.
+ */
+int64_t cf_counter_read(cf_counter *c);
+
+/**
+ * Back to zero. Adds racing with it may or may not survive.
+ */
+void cf_counter_reset(cf_counter *c);
+
+/******************************************************************************/
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
@@ -0,0 +1,75 @@
+/* 
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+#pragma once
+
+/*
+ * Built-in hash functions for shash and cf_rchash keys, so callers needn't
+ * roll their own. Tables pick one at creation with their *_CR_HASH_* flags,
+ * or callers can use them directly.
+ *
+ * cf_hash_crc32c()	- CRC32C, with SSE4.2 where the CPU has it.
+ * cf_hash_wy64()	- wyhash-style 64-bit multiply-mix, fast on any key length.
+ * cf_hash_digest()	- for keys that are (or start with) a cf_digest, whose
+ * 					  bytes are already uniformly random.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+
+typedef uint32_t (*cf_hash_fn) (const void *key, size_t key_len);
+
+/******************************************************************************
+ * FUNCTIONS
+ ******************************************************************************/
+
+/**
+ * CRC32C (Castagnoli) of key_len bytes. Spreads strings and digests well,
+ * but it's linear - pointers and counters, which differ in a few low bits,
+ * collide under a power of 2 table mask. Use cf_hash_wy32() for those.
+ */
+uint32_t cf_hash_crc32c(const void *key, size_t key_len);
+
+/**
+ * 64-bit hash of key_len bytes.
+ */
+uint64_t cf_hash_wy64(const void *key, size_t key_len);
+
+/**
+ * cf_hash_wy64() folded to 32 bits.
+ */
+uint32_t cf_hash_wy32(const void *key, size_t key_len);
+
+/**
+ * Hash of a key starting with a 20-byte cf_digest - 4 of its bytes, after the
+ * ones that pick the partition, so a table of one partition's digests spreads
+ * as well as any. Shorter keys fall back to cf_hash_wy32().
+ */
+uint32_t cf_hash_digest(const void *key, size_t key_len);
+
+/******************************************************************************/
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
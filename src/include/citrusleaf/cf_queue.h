@@ -17,6 +17,7 @@
 #pragma once
 
 #include <pthread.h>
+#include <citrusleaf/cf_atomic.h>
 #include <citrusleaf/cf_types.h>
 
 #ifdef __cplusplus
@@ -44,26 +45,43 @@ extern "C" {
 #define CF_QUEUE_WAIT_1SEC 1000
 #define CF_QUEUE_WAIT_30SEC 30000
 
+// flags for cf_queue_create_bounded()
+#define CF_QUEUE_LOCKFREE 0x01
+
 /******************************************************************************
  * TYPES
  ******************************************************************************/
 
 typedef int (*cf_queue_reduce_fn) (void *buf, void *udata);
 
+/**
+ * cf_queue_ring
+ * Private state of a CF_QUEUE_LOCKFREE queue.
+ */
+typedef struct cf_queue_ring_s cf_queue_ring;
+typedef struct cf_queue_index_s cf_queue_index;
+
 /**
  * cf_queue
  * A queue 
  */
 struct cf_queue_s {
     bool            threadsafe;     // sometimes it's good to live dangerously
-    unsigned int    allocsz;        // number of queue elements currently allocated
-    unsigned int    write_offset;   // 0 offset is first queue element.
+    unsigned int    allocsz;        // number of queue elements currently allocated (power of 2)
+    uint64_t        write_offset;   // 0 offset is first queue element.
                                     // write is always greater than or equal to read
-    unsigned int    read_offset;    // 
+    uint64_t        read_offset;    // offsets run free, CF_Q_INDEX() maps into queue
+    uint64_t *      dead;           // bitmap of deleted elements not yet compacted
+    unsigned int    n_dead;         // number of bits set in dead
     size_t          elementsz;      // number of bytes in an element
     pthread_mutex_t LOCK;           // the mutex lock
-    pthread_cond_t  CV;             // the condvar
+    pthread_cond_t  CV;             // the condvar, where there's no futex
+    cf_atomic32     n_waiters;      // consumers parked or about to park
+    cf_atomic32     wait_seq;       // eventcount consumers park on
     byte *          queue;          // the actual bytes that make up the queue
+    unsigned int    capacity;       // fixed element limit of a bounded queue, 0 if unbounded
+    cf_queue_ring * ring;           // lock-free ring, non-NULL only in CF_QUEUE_LOCKFREE mode
+    cf_queue_index * index;         // element hash index, non-NULL only for indexed queues
 };
 
 typedef struct cf_queue_s cf_queue;
@@ -74,6 +92,29 @@ typedef struct cf_queue_s cf_queue;
 
 cf_queue * cf_queue_create(size_t elementsz, bool threadsafe);
 
+/**
+ * Create a threadsafe queue that holds at most capacity elements. Pushes fail
+ * with CF_QUEUE_ERR once the queue is full.
+ *
+ * With CF_QUEUE_LOCKFREE the queue is a sequence-numbered multi-producer,
+ * multi-consumer ring (capacity is rounded up to a power of two), and push and
+ * pop only CAS the tail and head. A pop that finds the ring empty parks on the
+ * queue's eventcount (a futex on Linux, the mutex and condvar elsewhere), so
+ * pop keeps its usual ms_wait semantics, and a push only makes a wake call
+ * when a consumer is parked.
+ * A lock-free queue supports push, push_limit, pop, sz and delete_all - the
+ * other calls (including the batch calls) return CF_QUEUE_ERR.
+ */
+cf_queue * cf_queue_create_bounded(size_t elementsz, uint capacity, uint flags);
+
+/**
+ * Create an unbounded queue that also keeps a hash index of its elements, so
+ * cf_queue_push_unique() and cf_queue_delete() with a buf are O(1) expected
+ * rather than a scan of the whole queue. Costs a hash per push and pop.
+ * Reduce callbacks must not modify the elements of an indexed queue.
+ */
+cf_queue * cf_queue_create_indexed(size_t elementsz, bool threadsafe);
+
 void cf_queue_destroy(cf_queue *q);
 
 /**
@@ -97,10 +138,18 @@ bool cf_queue_push_limit(cf_queue *q, void *ptr, uint limit);
 int cf_queue_push_unique(cf_queue *q, void *ptr);
 	
 /**
- * Push head goes to the front, which currently means memcpying the entire queue contents.
+ * Push head goes to the front - the element is copied into the slot just
+ * behind the read offset, so it costs the same as cf_queue_push(). Not
+ * supported on ring queues.
  */
 int cf_queue_push_head(cf_queue *q, void *ptr);
 
+/**
+ * Push n contiguous elements at once - one lock, at most two memcpys and one
+ * wakeup (a broadcast if more than one consumer could make progress).
+ */
+int cf_queue_push_n(cf_queue *q, void *elems, uint n);
+
 /**
  * POP pops from the end of the queue, which is the most efficient
  * But understand this makes it LIFO, the least fair of queues
@@ -108,6 +157,13 @@ int cf_queue_push_head(cf_queue *q, void *ptr);
  */
 int cf_queue_pop(cf_queue *q, void *buf, int mswait);
 
+/**
+ * Pop up to max elements into buf (which must hold max elements) under one
+ * lock. Waits per mswait only until at least one element is available.
+ * Returns the number of elements popped, CF_QUEUE_EMPTY or CF_QUEUE_ERR.
+ */
+int cf_queue_pop_n(cf_queue *q, void *buf, uint max, int mswait);
+
 /**
  * Run the entire queue, calling the callback, with the lock held.
  * You can return values in the callback to cause deletes.
@@ -141,21 +197,30 @@ int cf_queue_delete(cf_queue *q, void *buf, bool only_one);
  */
 int cf_queue_delete_all(cf_queue *q);
 
-void cf_queue_delete_offset(cf_queue *q, uint index);
+void cf_queue_delete_offset(cf_queue *q, uint64_t offset);
 
 /******************************************************************************
  * MACROS
  ******************************************************************************/
 
-#define CF_Q_SZ(__q) (__q->write_offset - __q->read_offset)
+#define CF_Q_SZ(__q) (__q->write_offset - __q->read_offset - __q->n_dead)
 
 #define CF_Q_EMPTY(__q) (__q->write_offset == __q->read_offset)
 
+#define CF_Q_INDEX(__q, __i) ((uint)((__i) & (__q->allocsz - 1)))
+
 /**
  * todo: maybe it's faster to keep the read and write offsets in bytes,
  * to avoid the extra multiply?
  */
-#define CF_Q_ELEM_PTR(__q, __i) (&__q->queue[ (__i % __q->allocsz) * __q->elementsz ] )
+#define CF_Q_ELEM_PTR(__q, __i) (&__q->queue[ CF_Q_INDEX(__q, __i) * __q->elementsz ] )
+
+/**
+ * Elements deleted from the middle of the queue stay in place until they're
+ * compacted away - anything walking the offsets must skip them.
+ */
+#define CF_Q_ELEM_DEAD(__q, __i) (__q->n_dead && \
+		(__q->dead[CF_Q_INDEX(__q, __i) >> 6] & (1ULL << (CF_Q_INDEX(__q, __i) & 63))))
 
 /******************************************************************************/
 
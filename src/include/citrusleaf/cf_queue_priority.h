@@ -19,6 +19,10 @@
 /*
  * A simple priority queue implementation, which is simply a set of queues underneath.
  * This currently doesn't support 'delete' and 'reduce' functionality
+ *
+ * cf_queue_priority_create_heap() makes the variant with arbitrary priorities,
+ * backed by a 4-ary heap, and cf_queue_priority_create_fair() the variant that
+ * shares pops between the lanes by weight.
  */
 #include "cf_queue.h"
 
@@ -40,6 +44,35 @@ extern "C" {
 
 typedef struct cf_queue_priority_s cf_queue_priority;
 
+/**
+ * cf_queue_priority_heap
+ * Private state of a heap priority queue.
+ */
+typedef struct cf_queue_priority_heap_s cf_queue_priority_heap;
+
+/**
+ * cf_queue_priority_fair
+ * Private state of a weighted fair priority queue.
+ */
+typedef struct cf_queue_priority_fair_s cf_queue_priority_fair;
+
+/**
+ * Per-lane counters of a weighted fair priority queue.
+ */
+typedef struct cf_queue_priority_lane_stats_s {
+    unsigned int    depth;          // elements queued now
+    uint64_t        popped;         // elements popped
+    uint64_t        wait_us;        // total time popped elements were queued
+    uint64_t        wait_us_max;    // longest time a popped element was queued
+} cf_queue_priority_lane_stats;
+
+/**
+ * Refers to an element pushed on a heap priority queue, for
+ * cf_queue_priority_reprioritize(). Handles aren't reused, so one whose
+ * element has gone is safe to pass.
+ */
+typedef uint64_t cf_queue_priority_handle;
+
 struct cf_queue_priority_s {
     bool            threadsafe;
     cf_queue *      low_q;
@@ -47,6 +80,9 @@ struct cf_queue_priority_s {
     cf_queue *      high_q;
     pthread_mutex_t LOCK;
     pthread_cond_t  CV;
+    cf_queue_priority_heap * heap;  // non-NULL only for heap queues, which have no lanes
+    unsigned int    n_heap;         // number of elements in the heap
+    cf_queue_priority_fair * fair;  // non-NULL only for weighted fair queues
 };
 
 /******************************************************************************
@@ -54,17 +90,56 @@ struct cf_queue_priority_s {
  ******************************************************************************/
 
 cf_queue_priority *cf_queue_priority_create(size_t elementsz, bool threadsafe);
+
+/**
+ * Create a priority queue that takes any priority - lower pops first, so a
+ * deadline works as one - and pops elements of equal priority in push order.
+ * Push and pop are O(log n). cf_queue_priority_push() takes any int priority,
+ * and reduce_pop visits the elements of the lowest priority in push order.
+ */
+cf_queue_priority *cf_queue_priority_create_heap(size_t elementsz, bool threadsafe);
+
+/**
+ * Create a three lane priority queue that pops by deficit round robin rather
+ * than draining higher lanes first. Each round a lane may pop up to its
+ * weight in elements before the next lane's turn, and a lane with nothing
+ * queued gives up its turn - so a busy high lane gets high_weight pops for
+ * every low_weight a busy low lane gets, and no lane starves. Weights must be
+ * at least 1. Pop and reduce_pop both follow the rotation.
+ */
+cf_queue_priority *cf_queue_priority_create_fair(size_t elementsz, bool threadsafe,
+		unsigned int high_weight, unsigned int medium_weight, unsigned int low_weight);
 void cf_queue_priority_destroy(cf_queue_priority *q);
 int cf_queue_priority_push(cf_queue_priority *q, void *ptr, int pri);
 int cf_queue_priority_pop(cf_queue_priority *q, void *buf, int mswait);
 int cf_queue_priority_sz(cf_queue_priority *q);
 int cf_queue_priority_reduce_pop(cf_queue_priority *priority_q,  void *buf, cf_queue_reduce_fn cb, void *udata);
 
+/**
+ * Weighted fair queues only - get counters for the high, medium and low lanes,
+ * in that order. Returns -1 for other queues.
+ */
+int cf_queue_priority_get_stats(cf_queue_priority *q, cf_queue_priority_lane_stats stats[3]);
+
+/**
+ * Heap queues only - push with a 64-bit priority, and if handle isn't NULL
+ * return a handle to the element.
+ */
+int cf_queue_priority_push_handle(cf_queue_priority *q, void *ptr, int64_t pri, cf_queue_priority_handle *handle);
+
+/**
+ * Heap queues only - change the priority of a queued element, in O(log n).
+ * It keeps its place among elements of its new priority by when it was
+ * pushed. Returns CF_QUEUE_NOMATCH if the element has been popped.
+ */
+int cf_queue_priority_reprioritize(cf_queue_priority *q, cf_queue_priority_handle handle, int64_t pri);
+
 /******************************************************************************
  * MACROS
  ******************************************************************************/
 
-#define CF_Q_PRI_EMPTY(__q) (CF_Q_EMPTY(__q->low_q) && CF_Q_EMPTY(__q->medium_q) && CF_Q_EMPTY(__q->high_q))
+#define CF_Q_PRI_EMPTY(__q) (__q->heap ? __q->n_heap == 0 : \
+		(CF_Q_EMPTY(__q->low_q) && CF_Q_EMPTY(__q->medium_q) && CF_Q_EMPTY(__q->high_q)))
  
 /******************************************************************************/
 
@@ -25,6 +25,8 @@
 
 #include <citrusleaf/alloc.h>
 #include <citrusleaf/cf_atomic.h>
+#include <citrusleaf/cf_counter.h>
+#include <citrusleaf/cf_slab.h>
 #include <citrusleaf/cf_types.h>
 #include <inttypes.h>
 #include <stdint.h>
@@ -35,6 +37,8 @@
 extern "C" {
 #endif
 
+struct as_thread_pool;
+
 /******************************************************************************
  * CONSTANTS
  ******************************************************************************/
@@ -47,7 +51,9 @@ extern "C" {
 #define CF_RCHASH_REDUCE_DELETE 1
 
 /**
- * support resizes (will sometimes hang for long periods)
+ * support resizes - the table doubles when it holds more elements than
+ * buckets, and buckets migrate to the new table a few at a time as part of
+ * later operations, so no single call pays for the whole rehash
  */
 #define CF_RCHASH_CR_RESIZE 0x01
 
@@ -62,7 +68,8 @@ extern "C" {
 #define CF_RCHASH_CR_MT_BIGLOCK 0x04
 
 /**
- * support multithreaded access with a pool of object locks
+ * support multithreaded access with a pool of object locks - a fixed set of
+ * lock stripes sized by core count, not one lock per bucket
  */
 #define CF_RCHASH_CR_MT_MANYLOCK 0x08
 
@@ -71,6 +78,30 @@ extern "C" {
  */
 #define CF_RCHASH_CR_NOSIZE 0x10
 
+/**
+ * gets don't lock - they validate against a per-stripe sequence number and
+ * retry if a writer got in the way, and the table defers freeing elements and
+ * releasing objects until no reader can still see them. Writers lock as
+ * usual. Fixed-size keys only.
+ */
+#define CF_RCHASH_CR_LOCKFREE_READ 0x20
+
+/**
+ * use a built-in hash function (see cf_hash.h) instead of the one passed to
+ * create, which may be NULL - CRC32C, a wyhash-style mix, or a cf_digest at
+ * the start of the key
+ */
+#define CF_RCHASH_CR_HASH_CRC32C 0x40
+#define CF_RCHASH_CR_HASH_WY 0x80
+#define CF_RCHASH_CR_HASH_DIGEST 0x100
+
+/**
+ * chain elements come from a slab owned by the table (see cf_slab.h) instead
+ * of a malloc() each, and cf_rchash_destroy() hands the slab's memory back
+ * all at once. Variable-size keys are still allocated one by one.
+ */
+#define CF_RCHASH_CR_SLAB 0x200
+
 /******************************************************************************
  * TYPES
  ******************************************************************************/
@@ -78,6 +109,8 @@ extern "C" {
 typedef struct cf_rchash_s cf_rchash;
 typedef struct cf_rchash_elem_v_s cf_rchash_elem_v;
 typedef struct cf_rchash_elem_f_s cf_rchash_elem_f;
+typedef struct cf_rchash_stripe_s cf_rchash_stripe;
+typedef struct cf_rchash_reclaim_s cf_rchash_reclaim;
 
 /**
  * A generic call for hash functions the user can create
@@ -94,6 +127,12 @@ typedef uint32_t (*cf_rchash_hash_fn) (void *value, uint32_t value_len);
  */
 typedef int (*cf_rchash_reduce_fn) (void *key, uint32_t keylen, void *object, void *udata);
 
+/**
+ * Folds one partition's copy of the udata of a parallel reduce back into the
+ * caller's udata.
+ */
+typedef void (*cf_rchash_combine_fn) (void *udata, void *part_udata);
+
 /**
  * need a destructor for the object.
  *
@@ -133,17 +172,22 @@ struct cf_rchash_elem_f_s {
  * Private data.
  */
 struct cf_rchash_s {
-	cf_atomic32 			elements;
+	cf_atomic32 			elements;			// not kept with CF_RCHASH_CR_MT_MANYLOCK
 	uint32_t 				key_len;    		// if key_len == 0, then use the variable size functions
 	uint 					flags;
 	cf_rchash_hash_fn		h_fn;
 	cf_rchash_destructor_fn d_fn;
-	uint 					table_len; 			// number of elements currently in the table
+	uint 					table_len; 			// number of buckets currently in the table
 	void *					table;
+	uint					old_table_len;		// non-zero while a resize is migrating
+	void *					old_table;
+	cf_atomic32				stripes_migrated;	// stripes done with the current resize
 	pthread_mutex_t			biglock;
-	int						lock_table_len;
-	int						buckets_per_lock; 	// precompute: buckets / locks
-	pthread_mutex_t * 		lock_table;
+	uint32_t				n_stripes;			// power of 2, and always divides table_len
+	cf_rchash_stripe *		stripes;
+	cf_rchash_reclaim *		reclaim;			// only with CF_RCHASH_CR_LOCKFREE_READ
+	cf_slab *				slab;				// only with CF_RCHASH_CR_SLAB
+	cf_counter *			counter;			// only with CF_RCHASH_CR_MT_MANYLOCK
 };
 
 
@@ -196,6 +240,15 @@ uint32_t cf_rchash_get_size(cf_rchash *h);
 */
 int cf_rchash_reduce(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata);
 
+/*
+** Map/Reduce pattern, split into n_partitions ranges of buckets run across
+** the pool and the calling thread - partitions, udata copies and combine_fn
+** work as in shash_reduce_parallel() (cf_shash.h). Stopping works as in
+** cf_rchash_reduce(), for every partition at its next bucket, and the first
+** partition's stopping value is returned.
+*/
+int cf_rchash_reduce_parallel(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata, size_t udata_size, cf_rchash_combine_fn combine_fn, struct as_thread_pool *pool, uint32_t n_partitions);
+
 /*
  * Destroy the entire hash - all memory will be freed
  */
@@ -28,12 +28,18 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <citrusleaf/cf_atomic.h>
+#include <citrusleaf/cf_counter.h>
+#include <citrusleaf/cf_hash.h>
+#include <citrusleaf/cf_slab.h>
 #include <citrusleaf/cf_types.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+struct as_thread_pool;
+
 /******************************************************************************
  * CONSTANTS
  ******************************************************************************/
@@ -45,7 +51,12 @@ extern "C" {
 #define SHASH_OK 0
 
 /**
- * support resizes (will sometimes hang for long periods)
+ * support resizes - the table doubles once it holds more than the load set
+ * by shash_set_max_load() (default 1 element per bucket). The old table
+ * drains into the new one a few buckets per operation, so no single call
+ * pays for the whole rehash. With MT_MANYLOCK the locks become a power of 2
+ * number of stripes sized by core count, instead of one per bucket. Not
+ * supported with SHASH_CR_OPEN.
  */
 #define SHASH_CR_RESIZE 0x01
 
@@ -70,6 +81,32 @@ extern "C" {
  */
 #define SHASH_CR_UNTRACKED 0x10
 
+/**
+ * open addressing - keys and values live inline in a flat array, found by
+ * probing 16 control bytes at a time (with SSE2 where there is one), instead
+ * of in chains of separately allocated elements. The table is sized to hold
+ * 'sz' elements at 7/8 load and refuses puts past 15/16. With MT_MANYLOCK
+ * it's split into shards sized by core count, each with its own lock.
+ */
+#define SHASH_CR_OPEN 0x20
+
+/**
+ * use a built-in hash function (see cf_hash.h) over the key's key_len bytes
+ * instead of the one passed to create, which may be NULL - CRC32C, a
+ * wyhash-style mix, or a cf_digest at the start of the key
+ */
+#define SHASH_CR_HASH_CRC32C 0x40
+#define SHASH_CR_HASH_WY 0x80
+#define SHASH_CR_HASH_DIGEST 0x100
+
+/**
+ * chained elements come from a slab owned by the table (see cf_slab.h)
+ * instead of a malloc() each - deletes recycle them, and shash_deleteall()
+ * and shash_destroy() hand the slab's memory back all at once. Not
+ * supported with SHASH_CR_OPEN, which has no chains.
+ */
+#define SHASH_CR_SLAB 0x200
+
 /**
  * indicate that a delete should be done during the reduction
  */
@@ -99,6 +136,12 @@ typedef void (*shash_update_fn) (void *key, void *value_old, void *value_new, vo
  */
 typedef int (*shash_reduce_fn) (void *key, void *data, void *udata);
 
+/**
+ * Folds one partition's copy of the udata of a parallel reduce back into the
+ * caller's udata
+ */
+typedef void (*shash_combine_fn) (void *udata, void *part_udata);
+
 /**
  * Simple (and slow) element is when
  * everything is variable (although a very nicely packed structure for 32 or 64
@@ -111,20 +154,44 @@ struct shash_elem_s {
 
 typedef struct shash_elem_s shash_elem;
 
+typedef struct shash_shard_s shash_shard;
+
 struct shash_s {
-	uint 				elements; 		// INVALID in manylocks case - see notes under get_size
+	uint 				elements; 		// not kept in the MT_MANYLOCK case - see notes under get_size
 	uint32_t 			key_len;
 	uint32_t 			value_len;
 	uint 				flags;
 	shash_hash_fn		h_fn;
+	cf_hash_fn			key_hash_fn;	// SHASH_CR_HASH_* only - takes key_len
 	uint 				table_len; 		// number of elements currently in the table
 	void *				table;
 	pthread_mutex_t		biglock;
 	pthread_mutex_t	*	lock_table;
+	uint32_t			lock_table_len;	// MT_MANYLOCK - table_len, or stripes if SHASH_CR_RESIZE
+	uint32_t			max_load;		// SHASH_CR_RESIZE only - elements per 100 buckets
+	uint 				old_table_len;	// SHASH_CR_RESIZE only - non-zero while draining
+	void *				old_table;
+	uint32_t *			migrate;		// next old bucket to move, per lock
+	cf_atomic32			locks_migrated;
+	uint32_t			n_shards;		// SHASH_CR_OPEN only - power of 2
+	shash_shard *		shards;
+	cf_slab *			slab;			// SHASH_CR_SLAB only
+	cf_counter *		counter;		// MT_MANYLOCK chained only - replaces elements
 };
 
 typedef struct shash_s shash;
 
+/**
+ * Occupancy and cost of a table, from shash_get_stats().
+ */
+typedef struct shash_stats_s {
+	uint32_t			elements;
+	uint32_t			slots;			// buckets, or open addressing slots
+	size_t				bytes;			// table, chained elements and locks
+	double				probe_mean;		// per element - see shash_get_stats()
+	uint32_t			probe_max;
+} shash_stats;
+
 /******************************************************************************
  * FUNCTIONS
  ******************************************************************************/
@@ -139,6 +206,12 @@ typedef struct shash_s shash;
  */
 int shash_create(shash **h, shash_hash_fn h_fn, uint32_t key_len, uint32_t value_len, uint32_t sz, uint flags);
 
+/**
+ * Set how full a SHASH_CR_RESIZE table gets before it doubles, in elements
+ * per 100 buckets. Call before sharing the table between threads.
+ */
+int shash_set_max_load(shash *h, uint32_t max_load);
+
 /**
  * Place a value into the hash
  * Value will be copied into the hash
@@ -163,6 +236,24 @@ int shash_put_duplicate(shash *h, void *key, void *value);
  */
 int shash_get(shash *h, void *key, void *value);
 
+/**
+ * Get n keys at once - keys holds n keys of key_len bytes back to back, and
+ * values (if not NULL) is filled with n values of value_len bytes, in the
+ * same order. Each key's SHASH_OK or SHASH_ERR_NOTFOUND goes in results, if
+ * not NULL. Keys are hashed and their buckets prefetched a few dozen at a
+ * time before any is looked at, so the cache misses overlap, and then looked
+ * up grouped by lock, each lock taken once per group. Returns SHASH_OK if
+ * every key was found, otherwise the first key's failure.
+ */
+int shash_get_many(shash *h, void *keys, uint32_t n, void *values, int *results);
+
+/**
+ * Put n keys at once, as shash_put() - keys and values as for
+ * shash_get_many(). A key repeated in the batch ends up with its last value.
+ * Returns SHASH_OK if every put succeeded, otherwise the first key's failure.
+ */
+int shash_put_many(shash *h, void *keys, uint32_t n, void *values, int *results);
+
 /**
  * Returns the pointer to the internal item, and a locked-lock
  * which allows the touching of internal state. If non-lock hash table,
@@ -203,6 +294,13 @@ int shash_delete_lockfree(shash *h, void *key);
  */
 uint32_t shash_get_size(shash *h);
 
+/**
+ * Walk the table and fill in stats. The probe length of an element is how
+ * many elements a get compares to find it in a chained table, or how many
+ * 16-slot groups it scans in an open addressing table. Locks like reduce.
+ */
+int shash_get_stats(shash *h, shash_stats *stats);
+
 /**
  * An interesting idea: readv / writev for these functions?
  */
@@ -234,6 +332,25 @@ int shash_reduce(shash *h, shash_reduce_fn reduce_fn, void *udata);
  */
 int shash_reduce_delete(shash *h, shash_reduce_fn reduce_fn, void *udata);
 
+/**
+ * Map/Reduce pattern, split into n_partitions ranges of buckets (or shards,
+ * for SHASH_CR_OPEN) run across the pool and the calling thread. Locks are
+ * taken a bucket (or shard) at a time - the 'biglock' a few dozen buckets at
+ * a time - so writers get in between. Each partition runs reduce_fn on its
+ * own copy of the udata_size bytes at udata, and once all are done
+ * combine_fn folds each copy back into udata, in partition order, on the
+ * calling thread. With udata_size 0 every partition is passed udata itself
+ * and combine_fn may be NULL. A non-zero return from reduce_fn stops every
+ * partition at its next bucket, and the first partition's such value is
+ * returned. cf_rchash_reduce_parallel() works the same way.
+ */
+int shash_reduce_parallel(shash *h, shash_reduce_fn reduce_fn, void *udata, size_t udata_size, shash_combine_fn combine_fn, struct as_thread_pool *pool, uint32_t n_partitions);
+
+/**
+ * Parallel version of shash_reduce_delete() - as shash_reduce_parallel()
+ */
+int shash_reduce_delete_parallel(shash *h, shash_reduce_fn reduce_fn, void *udata, size_t udata_size, shash_combine_fn combine_fn, struct as_thread_pool *pool, uint32_t n_partitions);
+
 /**
  * Delete all the data from the entire hash - complete cleanup
  */
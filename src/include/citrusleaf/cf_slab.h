@@ -0,0 +1,113 @@
+/* 
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+#pragma once
+
+/*
+ * A slab allocator for many objects of one size, such as hash table chain
+ * elements. Objects are carved from large chunks and recycled through a free
+ * list, so churn never goes back to the system allocator, and everything is
+ * handed back at once by cf_slab_reset() or cf_slab_destroy().
+ *
+ * A CF_SLAB_MT slab gives each thread a magazine of free objects to allocate
+ * from and free to, and only goes to the shared free list a batch at a time.
+ * Magazines are picked by a per-thread index, so threads only share one once
+ * there are more of them than magazines.
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <citrusleaf/cf_types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/******************************************************************************
+ * CONSTANTS
+ ******************************************************************************/
+
+/**
+ * support multithreaded alloc and free
+ */
+#define CF_SLAB_MT 0x01
+
+/**
+ * chunks come from malloc() instead of cf_malloc()
+ */
+#define CF_SLAB_UNTRACKED 0x02
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+
+typedef struct cf_slab_mag_s cf_slab_mag;
+
+struct cf_slab_s {
+	size_t				obj_sz;			// rounded up to 16 bytes
+	uint32_t			chunk_objs;		// objects per chunk
+	uint				flags;
+	pthread_mutex_t		lock;			// CF_SLAB_MT - free list and chunks
+	void *				free_list;		// linked through each object's first word
+	uint8_t *			chunks;			// linked through each chunk's first word
+	uint32_t			n_chunks;
+	uint8_t *			carve;			// never used objects in the newest chunk
+	uint8_t *			carve_end;
+	uint32_t			n_mags;			// CF_SLAB_MT only - power of 2
+	cf_slab_mag *		mags;
+};
+
+typedef struct cf_slab_s cf_slab;
+
+/******************************************************************************
+ * FUNCTIONS
+ ******************************************************************************/
+
+/**
+ * Create a slab of obj_sz byte objects. Returns NULL if out of memory.
+ */
+cf_slab *cf_slab_create(size_t obj_sz, uint flags);
+
+/**
+ * Free every chunk, whether or not its objects were freed.
+ */
+void cf_slab_destroy(cf_slab *s);
+
+/**
+ * Returns NULL if out of memory.
+ */
+void *cf_slab_alloc(cf_slab *s);
+
+void cf_slab_free(cf_slab *s, void *p);
+
+/**
+ * Free every object at once, handing all the chunks back. Nothing else may
+ * use the slab meanwhile.
+ */
+void cf_slab_reset(cf_slab *s);
+
+/**
+ * Bytes of chunks currently held.
+ */
+size_t cf_slab_bytes(cf_slab *s);
+
+/******************************************************************************/
+
+#ifdef __cplusplus
+} // end extern "C"
+#endif
@@ -57,7 +57,7 @@ static as_hashmap * as_hashmap_cons(as_hashmap * map, uint32_t capacity)
 
 	size_t size = map->table_capacity * sizeof(as_hashmap_element);
 
-	map->table = (as_hashmap_element *)cf_malloc(size);
+	map->table = (as_hashmap_element *)cf_malloc_arena(size, CF_ALLOC_ARENA_HASHMAP);
 
 	if (! map->table) {
 		return NULL;
@@ -146,7 +146,7 @@ as_hashmap * as_hashmap_init(as_hashmap * map, uint32_t capacity)
 
 as_hashmap * as_hashmap_new(uint32_t capacity)
 {
-	as_hashmap * map = (as_hashmap *)cf_malloc(sizeof(as_hashmap));
+	as_hashmap * map = (as_hashmap *)cf_malloc_arena(sizeof(as_hashmap), CF_ALLOC_ARENA_HASHMAP);
 
 	if (! map) {
 		return NULL;
@@ -276,7 +276,7 @@ int as_hashmap_set(as_hashmap * map, const as_val * k, const as_val * v)
 
 		if (map->extras) {
 			as_hashmap_element * extras =
-					(as_hashmap_element *)cf_realloc(map->extras, size);
+					(as_hashmap_element *)cf_realloc_arena(map->extras, size, CF_ALLOC_ARENA_HASHMAP);
 
 			if (! extras) {
 				prev_e->next = cur_end;
@@ -287,7 +287,7 @@ int as_hashmap_set(as_hashmap * map, const as_val * k, const as_val * v)
 			memset((uint8_t*)map->extras + orig_size, 0, size - orig_size);
 		}
 		else {
-			if (! (map->extras = (as_hashmap_element *)cf_malloc(size))) {
+			if (! (map->extras = (as_hashmap_element *)cf_malloc_arena(size, CF_ALLOC_ARENA_HASHMAP))) {
 				prev_e->next = cur_end;
 				return -1;
 			}
@@ -28,7 +28,7 @@
 static int as_pack_resize(as_packer * pk, int length)
 {
 	// Add current buffer to linked list and allocate a new buffer
-	as_packer_buffer* entry = (as_packer_buffer*) cf_malloc(sizeof(as_packer_buffer));
+	as_packer_buffer* entry = (as_packer_buffer*) cf_malloc_arena(sizeof(as_packer_buffer), CF_ALLOC_ARENA_MSGPACK);
 	
 	if (entry == 0) {
 		return -1;
@@ -38,7 +38,7 @@ static int as_pack_resize(as_packer * pk, int length)
 	entry->next = 0;
 	
 	int size = (length > pk->capacity)? length : pk->capacity;
-	pk->buffer = (unsigned char*) cf_malloc(size);
+	pk->buffer = (unsigned char*) cf_malloc_arena(size, CF_ALLOC_ARENA_MSGPACK);
 	
 	if (pk->buffer == 0) {
 		return -1;
@@ -426,11 +426,21 @@ static int as_unpack_blob(as_unpacker * pk, int size, as_val ** val)
 	size--;
 	
 	if (type == AS_BYTES_STRING) {
-		char* v = cf_strndup((char*)pk->buffer + pk->offset, size);
+		char* v = cf_strndup_arena((char*)pk->buffer + pk->offset, size, CF_ALLOC_ARENA_MSGPACK);
+		
+		if (v == 0) {
+			return -1;
+		}
+		
 		*val = (as_val*) as_string_new(v, true);
 	}
 	else {
-		unsigned char* buf = cf_malloc(size);
+		unsigned char* buf = cf_malloc_arena(size, CF_ALLOC_ARENA_MSGPACK);
+		
+		if (buf == 0) {
+			return -1;
+		}
+		
 		memcpy(buf, pk->buffer + pk->offset, size);
 		as_bytes *b = as_bytes_new_wrap(buf, size, true);
 		if (b) {
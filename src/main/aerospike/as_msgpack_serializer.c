@@ -76,7 +76,7 @@ static uint32_t as_msgpack_serializer_serialize_getsize(as_serializer * s, as_va
 
 static int as_msgpack_serializer_serialize(as_serializer * s, as_val * v, as_buffer * buff) {
 	as_packer packer;
-	packer.buffer = (unsigned char *) cf_malloc(AS_PACKER_BUFFER_SIZE);
+	packer.buffer = (unsigned char *) cf_malloc_arena(AS_PACKER_BUFFER_SIZE, CF_ALLOC_ARENA_MSGPACK);
 	packer.capacity = AS_PACKER_BUFFER_SIZE;
 	packer.offset = 0;
 	packer.head = 0;
@@ -117,7 +117,7 @@ static int as_msgpack_serializer_serialize(as_serializer * s, as_val * v, as_buf
 			p = p->next;
 		}
 		
-		unsigned char * target = (unsigned char *) cf_malloc(size);
+		unsigned char * target = (unsigned char *) cf_malloc_arena(size, CF_ALLOC_ARENA_MSGPACK);
 		p = packer.head;
 		int offset = 0;
 		
@@ -16,159 +16,2700 @@
  */
 #include "aerospike/as_thread_pool.h"
 #include <citrusleaf/alloc.h>
+#include <citrusleaf/cf_atomic.h>
+#include <citrusleaf/cf_clock.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <dirent.h>
+#endif
+
 /******************************************************************************
  * TYPES
  *****************************************************************************/
 
-struct as_thread_pool_task {
-	as_task_fn task_fn;
-	void* udata;
-};
+struct as_thread_pool_task {
+	as_task_fn task_fn;
+	void* udata;
+};
+
+typedef struct as_thread_pool_task as_thread_pool_task;
+
+/**
+ *	Chase-Lev deque storage. Grown arrays are kept on the retired list until
+ *	the pool is destroyed, since a thief may still be reading one.
+ */
+typedef struct as_thread_pool_deque_array {
+	struct as_thread_pool_deque_array* retired;
+	uint64_t mask;
+	as_thread_pool_task tasks[];
+} as_thread_pool_deque_array;
+
+/**
+ *	Chase-Lev work-stealing deque. The owning worker pushes and takes at the
+ *	bottom, other workers steal from the top.
+ */
+typedef struct as_thread_pool_deque {
+	cf_atomic64 top;
+	uint8_t pad[64 - sizeof(cf_atomic64)];
+	cf_atomic64 bottom;
+	as_thread_pool_deque_array* volatile array;
+} as_thread_pool_deque;
+
+typedef struct as_thread_pool_worker {
+	as_thread_pool_deque deque;
+	as_thread_pool* pool;
+	uint32_t seed;
+	bool active;
+} as_thread_pool_worker;
+
+/**
+ *	Worker slots. Slots are never freed while the pool is up (thieves may be
+ *	looking at them) - a shut down worker's slot is reused by the next thread
+ *	started, and a grown array retires the old one like the deques do.
+ */
+typedef struct as_thread_pool_slots {
+	struct as_thread_pool_slots* retired;
+	uint32_t capacity;
+	as_thread_pool_worker* workers[];
+} as_thread_pool_slots;
+
+struct as_thread_pool_ws {
+	as_thread_pool_slots* volatile slots;
+	cf_atomic32 n_slots;
+	cf_atomic32 n_idle;
+	cf_atomic32 nudge_pending;
+};
+
+/**
+ *	A NUMA node's CPUs and, for a pool split into per-node sub-pools, its
+ *	dispatch queue and how many of its workers are running and idle.
+ */
+typedef struct as_thread_pool_node {
+	uint32_t* cpus;
+	uint32_t n_cpus;
+	cf_queue* queue;
+	cf_atomic32 n_threads;
+	cf_atomic32 n_idle;
+} as_thread_pool_node;
+
+/**
+ *	Placement policy and topology, for a pool created from a config. Each
+ *	running thread holds a placement slot - the lowest free one when it
+ *	started - which fixes its CPUs and node. Shrinking stops the threads in
+ *	the highest slots held.
+ */
+struct as_thread_pool_place {
+	pthread_mutex_t lock;
+	as_thread_pool_placement placement;
+	size_t stack_size;
+	char name_prefix[16];
+	as_thread_pool_node* nodes;
+	uint32_t n_nodes;
+	int32_t* cpu_node;		// node index by CPU id, -1 if not known
+	uint32_t n_cpu_ids;
+	uint32_t* order;		// slot i runs on order[i % n_order]
+	uint32_t n_order;
+	bool* slot_used;
+	bool* slot_stop;		// slot's thread is to exit, set by a shrink
+	uint32_t slot_capacity;
+	cf_atomic32 n_stopping;	// slots with slot_stop set
+	bool node_queues;
+};
+
+typedef struct as_thread_pool_place as_thread_pool_place;
+
+/**
+ *	Start argument for a thread of a pool created from a config, freed by the
+ *	thread.
+ */
+typedef struct as_thread_pool_start {
+	as_thread_pool* pool;
+	as_thread_pool_worker* worker;
+	uint32_t slot;
+} as_thread_pool_start;
+
+/**
+ *	A scheduled task. Sits on a wheel bucket list while pending, on the free
+ *	list otherwise. Entries live in fixed chunks so handles can index them.
+ */
+typedef struct as_thread_pool_timer_entry {
+	struct as_thread_pool_timer_entry* prev;
+	struct as_thread_pool_timer_entry* next;
+	uint64_t due;			// tick to fire at
+	uint64_t period;		// ticks between firings, 0 if one-shot
+	as_task_fn task_fn;
+	void* udata;
+	uint32_t index;
+	uint32_t generation;	// bumped when freed, so stale handles don't match
+	int32_t bucket;			// -1 if not pending
+} as_thread_pool_timer_entry;
+
+#define AS_TIMER_TICK_US 1000
+#define AS_TIMER_BITS 6
+#define AS_TIMER_SLOTS (1 << AS_TIMER_BITS)
+#define AS_TIMER_LEVELS 5
+#define AS_TIMER_CHUNK 4096
+
+/**
+ *	Hierarchical timing wheel. Level 0 has a bucket per tick, and each level
+ *	up a bucket per AS_TIMER_SLOTS buckets of the level below. A timer goes in
+ *	the lowest level that reaches its due tick, and moves down a level each
+ *	time the wheel turns past its bucket.
+ */
+struct as_thread_pool_timers {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	as_thread_pool* pool;
+	as_thread_pool_timer_entry* buckets[AS_TIMER_LEVELS * AS_TIMER_SLOTS];
+	uint64_t occupied[AS_TIMER_LEVELS];	// non-empty buckets, a bit each
+	uint64_t tick;						// next tick to process
+	uint64_t wake_tick;					// when the timer thread next looks
+	uint32_t n_pending;
+	as_thread_pool_timer_entry** chunks;
+	uint32_t n_chunks;
+	as_thread_pool_timer_entry* free_list;
+	as_thread_pool_task* fired;			// queued by the timer thread, unlocked
+	uint32_t n_fired;
+	uint32_t fired_capacity;
+	bool stop;
+};
+
+// A thread in as_future_wait_any(), on its stack - it parks on its own
+// condvar, and each future it waits for links to it.
+typedef struct as_future_waiter {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool fired;
+} as_future_waiter;
+
+typedef struct as_future_link {
+	as_future_waiter* waiter;
+	struct as_future_link* prev;
+	struct as_future_link* next;
+} as_future_link;
+
+// Futures wait_any registers on without allocating.
+#define AS_FUTURE_ANY_LINKS 16
+
+struct as_future {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	as_thread_pool* pool;
+	as_future_fn fn;
+	as_future_then_fn then_fn;
+	void* udata;
+	void* arg;				// the antecedent's result, for a continuation
+	void* result;
+	struct as_future* next;	// continuation to queue when done, or freelist link
+	as_future_link* any;	// as_future_wait_any() callers to wake when done
+	cf_atomic32 ref_count;
+	uint32_t n_waiters;
+	volatile bool done;
+};
+
+/******************************************************************************
+ * STATIC VARIABLES
+ *****************************************************************************/
+
+// The work-stealing worker running on this thread, if any.
+static __thread as_thread_pool_worker* as_current_worker = NULL;
+
+// The pool whose worker this is, if any, and for a node sub-pool worker its
+// node.
+static __thread as_thread_pool* as_current_pool = NULL;
+static __thread uint32_t as_current_node = 0;
+
+// Whether this is a pool's timer thread.
+static __thread bool as_in_timer = false;
+
+// The placement slot of this thread, for a pool created from a config.
+static __thread uint32_t as_current_slot = 0;
+
+// Futures are recycled here rather than freed - they outlive any one pool.
+static pthread_mutex_t as_future_free_lock = PTHREAD_MUTEX_INITIALIZER;
+static as_future* as_future_free_list = NULL;
+
+/******************************************************************************
+ * Deque Functions
+ *****************************************************************************/
+
+#define AS_THREAD_POOL_DEQUE_SIZE 256
+
+static as_thread_pool_deque_array*
+as_thread_pool_deque_array_create(uint64_t size)
+{
+	as_thread_pool_deque_array* a = cf_malloc(sizeof(as_thread_pool_deque_array) + (size * sizeof(as_thread_pool_task)));
+	
+	if (a) {
+		a->retired = NULL;
+		a->mask = size - 1;
+	}
+	return a;
+}
+
+static bool
+as_thread_pool_deque_init(as_thread_pool_deque* d)
+{
+	d->top = 0;
+	d->bottom = 0;
+	d->array = as_thread_pool_deque_array_create(AS_THREAD_POOL_DEQUE_SIZE);
+	return d->array != NULL;
+}
+
+static void
+as_thread_pool_deque_destroy(as_thread_pool_deque* d)
+{
+	as_thread_pool_deque_array* a = d->array;
+	
+	while (a) {
+		as_thread_pool_deque_array* retired = a->retired;
+		cf_free(a);
+		a = retired;
+	}
+}
+
+/**
+ *	Owner only. Returns false if the deque was full and couldn't grow.
+ */
+static bool
+as_thread_pool_deque_push(as_thread_pool_deque* d, as_thread_pool_task* task)
+{
+	uint64_t b = d->bottom;
+	uint64_t t = d->top;
+	as_thread_pool_deque_array* a = d->array;
+	
+	if (b - t > a->mask) {
+		as_thread_pool_deque_array* grown = as_thread_pool_deque_array_create((a->mask + 1) * 2);
+		
+		if (! grown) {
+			return false;
+		}
+		
+		for (uint64_t i = t; i < b; i++) {
+			grown->tasks[i & grown->mask] = a->tasks[i & a->mask];
+		}
+		grown->retired = a;
+		
+		// Contents before the array pointer.
+		CF_MEMORY_BARRIER_WRITE();
+		d->array = grown;
+		a = grown;
+	}
+	
+	a->tasks[b & a->mask] = *task;
+	
+	// The locked increment publishes the task, and is a full barrier so the
+	// caller's look for idle workers can't pass it.
+	cf_atomic64_incr(&d->bottom);
+	return true;
+}
+
+/**
+ *	Owner only - takes the most recently pushed task.
+ */
+static bool
+as_thread_pool_deque_take(as_thread_pool_deque* d, as_thread_pool_task* task)
+{
+	as_thread_pool_deque_array* a = d->array;
+	
+	// The new bottom must be visible before we read top, or a thief and the
+	// owner could both take the last task - a locked decrement is a full
+	// barrier, and cheaper than mfence.
+	uint64_t b = (uint64_t)cf_atomic64_decr(&d->bottom);
+	uint64_t t = d->top;
+	
+	if ((int64_t)(b - t) < 0) {
+		// Empty.
+		d->bottom = t;
+		return false;
+	}
+	
+	*task = a->tasks[b & a->mask];
+	
+	if (b != t) {
+		// More than one task left - no race with thieves.
+		return true;
+	}
+	
+	// Last task - race thieves for it.
+	bool won = cf_atomic64_cas(&d->top, t, t + 1) == (int64_t)t;
+	d->bottom = t + 1;
+	return won;
+}
+
+/**
+ *	Any thread - takes the oldest task. Returns false if the deque was empty or
+ *	another thread got there first.
+ */
+static bool
+as_thread_pool_deque_steal(as_thread_pool_deque* d, as_thread_pool_task* task)
+{
+	uint64_t t = d->top;
+	uint64_t b = d->bottom;
+	
+	if ((int64_t)(b - t) <= 0) {
+		return false;
+	}
+	
+	as_thread_pool_deque_array* a = d->array;
+	*task = a->tasks[t & a->mask];
+	
+	// If the slot was overwritten, top has moved and this fails.
+	return cf_atomic64_cas(&d->top, t, t + 1) == (int64_t)t;
+}
+
+static inline bool
+as_thread_pool_deque_empty(as_thread_pool_deque* d)
+{
+	return (int64_t)(d->bottom - d->top) <= 0;
+}
+
+/******************************************************************************
+ * Placement Functions
+ *****************************************************************************/
+
+static bool
+as_thread_pool_append(uint32_t** array, uint32_t* count, uint32_t value)
+{
+	// Grow at powers of 2.
+	if ((*count & (*count - 1)) == 0) {
+		uint32_t* grown = cf_realloc(*array, (*count ? *count * 2 : 1) * sizeof(uint32_t));
+		
+		if (! grown) {
+			return false;
+		}
+		*array = grown;
+	}
+	(*array)[(*count)++] = value;
+	return true;
+}
+
+static bool
+as_thread_pool_node_add(as_thread_pool_place* place, uint32_t* cpus, uint32_t n_cpus)
+{
+	as_thread_pool_node* nodes = cf_realloc(place->nodes, (place->n_nodes + 1) * sizeof(as_thread_pool_node));
+	
+	if (! nodes) {
+		return false;
+	}
+	place->nodes = nodes;
+	
+	as_thread_pool_node* node = &nodes[place->n_nodes++];
+	node->cpus = cpus;
+	node->n_cpus = n_cpus;
+	node->queue = NULL;
+	node->n_threads = 0;
+	node->n_idle = 0;
+	return true;
+}
+
+#if defined(__linux__)
+
+/**
+ *	Parse a sysfs CPU list, e.g. "0-3,8-11".
+ */
+static bool
+as_thread_pool_parse_cpulist(const char* s, uint32_t** cpus, uint32_t* n_cpus)
+{
+	while (*s >= '0' && *s <= '9') {
+		char* end;
+		uint32_t first = (uint32_t)strtoul(s, &end, 10);
+		uint32_t last = first;
+		
+		if (*end == '-') {
+			last = (uint32_t)strtoul(end + 1, &end, 10);
+		}
+		
+		for (uint32_t cpu = first; cpu <= last; cpu++) {
+			if (! as_thread_pool_append(cpus, n_cpus, cpu)) {
+				return false;
+			}
+		}
+		s = (*end == ',') ? end + 1 : end;
+	}
+	return true;
+}
+
+static int
+as_thread_pool_cmp_u32(const void* a, const void* b)
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ *	Read NUMA nodes and their CPUs from sysfs. Nodes without CPUs are skipped.
+ */
+static bool
+as_thread_pool_topology_read(as_thread_pool_place* place)
+{
+	DIR* dir = opendir("/sys/devices/system/node");
+	
+	if (! dir) {
+		return true;
+	}
+	
+	uint32_t* ids = NULL;
+	uint32_t n_ids = 0;
+	struct dirent* entry;
+	bool ok = true;
+	
+	while (ok && (entry = readdir(dir)) != NULL) {
+		unsigned id;
+		char c;
+		
+		if (sscanf(entry->d_name, "node%u%c", &id, &c) == 1) {
+			ok = as_thread_pool_append(&ids, &n_ids, id);
+		}
+	}
+	closedir(dir);
+	
+	if (ids) {
+		qsort(ids, n_ids, sizeof(uint32_t), as_thread_pool_cmp_u32);
+	}
+	
+	for (uint32_t i = 0; ok && i < n_ids; i++) {
+		char path[64];
+		char line[4096];
+		
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", ids[i]);
+		
+		FILE* f = fopen(path, "r");
+		
+		if (! f) {
+			continue;
+		}
+		
+		uint32_t* cpus = NULL;
+		uint32_t n_cpus = 0;
+		
+		if (fgets(line, sizeof(line), f)) {
+			ok = as_thread_pool_parse_cpulist(line, &cpus, &n_cpus);
+		}
+		fclose(f);
+		
+		if (ok && n_cpus != 0) {
+			ok = as_thread_pool_node_add(place, cpus, n_cpus);
+		}
+		
+		if (! ok || n_cpus == 0) {
+			cf_free(cpus);
+		}
+	}
+	cf_free(ids);
+	return ok;
+}
+
+#endif
+
+/**
+ *	Load the node topology, falling back to a single node of all online CPUs,
+ *	then work out the CPU order slots are placed in.
+ */
+static bool
+as_thread_pool_topology_load(as_thread_pool_place* place, const as_thread_pool_config* config)
+{
+#if defined(__linux__)
+	if (! as_thread_pool_topology_read(place)) {
+		return false;
+	}
+#endif
+	
+	if (place->n_nodes == 0) {
+		long n_online = sysconf(_SC_NPROCESSORS_ONLN);
+		uint32_t* cpus = NULL;
+		uint32_t n_cpus = 0;
+		
+		for (long i = 0; i < (n_online > 0 ? n_online : 1); i++) {
+			if (! as_thread_pool_append(&cpus, &n_cpus, (uint32_t)i)) {
+				cf_free(cpus);
+				return false;
+			}
+		}
+		
+		if (! as_thread_pool_node_add(place, cpus, n_cpus)) {
+			cf_free(cpus);
+			return false;
+		}
+	}
+	
+	// CPU to node map.
+	for (uint32_t n = 0; n < place->n_nodes; n++) {
+		for (uint32_t i = 0; i < place->nodes[n].n_cpus; i++) {
+			if (place->nodes[n].cpus[i] >= place->n_cpu_ids) {
+				place->n_cpu_ids = place->nodes[n].cpus[i] + 1;
+			}
+		}
+	}
+	
+	place->cpu_node = cf_malloc(place->n_cpu_ids * sizeof(int32_t));
+	
+	if (! place->cpu_node) {
+		return false;
+	}
+	
+	for (uint32_t i = 0; i < place->n_cpu_ids; i++) {
+		place->cpu_node[i] = -1;
+	}
+	
+	for (uint32_t n = 0; n < place->n_nodes; n++) {
+		for (uint32_t i = 0; i < place->nodes[n].n_cpus; i++) {
+			place->cpu_node[place->nodes[n].cpus[i]] = (int32_t)n;
+		}
+	}
+	
+	bool ok = true;
+	
+	switch (place->placement) {
+		case AS_THREAD_POOL_PLACE_CPUS:
+			for (uint32_t i = 0; ok && i < config->n_cpus; i++) {
+				ok = as_thread_pool_append(&place->order, &place->n_order, config->cpus[i]);
+			}
+			break;
+			
+		case AS_THREAD_POOL_PLACE_COMPACT:
+			// Node by node.
+			for (uint32_t n = 0; ok && n < place->n_nodes; n++) {
+				for (uint32_t i = 0; ok && i < place->nodes[n].n_cpus; i++) {
+					ok = as_thread_pool_append(&place->order, &place->n_order, place->nodes[n].cpus[i]);
+				}
+			}
+			break;
+			
+		case AS_THREAD_POOL_PLACE_SCATTER: {
+			// A CPU from each node in turn, until all nodes run out.
+			bool more = true;
+			
+			for (uint32_t i = 0; ok && more; i++) {
+				more = false;
+				
+				for (uint32_t n = 0; ok && n < place->n_nodes; n++) {
+					if (i < place->nodes[n].n_cpus) {
+						ok = as_thread_pool_append(&place->order, &place->n_order, place->nodes[n].cpus[i]);
+						more = true;
+					}
+				}
+			}
+			break;
+		}
+			
+		default:
+			break;
+	}
+	return ok;
+}
+
+static void
+as_thread_pool_place_destroy(as_thread_pool_place* place)
+{
+	for (uint32_t n = 0; n < place->n_nodes; n++) {
+		cf_free(place->nodes[n].cpus);
+		
+		if (place->nodes[n].queue) {
+			cf_queue_destroy(place->nodes[n].queue);
+		}
+	}
+	cf_free(place->nodes);
+	cf_free(place->cpu_node);
+	cf_free(place->order);
+	cf_free(place->slot_used);
+	cf_free(place->slot_stop);
+	pthread_mutex_destroy(&place->lock);
+	cf_free(place);
+}
+
+static as_thread_pool_place*
+as_thread_pool_place_create(const as_thread_pool_config* config)
+{
+	as_thread_pool_place* place = cf_malloc(sizeof(as_thread_pool_place));
+	
+	if (! place) {
+		return NULL;
+	}
+	memset(place, 0, sizeof(as_thread_pool_place));
+	pthread_mutex_init(&place->lock, NULL);
+	place->placement = config->placement;
+	place->stack_size = config->stack_size;
+	place->node_queues = config->node_queues;
+	
+	if (config->name_prefix) {
+		snprintf(place->name_prefix, sizeof(place->name_prefix), "%s", config->name_prefix);
+	}
+	
+	if (! as_thread_pool_topology_load(place, config)) {
+		as_thread_pool_place_destroy(place);
+		return NULL;
+	}
+	
+	if (place->node_queues) {
+		for (uint32_t n = 0; n < place->n_nodes; n++) {
+			place->nodes[n].queue = cf_queue_create(sizeof(as_thread_pool_task), true);
+			
+			if (! place->nodes[n].queue) {
+				as_thread_pool_place_destroy(place);
+				return NULL;
+			}
+		}
+	}
+	return place;
+}
+
+/**
+ *	The node a placement slot's thread runs on.
+ */
+static uint32_t
+as_thread_pool_slot_node(as_thread_pool_place* place, uint32_t slot)
+{
+	if (place->n_order) {
+		uint32_t cpu = place->order[slot % place->n_order];
+		
+		if (cpu < place->n_cpu_ids && place->cpu_node[cpu] >= 0) {
+			return (uint32_t)place->cpu_node[cpu];
+		}
+		return 0;
+	}
+	return slot % place->n_nodes;
+}
+
+/**
+ *	Take the lowest free placement slot. Returns false if out of memory.
+ */
+static bool
+as_thread_pool_slot_acquire(as_thread_pool_place* place, uint32_t* slot)
+{
+	pthread_mutex_lock(&place->lock);
+	
+	uint32_t i = 0;
+	
+	while (i < place->slot_capacity && place->slot_used[i]) {
+		i++;
+	}
+	
+	if (i == place->slot_capacity) {
+		uint32_t capacity = place->slot_capacity ? place->slot_capacity * 2 : 16;
+		bool* grown = cf_realloc(place->slot_used, capacity * sizeof(bool));
+		
+		if (! grown) {
+			pthread_mutex_unlock(&place->lock);
+			return false;
+		}
+		place->slot_used = grown;
+		
+		grown = cf_realloc(place->slot_stop, capacity * sizeof(bool));
+		
+		if (! grown) {
+			pthread_mutex_unlock(&place->lock);
+			return false;
+		}
+		place->slot_stop = grown;
+		
+		memset(place->slot_used + place->slot_capacity, 0, (capacity - place->slot_capacity) * sizeof(bool));
+		memset(place->slot_stop + place->slot_capacity, 0, (capacity - place->slot_capacity) * sizeof(bool));
+		place->slot_capacity = capacity;
+	}
+	
+	place->slot_used[i] = true;
+	pthread_mutex_unlock(&place->lock);
+	
+	if (place->node_queues) {
+		cf_atomic32_incr(&place->nodes[as_thread_pool_slot_node(place, i)].n_threads);
+	}
+	*slot = i;
+	return true;
+}
+
+static void
+as_thread_pool_slot_release(as_thread_pool_place* place, uint32_t slot)
+{
+	pthread_mutex_lock(&place->lock);
+	place->slot_used[slot] = false;
+	
+	if (place->slot_stop[slot]) {
+		place->slot_stop[slot] = false;
+		cf_atomic32_decr(&place->n_stopping);
+	}
+	pthread_mutex_unlock(&place->lock);
+}
+
+/**
+ *	Whether a shrink has told the thread in a placement slot to exit. Only
+ *	takes the lock while a shrink is under way.
+ */
+static bool
+as_thread_pool_slot_stopping(as_thread_pool_place* place, uint32_t slot)
+{
+	if (cf_atomic32_get(place->n_stopping) == 0) {
+		return false;
+	}
+	
+	pthread_mutex_lock(&place->lock);
+	bool stop = place->slot_stop[slot];
+	pthread_mutex_unlock(&place->lock);
+	return stop;
+}
+
+/**
+ *	Set stack size and CPU affinity for the thread in a placement slot.
+ */
+static bool
+as_thread_pool_slot_attrs(as_thread_pool_place* place, uint32_t slot, pthread_attr_t* attrs)
+{
+	if (place->stack_size && pthread_attr_setstacksize(attrs, place->stack_size) != 0) {
+		return false;
+	}
+	
+#if defined(__linux__)
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	
+	if (place->n_order) {
+		CPU_SET(place->order[slot % place->n_order], &cpus);
+	}
+	else if (place->placement == AS_THREAD_POOL_PLACE_NODE) {
+		as_thread_pool_node* node = &place->nodes[slot % place->n_nodes];
+		
+		for (uint32_t i = 0; i < node->n_cpus; i++) {
+			CPU_SET(node->cpus[i], &cpus);
+		}
+	}
+	else {
+		return true;
+	}
+	
+	if (pthread_attr_setaffinity_np(attrs, sizeof(cpu_set_t), &cpus) != 0) {
+		return false;
+	}
+#endif
+	return true;
+}
+
+/**
+ *	The node sub-pool a task queued from this thread goes to - the node it's
+ *	running on, unless that node's workers are all busy and another node has
+ *	one idle, or that node has no workers. Returns NULL if no node has any.
+ */
+static as_thread_pool_node*
+as_thread_pool_node_target(as_thread_pool* pool)
+{
+	as_thread_pool_place* place = pool->place;
+	uint32_t local = 0;
+	
+	if (as_current_pool == pool) {
+		local = as_current_node;
+	}
+#if defined(__linux__)
+	else {
+		int cpu = sched_getcpu();
+		
+		if (cpu >= 0 && (uint32_t)cpu < place->n_cpu_ids && place->cpu_node[cpu] >= 0) {
+			local = (uint32_t)place->cpu_node[cpu];
+		}
+	}
+#endif
+	
+	as_thread_pool_node* node = &place->nodes[local];
+	
+	if (cf_atomic32_get(node->n_idle) != 0) {
+		return node;
+	}
+	
+	as_thread_pool_node* any = cf_atomic32_get(node->n_threads) != 0 ? node : NULL;
+	
+	for (uint32_t i = 1; i < place->n_nodes; i++) {
+		as_thread_pool_node* other = &place->nodes[(local + i) % place->n_nodes];
+		
+		if (cf_atomic32_get(other->n_idle) != 0) {
+			return other;
+		}
+		
+		if (! any && cf_atomic32_get(other->n_threads) != 0) {
+			any = other;
+		}
+	}
+	return any;
+}
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+static void
+as_thread_pool_nudge_task(void* udata)
+{
+	// Only here to wake an idle worker, which then looks for work to steal.
+}
+
+/**
+ *	Wake one idle work-stealing worker, if there is one and nobody has been
+ *	woken already. Idle workers block on the dispatch queue, so a no-op task
+ *	does the waking.
+ */
+static void
+as_thread_pool_nudge(as_thread_pool* pool)
+{
+	struct as_thread_pool_ws* ws = pool->ws;
+	
+	if (cf_atomic32_get(ws->n_idle) != 0 && cf_atomic32_cas(&ws->nudge_pending, 0, 1) == 0) {
+		as_thread_pool_task task;
+		task.task_fn = as_thread_pool_nudge_task;
+		task.udata = NULL;
+		cf_queue_push(pool->dispatch_queue, &task);
+	}
+}
+
+static bool
+as_thread_pool_steal(as_thread_pool_worker* worker, as_thread_pool_task* task)
+{
+	struct as_thread_pool_ws* ws = worker->pool->ws;
+	// Count before array - a new slot is in the array before it's counted.
+	uint32_t n_slots = cf_atomic32_get(ws->n_slots);
+	as_thread_pool_slots* slots = ws->slots;
+	
+	// Start at a random victim so thieves spread out.
+	worker->seed ^= worker->seed << 13;
+	worker->seed ^= worker->seed >> 17;
+	worker->seed ^= worker->seed << 5;
+	
+	uint32_t start = worker->seed % n_slots;
+	
+	for (uint32_t i = 0; i < n_slots; i++) {
+		as_thread_pool_worker* victim = slots->workers[(start + i) % n_slots];
+		
+		if (victim != worker && as_thread_pool_deque_steal(&victim->deque, task)) {
+			// There may be more where that came from.
+			if (! as_thread_pool_deque_empty(&victim->deque)) {
+				as_thread_pool_nudge(worker->pool);
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool
+as_thread_pool_any_work(as_thread_pool* pool)
+{
+	struct as_thread_pool_ws* ws = pool->ws;
+	// Count before array - a new slot is in the array before it's counted.
+	uint32_t n_slots = cf_atomic32_get(ws->n_slots);
+	as_thread_pool_slots* slots = ws->slots;
+	
+	for (uint32_t i = 0; i < n_slots; i++) {
+		if (! as_thread_pool_deque_empty(&slots->workers[i]->deque)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ *	A queued task is starting - make room for another.
+ */
+static inline void
+as_thread_pool_taken(as_thread_pool* pool)
+{
+	// The locked decrement is a full barrier, pairing with the blocked count
+	// increment in as_thread_pool_admit_wait().
+	cf_atomic32_decr(&pool->depth);
+	
+	if (cf_atomic32_get(pool->n_blocked) != 0) {
+		pthread_mutex_lock(&pool->limit_lock);
+		pthread_cond_signal(&pool->limit_cond);
+		pthread_mutex_unlock(&pool->limit_lock);
+	}
+}
+
+/**
+ *	Whether this worker should exit. It just popped a shutdown task from q,
+ *	or with task NULL, it just ran a task. Any worker exits on a shutdown task
+ *	- except one a shrink of a pool created from a config queued, with udata
+ *	set. The threads to stop there are the ones in the slots the shrink
+ *	marked, and its shutdown tasks only wake workers to look - one popped by a
+ *	worker not marked is handed on.
+ */
+static bool
+as_thread_pool_should_stop(as_thread_pool* pool, cf_queue* q, as_thread_pool_task* task)
+{
+	as_thread_pool_place* place = pool->place;
+	
+	if (task && ! task->udata) {
+		return true;
+	}
+	
+	if (! place) {
+		return false;
+	}
+	
+	if (as_thread_pool_slot_stopping(place, as_current_slot)) {
+		return true;
+	}
+	
+	if (task && cf_atomic32_get(place->n_stopping) != 0) {
+		// A marked worker is busy, or asleep and beaten to this - wake the
+		// next, and back off meanwhile so as not to keep taking it back.
+		cf_queue_push(q, task);
+		usleep(1000);
+	}
+	return false;
+}
+
+static void
+as_thread_pool_run_shared(as_thread_pool* pool)
+{
+	as_thread_pool_task task;
+	
+	as_current_pool = pool;
+	
+	// Retrieve tasks from queue and execute.
+	while (cf_queue_pop(pool->dispatch_queue, &task, CF_QUEUE_FOREVER) == CF_QUEUE_OK) {
+		// A null task indicates thread should be shut down.
+		if (! task.task_fn) {
+			if (as_thread_pool_should_stop(pool, pool->dispatch_queue, &task)) {
+				break;
+			}
+			continue;
+		}
+		
+		// Run task
+		as_thread_pool_taken(pool);
+		task.task_fn(task.udata);
+		
+		if (as_thread_pool_should_stop(pool, pool->dispatch_queue, NULL)) {
+			break;
+		}
+	}
+	
+	as_current_pool = NULL;
+}
+
+/**
+ *	Take a task from another node's sub-pool. Shutdown tasks are left for
+ *	that node's workers.
+ */
+static bool
+as_thread_pool_node_steal(as_thread_pool_place* place, uint32_t ni, as_thread_pool_task* task)
+{
+	for (uint32_t i = 1; i < place->n_nodes; i++) {
+		cf_queue* q = place->nodes[(ni + i) % place->n_nodes].queue;
+		
+		if (cf_queue_pop(q, task, CF_QUEUE_NOWAIT) == CF_QUEUE_OK) {
+			if (task->task_fn) {
+				return true;
+			}
+			cf_queue_push_head(q, task);
+		}
+	}
+	return false;
+}
+
+static void
+as_thread_pool_run_node(as_thread_pool* pool, uint32_t ni)
+{
+	as_thread_pool_place* place = pool->place;
+	as_thread_pool_node* node = &place->nodes[ni];
+	as_thread_pool_task task;
+	
+	as_current_pool = pool;
+	as_current_node = ni;
+	
+	while (true) {
+		// Own node's tasks first, then other nodes' rather than go idle.
+		if (cf_queue_pop(node->queue, &task, CF_QUEUE_NOWAIT) != CF_QUEUE_OK &&
+			! as_thread_pool_node_steal(place, ni, &task)) {
+			
+			// Queuers see us idle and send work here before busy nodes.
+			cf_atomic32_incr(&node->n_idle);
+			int rv = cf_queue_pop(node->queue, &task, CF_QUEUE_FOREVER);
+			cf_atomic32_decr(&node->n_idle);
+			
+			if (rv != CF_QUEUE_OK) {
+				continue;
+			}
+		}
+		
+		// A null task indicates thread should be shut down.
+		if (! task.task_fn) {
+			if (as_thread_pool_should_stop(pool, node->queue, &task)) {
+				break;
+			}
+			continue;
+		}
+		
+		as_thread_pool_taken(pool);
+		task.task_fn(task.udata);
+		
+		if (as_thread_pool_should_stop(pool, node->queue, NULL)) {
+			break;
+		}
+	}
+	
+	as_current_pool = NULL;
+	
+	// The node's last worker hands anything queued since to the other nodes.
+	if (cf_atomic32_decr(&node->n_threads) == 0) {
+		while (cf_queue_pop(node->queue, &task, CF_QUEUE_NOWAIT) == CF_QUEUE_OK) {
+			as_thread_pool_node* target = as_thread_pool_node_target(pool);
+			
+			if (! target) {
+				// Nobody left - as with a shared queue, the task stays queued.
+				cf_queue_push_head(node->queue, &task);
+				break;
+			}
+			cf_queue_push(target->queue, &task);
+		}
+	}
+}
+
+static void
+as_thread_pool_complete(as_thread_pool* pool)
+{
+	// Send thread completion event back to caller.
+	uint32_t complete = 1;
+	cf_queue_push(pool->complete_queue, &complete);
+}
+
+void*
+as_thread_worker(void* data)
+{
+	as_thread_pool* pool = data;
+	
+	as_thread_pool_run_shared(pool);
+	as_thread_pool_complete(pool);
+	return 0;
+}
+
+static void
+as_thread_pool_run_ws(as_thread_pool_worker* worker)
+{
+	as_thread_pool* pool = worker->pool;
+	struct as_thread_pool_ws* ws = pool->ws;
+	as_thread_pool_task task;
+	
+	as_current_worker = worker;
+	as_current_pool = pool;
+	
+	while (true) {
+		// Own tasks newest first, then the shared queue, then other workers'
+		// tasks oldest first.
+		if (! as_thread_pool_deque_take(&worker->deque, &task) &&
+			cf_queue_pop(pool->dispatch_queue, &task, CF_QUEUE_NOWAIT) != CF_QUEUE_OK &&
+			! as_thread_pool_steal(worker, &task)) {
+			
+			// Nothing anywhere - go idle on the shared queue. The locked
+			// increment is a full barrier, pairing with the one in
+			// as_thread_pool_queue_task(), so work pushed to a deque after the
+			// check below always sees us idle and nudges.
+			cf_atomic32_incr(&ws->n_idle);
+			
+			if (as_thread_pool_any_work(pool)) {
+				cf_atomic32_decr(&ws->n_idle);
+				continue;
+			}
+			
+			int rv = cf_queue_pop(pool->dispatch_queue, &task, CF_QUEUE_FOREVER);
+			cf_atomic32_decr(&ws->n_idle);
+			
+			if (rv != CF_QUEUE_OK) {
+				continue;
+			}
+		}
+		
+		if (task.task_fn == as_thread_pool_nudge_task) {
+			cf_atomic32_set(&ws->nudge_pending, 0);
+			continue;
+		}
+		
+		// A null task indicates thread should be shut down.
+		if (! task.task_fn) {
+			if (as_thread_pool_should_stop(pool, pool->dispatch_queue, &task)) {
+				break;
+			}
+			continue;
+		}
+		
+		as_thread_pool_taken(pool);
+		task.task_fn(task.udata);
+		
+		if (as_thread_pool_should_stop(pool, pool->dispatch_queue, NULL)) {
+			break;
+		}
+	}
+	
+	// Run whatever is left on our deque (and anything it spawns) before going.
+	while (as_thread_pool_deque_take(&worker->deque, &task)) {
+		as_thread_pool_taken(pool);
+		task.task_fn(task.udata);
+	}
+	
+	as_current_worker = NULL;
+	as_current_pool = NULL;
+	worker->active = false;
+}
+
+static void*
+as_thread_ws_worker(void* data)
+{
+	as_thread_pool_worker* worker = data;
+	as_thread_pool* pool = worker->pool;
+	
+	as_thread_pool_run_ws(worker);
+	as_thread_pool_complete(pool);
+	return 0;
+}
+
+/**
+ *	Thread of a pool created from a config.
+ */
+static void*
+as_thread_placed_worker(void* data)
+{
+	as_thread_pool_start start = *(as_thread_pool_start*)data;
+	as_thread_pool_place* place = start.pool->place;
+	
+	cf_free(data);
+	as_current_slot = start.slot;
+	
+#if defined(__linux__)
+	if (place->name_prefix[0]) {
+		// Names are limited to 15 characters - shorten the prefix, not the
+		// slot number.
+		char suffix[12];
+		char name[16];
+		size_t suffix_len = (size_t)snprintf(suffix, sizeof(suffix), "-%u", start.slot);
+		size_t len = strlen(place->name_prefix);
+		
+		if (len > sizeof(name) - 1 - suffix_len) {
+			len = sizeof(name) - 1 - suffix_len;
+		}
+		memcpy(name, place->name_prefix, len);
+		memcpy(name + len, suffix, suffix_len + 1);
+		pthread_setname_np(pthread_self(), name);
+	}
+#endif
+	
+	if (start.worker) {
+		as_thread_pool_run_ws(start.worker);
+	}
+	else if (place->node_queues) {
+		as_thread_pool_run_node(start.pool, as_thread_pool_slot_node(place, start.slot));
+	}
+	else {
+		as_thread_pool_run_shared(start.pool);
+	}
+	
+	// Slot before completion, so a thread started next can have it.
+	as_thread_pool_slot_release(place, start.slot);
+	as_thread_pool_complete(start.pool);
+	return 0;
+}
+
+/**
+ *	Call with pool lock held. Finds a free worker slot, adding one if needed.
+ */
+static as_thread_pool_worker*
+as_thread_pool_worker_acquire(as_thread_pool* pool)
+{
+	struct as_thread_pool_ws* ws = pool->ws;
+	as_thread_pool_slots* slots = ws->slots;
+	uint32_t n_slots = ws->n_slots;
+	
+	for (uint32_t i = 0; i < n_slots; i++) {
+		if (! slots->workers[i]->active) {
+			slots->workers[i]->active = true;
+			return slots->workers[i];
+		}
+	}
+	
+	if (n_slots == slots->capacity) {
+		as_thread_pool_slots* grown = cf_malloc(sizeof(as_thread_pool_slots) + (slots->capacity * 2 * sizeof(as_thread_pool_worker*)));
+		
+		if (! grown) {
+			return NULL;
+		}
+		grown->retired = slots;
+		grown->capacity = slots->capacity * 2;
+		memcpy(grown->workers, slots->workers, n_slots * sizeof(as_thread_pool_worker*));
+		
+		CF_MEMORY_BARRIER_WRITE();
+		ws->slots = grown;
+		slots = grown;
+	}
+	
+	as_thread_pool_worker* worker = cf_malloc(sizeof(as_thread_pool_worker));
+	
+	if (! worker) {
+		return NULL;
+	}
+	
+	if (! as_thread_pool_deque_init(&worker->deque)) {
+		cf_free(worker);
+		return NULL;
+	}
+	worker->pool = pool;
+	worker->seed = n_slots * 2654435761u + 1;
+	worker->active = true;
+	
+	// Slot before the count that makes it visible to thieves.
+	slots->workers[n_slots] = worker;
+	CF_MEMORY_BARRIER_WRITE();
+	ws->n_slots = n_slots + 1;
+	return worker;
+}
+
+static struct as_thread_pool_ws*
+as_thread_pool_ws_create()
+{
+	struct as_thread_pool_ws* ws = cf_malloc(sizeof(struct as_thread_pool_ws));
+	
+	if (! ws) {
+		return NULL;
+	}
+	
+	uint32_t capacity = 16;
+	
+	ws->slots = cf_malloc(sizeof(as_thread_pool_slots) + (capacity * sizeof(as_thread_pool_worker*)));
+	
+	if (! ws->slots) {
+		cf_free(ws);
+		return NULL;
+	}
+	ws->slots->retired = NULL;
+	ws->slots->capacity = capacity;
+	ws->n_slots = 0;
+	ws->n_idle = 0;
+	ws->nudge_pending = 0;
+	return ws;
+}
+
+static void
+as_thread_pool_ws_destroy(struct as_thread_pool_ws* ws)
+{
+	as_thread_pool_slots* slots = ws->slots;
+	
+	for (uint32_t i = 0; i < ws->n_slots; i++) {
+		as_thread_pool_deque_destroy(&slots->workers[i]->deque);
+		cf_free(slots->workers[i]);
+	}
+	
+	while (slots) {
+		as_thread_pool_slots* retired = slots->retired;
+		cf_free(slots);
+		slots = retired;
+	}
+	cf_free(ws);
+}
+
+/**
+ *	Start a thread of a pool created from a config, in the lowest free
+ *	placement slot.
+ */
+static bool
+as_thread_pool_create_placed(as_thread_pool* pool)
+{
+	as_thread_pool_place* place = pool->place;
+	as_thread_pool_start* start = cf_malloc(sizeof(as_thread_pool_start));
+	
+	if (! start) {
+		return false;
+	}
+	start->pool = pool;
+	start->worker = NULL;
+	
+	if (pool->ws && ! (start->worker = as_thread_pool_worker_acquire(pool))) {
+		cf_free(start);
+		return false;
+	}
+	
+	if (! as_thread_pool_slot_acquire(place, &start->slot)) {
+		if (start->worker) {
+			start->worker->active = false;
+		}
+		cf_free(start);
+		return false;
+	}
+	
+	// Attributes vary by slot, so each thread gets its own.
+	pthread_attr_t attrs;
+	pthread_attr_init(&attrs);
+	pthread_attr_setdetachstate(&attrs, PTHREAD_CREATE_DETACHED);
+	
+	pthread_t thread;
+	bool ok = as_thread_pool_slot_attrs(place, start->slot, &attrs) &&
+		pthread_create(&thread, &attrs, as_thread_placed_worker, start) == 0;
+	
+	pthread_attr_destroy(&attrs);
+	
+	if (! ok) {
+		if (place->node_queues) {
+			cf_atomic32_decr(&place->nodes[as_thread_pool_slot_node(place, start->slot)].n_threads);
+		}
+		as_thread_pool_slot_release(place, start->slot);
+		
+		if (start->worker) {
+			start->worker->active = false;
+		}
+		cf_free(start);
+	}
+	return ok;
+}
+
+static uint32_t
+as_thread_pool_create_threads(as_thread_pool* pool, uint32_t count)
+{
+	// Start detached threads.  There is no need to store thread because a completion queue
+	// is used to join back threads on termination.
+	pthread_attr_t attrs;
+	pthread_attr_init(&attrs);
+	pthread_attr_setdetachstate(&attrs, PTHREAD_CREATE_DETACHED);
+	
+	int threads_created = 0;
+	pthread_t thread;
+	
+	for (uint32_t i = 0; i < count; i++) {
+		if (pool->place) {
+			if (as_thread_pool_create_placed(pool)) {
+				threads_created++;
+			}
+		}
+		else if (pool->ws) {
+			as_thread_pool_worker* worker = as_thread_pool_worker_acquire(pool);
+			
+			if (! worker) {
+				continue;
+			}
+			
+			if (pthread_create(&thread, &attrs, as_thread_ws_worker, worker) == 0) {
+				threads_created++;
+			}
+			else {
+				worker->active = false;
+			}
+		}
+		else if (pthread_create(&thread, &attrs, as_thread_worker, pool) == 0) {
+			threads_created++;
+		}
+	}
+	return threads_created;
+}
+
+static void
+as_thread_pool_shutdown_threads(as_thread_pool* pool, uint32_t count)
+{
+	// This tells the worker threads to stop. We do this (instead of using a
+	// "running" flag) to allow the workers to "wait forever" on processing the
+	// work dispatch queue, which has minimum impact when the queue is empty.
+	// This also means all queued requests get processed when shutting down.
+	as_thread_pool_task task;
+	task.task_fn = NULL;
+	task.udata = NULL;
+	
+	if (pool->place) {
+		// Stop the threads in the highest slots in use - on a shrink, mark
+		// them and wake a worker for each, on its node for sub-pools. No
+		// thread starts or stops meanwhile but these, so slots are stable.
+		as_thread_pool_place* place = pool->place;
+		bool shrink = count < pool->thread_size;
+		uint32_t n = 0;
+		
+		if (shrink) {
+			task.udata = place;
+		}
+		
+		pthread_mutex_lock(&place->lock);
+		
+		for (uint32_t slot = place->slot_capacity; slot > 0 && n < count; slot--) {
+			if (place->slot_used[slot - 1] && ! place->slot_stop[slot - 1]) {
+				if (shrink) {
+					place->slot_stop[slot - 1] = true;
+					cf_atomic32_incr(&place->n_stopping);
+				}
+				
+				cf_queue* q = place->node_queues ?
+					place->nodes[as_thread_pool_slot_node(place, slot - 1)].queue : pool->dispatch_queue;
+				
+				cf_queue_push(q, &task);
+				n++;
+			}
+		}
+		pthread_mutex_unlock(&place->lock);
+	}
+	else {
+		for (uint32_t i = 0; i < count; i++) {
+			cf_queue_push(pool->dispatch_queue, &task);
+		}
+	}
+	
+	// Wait till threads finish.
+	uint32_t complete;
+	for (uint32_t i = 0; i < count; i++) {
+		cf_queue_pop(pool->complete_queue, &complete, CF_QUEUE_FOREVER);
+	}
+}
+
+static void
+as_thread_pool_drain_queue(as_thread_pool* pool, cf_queue* q)
+{
+	as_thread_pool_task task;
+	
+	while (cf_queue_pop(q, &task, CF_QUEUE_NOWAIT) == CF_QUEUE_OK) {
+		// Shutdown and nudge tasks never took room.
+		if (task.task_fn && task.task_fn != as_thread_pool_nudge_task) {
+			as_thread_pool_taken(pool);
+			task.task_fn(task.udata);
+		}
+	}
+}
+
+/**
+ *	Run whatever is still queued once every worker has gone - tasks, such as
+ *	future continuations, that workers queued behind the shutdown tasks on
+ *	their way out. Anything these queue in turn is refused, and continuations
+ *	run in place.
+ */
+static void
+as_thread_pool_drain(as_thread_pool* pool)
+{
+	if (pool->place && pool->place->node_queues) {
+		for (uint32_t n = 0; n < pool->place->n_nodes; n++) {
+			as_thread_pool_drain_queue(pool, pool->place->nodes[n].queue);
+		}
+	}
+	as_thread_pool_drain_queue(pool, pool->dispatch_queue);
+}
+
+static void
+as_thread_pool_counters_destroy(as_thread_pool* pool)
+{
+	cf_counter** counters[] = { &pool->n_admitted, &pool->n_rejected, &pool->n_caller_ran };
+	
+	for (uint32_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+		if (*counters[i]) {
+			cf_counter_destroy(*counters[i]);
+			*counters[i] = NULL;
+		}
+	}
+}
+
+int
+as_thread_pool_init(as_thread_pool* pool, uint32_t thread_size)
+{
+	return as_thread_pool_init_mode(pool, thread_size, AS_THREAD_POOL_SHARED_QUEUE);
+}
+
+int
+as_thread_pool_init_mode(as_thread_pool* pool, uint32_t thread_size, as_thread_pool_mode mode)
+{
+	as_thread_pool_config config;
+	as_thread_pool_config_init(&config);
+	config.thread_size = thread_size;
+	config.mode = mode;
+	return as_thread_pool_init_config(pool, &config);
+}
+
+void
+as_thread_pool_config_init(as_thread_pool_config* config)
+{
+	config->thread_size = 0;
+	config->mode = AS_THREAD_POOL_SHARED_QUEUE;
+	config->placement = AS_THREAD_POOL_PLACE_ANY;
+	config->cpus = NULL;
+	config->n_cpus = 0;
+	config->stack_size = 0;
+	config->name_prefix = NULL;
+	config->node_queues = false;
+	config->queue_limit = 0;
+	config->overflow = AS_THREAD_POOL_BLOCK;
+}
+
+int
+as_thread_pool_init_config(as_thread_pool* pool, const as_thread_pool_config* config)
+{
+	if ((config->placement == AS_THREAD_POOL_PLACE_CPUS && (! config->cpus || config->n_cpus == 0)) ||
+		(config->node_queues && (config->mode != AS_THREAD_POOL_SHARED_QUEUE || config->placement == AS_THREAD_POOL_PLACE_ANY)) ||
+		(config->stack_size != 0 && config->stack_size < PTHREAD_STACK_MIN)) {
+		return -4;
+	}
+	
+	uint32_t thread_size = config->thread_size;
+	
+	if (pthread_mutex_init(&pool->lock, NULL)) {
+		return -1;
+	}
+
+    if (pthread_mutex_lock(&pool->lock)) {
+        return -2;
+    }
+
+	// Initialize queues.
+	pool->dispatch_queue = cf_queue_create(sizeof(as_thread_pool_task), true);
+	pool->complete_queue = cf_queue_create(sizeof(uint32_t), true);
+	pool->ws = NULL;
+	pool->place = NULL;
+	pool->timers = NULL;
+	pool->thread_size = thread_size;
+	pool->initialized = 1;
+	pool->depth = 0;
+	pool->queue_limit = config->queue_limit;
+	pool->overflow = config->overflow;
+	pool->n_blocked = 0;
+	pool->closing = false;
+	pthread_mutex_init(&pool->limit_lock, NULL);
+	pthread_cond_init(&pool->limit_cond, NULL);
+	memset(&pool->closed_stats, 0, sizeof(as_thread_pool_stats));
+	
+	// Every queuer bumps these, so each is sharded rather than one line all
+	// of them write.
+	pool->n_admitted = cf_counter_create(0);
+	pool->n_rejected = cf_counter_create(0);
+	pool->n_caller_ran = cf_counter_create(0);
+	
+	if (! pool->n_admitted || ! pool->n_rejected || ! pool->n_caller_ran) {
+		as_thread_pool_counters_destroy(pool);
+		pool->thread_size = 0;
+		pthread_mutex_unlock(&pool->lock);
+		return -3;
+	}
+	
+	// Placement is only needed if asked for.
+	if (config->placement != AS_THREAD_POOL_PLACE_ANY || config->stack_size || config->name_prefix) {
+		pool->place = as_thread_pool_place_create(config);
+		
+		if (! pool->place) {
+			as_thread_pool_counters_destroy(pool);
+			pool->thread_size = 0;
+			pthread_mutex_unlock(&pool->lock);
+			return -3;
+		}
+	}
+	
+	if (config->mode == AS_THREAD_POOL_WORK_STEALING) {
+		pool->ws = as_thread_pool_ws_create();
+		
+		if (! pool->ws) {
+			as_thread_pool_counters_destroy(pool);
+			pool->thread_size = 0;
+			pthread_mutex_unlock(&pool->lock);
+			return -3;
+		}
+	}
+	
+	// Start detached threads.
+	pool->thread_size = as_thread_pool_create_threads(pool, thread_size);
+	int rc = (pool->thread_size == thread_size)? 0 : -3;
+	
+	pthread_mutex_unlock(&pool->lock);
+	return rc;
+}
+
+int
+as_thread_pool_resize(as_thread_pool* pool, uint32_t thread_size)
+{
+    if (pthread_mutex_lock(&pool->lock)) {
+        return -1;
+    }
+
+	if (! pool->initialized) {
+		// Pool has already been closed.
+		pthread_mutex_unlock(&pool->lock);
+		return -2;
+	}
+	
+	int rc = 0;
+	
+	if (thread_size != pool->thread_size) {
+		if (thread_size < pool->thread_size) {
+			// Shutdown excess threads.
+			as_thread_pool_shutdown_threads(pool, pool->thread_size - thread_size);
+			pool->thread_size = thread_size;
+		}
+		else {
+			// Start new threads.
+			pool->thread_size += as_thread_pool_create_threads(pool, thread_size - pool->thread_size);
+			rc = (pool->thread_size == thread_size)? 0 : -3;
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return rc;
+}
+
+/**
+ *	Wait for room below a bounded pool's limit, and take it.
+ *
+ *	Returns:
+ *	0  : Room taken
+ *	-1 : Pool is being destroyed
+ */
+static int
+as_thread_pool_admit_wait(as_thread_pool* pool)
+{
+	int rc = 0;
+	
+	pthread_mutex_lock(&pool->limit_lock);
+	
+	// The locked increment is a full barrier, pairing with the depth
+	// decrement in as_thread_pool_taken() - either it sees us blocked, or we
+	// see the room it made.
+	cf_atomic32_incr(&pool->n_blocked);
+	
+	while (true) {
+		if (pool->closing) {
+			rc = -1;
+			break;
+		}
+		
+		int32_t depth = cf_atomic32_get(pool->depth);
+		
+		if ((uint32_t)depth < pool->queue_limit) {
+			if (cf_atomic32_cas(&pool->depth, depth, depth + 1) == depth) {
+				break;
+			}
+			continue;
+		}
+		pthread_cond_wait(&pool->limit_cond, &pool->limit_lock);
+	}
+	
+	cf_atomic32_decr(&pool->n_blocked);
+	
+	if (pool->closing) {
+		// Let as_thread_pool_destroy() know we're out.
+		pthread_cond_broadcast(&pool->limit_cond);
+	}
+	pthread_mutex_unlock(&pool->limit_lock);
+	return rc;
+}
+
+/**
+ *	Take room for a task below the pool's limit, if it has one.
+ *
+ *	Returns:
+ *	0  : Room taken - queue the task
+ *	1  : No room - caller runs the task
+ *	-1 : Pool is being destroyed
+ *	-3 : No room - reject the task
+ */
+static int
+as_thread_pool_admit(as_thread_pool* pool)
+{
+	if (pool->queue_limit == 0) {
+		cf_atomic32_incr(&pool->depth);
+		return 0;
+	}
+	
+	// Only ever take room that's there, so a blocked queuer can't miss it.
+	while (true) {
+		int32_t depth = cf_atomic32_get(pool->depth);
+		
+		if ((uint32_t)depth >= pool->queue_limit) {
+			break;
+		}
+		
+		if (cf_atomic32_cas(&pool->depth, depth, depth + 1) == depth) {
+			return 0;
+		}
+	}
+	
+	// Timer fires go over the limit rather than wait, be refused or run on
+	// the timer thread, where one slow task would hold up every other timer.
+	// There are never more than there are timers due.
+	if (as_in_timer) {
+		cf_atomic32_incr(&pool->depth);
+		return 0;
+	}
+	
+	switch (pool->overflow) {
+		case AS_THREAD_POOL_BLOCK:
+			if (as_current_pool != pool) {
+				return as_thread_pool_admit_wait(pool);
+			}
+			// The pool's own threads can't wait on themselves.
+			break;
+			
+		case AS_THREAD_POOL_REJECT:
+			cf_counter_add(pool->n_rejected, 1);
+			return -3;
+			
+		default:
+			break;
+	}
+	
+	cf_counter_add(pool->n_rejected, 1);
+	cf_counter_add(pool->n_caller_ran, 1);
+	return 1;
+}
+
+static int
+as_thread_pool_dispatch(as_thread_pool* pool, as_thread_pool_task* task)
+{
+	// A worker of this pool queues onto its own deque.
+	as_thread_pool_worker* worker = as_current_worker;
+	
+	if (pool->ws && worker && worker->pool == pool) {
+		if (as_thread_pool_deque_push(&worker->deque, task)) {
+			// The push is a full barrier, pairing with the idle count
+			// increment in as_thread_pool_run_ws().
+			as_thread_pool_nudge(pool);
+			return 0;
+		}
+		// Deque couldn't grow - the shared queue will do.
+	}
+	
+	if (pool->place && pool->place->node_queues) {
+		as_thread_pool_node* node = as_thread_pool_node_target(pool);
+		
+		if (! node) {
+			return -1;
+		}
+		
+		if (cf_queue_push(node->queue, task) != CF_QUEUE_OK) {
+			return -2;
+		}
+		return 0;
+	}
+	
+	if (cf_queue_push(pool->dispatch_queue, task) != CF_QUEUE_OK) {
+		return -2;
+	}
+	return 0;
+}
+
+int
+as_thread_pool_queue_task(as_thread_pool* pool, as_task_fn task_fn, void* udata)
+{
+	if (pool->thread_size == 0) {
+		// No threads are running to process task.
+		return -1;
+	}
+	
+	// Once destroy starts only the pool's own threads may queue - what they
+	// queue is run by a worker, or by as_thread_pool_drain() after the last
+	// one goes. Anyone else must not race destroy, so a plain read will do.
+	if (pool->closing && as_current_pool != pool) {
+		return -1;
+	}
+	
+	int rc = as_thread_pool_admit(pool);
+	
+	if (rc == 1) {
+		task_fn(udata);
+		return 0;
+	}
+	
+	if (rc != 0) {
+		return rc;
+	}
+	
+	as_thread_pool_task task;
+	task.task_fn = task_fn;
+	task.udata = udata;
+	
+	rc = as_thread_pool_dispatch(pool, &task);
+	
+	if (rc != 0) {
+		// Give back the room.
+		as_thread_pool_taken(pool);
+		return rc;
+	}
+	
+	cf_counter_add(pool->n_admitted, 1);
+	return 0;
+}
+
+void
+as_thread_pool_get_stats(as_thread_pool* pool, as_thread_pool_stats* stats)
+{
+	if (! pool->n_admitted) {
+		// Destroyed.
+		*stats = pool->closed_stats;
+		return;
+	}
+	
+	stats->depth = (uint32_t)cf_atomic32_get(pool->depth);
+	stats->admitted = (uint64_t)cf_counter_read(pool->n_admitted);
+	stats->rejected = (uint64_t)cf_counter_read(pool->n_rejected);
+	stats->caller_ran = (uint64_t)cf_counter_read(pool->n_caller_ran);
+}
+
+/******************************************************************************
+ * Timer Functions
+ *****************************************************************************/
+
+static inline uint64_t
+as_timer_now_tick()
+{
+	return cf_getus() / AS_TIMER_TICK_US;
+}
+
+/**
+ *	Call with timers lock held.
+ */
+static void
+as_timer_link(struct as_thread_pool_timers* t, as_thread_pool_timer_entry* e)
+{
+	uint64_t due = e->due < t->tick ? t->tick : e->due;
+	uint64_t delta = due - t->tick;
+	uint32_t level = 0;
+	
+	while (level < AS_TIMER_LEVELS - 1 && delta >= (1ULL << (AS_TIMER_BITS * (level + 1)))) {
+		level++;
+	}
+	
+	if (delta >= (1ULL << (AS_TIMER_BITS * AS_TIMER_LEVELS))) {
+		// Beyond the wheel - park in the furthest bucket, it's relinked from
+		// there.
+		due = t->tick + (1ULL << (AS_TIMER_BITS * AS_TIMER_LEVELS)) - 1;
+	}
+	
+	uint32_t slot = (uint32_t)(due >> (AS_TIMER_BITS * level)) & (AS_TIMER_SLOTS - 1);
+	int32_t bucket = (int32_t)(level * AS_TIMER_SLOTS + slot);
+	
+	e->bucket = bucket;
+	e->prev = NULL;
+	e->next = t->buckets[bucket];
+	
+	if (e->next) {
+		e->next->prev = e;
+	}
+	t->buckets[bucket] = e;
+	t->occupied[level] |= 1ULL << slot;
+}
+
+/**
+ *	Call with timers lock held.
+ */
+static void
+as_timer_unlink(struct as_thread_pool_timers* t, as_thread_pool_timer_entry* e)
+{
+	if (e->prev) {
+		e->prev->next = e->next;
+	}
+	else {
+		t->buckets[e->bucket] = e->next;
+		
+		if (! e->next) {
+			t->occupied[e->bucket / AS_TIMER_SLOTS] &= ~(1ULL << (e->bucket % AS_TIMER_SLOTS));
+		}
+	}
+	
+	if (e->next) {
+		e->next->prev = e->prev;
+	}
+	e->bucket = -1;
+}
+
+/**
+ *	Call with timers lock held.
+ */
+static as_thread_pool_timer_entry*
+as_timer_alloc(struct as_thread_pool_timers* t)
+{
+	if (! t->free_list) {
+		as_thread_pool_timer_entry** chunks = cf_realloc(t->chunks, (t->n_chunks + 1) * sizeof(as_thread_pool_timer_entry*));
+		
+		if (! chunks) {
+			return NULL;
+		}
+		t->chunks = chunks;
+		
+		as_thread_pool_timer_entry* chunk = cf_malloc(AS_TIMER_CHUNK * sizeof(as_thread_pool_timer_entry));
+		
+		if (! chunk) {
+			return NULL;
+		}
+		
+		for (uint32_t i = AS_TIMER_CHUNK; i > 0; i--) {
+			as_thread_pool_timer_entry* e = &chunk[i - 1];
+			e->index = (t->n_chunks * AS_TIMER_CHUNK) + i - 1;
+			e->generation = 0;
+			e->bucket = -1;
+			e->next = t->free_list;
+			t->free_list = e;
+		}
+		t->chunks[t->n_chunks++] = chunk;
+	}
+	
+	as_thread_pool_timer_entry* e = t->free_list;
+	t->free_list = e->next;
+	return e;
+}
+
+/**
+ *	Call with timers lock held.
+ */
+static void
+as_timer_free(struct as_thread_pool_timers* t, as_thread_pool_timer_entry* e)
+{
+	e->generation++;
+	e->next = t->free_list;
+	t->free_list = e;
+}
+
+/**
+ *	Call with timers lock held. Processes one tick - relinks the buckets the
+ *	wheel turns past, then fires the tick's level 0 bucket.
+ */
+static void
+as_timer_step(struct as_thread_pool_timers* t)
+{
+	uint64_t tick = t->tick;
+	
+	for (uint32_t level = 1; level < AS_TIMER_LEVELS; level++) {
+		if (((tick >> (AS_TIMER_BITS * (level - 1))) & (AS_TIMER_SLOTS - 1)) != 0) {
+			break;
+		}
+		
+		int32_t bucket = (int32_t)(level * AS_TIMER_SLOTS + ((tick >> (AS_TIMER_BITS * level)) & (AS_TIMER_SLOTS - 1)));
+		as_thread_pool_timer_entry* e = t->buckets[bucket];
+		
+		t->buckets[bucket] = NULL;
+		t->occupied[level] &= ~(1ULL << (bucket % AS_TIMER_SLOTS));
+		
+		while (e) {
+			as_thread_pool_timer_entry* next = e->next;
+			as_timer_link(t, e);
+			e = next;
+		}
+	}
+	
+	int32_t bucket = (int32_t)(tick & (AS_TIMER_SLOTS - 1));
+	
+	while (t->buckets[bucket]) {
+		as_thread_pool_timer_entry* e = t->buckets[bucket];
+		as_timer_unlink(t, e);
+		
+		if (e->due > tick) {
+			// Was beyond the wheel - not yet.
+			as_timer_link(t, e);
+			continue;
+		}
+		
+		if (t->n_fired == t->fired_capacity) {
+			uint32_t capacity = t->fired_capacity ? t->fired_capacity * 2 : 64;
+			as_thread_pool_task* fired = cf_realloc(t->fired, capacity * sizeof(as_thread_pool_task));
+			
+			if (! fired) {
+				// Try again next time round.
+				as_timer_link(t, e);
+				break;
+			}
+			t->fired = fired;
+			t->fired_capacity = capacity;
+		}
+		
+		t->fired[t->n_fired].task_fn = e->task_fn;
+		t->fired[t->n_fired].udata = e->udata;
+		t->n_fired++;
+		
+		if (e->period) {
+			// Fixed schedule - if we're late, skip the missed firings rather
+			// than burst.
+			e->due += e->period;
+			
+			if (e->due <= tick) {
+				e->due += ((tick - e->due) / e->period + 1) * e->period;
+			}
+			as_timer_link(t, e);
+		}
+		else {
+			as_timer_free(t, e);
+			t->n_pending--;
+		}
+	}
+	t->tick++;
+}
+
+/**
+ *	Call with timers lock held. Processes ticks up to now.
+ */
+static void
+as_timer_advance(struct as_thread_pool_timers* t, uint64_t now)
+{
+	while (t->tick <= now) {
+		if (t->n_pending == 0) {
+			t->tick = now + 1;
+			break;
+		}
+		
+		if (t->occupied[0] == 0 && (t->tick & (AS_TIMER_SLOTS - 1)) != 0) {
+			// Nothing to fire until the wheel turns.
+			uint64_t turn = (t->tick | (AS_TIMER_SLOTS - 1)) + 1;
+			t->tick = turn <= now ? turn : now + 1;
+			continue;
+		}
+		as_timer_step(t);
+	}
+}
+
+/**
+ *	Call with timers lock held. The next tick anything may fire or move down
+ *	to level 0, UINT64_MAX if nothing is pending.
+ */
+static uint64_t
+as_timer_next_tick(struct as_thread_pool_timers* t)
+{
+	if (t->n_pending == 0) {
+		return UINT64_MAX;
+	}
+	
+	uint32_t idx = (uint32_t)(t->tick & (AS_TIMER_SLOTS - 1));
+	
+	if (idx == 0) {
+		return t->tick;
+	}
+	
+	uint64_t turn = (t->tick | (AS_TIMER_SLOTS - 1)) + 1;
+	
+	// Level 0 buckets from here to the turn.
+	uint64_t ahead = t->occupied[0] >> idx;
+	
+	if (ahead) {
+		return t->tick + (uint64_t)__builtin_ctzll(ahead);
+	}
+	return turn;
+}
+
+static void*
+as_timer_thread(void* data)
+{
+	struct as_thread_pool_timers* t = data;
+	
+	// Don't hold to a bounded pool's limit - see as_thread_pool_admit().
+	as_in_timer = true;
+	
+	pthread_mutex_lock(&t->lock);
+	
+	while (! t->stop) {
+		as_timer_advance(t, as_timer_now_tick());
+		
+		if (t->n_fired) {
+			// Queue outside the lock - only this thread touches the batch.
+			uint32_t n_fired = t->n_fired;
+			t->n_fired = 0;
+			pthread_mutex_unlock(&t->lock);
+			
+			for (uint32_t i = 0; i < n_fired; i++) {
+				as_thread_pool_task* task = &t->fired[i];
+				
+				// Refused - run it here rather than drop it.
+				if (as_thread_pool_queue_task(t->pool, task->task_fn, task->udata) != 0) {
+					task->task_fn(task->udata);
+				}
+			}
+			pthread_mutex_lock(&t->lock);
+			continue;
+		}
+		
+		t->wake_tick = as_timer_next_tick(t);
+		
+		if (t->wake_tick == UINT64_MAX) {
+			pthread_cond_wait(&t->cond, &t->lock);
+			continue;
+		}
+		
+		// Wake at least once a second in case the wall clock the wait runs
+		// on jumps.
+		uint64_t us = cf_getus();
+		uint64_t wake_us = t->wake_tick * AS_TIMER_TICK_US;
+		
+		if (wake_us > us) {
+			uint64_t wait_us = wake_us - us < 1000000 ? wake_us - us : 1000000;
+			struct timespec delta = { .tv_sec = wait_us / 1000000, .tv_nsec = (wait_us % 1000000) * 1000 };
+			struct timespec tp;
+			
+			cf_clock_current_add(&delta, &tp);
+			pthread_cond_timedwait(&t->cond, &t->lock, &tp);
+		}
+	}
+	pthread_mutex_unlock(&t->lock);
+	return 0;
+}
+
+static void
+as_timers_destroy(struct as_thread_pool_timers* t)
+{
+	for (uint32_t i = 0; i < t->n_chunks; i++) {
+		cf_free(t->chunks[i]);
+	}
+	cf_free(t->chunks);
+	cf_free(t->fired);
+	pthread_cond_destroy(&t->cond);
+	pthread_mutex_destroy(&t->lock);
+	cf_free(t);
+}
+
+static struct as_thread_pool_timers*
+as_timers_create(as_thread_pool* pool)
+{
+	struct as_thread_pool_timers* t = cf_malloc(sizeof(struct as_thread_pool_timers));
+	
+	if (! t) {
+		return NULL;
+	}
+	memset(t, 0, sizeof(struct as_thread_pool_timers));
+	pthread_mutex_init(&t->lock, NULL);
+	pthread_cond_init(&t->cond, NULL);
+	t->pool = pool;
+	t->tick = as_timer_now_tick();
+	t->wake_tick = UINT64_MAX;
+	
+	if (pthread_create(&t->thread, NULL, as_timer_thread, t) != 0) {
+		as_timers_destroy(t);
+		return NULL;
+	}
+	return t;
+}
+
+/**
+ *	Stop the timer thread and drop pending timers.
+ */
+static void
+as_timers_shutdown(struct as_thread_pool_timers* t)
+{
+	pthread_mutex_lock(&t->lock);
+	t->stop = true;
+	pthread_cond_signal(&t->cond);
+	pthread_mutex_unlock(&t->lock);
+	pthread_join(t->thread, NULL);
+	as_timers_destroy(t);
+}
+
+as_thread_pool_timer
+as_thread_pool_schedule_periodic(as_thread_pool* pool, as_task_fn task_fn, void* udata, uint64_t delay_us, uint64_t period_us)
+{
+	struct as_thread_pool_timers* t = pool->timers;
+	
+	if (! t) {
+		// Timer thread starts on first use.
+		if (pthread_mutex_lock(&pool->lock)) {
+			return 0;
+		}
+		
+		if (pool->initialized && ! pool->timers) {
+			t = as_timers_create(pool);
+			CF_MEMORY_BARRIER_WRITE();
+			pool->timers = t;
+		}
+		t = pool->timers;
+		pthread_mutex_unlock(&pool->lock);
+		
+		if (! t) {
+			return 0;
+		}
+	}
+	
+	pthread_mutex_lock(&t->lock);
+	
+	as_thread_pool_timer_entry* e = as_timer_alloc(t);
+	
+	if (! e) {
+		pthread_mutex_unlock(&t->lock);
+		return 0;
+	}
+	
+	// Round up, so we never fire early.
+	e->due = (cf_getus() + delay_us + AS_TIMER_TICK_US - 1) / AS_TIMER_TICK_US;
+	e->period = (period_us + AS_TIMER_TICK_US - 1) / AS_TIMER_TICK_US;
+	e->task_fn = task_fn;
+	e->udata = udata;
+	as_timer_link(t, e);
+	t->n_pending++;
+	
+	if (e->due < t->wake_tick) {
+		t->wake_tick = e->due;
+		pthread_cond_signal(&t->cond);
+	}
+	
+	as_thread_pool_timer timer = ((uint64_t)e->generation << 32) | (e->index + 1);
+	pthread_mutex_unlock(&t->lock);
+	return timer;
+}
+
+as_thread_pool_timer
+as_thread_pool_schedule(as_thread_pool* pool, as_task_fn task_fn, void* udata, uint64_t delay_us)
+{
+	return as_thread_pool_schedule_periodic(pool, task_fn, udata, delay_us, 0);
+}
 
-typedef struct as_thread_pool_task as_thread_pool_task;
+int
+as_thread_pool_cancel(as_thread_pool* pool, as_thread_pool_timer timer)
+{
+	struct as_thread_pool_timers* t = pool->timers;
+	uint32_t index = (uint32_t)timer - 1;
+	uint32_t generation = (uint32_t)(timer >> 32);
+	int rc = -1;
+	
+	if (! t || (uint32_t)timer == 0) {
+		return -1;
+	}
+	
+	pthread_mutex_lock(&t->lock);
+	
+	if (index < t->n_chunks * AS_TIMER_CHUNK) {
+		as_thread_pool_timer_entry* e = &t->chunks[index / AS_TIMER_CHUNK][index % AS_TIMER_CHUNK];
+		
+		if (e->generation == generation && e->bucket >= 0) {
+			as_timer_unlink(t, e);
+			as_timer_free(t, e);
+			t->n_pending--;
+			rc = 0;
+		}
+	}
+	pthread_mutex_unlock(&t->lock);
+	return rc;
+}
 
 /******************************************************************************
- * Functions
+ * Future Functions
  *****************************************************************************/
 
-void*
-as_thread_worker(void* data)
+static as_future*
+as_future_acquire(as_thread_pool* pool)
 {
-	as_thread_pool* pool = data;
-	as_thread_pool_task task;
+	pthread_mutex_lock(&as_future_free_lock);
+	as_future* f = as_future_free_list;
 	
-	// Retrieve tasks from queue and execute.
-	while (cf_queue_pop(pool->dispatch_queue, &task, CF_QUEUE_FOREVER) == CF_QUEUE_OK) {
-		// A null task indicates thread should be shut down.
-		if (! task.task_fn) {
-			break;
-		}
+	if (f) {
+		as_future_free_list = f->next;
+	}
+	pthread_mutex_unlock(&as_future_free_lock);
+	
+	if (! f) {
+		f = cf_malloc(sizeof(as_future));
 		
-		// Run task
-		task.task_fn(task.udata);
+		if (! f) {
+			return NULL;
+		}
+		pthread_mutex_init(&f->lock, NULL);
+		pthread_cond_init(&f->cond, NULL);
 	}
 	
-	// Send thread completion event back to caller.
-	uint32_t complete = 1;
-	cf_queue_push(pool->complete_queue, &complete);
-	return 0;
+	f->pool = pool;
+	f->fn = NULL;
+	f->then_fn = NULL;
+	f->udata = NULL;
+	f->arg = NULL;
+	f->result = NULL;
+	f->next = NULL;
+	f->any = NULL;
+	f->n_waiters = 0;
+	f->done = false;
+	
+	// One for the caller, one for the task.
+	f->ref_count = 2;
+	return f;
 }
 
-static uint32_t
-as_thread_pool_create_threads(as_thread_pool* pool, uint32_t count)
+void
+as_future_release(as_future* future)
 {
-	// Start detached threads.  There is no need to store thread because a completion queue
-	// is used to join back threads on termination.
-	pthread_attr_t attrs;
-	pthread_attr_init(&attrs);
-	pthread_attr_setdetachstate(&attrs, PTHREAD_CREATE_DETACHED);
+	if (cf_atomic32_decr(&future->ref_count) != 0) {
+		return;
+	}
 	
-	int threads_created = 0;
-	pthread_t thread;
+	pthread_mutex_lock(&as_future_free_lock);
+	future->next = as_future_free_list;
+	as_future_free_list = future;
+	pthread_mutex_unlock(&as_future_free_lock);
+}
+
+static void as_future_queue(as_future* f);
+
+static void
+as_future_complete(as_future* f, void* result)
+{
+	pthread_mutex_lock(&f->lock);
+	f->result = result;
+	f->done = true;
 	
-	for (uint32_t i = 0; i < count; i++) {
-		if (pthread_create(&thread, &attrs, as_thread_worker, pool) == 0) {
-			threads_created++;
-		}
+	as_future* next = f->next;
+	f->next = NULL;
+	
+	if (f->n_waiters) {
+		pthread_cond_broadcast(&f->cond);
 	}
-	return threads_created;
+	
+	// A waiter can't unlink, and so can't return, while we hold the lock.
+	for (as_future_link* link = f->any; link; link = link->next) {
+		as_future_waiter* w = link->waiter;
+		
+		pthread_mutex_lock(&w->lock);
+		w->fired = true;
+		pthread_cond_signal(&w->cond);
+		pthread_mutex_unlock(&w->lock);
+	}
+	pthread_mutex_unlock(&f->lock);
+	
+	if (next) {
+		next->arg = result;
+		as_future_queue(next);
+	}
+	
+	// The task's hold.
+	as_future_release(f);
 }
 
 static void
-as_thread_pool_shutdown_threads(as_thread_pool* pool, uint32_t count)
+as_future_run(void* udata)
 {
-	// This tells the worker threads to stop. We do this (instead of using a
-	// "running" flag) to allow the workers to "wait forever" on processing the
-	// work dispatch queue, which has minimum impact when the queue is empty.
-	// This also means all queued requests get processed when shutting down.
-	for (uint32_t i = 0; i < count; i++) {
-		as_thread_pool_task task;
-		task.task_fn = NULL;
-		task.udata = NULL;
-		cf_queue_push(pool->dispatch_queue, &task);
-	}
+	as_future* f = udata;
+	void* result = f->fn ? f->fn(f->udata) : f->then_fn(f->arg, f->udata);
 	
-	// Wait till threads finish.
-	uint32_t complete;
-	for (uint32_t i = 0; i < count; i++) {
-		cf_queue_pop(pool->complete_queue, &complete, CF_QUEUE_FOREVER);
+	as_future_complete(f, result);
+}
+
+static void
+as_future_queue(as_future* f)
+{
+	// A pool that's closing or gone refuses continuations from outside it -
+	// run it here.
+	if (as_thread_pool_queue_task(f->pool, as_future_run, f) != 0) {
+		as_future_run(f);
 	}
 }
 
-int
-as_thread_pool_init(as_thread_pool* pool, uint32_t thread_size)
+as_future*
+as_thread_pool_submit(as_thread_pool* pool, as_future_fn fn, void* udata)
 {
-	if (pthread_mutex_init(&pool->lock, NULL)) {
-		return -1;
+	as_future* f = as_future_acquire(pool);
+	
+	if (! f) {
+		return NULL;
 	}
+	f->fn = fn;
+	f->udata = udata;
+	
+	if (as_thread_pool_queue_task(pool, as_future_run, f) != 0) {
+		f->ref_count = 1;
+		as_future_release(f);
+		return NULL;
+	}
+	return f;
+}
 
-    if (pthread_mutex_lock(&pool->lock)) {
-        return -2;
-    }
+as_future*
+as_future_then(as_future* future, as_future_then_fn fn, void* udata)
+{
+	as_future* g = as_future_acquire(future->pool);
+	
+	if (! g) {
+		return NULL;
+	}
+	g->then_fn = fn;
+	g->udata = udata;
+	
+	pthread_mutex_lock(&future->lock);
+	
+	if (future->next) {
+		pthread_mutex_unlock(&future->lock);
+		g->ref_count = 1;
+		as_future_release(g);
+		return NULL;
+	}
+	
+	if (! future->done) {
+		// Queued by as_future_complete().
+		future->next = g;
+		pthread_mutex_unlock(&future->lock);
+		return g;
+	}
+	
+	g->arg = future->result;
+	pthread_mutex_unlock(&future->lock);
+	as_future_queue(g);
+	return g;
+}
 
-	// Initialize queues.
-	pool->dispatch_queue = cf_queue_create(sizeof(as_thread_pool_task), true);
-	pool->complete_queue = cf_queue_create(sizeof(uint32_t), true);
-	pool->thread_size = thread_size;
-	pool->initialized = 1;
+static int
+as_future_wait_until(as_future* f, const struct timespec* tp, void** result)
+{
+	int rc = 0;
 	
-	// Start detached threads.
-	pool->thread_size = as_thread_pool_create_threads(pool, thread_size);
-	int rc = (pool->thread_size == thread_size)? 0 : -3;
+	pthread_mutex_lock(&f->lock);
 	
-	pthread_mutex_unlock(&pool->lock);
+	while (! f->done) {
+		f->n_waiters++;
+		
+		if (! tp) {
+			pthread_cond_wait(&f->cond, &f->lock);
+		}
+		else if (pthread_cond_timedwait(&f->cond, &f->lock, tp) == ETIMEDOUT && ! f->done) {
+			rc = -1;
+		}
+		f->n_waiters--;
+		
+		if (rc) {
+			break;
+		}
+	}
+	
+	if (rc == 0 && result) {
+		*result = f->result;
+	}
+	pthread_mutex_unlock(&f->lock);
 	return rc;
 }
 
+void*
+as_future_wait(as_future* future)
+{
+	void* result = NULL;
+	as_future_wait_until(future, NULL, &result);
+	return result;
+}
+
 int
-as_thread_pool_resize(as_thread_pool* pool, uint32_t thread_size)
+as_future_wait_timeout(as_future* future, int ms_wait, void** result)
 {
-    if (pthread_mutex_lock(&pool->lock)) {
-        return -1;
-    }
+	struct timespec tp;
+	
+	if (ms_wait >= 0) {
+		cf_set_wait_timespec(ms_wait, &tp);
+	}
+	return as_future_wait_until(future, ms_wait >= 0 ? &tp : NULL, result);
+}
 
-	if (! pool->initialized) {
-		// Pool has already been closed.
-		pthread_mutex_unlock(&pool->lock);
-		return -2;
+int
+as_future_wait_all(as_future** futures, uint32_t n_futures, int ms_wait)
+{
+	struct timespec tp;
+	
+	if (ms_wait >= 0) {
+		cf_set_wait_timespec(ms_wait, &tp);
 	}
 	
-	int rc = 0;
+	// One deadline for the lot.
+	for (uint32_t i = 0; i < n_futures; i++) {
+		if (as_future_wait_until(futures[i], ms_wait >= 0 ? &tp : NULL, NULL) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int
+as_future_wait_any(as_future** futures, uint32_t n_futures, int ms_wait)
+{
+	struct timespec tp;
 	
-	if (thread_size != pool->thread_size) {
-		if (thread_size < pool->thread_size) {
-			// Shutdown excess threads.
-			as_thread_pool_shutdown_threads(pool, pool->thread_size - thread_size);
-			pool->thread_size = thread_size;
+	if (ms_wait >= 0) {
+		cf_set_wait_timespec(ms_wait, &tp);
+	}
+	
+	as_future_link stack_links[AS_FUTURE_ANY_LINKS];
+	as_future_link* links = stack_links;
+	
+	if (n_futures > AS_FUTURE_ANY_LINKS) {
+		links = cf_malloc(n_futures * sizeof(as_future_link));
+		
+		if (! links) {
+			return -1;
+		}
+	}
+	
+	as_future_waiter w;
+	pthread_mutex_init(&w.lock, NULL);
+	pthread_cond_init(&w.cond, NULL);
+	w.fired = false;
+	
+	// Link to each future until one turns out to be done already.
+	uint32_t n_linked = 0;
+	
+	for (; n_linked < n_futures; n_linked++) {
+		as_future* f = futures[n_linked];
+		
+		pthread_mutex_lock(&f->lock);
+		
+		if (f->done) {
+			pthread_mutex_unlock(&f->lock);
+			w.fired = true;
+			break;
+		}
+		
+		as_future_link* link = &links[n_linked];
+		
+		link->waiter = &w;
+		link->prev = NULL;
+		link->next = f->any;
+		
+		if (f->any) {
+			f->any->prev = link;
+		}
+		f->any = link;
+		pthread_mutex_unlock(&f->lock);
+	}
+	
+	pthread_mutex_lock(&w.lock);
+	
+	while (! w.fired) {
+		if (ms_wait < 0) {
+			pthread_cond_wait(&w.cond, &w.lock);
+		}
+		else if (pthread_cond_timedwait(&w.cond, &w.lock, &tp) == ETIMEDOUT) {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&w.lock);
+	
+	// Unlink under each future's lock - after this no completion touches w,
+	// and any done flag set before is visible.
+	for (uint32_t i = 0; i < n_linked; i++) {
+		as_future* f = futures[i];
+		as_future_link* link = &links[i];
+		
+		pthread_mutex_lock(&f->lock);
+		
+		if (link->prev) {
+			link->prev->next = link->next;
 		}
 		else {
-			// Start new threads.
-			pool->thread_size += as_thread_pool_create_threads(pool, thread_size - pool->thread_size);
-			rc = (pool->thread_size == thread_size)? 0 : -3;
+			f->any = link->next;
+		}
+		
+		if (link->next) {
+			link->next->prev = link->prev;
 		}
+		pthread_mutex_unlock(&f->lock);
 	}
-	pthread_mutex_unlock(&pool->lock);
-	return rc;
+	
+	pthread_cond_destroy(&w.cond);
+	pthread_mutex_destroy(&w.lock);
+	
+	if (links != stack_links) {
+		cf_free(links);
+	}
+	
+	// Also the one last look after a timeout.
+	for (uint32_t i = 0; i < n_futures; i++) {
+		if (futures[i]->done) {
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+/******************************************************************************
+ * Partition Functions
+ *****************************************************************************/
+
+/**
+ *	Shared by the caller and the tasks of as_thread_pool_run_partitions().
+ *	Whoever drops the last reference frees it, so a task that starts after
+ *	the caller has returned finds no partitions left and cleans up.
+ */
+typedef struct as_partition_job {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	as_partition_fn fn;
+	void* udata;
+	uint32_t n_partitions;
+	cf_atomic32 next;
+	uint32_t n_done;
+	uint32_t ref_count;
+} as_partition_job;
+
+static void
+as_partition_job_release(as_partition_job* job)
+{
+	pthread_mutex_lock(&job->lock);
+	bool last = --job->ref_count == 0;
+	pthread_mutex_unlock(&job->lock);
+	
+	if (last) {
+		pthread_cond_destroy(&job->cond);
+		pthread_mutex_destroy(&job->lock);
+		cf_free(job);
+	}
+}
+
+// Run partitions until none are left unclaimed.
+static void
+as_partition_job_run(as_partition_job* job)
+{
+	uint32_t i;
+	
+	while ((i = cf_atomic32_incr(&job->next) - 1) < job->n_partitions) {
+		job->fn(job->udata, i);
+		
+		pthread_mutex_lock(&job->lock);
+		
+		if (++job->n_done == job->n_partitions) {
+			pthread_cond_signal(&job->cond);
+		}
+		pthread_mutex_unlock(&job->lock);
+	}
+}
+
+static void
+as_partition_task(void* udata)
+{
+	as_partition_job* job = udata;
+	
+	as_partition_job_run(job);
+	as_partition_job_release(job);
 }
 
 int
-as_thread_pool_queue_task(as_thread_pool* pool, as_task_fn task_fn, void* udata)
+as_thread_pool_run_partitions(as_thread_pool* pool, as_partition_fn fn, void* udata, uint32_t n_partitions)
 {
-	if (pool->thread_size == 0) {
-		// No threads are running to process task.
+	if (n_partitions == 0) {
+		return 0;
+	}
+	
+	as_partition_job* job = cf_malloc(sizeof(as_partition_job));
+	
+	if (! job) {
 		return -1;
 	}
 	
-	as_thread_pool_task task;
-	task.task_fn = task_fn;
-	task.udata = udata;
+	pthread_mutex_init(&job->lock, NULL);
+	pthread_cond_init(&job->cond, NULL);
+	job->fn = fn;
+	job->udata = udata;
+	job->n_partitions = n_partitions;
+	job->next = 0;
+	job->n_done = 0;
+	job->ref_count = 1;
 	
-	if (cf_queue_push(pool->dispatch_queue, &task) != CF_QUEUE_OK) {
-		return -2;
+	// The caller takes a partition itself, so one task fewer than partitions
+	// keeps every thread busy. A task the pool won't take is just one less
+	// helper.
+	uint32_t n_tasks = pool ? pool->thread_size : 0;
+	
+	if (n_tasks > n_partitions - 1) {
+		n_tasks = n_partitions - 1;
+	}
+	
+	for (uint32_t i = 0; i < n_tasks; i++) {
+		pthread_mutex_lock(&job->lock);
+		job->ref_count++;
+		pthread_mutex_unlock(&job->lock);
+		
+		if (as_thread_pool_queue_task(pool, as_partition_task, job) != 0) {
+			as_partition_job_release(job);
+			break;
+		}
+	}
+	
+	as_partition_job_run(job);
+	
+	// Only wait for partitions already claimed - tasks still queued behind
+	// us (maybe on this very thread) have nothing left to do.
+	pthread_mutex_lock(&job->lock);
+	
+	while (job->n_done < n_partitions) {
+		pthread_cond_wait(&job->cond, &job->lock);
 	}
+	pthread_mutex_unlock(&job->lock);
+	
+	as_partition_job_release(job);
 	return 0;
 }
 
@@ -185,11 +2726,43 @@ as_thread_pool_destroy(as_thread_pool* pool)
 		return -2;
 	}
 
+	// Turn away queuers waiting for room, and wait for them to go.
+	pthread_mutex_lock(&pool->limit_lock);
+	pool->closing = true;
+	pthread_cond_broadcast(&pool->limit_cond);
+	
+	while (cf_atomic32_get(pool->n_blocked) != 0) {
+		pthread_cond_wait(&pool->limit_cond, &pool->limit_lock);
+	}
+	pthread_mutex_unlock(&pool->limit_lock);
+	
+	// Timers first, so nothing more is queued.
+	if (pool->timers) {
+		as_timers_shutdown(pool->timers);
+		pool->timers = NULL;
+	}
+	
 	as_thread_pool_shutdown_threads(pool, pool->thread_size);
+	as_thread_pool_drain(pool);
 	cf_queue_destroy(pool->dispatch_queue);
 	cf_queue_destroy(pool->complete_queue);
+	
+	if (pool->ws) {
+		as_thread_pool_ws_destroy(pool->ws);
+		pool->ws = NULL;
+	}
+	
+	if (pool->place) {
+		as_thread_pool_place_destroy(pool->place);
+		pool->place = NULL;
+	}
+	
+	as_thread_pool_get_stats(pool, &pool->closed_stats);
+	as_thread_pool_counters_destroy(pool);
 	pool->initialized = 0;
 	pthread_mutex_unlock(&pool->lock);
 	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->limit_cond);
+	pthread_mutex_destroy(&pool->limit_lock);
 	return 0;
 }
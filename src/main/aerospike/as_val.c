@@ -129,8 +129,9 @@ static as_val * as_val_reserve_noop(as_val * v)
 
 static as_val * as_val_reserve_count(as_val * v)
 {
-	// return after ref-counting !!
-	cf_atomic32_add(&(v->count),1);
+	// return after ref-counting !! - the caller holds a reference already, so
+	// there's nothing to order
+	cf_atomic32_fetch_add(&(v->count), 1, CF_ATOMIC_RELAXED);
 	return v;
 }
 
@@ -154,9 +155,12 @@ as_val * as_val_val_reserve(as_val * v)
 
 as_val * as_val_val_destroy(as_val * v)
 {
-	if ( v == NULL || !v->count ) return v;
-	// if we reach the last reference, call the destructor, and free
-	if ( 0 == cf_atomic32_decr(&(v->count)) ) {
+	if ( v == NULL || !cf_atomic32_load(&(v->count), CF_ATOMIC_RELAXED) ) return v;
+	// if we reach the last reference, call the destructor, and free - the
+	// release decrement and acquire fence let the destructor see every write
+	// made through the other references
+	if ( 1 == cf_atomic32_fetch_add(&(v->count), -1, CF_ATOMIC_RELEASE) ) {
+		cf_atomic_fence(CF_ATOMIC_ACQUIRE);
 		as_val_destroy_callbacks[ v->type ](v);     
 		if ( v->free ) {
 			cf_free(v);
@@ -21,92 +21,170 @@
 #ifndef ENHANCED_ALLOC
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 
 #include <citrusleaf/alloc.h>
 
+cf_alloc_hooks *g_alloc_hooks = NULL;
+
 void *cf_malloc(size_t sz) {
-	return malloc(sz);
+	return g_alloc_hooks ? g_alloc_hooks->malloc(sz, CF_ALLOC_ARENA_DEFAULT) : malloc(sz);
 }
 
 void *cf_calloc(size_t nmemb, size_t sz) {
-	return calloc(nmemb, sz);
+	return g_alloc_hooks ? g_alloc_hooks->calloc(nmemb, sz, CF_ALLOC_ARENA_DEFAULT) : calloc(nmemb, sz);
 }
 
 void *cf_realloc(void *ptr, size_t sz) {
-	return realloc(ptr,sz);
+	return g_alloc_hooks ? g_alloc_hooks->realloc(ptr, sz, CF_ALLOC_ARENA_DEFAULT) : realloc(ptr,sz);
 }
 
 void *cf_strdup(const char *s) {
-	return strdup(s);
+	return g_alloc_hooks ? cf_strndup(s, strlen(s)) : strdup(s);
 }
 
 void *cf_strndup(const char *s, size_t n) {
-	return strndup(s, n);
+	return cf_strndup_arena(s, n, CF_ALLOC_ARENA_DEFAULT);
 }
 
 void *cf_valloc(size_t sz) {
-	return valloc(sz);
+	return g_alloc_hooks ? g_alloc_hooks->valloc(sz, CF_ALLOC_ARENA_DEFAULT) : valloc(sz);
 }
 
 void cf_free(void *p) {
-	free(p);
+	if (g_alloc_hooks) {
+		if (p) g_alloc_hooks->free(p);
+	}
+	else {
+		free(p);
+	}
+}
+
+void *cf_malloc_arena(size_t sz, cf_alloc_arena arena) {
+	return g_alloc_hooks ? g_alloc_hooks->malloc(sz, arena) : malloc(sz);
+}
+
+void *cf_calloc_arena(size_t nmemb, size_t sz, cf_alloc_arena arena) {
+	return g_alloc_hooks ? g_alloc_hooks->calloc(nmemb, sz, arena) : calloc(nmemb, sz);
+}
+
+void *cf_realloc_arena(void *ptr, size_t sz, cf_alloc_arena arena) {
+	return g_alloc_hooks ? g_alloc_hooks->realloc(ptr, sz, arena) : realloc(ptr, sz);
+}
+
+void *cf_strndup_arena(const char *s, size_t n, cf_alloc_arena arena) {
+	if (! g_alloc_hooks) {
+		return strndup(s, n);
+	}
+
+	size_t len = strnlen(s, n);
+	char *d = g_alloc_hooks->malloc(len + 1, arena);
+
+	if (d) {
+		memcpy(d, s, len);
+		d[len] = 0;
+	}
+	return d;
+}
+
+// Set in the count of a biased region until its owner shares it - only the
+// owner reads or writes the count meanwhile.
+#define CF_RC_BIASED 0x80000000
+
+static inline cf_rc_hdr *cf_rc_hdr_of(void *addr) {
+	return (cf_rc_hdr *) (((uint8_t *)addr) - sizeof(cf_rc_hdr));
+}
+
+static inline void *cf_rc_alloc_x(size_t sz, uint32_t count) {
+	if (sz > UINT32_MAX) {
+		return NULL;
+	}
+
+	cf_rc_hdr *hdr = cf_alloc_cache_hooks()->malloc(sizeof(cf_rc_hdr) + sz, CF_ALLOC_ARENA_RC);
+
+	if (NULL == hdr) {
+		return NULL;
+	}
+	hdr->count = count;
+	hdr->sz = (uint32_t)sz;
+
+	return hdr + 1;
 }
 
 /* cf_rc_count
  * Get the reservation count for a memory region */
 cf_atomic_int_t cf_rc_count(void *addr) {
-	cf_rc_counter *rc = (cf_rc_counter *) (((uint8_t *)addr) - sizeof(cf_rc_counter));
-
-	return *rc;
+	return cf_atomic32_load(&cf_rc_hdr_of(addr)->count, CF_ATOMIC_RELAXED) & ~CF_RC_BIASED;
 }
 
 /* cf_rc_reserve
- * Get a reservation on a memory region */
+ * Get a reservation on a memory region - the caller already holds one, so
+ * there's nothing to order */
 int cf_rc_reserve(void *addr) {
-	cf_rc_counter *rc = (cf_rc_counter *) (((uint8_t *)addr) - sizeof(cf_rc_counter));
-	int i = (int) cf_atomic32_add(rc, 1);
+	cf_rc_counter *rc = &cf_rc_hdr_of(addr)->count;
+	uint32_t c = cf_atomic32_load(rc, CF_ATOMIC_RELAXED);
 
-	smb_mb();
+	if (c & CF_RC_BIASED) {
+		cf_atomic32_store(rc, c + 1, CF_ATOMIC_RELAXED);
+		return (int)((c + 1) & ~CF_RC_BIASED);
+	}
 
-	return i;
+	return (int)(cf_atomic32_fetch_add(rc, 1, CF_ATOMIC_RELAXED) + 1);
 }
 
 /* cf_rc_alloc
- * Allocate a reference-counted memory region.  This region will be filled
- * with uint8_ts of value zero */
+ * Allocate a reference-counted memory region, with one reservation held */
 void *cf_rc_alloc(size_t sz)
 {
-	size_t asz = sizeof(cf_rc_counter) + sz;
-	uint8_t *addr = malloc(asz);
+	return cf_rc_alloc_x(sz, 1);
+}
 
-	if (NULL == addr) {
-		return NULL;
-	}
-	cf_atomic_int_set((cf_atomic_int *) addr, 1);
+/* cf_rc_alloc_biased
+ * Allocate a reference-counted memory region only this thread may reserve
+ * and release until it calls cf_rc_share() */
+void *cf_rc_alloc_biased(size_t sz)
+{
+	return cf_rc_alloc_x(sz, CF_RC_BIASED | 1);
+}
+
+/* cf_rc_share
+ * Let other threads reserve and release a biased region - a no-op for any
+ * other. Only the owner may call it */
+void cf_rc_share(void *addr) {
+	cf_rc_counter *rc = &cf_rc_hdr_of(addr)->count;
+	uint32_t c = cf_atomic32_load(rc, CF_ATOMIC_RELAXED);
 
-	return addr + sizeof(cf_rc_counter);
+	if (c & CF_RC_BIASED) {
+		cf_atomic32_store(rc, c & ~CF_RC_BIASED, CF_ATOMIC_RELEASE);
+	}
 }
 
 /* cf_rc_free
  * Deallocate a reference-counted memory region */
 void cf_rc_free(void *addr) {
-	cf_rc_counter *rc = (cf_rc_counter *) (((uint8_t *)addr) - sizeof(cf_rc_counter));
-	free((void *) rc);
+	cf_alloc_cache_hooks()->free(cf_rc_hdr_of(addr));
 }
 
 /* cf_rc_release
  * Release a reservation on a memory region */
 static inline cf_atomic_int_t cf_rc_release_x(void *addr, bool autofree) {
-	uint64_t c = 0;
-	cf_rc_counter *rc = (cf_rc_counter *) (((uint8_t *)addr) - sizeof(cf_rc_counter));
+	cf_rc_counter *rc = &cf_rc_hdr_of(addr)->count;
+	uint32_t c = cf_atomic32_load(rc, CF_ATOMIC_RELAXED);
 
 	// Release the reservation; if this reduced the reference count to zero,
-	// then free the block if autofree is set, and return 1.  Otherwise,
-	// return 0
-	smb_mb();
-	if (0 == (c = cf_atomic32_decr(rc)) && autofree) {
-		free((void *)rc);
+	// then free the block if autofree is set, and return 0.  Otherwise,
+	// return the remaining count
+	if (c & CF_RC_BIASED) {
+		cf_atomic32_store(rc, --c, CF_ATOMIC_RELAXED);
+		c &= ~CF_RC_BIASED;
+	}
+	else if (0 == (c = cf_atomic32_fetch_add(rc, -1, CF_ATOMIC_RELEASE) - 1)) {
+		cf_atomic_fence(CF_ATOMIC_ACQUIRE);
+	}
+
+	if (0 == c && autofree) {
+		cf_rc_free(addr);
 	}
 
 	return c;
@@ -0,0 +1,370 @@
+/* 
+ * Copyright 2008-2014 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+/*
+ *  NB:  Like cf_alloc.c, only without the enhanced memory allocator.
+ */
+#ifndef ENHANCED_ALLOC
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <citrusleaf/alloc.h>
+
+/******************************************************************************
+ * CONSTANTS
+ ******************************************************************************/
+
+// Sizes, with the header, are 16 bytes apart up to 128, then 4 classes per
+// doubling up to 4KB - at most a quarter wasted past 128 bytes.
+#define CF_ALLOC_N_CLASSES 28
+#define CF_ALLOC_MAX_CLASS_SZ 4096
+
+// Header cls values for blocks straight from the C library.
+#define CF_ALLOC_LARGE 0xFFFFFFFE
+#define CF_ALLOC_PAGE 0xFFFFFFFF
+
+// Blocks are carved from chunks this big, one class and arena per chunk.
+#define CF_ALLOC_CHUNK_SZ (64 * 1024)
+
+// Bytes a thread caches per class and arena, bounded by a block count. It
+// moves half that to and from the arena at a time.
+#define CF_ALLOC_BIN_SZ (32 * 1024)
+#define CF_ALLOC_BIN_MIN 8
+#define CF_ALLOC_BIN_MAX 128
+
+static const uint32_t g_class_sz[CF_ALLOC_N_CLASSES] = {
+	16, 32, 48, 64, 80, 96, 112, 128,
+	160, 192, 224, 256, 320, 384, 448, 512,
+	640, 768, 896, 1024, 1280, 1536, 1792, 2048,
+	2560, 3072, 3584, 4096
+};
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+
+/*
+ * Precedes every block handed out, so free knows where the block goes back.
+ */
+typedef struct cf_alloc_hdr_s {
+	uint32_t			cls;
+	uint32_t			arena;
+	size_t				sz;				// CF_ALLOC_LARGE or CF_ALLOC_PAGE - bytes asked for
+} __attribute__ ((aligned(16))) cf_alloc_hdr;
+
+/*
+ * A thread's cached free blocks of one class and arena, linked through their
+ * first word.
+ */
+typedef struct cf_alloc_bin_s {
+	void *				head;
+	uint32_t			n;
+} cf_alloc_bin;
+
+/*
+ * An arena's free blocks of one class, shared by every thread.
+ */
+typedef struct cf_alloc_depot_s {
+	pthread_mutex_t		lock;
+	void *				head;
+	uint8_t *			carve;			// never used blocks of the newest chunk
+	uint8_t *			carve_end;
+} cf_alloc_depot;
+
+/******************************************************************************
+ * GLOBALS
+ ******************************************************************************/
+
+static pthread_once_t g_cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_cache_key;
+static size_t g_page_sz;
+static uint32_t g_bin_max[CF_ALLOC_N_CLASSES];
+static cf_alloc_depot g_depots[CF_ALLOC_N_ARENAS][CF_ALLOC_N_CLASSES];
+
+static __thread cf_alloc_bin t_bins[CF_ALLOC_N_ARENAS][CF_ALLOC_N_CLASSES];
+static __thread bool t_registered = false;
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ ******************************************************************************/
+
+static inline uint32_t cf_alloc_class(size_t sz) {
+	if (sz <= 128) {
+		return sz ? (uint32_t)((sz - 1) >> 4) : 0;
+	}
+
+	uint32_t lg = 63 - (uint32_t)__builtin_clzll((unsigned long long)(sz - 1));
+
+	return 8 + ((lg - 7) * 4) + (uint32_t)(((sz - 1) >> (lg - 2)) & 3);
+}
+
+// Move the first n blocks of the bin to the arena.
+static void cf_alloc_bin_flush(cf_alloc_bin *bin, uint32_t arena, uint32_t cls, uint32_t n) {
+	void *first = bin->head;
+	void *last = first;
+
+	for (uint32_t i = 1; i < n; i++) {
+		last = *(void **)last;
+	}
+
+	bin->head = *(void **)last;
+	bin->n -= n;
+
+	cf_alloc_depot *d = &g_depots[arena][cls];
+
+	pthread_mutex_lock(&d->lock);
+	*(void **)last = d->head;
+	d->head = first;
+	pthread_mutex_unlock(&d->lock);
+}
+
+// Hand an exiting thread's cached blocks back to their arenas. Other key
+// destructors may still allocate after this, and register again.
+static void cf_alloc_thread_exit(void *udata) {
+	t_registered = false;
+
+	for (uint32_t a = 0; a < CF_ALLOC_N_ARENAS; a++) {
+		for (uint32_t c = 0; c < CF_ALLOC_N_CLASSES; c++) {
+			if (t_bins[a][c].n) {
+				cf_alloc_bin_flush(&t_bins[a][c], a, c, t_bins[a][c].n);
+			}
+		}
+	}
+}
+
+static void cf_alloc_cache_init() {
+	long page_sz = sysconf(_SC_PAGESIZE);
+
+	g_page_sz = page_sz > 0 ? (size_t)page_sz : 4096;
+	pthread_key_create(&g_cache_key, cf_alloc_thread_exit);
+
+	for (uint32_t c = 0; c < CF_ALLOC_N_CLASSES; c++) {
+		uint32_t n = CF_ALLOC_BIN_SZ / g_class_sz[c];
+
+		g_bin_max[c] = n < CF_ALLOC_BIN_MIN ? CF_ALLOC_BIN_MIN : (n > CF_ALLOC_BIN_MAX ? CF_ALLOC_BIN_MAX : n);
+
+		for (uint32_t a = 0; a < CF_ALLOC_N_ARENAS; a++) {
+			pthread_mutex_init(&g_depots[a][c].lock, 0);
+		}
+	}
+}
+
+// The thread's first cached block - from here on it needs flushing at exit.
+static void cf_alloc_thread_register() {
+	pthread_once(&g_cache_once, cf_alloc_cache_init);
+	pthread_setspecific(g_cache_key, (void *)1);
+	t_registered = true;
+}
+
+// Fill an empty bin halfway from the arena, carving a new chunk if it's out.
+static bool cf_alloc_bin_refill(cf_alloc_bin *bin, uint32_t arena, uint32_t cls) {
+	if (! t_registered) {
+		cf_alloc_thread_register();
+	}
+
+	cf_alloc_depot *d = &g_depots[arena][cls];
+	uint32_t want = g_bin_max[cls] / 2;
+	size_t sz = g_class_sz[cls];
+
+	pthread_mutex_lock(&d->lock);
+
+	while (bin->n < want) {
+		void *b = d->head;
+
+		if (b) {
+			d->head = *(void **)b;
+		}
+		else {
+			if (d->carve == d->carve_end) {
+				uint8_t *chunk = (uint8_t *)malloc(CF_ALLOC_CHUNK_SZ);
+
+				if (! chunk) {
+					break;
+				}
+
+				d->carve = chunk;
+				d->carve_end = chunk + ((CF_ALLOC_CHUNK_SZ / sz) * sz);
+			}
+
+			b = d->carve;
+			d->carve += sz;
+		}
+
+		*(void **)b = bin->head;
+		bin->head = b;
+		bin->n++;
+	}
+
+	pthread_mutex_unlock(&d->lock);
+
+	return bin->n != 0;
+}
+
+static inline size_t cf_alloc_usable(cf_alloc_hdr *hdr) {
+	return hdr->cls >= CF_ALLOC_LARGE ? hdr->sz : g_class_sz[hdr->cls] - sizeof(cf_alloc_hdr);
+}
+
+static void *cf_alloc_cache_malloc(size_t sz, cf_alloc_arena arena) {
+	size_t total = sz + sizeof(cf_alloc_hdr);
+	cf_alloc_hdr *hdr;
+
+	if ((uint32_t)arena >= CF_ALLOC_N_ARENAS) {
+		arena = CF_ALLOC_ARENA_DEFAULT;
+	}
+
+	if (total < sz) {
+		return(0);
+	}
+
+	if (total > CF_ALLOC_MAX_CLASS_SZ) {
+		if (! (hdr = (cf_alloc_hdr *)malloc(total))) {
+			return(0);
+		}
+
+		hdr->cls = CF_ALLOC_LARGE;
+		hdr->arena = arena;
+		hdr->sz = sz;
+		return(hdr + 1);
+	}
+
+	uint32_t cls = cf_alloc_class(total);
+	cf_alloc_bin *bin = &t_bins[arena][cls];
+
+	if (! bin->head && ! cf_alloc_bin_refill(bin, arena, cls)) {
+		return(0);
+	}
+
+	hdr = (cf_alloc_hdr *)bin->head;
+	bin->head = *(void **)hdr;
+	bin->n--;
+
+	hdr->cls = cls;
+	hdr->arena = arena;
+	return(hdr + 1);
+}
+
+static void cf_alloc_cache_free(void *p) {
+	cf_alloc_hdr *hdr = (cf_alloc_hdr *)p - 1;
+
+	if (hdr->cls == CF_ALLOC_LARGE) {
+		free(hdr);
+		return;
+	}
+
+	if (hdr->cls == CF_ALLOC_PAGE) {
+		free((uint8_t *)p - g_page_sz);
+		return;
+	}
+
+	uint32_t arena = hdr->arena;
+	uint32_t cls = hdr->cls;
+	cf_alloc_bin *bin = &t_bins[arena][cls];
+
+	if (! t_registered) {
+		cf_alloc_thread_register();
+	}
+
+	*(void **)hdr = bin->head;
+	bin->head = hdr;
+	bin->n++;
+
+	if (bin->n > g_bin_max[cls]) {
+		cf_alloc_bin_flush(bin, arena, cls, bin->n / 2);
+	}
+}
+
+static void *cf_alloc_cache_calloc(size_t nmemb, size_t sz, cf_alloc_arena arena) {
+	if (sz && nmemb > SIZE_MAX / sz) {
+		return(0);
+	}
+
+	void *p = cf_alloc_cache_malloc(nmemb * sz, arena);
+
+	if (p) {
+		memset(p, 0, nmemb * sz);
+	}
+	return(p);
+}
+
+static void *cf_alloc_cache_realloc(void *ptr, size_t sz, cf_alloc_arena arena) {
+	if (! ptr) {
+		return(cf_alloc_cache_malloc(sz, arena));
+	}
+
+	if (sz == 0) {
+		cf_alloc_cache_free(ptr);
+		return(0);
+	}
+
+	cf_alloc_hdr *hdr = (cf_alloc_hdr *)ptr - 1;
+	size_t usable = cf_alloc_usable(hdr);
+
+	if (sz <= usable && hdr->cls < CF_ALLOC_LARGE) {
+		return(ptr);
+	}
+
+	void *p = cf_alloc_cache_malloc(sz, (cf_alloc_arena)hdr->arena);
+
+	if (p) {
+		memcpy(p, ptr, usable < sz ? usable : sz);
+		cf_alloc_cache_free(ptr);
+	}
+	return(p);
+}
+
+// The header goes at the end of a page ahead of the one handed out.
+static void *cf_alloc_cache_valloc(size_t sz, cf_alloc_arena arena) {
+	void *base;
+
+	pthread_once(&g_cache_once, cf_alloc_cache_init);
+
+	if (sz > SIZE_MAX - g_page_sz || posix_memalign(&base, g_page_sz, g_page_sz + sz) != 0) {
+		return(0);
+	}
+
+	uint8_t *p = (uint8_t *)base + g_page_sz;
+	cf_alloc_hdr *hdr = (cf_alloc_hdr *)p - 1;
+
+	hdr->cls = CF_ALLOC_PAGE;
+	hdr->arena = (uint32_t)arena < CF_ALLOC_N_ARENAS ? arena : CF_ALLOC_ARENA_DEFAULT;
+	hdr->sz = sz;
+	return(p);
+}
+
+/******************************************************************************
+ * FUNCTIONS
+ ******************************************************************************/
+
+static cf_alloc_hooks g_cache_hooks = {
+	.malloc = cf_alloc_cache_malloc,
+	.calloc = cf_alloc_cache_calloc,
+	.realloc = cf_alloc_cache_realloc,
+	.valloc = cf_alloc_cache_valloc,
+	.free = cf_alloc_cache_free
+};
+
+cf_alloc_hooks *cf_alloc_cache_hooks() {
+	return(&g_cache_hooks);
+}
+
+#endif // defined(ENHANCED_ALLOC)
@@ -45,3 +45,15 @@ int cf_bits_find_last_set_64(uint64_t v) {
         return cf_bits_find_last_set((uint32_t)v);
     }
 }
+
+uint32_t cf_pow2_per_cpu(uint32_t per_cpu, uint32_t max) {
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t want = (uint64_t)(n_cpus > 0 ? n_cpus : 1) * per_cpu;
+    uint32_t n = 1;
+
+    while (n < want && n <= max / 2) {
+        n *= 2;
+    }
+
+    return n;
+}
@@ -131,7 +131,7 @@ void cf_set_wait_timespec(int ms_wait, struct timespec* out)
     out->tv_nsec += (ms_wait % 1000) * 1000 * 1000;
 #endif
 	
-	if (out->tv_nsec > (1000 * 1000 * 1000)) {
+	if (out->tv_nsec >= (1000 * 1000 * 1000)) {
         out->tv_nsec -= 1000 * 1000 * 1000;
         out->tv_sec++;
     }
@@ -154,7 +154,7 @@ void cf_clock_current_add(struct timespec* delta, struct timespec* out)
     out->tv_nsec += delta->tv_nsec;
 #endif
 	
-    if (out->tv_nsec > (1000 * 1000 * 1000)) {
+    if (out->tv_nsec >= (1000 * 1000 * 1000)) {
         out->tv_nsec -= 1000 * 1000 * 1000;
         out->tv_sec++;
     }
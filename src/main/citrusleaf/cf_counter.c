@@ -0,0 +1,126 @@
+/* 
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <citrusleaf/alloc.h>
+#include <citrusleaf/cf_atomic.h>
+#include <citrusleaf/cf_bits.h>
+#include <citrusleaf/cf_counter.h>
+
+/******************************************************************************
+ * CONSTANTS
+ ******************************************************************************/
+
+// Shards per online core, and the most a counter gets.
+#define CF_COUNTER_SHARDS_PER_CPU 2
+#define CF_COUNTER_MAX_SHARDS 64
+
+/******************************************************************************
+ * GLOBALS
+ ******************************************************************************/
+
+static cf_atomic32 g_counter_threads = 0;
+__thread uint32_t g_counter_thread = 0;
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ ******************************************************************************/
+
+static inline void *cf_counter_mem_alloc(uint flags, size_t sz) {
+	return (flags & CF_COUNTER_UNTRACKED) ? malloc(sz) : cf_malloc(sz);
+}
+
+static inline void cf_counter_mem_free(uint flags, void *p) {
+	if (flags & CF_COUNTER_UNTRACKED)
+		free(p);
+	else
+		cf_free(p);
+}
+
+/******************************************************************************
+ * FUNCTIONS
+ ******************************************************************************/
+
+cf_counter *cf_counter_create(uint flags) {
+	cf_counter *c = (cf_counter *)cf_counter_mem_alloc(flags, sizeof(cf_counter));
+
+	if (! c) {
+		return(0);
+	}
+
+	c->flags = flags;
+	c->n_shards = cf_pow2_per_cpu(CF_COUNTER_SHARDS_PER_CPU, CF_COUNTER_MAX_SHARDS);
+
+	// Room to line align the shards, wherever the allocator puts them.
+	size_t shards_sz = sizeof(cf_counter_shard) * c->n_shards;
+
+	if (! (c->mem = cf_counter_mem_alloc(flags, shards_sz + CF_COUNTER_LINE_SZ - 1))) {
+		cf_counter_mem_free(flags, c);
+		return(0);
+	}
+
+	uintptr_t p = ((uintptr_t)c->mem + CF_COUNTER_LINE_SZ - 1) & ~(uintptr_t)(CF_COUNTER_LINE_SZ - 1);
+
+	c->shards = (cf_counter_shard *)p;
+	memset(c->shards, 0, shards_sz);
+
+	return(c);
+}
+
+void cf_counter_destroy(cf_counter *c) {
+	uint flags = c->flags;
+
+	cf_counter_mem_free(flags, c->mem);
+	cf_counter_mem_free(flags, c);
+}
+
+uint32_t cf_counter_thread_assign() {
+	g_counter_thread = (uint32_t)cf_atomic32_incr(&g_counter_threads);
+
+	// Wrapped all the way round - any non-zero index will do.
+	if (g_counter_thread == 0) {
+		g_counter_thread = 1;
+	}
+
+	return(g_counter_thread);
+}
+
+// A shard that only saw decrements holds a wrapped negative, so sum in the
+// shards' own width and sign extend at the end.
+int64_t cf_counter_read(cf_counter *c) {
+	cf_atomic_int_t sum = 0;
+
+	for (uint32_t i = 0; i < c->n_shards; i++) {
+		sum += cf_atomic_int_load(&c->shards[i].n, CF_ATOMIC_RELAXED);
+	}
+
+#if SIZEOF_ATOMIC_INT == 4
+	return((int64_t)(int32_t)sum);
+#else
+	return((int64_t)sum);
+#endif
+}
+
+void cf_counter_reset(cf_counter *c) {
+	for (uint32_t i = 0; i < c->n_shards; i++) {
+		cf_atomic_int_store(&c->shards[i].n, 0, CF_ATOMIC_RELAXED);
+	}
+}
@@ -15,29 +15,555 @@
  * the License.
  */
 #include <citrusleaf/cf_queue.h>
+#include <citrusleaf/cf_atomic.h>
+#include <citrusleaf/cf_bits.h>
 #include <citrusleaf/cf_clock.h>
 #include <citrusleaf/alloc.h>
 
+#include <errno.h>
+#include <sched.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+
+#define CF_QUEUE_CACHE_LINE 64
+
+/**
+ * Bounded MPMC ring (after D. Vyukov). Every cell carries a sequence number:
+ * a cell at position pos is free for the producer that claims tail == pos when
+ * seq == pos, and holds an element for the consumer that claims head == pos
+ * when seq == pos + 1. Head and tail live on their own cache lines.
+ */
+struct cf_queue_ring_s {
+	cf_atomic64     tail;
+	uint8_t         pad0[CF_QUEUE_CACHE_LINE - sizeof(cf_atomic64)];
+	cf_atomic64     head;
+	uint8_t         pad1[CF_QUEUE_CACHE_LINE - sizeof(cf_atomic64)];
+	uint64_t        mask;           // number of cells - 1
+	size_t          cell_sz;        // sequence number plus element, 8-byte aligned
+	uint8_t         cells[];
+};
+
+typedef struct cf_queue_cell_s {
+	cf_atomic64     seq;
+	uint8_t         data[];
+} cf_queue_cell;
+
+/******************************************************************************
+ * INLINE FUNCTIONS
+ ******************************************************************************/
+
+static inline uint cf_queue_roundup_pow2(uint n)
+{
+	uint p = 1;
+
+	while (p < n) {
+		p <<= 1;
+	}
+	return(p);
+}
+
+#define CF_Q_DEAD_WORDS(__sz) (((__sz) + 63) >> 6)
+
+static inline void cf_queue_clear_dead(cf_queue *q, uint64_t offset)
+{
+	uint index = CF_Q_INDEX(q, offset);
+
+	q->dead[index >> 6] &= ~(1ULL << (index & 63));
+	q->n_dead--;
+}
+
+//
+// Keep tombstones strictly inside the queue - the elements at the read and
+// write ends are always live, so pop never has to look for one.
+//
+static inline void cf_queue_trim(cf_queue *q)
+{
+	while (q->n_dead && CF_Q_ELEM_DEAD(q, q->read_offset)) {
+		cf_queue_clear_dead(q, q->read_offset);
+		q->read_offset++;
+	}
+	while (q->n_dead && CF_Q_ELEM_DEAD(q, q->write_offset - 1)) {
+		cf_queue_clear_dead(q, q->write_offset - 1);
+		q->write_offset--;
+	}
+}
+
+/******************************************************************************
+ * WAITING
+ ******************************************************************************/
+
+// Consumers park on an eventcount - a consumer that finds the queue empty
+// counts itself in n_waiters, samples wait_seq, and sleeps until wait_seq
+// moves. Producers only bump wait_seq and wake someone when n_waiters says
+// there's someone to wake, so pushing to a queue with no blocked consumers
+// makes no syscall, and each element wakes at most one consumer.
+
+//
+// Call without the queue lock, having sampled seen from wait_seq (before the
+// last look at the queue). Returns false if the deadline tp passed.
+//
+static bool cf_queue_park(cf_queue *q, uint32_t seen, const struct timespec *tp)
+{
+#ifdef __linux__
+	// tp is an absolute CLOCK_REALTIME deadline, from cf_set_wait_timespec()
+	int rv = syscall(SYS_futex, (void *)&q->wait_seq,
+			FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG | FUTEX_CLOCK_REALTIME,
+			seen, tp, NULL, FUTEX_BITSET_MATCH_ANY);
+
+	return(! (rv == -1 && errno == ETIMEDOUT));
+#else
+	bool woken = true;
+
+	pthread_mutex_lock(&q->LOCK);
+
+	while (q->wait_seq == seen) {
+		if (! tp) {
+			pthread_cond_wait(&q->CV, &q->LOCK);
+		}
+		else if (ETIMEDOUT == pthread_cond_timedwait(&q->CV, &q->LOCK, tp)) {
+			woken = false;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&q->LOCK);
+	return(woken);
+#endif
+}
+
+//
+// Call without the queue lock, after bumping wait_seq.
+//
+static void cf_queue_unpark(cf_queue *q, uint n)
+{
+#ifdef __linux__
+	syscall(SYS_futex, (void *)&q->wait_seq, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+#else
+	if (n > 1)
+		pthread_cond_broadcast(&q->CV);
+	else
+		pthread_cond_signal(&q->CV);
+#endif
+}
+
+//
+// Call with the queue lock held. Drops the lock to park, and returns with it
+// held again - false if the deadline tp passed.
+//
+static bool cf_queue_wait(cf_queue *q, const struct timespec *tp)
+{
+	uint32_t seen = q->wait_seq;
+
+	q->n_waiters++;
+	pthread_mutex_unlock(&q->LOCK);
+
+	bool woken = cf_queue_park(q, seen, tp);
+
+	pthread_mutex_lock(&q->LOCK);
+	q->n_waiters--;
+
+	return(woken);
+}
+
+//
+// Call with the queue lock held, having just added n elements. Returns how
+// many consumers to unpark once the lock is dropped.
+//
+static inline uint cf_queue_wake_count(cf_queue *q, uint n)
+{
+	uint n_waiters = q->n_waiters;
+
+	if (n_waiters == 0)
+		return(0);
+
+	q->wait_seq++;
+	return(n < n_waiters ? n : n_waiters);
+}
+
+/******************************************************************************
+ * INDEX
+ ******************************************************************************/
+
+// An indexed queue keeps a side table of the slots holding live elements,
+// keyed by a hash of the element bytes - open addressing with linear probing
+// and backward-shift deletion, sized to twice the queue allocation so it's
+// never more than half full.
+
+typedef struct cf_queue_index_ent_s {
+	uint32_t	tag;		// high bits of the element hash, skips most memcmps
+	uint32_t	slot;		// queue slot + 1, 0 if the entry is empty
+} cf_queue_index_ent;
+
+struct cf_queue_index_s {
+	uint32_t			mask;
+	cf_queue_index_ent	ents[];
+};
+
+// FNV-1a - elements are small, usually a few words.
+static inline uint64_t cf_queue_hash(const byte *elem, size_t elementsz)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (size_t i = 0; i < elementsz; i++) {
+		h ^= elem[i];
+		h *= 0x100000001b3ULL;
+	}
+	return(h);
+}
+
+static cf_queue_index * cf_queue_index_create(uint allocsz)
+{
+	uint n_ents = allocsz * 2;
+	cf_queue_index *x = (cf_queue_index*)cf_malloc_arena(sizeof(cf_queue_index) +
+			(n_ents * sizeof(cf_queue_index_ent)), CF_ALLOC_ARENA_QUEUE);
+
+	if (! x)
+		return(NULL);
+
+	x->mask = n_ents - 1;
+	memset(x->ents, 0, n_ents * sizeof(cf_queue_index_ent));
+	return(x);
+}
+
+static void cf_queue_index_add(cf_queue *q, uint slot)
+{
+	cf_queue_index *x = q->index;
+	uint64_t h = cf_queue_hash(&q->queue[slot * q->elementsz], q->elementsz);
+	uint32_t i = (uint32_t)h & x->mask;
+
+	while (x->ents[i].slot) {
+		i = (i + 1) & x->mask;
+	}
+
+	x->ents[i].tag = (uint32_t)(h >> 32);
+	x->ents[i].slot = slot + 1;
+}
+
+//
+// Find the queued element equal to elem that's nearest the head. Returns
+// false if it's not queued - if stop_at_any is set, returns on the first
+// match without an offset.
+//
+static bool cf_queue_index_find(cf_queue *q, const void *elem, bool stop_at_any,
+		uint64_t *offset)
+{
+	cf_queue_index *x = q->index;
+	uint64_t h = cf_queue_hash((const byte *)elem, q->elementsz);
+	uint32_t tag = (uint32_t)(h >> 32);
+	uint r_index = CF_Q_INDEX(q, q->read_offset);
+	uint64_t best = 0;
+	bool found = false;
+
+	// equal elements all hash to one cluster, so walk it to the end
+	for (uint32_t i = (uint32_t)h & x->mask; x->ents[i].slot; i = (i + 1) & x->mask) {
+		uint slot = x->ents[i].slot - 1;
+
+		if (x->ents[i].tag != tag ||
+				0 != memcmp(&q->queue[slot * q->elementsz], elem, q->elementsz)) {
+			continue;
+		}
+
+		if (stop_at_any)
+			return(true);
+
+		uint64_t dist = (slot - r_index) & (q->allocsz - 1);
+
+		if (! found || dist < best) {
+			best = dist;
+			found = true;
+		}
+	}
+
+	if (found)
+		*offset = q->read_offset + best;
+
+	return(found);
+}
+
+static void cf_queue_index_remove(cf_queue *q, uint slot)
+{
+	cf_queue_index *x = q->index;
+	uint64_t h = cf_queue_hash(&q->queue[slot * q->elementsz], q->elementsz);
+	uint32_t i = (uint32_t)h & x->mask;
+
+	while (x->ents[i].slot != slot + 1) {
+		if (! x->ents[i].slot)
+			return; // not indexed - shouldn't happen
+		i = (i + 1) & x->mask;
+	}
+
+	// Shift back any later entry of the cluster that the hole would otherwise
+	// cut off from its home position.
+	uint32_t j = i;
+
+	while (true) {
+		j = (j + 1) & x->mask;
+
+		if (! x->ents[j].slot)
+			break;
+
+		uint32_t home = (uint32_t)cf_queue_hash(
+				&q->queue[(x->ents[j].slot - 1) * q->elementsz], q->elementsz) & x->mask;
+
+		// move j into the hole unless its home lies cyclically in (i, j]
+		if (((j - home) & x->mask) >= ((j - i) & x->mask)) {
+			x->ents[i] = x->ents[j];
+			i = j;
+		}
+	}
+
+	x->ents[i].slot = 0;
+}
+
+//
+// Call after elements have moved - compaction or resize.
+//
+static void cf_queue_index_rebuild(cf_queue *q)
+{
+	memset(q->index->ents, 0, (q->index->mask + 1) * sizeof(cf_queue_index_ent));
+
+	for (uint64_t i = q->read_offset; i < q->write_offset; i++) {
+		if (! CF_Q_ELEM_DEAD(q, i)) {
+			cf_queue_index_add(q, CF_Q_INDEX(q, i));
+		}
+	}
+}
+
+/******************************************************************************
+ * LOCK-FREE RING
+ ******************************************************************************/
+
+static inline cf_queue_cell * cf_queue_ring_cell(cf_queue_ring *r, uint64_t pos)
+{
+	return (cf_queue_cell *)&r->cells[(pos & r->mask) * r->cell_sz];
+}
+
+static cf_queue_ring * cf_queue_ring_create(size_t elementsz, uint capacity)
+{
+	uint64_t n_cells = cf_queue_roundup_pow2(capacity);
+
+	size_t cell_sz = cf_roundup(sizeof(cf_queue_cell) + elementsz, sizeof(uint64_t));
+	cf_queue_ring *r = (cf_queue_ring*)cf_malloc_arena(sizeof(cf_queue_ring) + (n_cells * cell_sz), CF_ALLOC_ARENA_QUEUE);
+
+	if (!r)
+		return(NULL);
+
+	r->tail = 0;
+	r->head = 0;
+	r->mask = n_cells - 1;
+	r->cell_sz = cell_sz;
+
+	for (uint64_t i = 0; i < n_cells; i++) {
+		cf_queue_ring_cell(r, i)->seq = i;
+	}
+
+	return(r);
+}
+
+static bool cf_queue_ring_push(cf_queue_ring *r, void *ptr, size_t elementsz)
+{
+	uint64_t pos = cf_atomic64_get(r->tail);
+	cf_queue_cell *cell;
+
+	while (true) {
+		cell = cf_queue_ring_cell(r, pos);
+
+		int64_t dif = (int64_t)cf_atomic64_get(cell->seq) - (int64_t)pos;
+
+		if (dif == 0) {
+			uint64_t prior = cf_atomic64_cas(&r->tail, pos, pos + 1);
+
+			if (prior == pos) {
+				break;
+			}
+			pos = prior;
+		}
+		else if (dif < 0) {
+			// The consumer of the previous lap hasn't freed the cell. Only
+			// report full if it really is - otherwise that consumer is mid-copy
+			// (maybe preempted), so let it finish.
+			if (pos - cf_atomic64_get(r->head) > r->mask) {
+				return(false);
+			}
+			sched_yield();
+			pos = cf_atomic64_get(r->tail);
+		}
+		else {
+			pos = cf_atomic64_get(r->tail);
+		}
+	}
+
+	memcpy(cell->data, ptr, elementsz);
+
+	// release - the element must be visible before the sequence number
+	CF_MEMORY_BARRIER_WRITE();
+	cf_atomic64_set(&cell->seq, pos + 1);
+	return(true);
+}
+
+static bool cf_queue_ring_pop(cf_queue_ring *r, void *buf, size_t elementsz)
+{
+	uint64_t pos = cf_atomic64_get(r->head);
+	cf_queue_cell *cell;
+
+	while (true) {
+		cell = cf_queue_ring_cell(r, pos);
+
+		int64_t dif = (int64_t)cf_atomic64_get(cell->seq) - (int64_t)(pos + 1);
+
+		if (dif == 0) {
+			uint64_t prior = cf_atomic64_cas(&r->head, pos, pos + 1);
+
+			if (prior == pos) {
+				break;
+			}
+			pos = prior;
+		}
+		else if (dif < 0) {
+			// No producer has filled this cell. If none has claimed it either
+			// the ring is empty - otherwise that producer is mid-copy.
+			if (cf_atomic64_get(r->tail) == pos) {
+				return(false);
+			}
+			sched_yield();
+			pos = cf_atomic64_get(r->head);
+		}
+		else {
+			pos = cf_atomic64_get(r->head);
+		}
+	}
+
+	memcpy(buf, cell->data, elementsz);
+
+	// release - hand the cell to the producer of the next lap
+	CF_MEMORY_BARRIER_WRITE();
+	cf_atomic64_set(&cell->seq, pos + r->mask + 1);
+	return(true);
+}
+
+static inline int cf_queue_ring_sz(cf_queue_ring *r)
+{
+	// Racy snapshot - read head first so the result can't go negative.
+	uint64_t head = cf_atomic64_get(r->head);
+	uint64_t tail = cf_atomic64_get(r->tail);
+
+	return(tail > head ? (int)(tail - head) : 0);
+}
+
+static int cf_queue_ring_push_wake(cf_queue *q, void *ptr)
+{
+	cf_queue_ring *r = q->ring;
+
+	if (! cf_queue_ring_push(r, ptr, q->elementsz)) {
+		return(CF_QUEUE_ERR);
+	}
+
+	// Pairs with the waiter count increment in cf_queue_ring_pop_wait() - the
+	// published element must be visible before we look for sleepers, otherwise
+	// a consumer could re-check an empty ring and park after we skipped it.
+	smb_mb();
+
+	if (cf_atomic32_get(q->n_waiters) != 0) {
+#ifdef __linux__
+		cf_atomic32_incr(&q->wait_seq);
+#else
+		// the condvar fallback checks wait_seq under the lock
+		pthread_mutex_lock(&q->LOCK);
+		q->wait_seq++;
+		pthread_mutex_unlock(&q->LOCK);
+#endif
+		cf_queue_unpark(q, 1);
+	}
+
+	return(CF_QUEUE_OK);
+}
+
+static int cf_queue_ring_pop_wait(cf_queue *q, void *buf, int ms_wait)
+{
+	cf_queue_ring *r = q->ring;
+
+	// Fast path - never park unless the ring is empty.
+	if (cf_queue_ring_pop(r, buf, q->elementsz)) {
+		return(CF_QUEUE_OK);
+	}
+
+	if (CF_QUEUE_NOWAIT == ms_wait) {
+		return(CF_QUEUE_EMPTY);
+	}
+
+	struct timespec tp;
+	if (ms_wait > 0) {
+		cf_set_wait_timespec(ms_wait, &tp);
+	}
+
+	int rv = CF_QUEUE_OK;
+
+	// The locked increment is a full barrier - pairs with smb_mb() in
+	// cf_queue_ring_push_wake().
+	cf_atomic32_incr(&q->n_waiters);
+
+	while (true) {
+		uint32_t seen = cf_atomic32_get(q->wait_seq);
+
+		if (cf_queue_ring_pop(r, buf, q->elementsz)) {
+			break;
+		}
+
+		if (! cf_queue_park(q, seen, ms_wait > 0 ? &tp : NULL)) {
+			if (! cf_queue_ring_pop(r, buf, q->elementsz)) {
+				rv = CF_QUEUE_EMPTY;
+			}
+			break;
+		}
+	}
+
+	cf_atomic32_decr(&q->n_waiters);
+
+	return(rv);
+}
+
 /******************************************************************************
  * FUNCTIONS
  ******************************************************************************/
 
-cf_queue * cf_queue_create(size_t elementsz, bool threadsafe)
+//
+// Element array of allocsz elements - none for a lock-free ring, which keeps
+// its elements in the ring.
+//
+static cf_queue * cf_queue_alloc(size_t elementsz, bool threadsafe, uint allocsz)
 {
-	cf_queue *q = (cf_queue*)cf_malloc( sizeof(cf_queue));
+	cf_queue *q = (cf_queue*)cf_malloc_arena( sizeof(cf_queue), CF_ALLOC_ARENA_QUEUE);
 
 	if (!q)
 		return(NULL);
 
-	q->allocsz = CF_QUEUE_ALLOCSZ;
+	q->allocsz = allocsz;
 	q->write_offset = q->read_offset = 0;
 	q->elementsz = elementsz;
 	q->threadsafe = threadsafe;
-
-	q->queue = (uint8_t*)cf_malloc(CF_QUEUE_ALLOCSZ * elementsz);
-	if (! q->queue) {
-		cf_free(q);
-		return(NULL);
+	q->capacity = 0;
+	q->ring = NULL;
+	q->dead = NULL;
+	q->n_dead = 0;
+	q->index = NULL;
+	q->n_waiters = 0;
+	q->wait_seq = 0;
+	q->queue = NULL;
+
+	if (allocsz) {
+		q->queue = (uint8_t*)cf_malloc_arena(allocsz * elementsz, CF_ALLOC_ARENA_QUEUE);
+		if (! q->queue) {
+			cf_free(q);
+			return(NULL);
+		}
 	}
 
 	if (!q->threadsafe)
@@ -59,14 +585,77 @@ cf_queue * cf_queue_create(size_t elementsz, bool threadsafe)
 	return(q);
 }
 
+cf_queue * cf_queue_create(size_t elementsz, bool threadsafe)
+{
+	return(cf_queue_alloc(elementsz, threadsafe, cf_queue_roundup_pow2(CF_QUEUE_ALLOCSZ)));
+}
+
+cf_queue * cf_queue_create_bounded(size_t elementsz, uint capacity, uint flags)
+{
+	if (capacity == 0)
+		return(NULL);
+
+	if (flags & CF_QUEUE_LOCKFREE) {
+		cf_queue *q = cf_queue_alloc(elementsz, true, 0);
+
+		if (!q)
+			return(NULL);
+
+		q->ring = cf_queue_ring_create(elementsz, capacity);
+		if (! q->ring) {
+			cf_queue_destroy(q);
+			return(NULL);
+		}
+		q->capacity = (uint)(q->ring->mask + 1);
+		return(q);
+	}
+
+	// Allocate the whole thing now - cf_queue_reserve() never goes past it.
+	uint allocsz = cf_queue_roundup_pow2(capacity);
+	uint default_sz = cf_queue_roundup_pow2(CF_QUEUE_ALLOCSZ);
+	cf_queue *q = cf_queue_alloc(elementsz, true, allocsz > default_sz ? allocsz : default_sz);
+
+	if (!q)
+		return(NULL);
+
+	q->capacity = capacity;
+	return(q);
+}
+
+cf_queue * cf_queue_create_indexed(size_t elementsz, bool threadsafe)
+{
+	cf_queue *q = cf_queue_create(elementsz, threadsafe);
+
+	if (!q)
+		return(NULL);
+
+	q->index = cf_queue_index_create(q->allocsz);
+	if (! q->index) {
+		cf_queue_destroy(q);
+		return(NULL);
+	}
+
+	return(q);
+}
+
 void cf_queue_destroy(cf_queue *q) 
 {
 	if (q->threadsafe) {
 		pthread_cond_destroy(&q->CV);
 		pthread_mutex_destroy(&q->LOCK);
 	}
-	memset(q->queue, 0, sizeof(q->allocsz * q->elementsz));
-	cf_free(q->queue);
+	if (q->ring) {
+		cf_free(q->ring);
+	}
+	if (q->dead) {
+		cf_free(q->dead);
+	}
+	if (q->index) {
+		cf_free(q->index);
+	}
+	if (q->queue) {
+		cf_free(q->queue);
+	}
 	memset(q, 0, sizeof(cf_queue) );
 	cf_free(q);
 }
@@ -75,6 +664,9 @@ int cf_queue_sz(cf_queue *q)
 {
 	int rv;
 
+	if (q->ring)
+		return(cf_queue_ring_sz(q->ring));
+
 	if (q->threadsafe)
 		pthread_mutex_lock(&q->LOCK);
 
@@ -86,59 +678,164 @@ int cf_queue_sz(cf_queue *q)
 	return(rv);
 }
 
+//
+// Internal function. Copy n elements starting at the read offset into buf,
+// without consuming them - at most two memcpys across the wrap point.
+//
+static void cf_queue_copy_out(cf_queue *q, byte *buf, uint n)
+{
+	uint r_index = CF_Q_INDEX(q, q->read_offset);
+	uint first = q->allocsz - r_index;
+
+	if (first > n) {
+		first = n;
+	}
+
+	memcpy(buf, &q->queue[r_index * q->elementsz], first * q->elementsz);
+
+	if (n > first) {
+		memcpy(&buf[first * q->elementsz], &q->queue[0], (n - first) * q->elementsz);
+	}
+}
+
+//
+// Internal function. Call with lock held. Squeeze out the tombstones left by
+// cf_queue_delete_offset(), sliding live elements toward the head.
+//
+static void cf_queue_compact(cf_queue *q)
+{
+	uint64_t w = q->read_offset;
+
+	for (uint64_t i = q->read_offset; i < q->write_offset; i++) {
+		if (CF_Q_ELEM_DEAD(q, i)) {
+			cf_queue_clear_dead(q, i);
+			continue;
+		}
+		if (w != i) {
+			memcpy(CF_Q_ELEM_PTR(q, w), CF_Q_ELEM_PTR(q, i), q->elementsz);
+		}
+		w++;
+	}
+
+	q->write_offset = w;
+
+	if (q->index)
+		cf_queue_index_rebuild(q);
+}
+
 //
 // Internal function. Call with new size with lock held.
-// This function only works on full queues.
+// Grows the allocation to new_sz, a larger power of 2. The queue must have
+// been compacted.
 //
 static int cf_queue_resize(cf_queue *q, uint new_sz)
 {
-	// check if queue is not full
-	if (CF_Q_SZ(q) != q->allocsz) {
+	if (new_sz <= q->allocsz || q->n_dead) {
 		return(-1);
 	}
-	
-	// the rare case where the queue is not fragmented, and realloc makes sense
-	// and none of the offsets need to move
-	if (0 == q->read_offset % q->allocsz) {
-		q->queue = (uint8_t*)cf_realloc(q->queue, new_sz * q->elementsz);
-		if (!q->queue) {
+
+	uint old_sz = q->allocsz;
+	uint sz = CF_Q_SZ(q);
+	uint r_index = CF_Q_INDEX(q, q->read_offset);
+
+	cf_queue_index *index = NULL;
+
+	if (q->index) {
+		index = cf_queue_index_create(new_sz);
+		if (!index) {
 			return(-1);
 		}
-		q->read_offset = 0;
-		q->write_offset = q->allocsz;
 	}
-	else {
-		
-		byte *newq = (uint8_t*)cf_malloc(new_sz * q->elementsz);
-		if (!newq) {
+
+	// no tombstones after compaction, so the bitmap just grows cleared
+	if (q->dead) {
+		uint64_t *dead = (uint64_t*)cf_realloc_arena(q->dead, CF_Q_DEAD_WORDS(new_sz) * sizeof(uint64_t), CF_ALLOC_ARENA_QUEUE);
+		if (!dead) {
+			if (index)
+				cf_free(index);
 			return(-1);
 		}
-		// endsz is used bytes in the old queue from the insert point to the end
-		size_t endsz = (q->allocsz - (q->read_offset % q->allocsz)) * q->elementsz;
-		memcpy(&newq[0], CF_Q_ELEM_PTR(q, q->read_offset), endsz);
-		memcpy(&newq[endsz], &q->queue[0], (q->allocsz * q->elementsz) - endsz); 
-		
-		cf_free(q->queue);
-		q->queue = newq;
-
-		q->write_offset = q->allocsz;
-		q->read_offset = 0;
+		memset(dead, 0, CF_Q_DEAD_WORDS(new_sz) * sizeof(uint64_t));
+		q->dead = dead;
 	}
 
+	byte *newq = (uint8_t*)cf_realloc_arena(q->queue, new_sz * q->elementsz, CF_ALLOC_ARENA_QUEUE);
+	if (!newq) {
+		if (index)
+			cf_free(index);
+		return(-1);
+	}
+	q->queue = newq;
 	q->allocsz = new_sz;
+
+	// Elements that didn't wrap keep their index under the new mask. If the
+	// contents wrapped, realloc kept both parts in place and one memcpy mends
+	// the gap - move whichever part is smaller, the wrapped prefix up past the
+	// old end, or the tail up against the new end.
+	if (r_index + sz > old_sz) {
+		uint tail_n = old_sz - r_index;
+		uint wrap_n = sz - tail_n;
+
+		if (wrap_n <= tail_n) {
+			memcpy(&q->queue[old_sz * q->elementsz], &q->queue[0],
+					wrap_n * q->elementsz);
+			q->read_offset = r_index;
+		}
+		else {
+			memcpy(&q->queue[(new_sz - tail_n) * q->elementsz],
+					&q->queue[r_index * q->elementsz], tail_n * q->elementsz);
+			q->read_offset = new_sz - tail_n;
+		}
+	}
+	else {
+		q->read_offset = r_index;
+	}
+
+	q->write_offset = q->read_offset + sz;
+
+	if (index) {
+		cf_free(q->index);
+		q->index = index;
+		cf_queue_index_rebuild(q);
+	}
+
 	return(0);	
 }
 
 //
-// we have to guard against wraparound, call this occasionally
-// I really expect this will never get called....
-// HOWEVER it can be a symptom of a queue getting really, really deep
+// Internal function. Call with lock held. Make sure there's room for n more
+// elements, doubling the allocation as needed.
 //
-static void cf_queue_unwrap(cf_queue *q)
+static int cf_queue_reserve(cf_queue *q, uint n)
 {
-	int sz = CF_Q_SZ(q);
-	q->read_offset %= q->allocsz;
-	q->write_offset = q->read_offset + sz;
+	// bounded queues never grow past their capacity
+	if (q->capacity && CF_Q_SZ(q) + n > q->capacity) {
+		return(-1);
+	}
+
+	// tombstones take up slots until they're compacted
+	uint64_t need = q->write_offset - q->read_offset + n;
+
+	if (need <= q->allocsz) {
+		return(0);
+	}
+
+	if (q->n_dead) {
+		cf_queue_compact(q);
+		need = CF_Q_SZ(q) + n;
+
+		if (need <= q->allocsz) {
+			return(0);
+		}
+	}
+
+	uint new_sz = q->allocsz;
+
+	while (new_sz < need) {
+		new_sz *= 2;
+	}
+
+	return(cf_queue_resize(q, new_sz));
 }
 
 int cf_queue_push(cf_queue *q, void *ptr)
@@ -147,30 +844,32 @@ int cf_queue_push(cf_queue *q, void *ptr)
 		return(-1);
 	}
 
+	if (q->ring)
+		return(cf_queue_ring_push_wake(q, ptr));
+
 	if (q->threadsafe && (0 != pthread_mutex_lock(&q->LOCK)))
 		return(-1);
 
 	// Check queue length
-	if (CF_Q_SZ(q) == q->allocsz) {
-		if (0 != cf_queue_resize(q, q->allocsz * 2)) {
-			if (q->threadsafe)
-				pthread_mutex_unlock(&q->LOCK);
-			return(-1);
-		}
+	if (0 != cf_queue_reserve(q, 1)) {
+		if (q->threadsafe)
+			pthread_mutex_unlock(&q->LOCK);
+		return(-1);
 	}
 
-	// todo: if queues are power of 2, this can be a shift
 	memcpy(CF_Q_ELEM_PTR(q,q->write_offset), ptr, q->elementsz);
+	if (q->index)
+		cf_queue_index_add(q, CF_Q_INDEX(q, q->write_offset));
 	q->write_offset++;
-	// we're at risk of overflow if the write offset is that high
-	if (q->write_offset & 0xC0000000) cf_queue_unwrap(q);
 	
-	if (q->threadsafe)
-		pthread_cond_signal(&q->CV);
+	uint wake = cf_queue_wake_count(q, 1);
 
 	if (q->threadsafe && (0 != pthread_mutex_unlock(&q->LOCK)))
 		return(-1);
 
+	if (wake)
+		cf_queue_unpark(q, wake);
+
 	return(0);
 }
 
@@ -180,6 +879,11 @@ int cf_queue_push(cf_queue *q, void *ptr)
 //
 bool cf_queue_push_limit(cf_queue *q, void *ptr, uint limit)
 {
+	// the lock-free size is only a snapshot, so the limit is approximate
+	if (q->ring)
+		return(cf_queue_ring_sz(q->ring) < limit &&
+				cf_queue_ring_push_wake(q, ptr) == CF_QUEUE_OK);
+
 	if (q->threadsafe && (0 != pthread_mutex_lock(&q->LOCK)))
 		return false;
 
@@ -191,26 +895,25 @@ bool cf_queue_push_limit(cf_queue *q, void *ptr, uint limit)
 		return false;
 	}
 
-	if (size == q->allocsz) {
-		if (0 != cf_queue_resize(q, q->allocsz * 2)) {
-			if (q->threadsafe)
-				pthread_mutex_unlock(&q->LOCK);
-			return false;
-		}
+	if (0 != cf_queue_reserve(q, 1)) {
+		if (q->threadsafe)
+			pthread_mutex_unlock(&q->LOCK);
+		return false;
 	}
 
-	// todo: if queues are power of 2, this can be a shift
 	memcpy(CF_Q_ELEM_PTR(q,q->write_offset), ptr, q->elementsz);
+	if (q->index)
+		cf_queue_index_add(q, CF_Q_INDEX(q, q->write_offset));
 	q->write_offset++;
-	// we're at risk of overflow if the write offset is that high
-	if (q->write_offset & 0xC0000000) cf_queue_unwrap(q);
 
-	if (q->threadsafe)
-		pthread_cond_signal(&q->CV);
+	uint wake = cf_queue_wake_count(q, 1);
 
 	if (q->threadsafe && (0 != pthread_mutex_unlock(&q->LOCK)))
 		return false;
 
+	if (wake)
+		cf_queue_unpark(q, wake);
+
 	return true;
 }
 
@@ -219,13 +922,25 @@ bool cf_queue_push_limit(cf_queue *q, void *ptr, uint limit)
 //
 int cf_queue_push_unique(cf_queue *q, void *ptr)
 {
+	if (q->ring)
+		return(-1);
+
 	if (q->threadsafe && (0 != pthread_mutex_lock(&q->LOCK)))
 		return(-1);
 
 	// Check if element is already queued.
-	if (CF_Q_SZ(q)) {
-		for (uint i = q->read_offset; i < q->write_offset; i++) {
-			if (0 == memcmp(CF_Q_ELEM_PTR(q, i), ptr, q->elementsz)) {
+	if (q->index) {
+		if (cf_queue_index_find(q, ptr, true, NULL)) {
+			if (q->threadsafe) {
+				pthread_mutex_unlock(&q->LOCK);
+			}
+			return -2;
+		}
+	}
+	else if (CF_Q_SZ(q)) {
+		for (uint64_t i = q->read_offset; i < q->write_offset; i++) {
+			if (! CF_Q_ELEM_DEAD(q, i) &&
+					0 == memcmp(CF_Q_ELEM_PTR(q, i), ptr, q->elementsz)) {
 				if (q->threadsafe) {
 					pthread_mutex_unlock(&q->LOCK);
 				}
@@ -236,72 +951,123 @@ int cf_queue_push_unique(cf_queue *q, void *ptr)
 		}
 	}
 
-	if (CF_Q_SZ(q) == q->allocsz) {
-		if (0 != cf_queue_resize(q, q->allocsz * 2)) {
-			if (q->threadsafe)
-				pthread_mutex_unlock(&q->LOCK);
-			return(-1);
-		}
+	if (0 != cf_queue_reserve(q, 1)) {
+		if (q->threadsafe)
+			pthread_mutex_unlock(&q->LOCK);
+		return(-1);
 	}
 
-	// todo: if queues are power of 2, this can be a shift
 	memcpy(CF_Q_ELEM_PTR(q,q->write_offset), ptr, q->elementsz);
+	if (q->index)
+		cf_queue_index_add(q, CF_Q_INDEX(q, q->write_offset));
 	q->write_offset++;
-	// we're at risk of overflow if the write offset is that high
-	if (q->write_offset & 0xC0000000) cf_queue_unwrap(q);
 
-	if (q->threadsafe)
-		pthread_cond_signal(&q->CV);
+	uint wake = cf_queue_wake_count(q, 1);
 
 	if (q->threadsafe && (0 != pthread_mutex_unlock(&q->LOCK)))
 		return(-1);
 
+	if (wake)
+		cf_queue_unpark(q, wake);
+
 	return(0);
 }
 
 //
 // cf_queue_push_head
-// Push head goes to the front, which currently means memcpying the entire queue contents.
+// Push head goes to the front, just behind the read offset.
 //
 int cf_queue_push_head(cf_queue *q, void *ptr) 
 {
+	if (q->ring)
+		return(-1);
+
 	if (q->threadsafe && (0 != pthread_mutex_lock(&q->LOCK)))
 		return(-1);
 
-	if (CF_Q_SZ(q) == q->allocsz) {
-		if (0 != cf_queue_resize(q, q->allocsz * 2)) {
-			if (q->threadsafe)
-				pthread_mutex_unlock(&q->LOCK);
-			return(-1);
-		}
+	if (0 != cf_queue_reserve(q, 1)) {
+		if (q->threadsafe)
+			pthread_mutex_unlock(&q->LOCK);
+		return(-1);
 	}
 	
-	// easy case, tail insert is head insert
-	if (q->read_offset == q->write_offset) {
-		memcpy(CF_Q_ELEM_PTR(q,q->write_offset), ptr, q->elementsz);
-		q->write_offset++;
-	}		
-	// another easy case, there's space up front
-	else if (q->read_offset > 0) {
-		q->read_offset--;
-		memcpy(CF_Q_ELEM_PTR(q,q->read_offset), ptr, q->elementsz);
-	}
-	// hard case, we're going to have to shift everything back
-	else {
-		memmove(CF_Q_ELEM_PTR(q, 1),CF_Q_ELEM_PTR(q, 0),q->elementsz * CF_Q_SZ(q) );
-		memcpy(CF_Q_ELEM_PTR(q,0), ptr, q->elementsz);		
-		q->write_offset++;
-	}	
-		
-	// we're at risk of overflow if the write offset is that high
-	if (q->write_offset & 0xC0000000) cf_queue_unwrap(q);
+	// the slot below the read offset is free, it may just be across the wrap -
+	// step both offsets up a lap first so the read offset can't go below 0
+	if (q->read_offset == 0) {
+		q->read_offset += q->allocsz;
+		q->write_offset += q->allocsz;
+	}
+
+	q->read_offset--;
+	memcpy(CF_Q_ELEM_PTR(q,q->read_offset), ptr, q->elementsz);
+	if (q->index)
+		cf_queue_index_add(q, CF_Q_INDEX(q, q->read_offset));
 	
-	if (q->threadsafe)
-		pthread_cond_signal(&q->CV);
+	uint wake = cf_queue_wake_count(q, 1);
 
 	if (q->threadsafe && (0 != pthread_mutex_unlock(&q->LOCK)))
 		return(-1);
 
+	if (wake)
+		cf_queue_unpark(q, wake);
+
+	return(0);
+}
+
+//
+// cf_queue_push_n
+// Push n contiguous elements with one lock, at most two memcpys and a single
+// wakeup for the whole batch.
+//
+int cf_queue_push_n(cf_queue *q, void *elems, uint n)
+{
+	if (!q || !elems || q->ring) {
+		return(-1);
+	}
+
+	if (n == 0) {
+		return(0);
+	}
+
+	if (q->threadsafe && (0 != pthread_mutex_lock(&q->LOCK)))
+		return(-1);
+
+	if (0 != cf_queue_reserve(q, n)) {
+		if (q->threadsafe)
+			pthread_mutex_unlock(&q->LOCK);
+		return(-1);
+	}
+
+	uint w_index = CF_Q_INDEX(q, q->write_offset);
+	uint first = q->allocsz - w_index;
+
+	if (first > n) {
+		first = n;
+	}
+
+	memcpy(CF_Q_ELEM_PTR(q, q->write_offset), elems, first * q->elementsz);
+
+	if (n > first) {
+		memcpy(&q->queue[0], (byte *)elems + (first * q->elementsz), (n - first) * q->elementsz);
+	}
+
+	if (q->index) {
+		for (uint i = 0; i < n; i++) {
+			cf_queue_index_add(q, CF_Q_INDEX(q, q->write_offset + i));
+		}
+	}
+
+	q->write_offset += n;
+
+	// one consumer per element, at most
+	uint wake = cf_queue_wake_count(q, n);
+
+	if (q->threadsafe && (0 != pthread_mutex_unlock(&q->LOCK)))
+		return(-1);
+
+	if (wake)
+		cf_queue_unpark(q, wake);
+
 	return(0);
 }
 
@@ -316,6 +1082,9 @@ int cf_queue_pop(cf_queue *q, void *buf, int ms_wait)
 	if (NULL == q)
 		return(-1);
 
+	if (q->ring)
+		return(cf_queue_ring_pop_wait(q, buf, ms_wait));
+
 	if (q->threadsafe && (0 != pthread_mutex_lock(&q->LOCK)))
 		return(-1);
 
@@ -324,31 +1093,27 @@ int cf_queue_pop(cf_queue *q, void *buf, int ms_wait)
         cf_set_wait_timespec(ms_wait, &tp);
 	}
 
-	// Note that we apparently have to use a while() loop.  Careful reading
-	// of the pthread_cond_signal() documentation says that AT LEAST ONE
-	// waiting thread will be awakened...
+	// Note that we have to use a while() loop - another consumer may beat us
+	// to the element we were woken for.
 	if (q->threadsafe) {
 		while (CF_Q_EMPTY(q)) {
-			if (CF_QUEUE_FOREVER == ms_wait) {
-				pthread_cond_wait(&q->CV, &q->LOCK);
-			}
-			else if (CF_QUEUE_NOWAIT == ms_wait) {
+			if (CF_QUEUE_NOWAIT == ms_wait) {
 				pthread_mutex_unlock(&q->LOCK);
 				return(CF_QUEUE_EMPTY);
 			}
-			else {
-				pthread_cond_timedwait(&q->CV, &q->LOCK, &tp);
-				if (CF_Q_EMPTY(q)) {
-					pthread_mutex_unlock(&q->LOCK);
-					return(CF_QUEUE_EMPTY);
-				}
+			if (! cf_queue_wait(q, ms_wait > 0 ? &tp : NULL) && CF_Q_EMPTY(q)) {
+				pthread_mutex_unlock(&q->LOCK);
+				return(CF_QUEUE_EMPTY);
 			}
 		}
 	} else if (CF_Q_EMPTY(q))
 		return(CF_QUEUE_EMPTY);
 
 	memcpy(buf, CF_Q_ELEM_PTR(q,q->read_offset), q->elementsz);
+	if (q->index)
+		cf_queue_index_remove(q, CF_Q_INDEX(q, q->read_offset));
 	q->read_offset++;
+	cf_queue_trim(q);
 	
 	// interesting idea - this probably keeps the cache fresher
 	// because the queue is fully empty just make it all zero
@@ -363,40 +1128,122 @@ int cf_queue_pop(cf_queue *q, void *buf, int ms_wait)
 	return(0);
 }
 
-void cf_queue_delete_offset(cf_queue *q, uint index)
+//
+// cf_queue_pop_n
+// Pop up to max elements into buf with one lock and at most two memcpys.
+// Waits (as cf_queue_pop) only until at least one element is available.
+// Returns the number of elements popped, or CF_QUEUE_EMPTY / CF_QUEUE_ERR.
+//
+int cf_queue_pop_n(cf_queue *q, void *buf, uint max, int ms_wait)
 {
-	index %= q->allocsz;
-	uint r_index = q->read_offset % q->allocsz;
-	uint w_index = q->write_offset % q->allocsz;
-	
-	// assumes index is validated!
+	if (NULL == q || q->ring || max == 0)
+		return(-1);
+
+	if (q->threadsafe && (0 != pthread_mutex_lock(&q->LOCK)))
+		return(-1);
+
+	struct timespec tp;
+	if (ms_wait > 0) {
+		cf_set_wait_timespec(ms_wait, &tp);
+	}
+
+	if (q->threadsafe) {
+		while (CF_Q_EMPTY(q)) {
+			if (CF_QUEUE_NOWAIT == ms_wait) {
+				pthread_mutex_unlock(&q->LOCK);
+				return(CF_QUEUE_EMPTY);
+			}
+			if (! cf_queue_wait(q, ms_wait > 0 ? &tp : NULL) && CF_Q_EMPTY(q)) {
+				pthread_mutex_unlock(&q->LOCK);
+				return(CF_QUEUE_EMPTY);
+			}
+		}
+	} else if (CF_Q_EMPTY(q))
+		return(CF_QUEUE_EMPTY);
+
+	uint n = CF_Q_SZ(q);
+
+	if (n > max) {
+		n = max;
+	}
+
+	if (q->n_dead == 0) {
+		cf_queue_copy_out(q, (byte *)buf, n);
+		if (q->index) {
+			for (uint i = 0; i < n; i++) {
+				cf_queue_index_remove(q, CF_Q_INDEX(q, q->read_offset + i));
+			}
+		}
+		q->read_offset += n;
+	}
+	else {
+		// tombstones in the way - take them one at a time
+		for (uint i = 0; i < n; i++) {
+			memcpy((byte *)buf + (i * q->elementsz), CF_Q_ELEM_PTR(q, q->read_offset), q->elementsz);
+			if (q->index)
+				cf_queue_index_remove(q, CF_Q_INDEX(q, q->read_offset));
+			q->read_offset++;
+			cf_queue_trim(q);
+		}
+	}
+
+	if (q->read_offset == q->write_offset) {
+		q->read_offset = q->write_offset = 0;
+	}
+
+	if (q->threadsafe && (0 != pthread_mutex_unlock(&q->LOCK))) {
+		return(-1);
+	}
+
+	return((int)n);
+}
+
+//
+// Delete at either end just moves the offset. Anywhere else the element is
+// marked dead in place, and skipped by pop until compaction or a resize
+// squeezes it out.
+//
+void cf_queue_delete_offset(cf_queue *q, uint64_t offset)
+{
+	// assumes offset is validated!
+
+	if (q->index)
+		cf_queue_index_remove(q, CF_Q_INDEX(q, offset));
 	
 	// if we're deleting the one at the head, just increase the readoffset
-	if (index == r_index) {
+	if (offset == q->read_offset) {
 		q->read_offset++;
+		cf_queue_trim(q);
 		return;
 	}
 	// if we're deleting the tail just decrease the write offset
-	if (w_index && (index == w_index - 1)) {
+	if (offset == q->write_offset - 1) {
 		q->write_offset--;
+		cf_queue_trim(q);
 		return;
 	}
-	// and the memory copy is overlapping, so must use memmove
-	if (index > r_index) {
-		memmove( &q->queue[ (r_index + 1) * q->elementsz ],
-			     &q->queue[ r_index * q->elementsz ],
-				 (index - r_index) * q->elementsz );
-		q->read_offset++;
-		return;
-	}
-	
-	if (index < w_index) {
-		memmove( &q->queue[ index * q->elementsz ],
-			     &q->queue[ (index + 1) * q->elementsz ],
-			     (w_index - index - 1) * q->elementsz);
-		q->write_offset--;
-		return;
+
+	if (! q->dead) {
+		q->dead = (uint64_t*)cf_malloc_arena(CF_Q_DEAD_WORDS(q->allocsz) * sizeof(uint64_t), CF_ALLOC_ARENA_QUEUE);
+
+		// no memory for the bitmap - fall back to closing the gap
+		if (! q->dead) {
+			for (uint64_t i = offset; i < q->write_offset - 1; i++) {
+				memcpy(CF_Q_ELEM_PTR(q, i), CF_Q_ELEM_PTR(q, i + 1), q->elementsz);
+			}
+			q->write_offset--;
+
+			if (q->index)
+				cf_queue_index_rebuild(q);
+			return;
+		}
+		memset(q->dead, 0, CF_Q_DEAD_WORDS(q->allocsz) * sizeof(uint64_t));
 	}
+
+	uint index = CF_Q_INDEX(q, offset);
+
+	q->dead[index >> 6] |= 1ULL << (index & 63);
+	q->n_dead++;
 }
 
 //
@@ -404,7 +1251,7 @@ void cf_queue_delete_offset(cf_queue *q, uint index)
 //
 int cf_queue_reduce(cf_queue *q,  cf_queue_reduce_fn cb, void *udata)
 {
-	if (NULL == q)
+	if (NULL == q || q->ring)
 		return(-1);
 
 	if (q->threadsafe && (0 != pthread_mutex_lock(&q->LOCK)))
@@ -417,10 +1264,13 @@ int cf_queue_reduce(cf_queue *q,  cf_queue_reduce_fn cb, void *udata)
 		// will change the read and write offset, so this is simpler for now
 		// can optimize if necessary later....
 		
-		for (uint i = q->read_offset ; 
+		for (uint64_t i = q->read_offset ; 
 			 i < q->write_offset ;
 			 i++)
 		{
+			if (CF_Q_ELEM_DEAD(q, i)) {
+				continue;
+			}
 			
 			int rv = cb(CF_Q_ELEM_PTR(q, i), udata);
 			
@@ -449,7 +1299,7 @@ Found:
 //
 int cf_queue_reduce_reverse(cf_queue *q, cf_queue_reduce_fn cb, void *udata)
 {
-	if (NULL == q)
+	if (NULL == q || q->ring)
 		return(-1);
 
 	if (q->threadsafe && (0 != pthread_mutex_lock(&q->LOCK)))
@@ -463,10 +1313,13 @@ int cf_queue_reduce_reverse(cf_queue *q, cf_queue_reduce_fn cb, void *udata)
 		// can optimize if necessary later....
 		// Iterate over all queue members calling the callback
 
-		for (uint i = q->write_offset - 1 ;
-			 i >= q->read_offset ;
-			 i--)
+		for (uint64_t i = q->write_offset ;
+			 i-- > q->read_offset ;
+			 )
 		{
+			if (CF_Q_ELEM_DEAD(q, i)) {
+				continue;
+			}
 
 			int rv = cb(CF_Q_ELEM_PTR(q, i), udata);
 
@@ -499,17 +1352,45 @@ int cf_queue_delete(cf_queue *q, void *buf, bool only_one)
 	if (NULL == q)
 		return(CF_QUEUE_ERR);
 
+	if (q->ring) {
+		if (buf)
+			return(CF_QUEUE_ERR);
+
+		// delete all - just drain the ring
+		uint8_t scratch[q->elementsz];
+		bool found = false;
+
+		while (cf_queue_ring_pop(q->ring, scratch, q->elementsz)) {
+			found = true;
+		}
+		return(found ? CF_QUEUE_OK : CF_QUEUE_EMPTY);
+	}
+
 	if (q->threadsafe && (0 != pthread_mutex_lock(&q->LOCK)))
 		return(CF_QUEUE_ERR);
 
 	bool found = false;
-	
-	if (CF_Q_SZ(q)) {
 
-		for (uint i = q->read_offset ; 
-			 i < q->write_offset ;
-			 i++)
-		{
+	if (q->index && buf) {
+		uint64_t offset;
+
+		// earliest first, same as the scan
+		while (cf_queue_index_find(q, buf, false, &offset)) {
+			cf_queue_delete_offset(q, offset);
+			found = true;
+			if (only_one == true)	goto Done;
+		}
+	}
+	else if (CF_Q_SZ(q)) {
+
+		uint64_t i = q->read_offset;
+
+		while (i < q->write_offset) {
+
+			if (CF_Q_ELEM_DEAD(q, i)) {
+				i++;
+				continue;
+			}
 
 			int rv = 0;
 			
@@ -521,7 +1402,13 @@ int cf_queue_delete(cf_queue *q, void *buf, bool only_one)
 				found = true;
 				if (only_one == true)	goto Done;
 			}
-		};
+
+			// deleting at the head may have trimmed tombstones behind it
+			i++;
+			if (i < q->read_offset) {
+				i = q->read_offset;
+			}
+		}
 	}
 
 Done:
@@ -18,6 +18,368 @@
 #include <citrusleaf/cf_clock.h>
 #include <citrusleaf/alloc.h>
 
+#include <stdlib.h>
+#include <string.h>
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+
+// Heap order is by priority, then push sequence - keeping the two together
+// makes a comparison one cache line, and a node's 4 children are adjacent.
+typedef struct cf_queue_priority_entry_s {
+    int64_t     pri;
+    uint64_t    seq;
+    uint32_t    slot;   // where the element lives, which doesn't move
+} cf_queue_priority_entry;
+
+struct cf_queue_priority_heap_s {
+    cf_queue_priority_entry * entries;  // heap ordered, n_heap in use
+    uint32_t *  pos;            // heap position by slot, UINT32_MAX if free
+    uint32_t *  generation;     // by slot, bumped as the slot is freed
+    uint32_t *  free_slots;
+    unsigned int n_free;
+    byte *      elements;       // element storage by slot
+    cf_queue_priority_entry ** found;   // reduce_pop scratch, one per slot
+    uint32_t *  stack;          // reduce_pop scratch, one per slot
+    size_t      elementsz;
+    unsigned int capacity;
+    uint64_t    seq;
+};
+
+struct cf_queue_priority_fair_s {
+    unsigned int weights[3];    // high, medium, low
+    unsigned int lane;          // lane whose turn it is
+    unsigned int credit;        // pops left in its turn
+    cf_queue *  stamps[3];      // push time of each element, in step with its lane
+    uint64_t    popped[3];
+    uint64_t    wait_us[3];
+    uint64_t    wait_us_max[3];
+};
+
+/******************************************************************************
+ * CONSTANTS
+ ******************************************************************************/
+
+#define CF_Q_PRI_HEAP_D 4
+#define CF_Q_PRI_HEAP_INIT 64
+
+/******************************************************************************
+ * HEAP
+ ******************************************************************************/
+
+static inline bool
+cf_queue_priority_entry_before(const cf_queue_priority_entry *a, const cf_queue_priority_entry *b)
+{
+    return a->pri < b->pri || (a->pri == b->pri && a->seq < b->seq);
+}
+
+static void
+cf_queue_priority_heap_up(cf_queue_priority_heap *h, uint32_t i)
+{
+    cf_queue_priority_entry e = h->entries[i];
+
+    while (i > 0) {
+        uint32_t parent = (i - 1) / CF_Q_PRI_HEAP_D;
+
+        if (! cf_queue_priority_entry_before(&e, &h->entries[parent]))
+            break;
+
+        h->entries[i] = h->entries[parent];
+        h->pos[h->entries[i].slot] = i;
+        i = parent;
+    }
+
+    h->entries[i] = e;
+    h->pos[e.slot] = i;
+}
+
+static void
+cf_queue_priority_heap_down(cf_queue_priority_heap *h, uint32_t n, uint32_t i)
+{
+    cf_queue_priority_entry e = h->entries[i];
+
+    while (true) {
+        uint32_t first = (i * CF_Q_PRI_HEAP_D) + 1;
+
+        if (first >= n)
+            break;
+
+        uint32_t last = first + CF_Q_PRI_HEAP_D < n ? first + CF_Q_PRI_HEAP_D : n;
+        uint32_t best = first;
+
+        for (uint32_t c = first + 1; c < last; c++) {
+            if (cf_queue_priority_entry_before(&h->entries[c], &h->entries[best]))
+                best = c;
+        }
+
+        if (! cf_queue_priority_entry_before(&h->entries[best], &e))
+            break;
+
+        h->entries[i] = h->entries[best];
+        h->pos[h->entries[i].slot] = i;
+        i = best;
+    }
+
+    h->entries[i] = e;
+    h->pos[e.slot] = i;
+}
+
+static void
+cf_queue_priority_heap_destroy(cf_queue_priority_heap *h)
+{
+    cf_free(h->entries);
+    cf_free(h->pos);
+    cf_free(h->generation);
+    cf_free(h->free_slots);
+    cf_free(h->elements);
+    cf_free(h->found);
+    cf_free(h->stack);
+    cf_free(h);
+}
+
+// Double the capacity - all arrays are per slot, so they grow together.
+static int
+cf_queue_priority_heap_grow(cf_queue_priority_heap *h)
+{
+    unsigned int capacity = h->capacity ? h->capacity * 2 : CF_Q_PRI_HEAP_INIT;
+    void *p;
+
+    if (! (p = cf_realloc(h->entries, capacity * sizeof(cf_queue_priority_entry))))
+        return(-1);
+    h->entries = p;
+
+    if (! (p = cf_realloc(h->pos, capacity * sizeof(uint32_t))))
+        return(-1);
+    h->pos = p;
+
+    if (! (p = cf_realloc(h->generation, capacity * sizeof(uint32_t))))
+        return(-1);
+    h->generation = p;
+
+    if (! (p = cf_realloc(h->free_slots, capacity * sizeof(uint32_t))))
+        return(-1);
+    h->free_slots = p;
+
+    if (! (p = cf_realloc(h->elements, capacity * h->elementsz)))
+        return(-1);
+    h->elements = p;
+
+    if (! (p = cf_realloc(h->found, capacity * sizeof(cf_queue_priority_entry *))))
+        return(-1);
+    h->found = p;
+
+    if (! (p = cf_realloc(h->stack, capacity * sizeof(uint32_t))))
+        return(-1);
+    h->stack = p;
+
+    // New slots are taken lowest first.
+    for (unsigned int slot = capacity; slot > h->capacity; slot--) {
+        h->pos[slot - 1] = UINT32_MAX;
+        h->generation[slot - 1] = 0;
+        h->free_slots[h->n_free++] = slot - 1;
+    }
+
+    h->capacity = capacity;
+    return(0);
+}
+
+static cf_queue_priority_heap *
+cf_queue_priority_heap_create(size_t elementsz)
+{
+    cf_queue_priority_heap *h = cf_malloc(sizeof(cf_queue_priority_heap));
+    if (!h) return(0);
+
+    memset(h, 0, sizeof(cf_queue_priority_heap));
+    h->elementsz = elementsz;
+
+    if (0 != cf_queue_priority_heap_grow(h)) {
+        cf_queue_priority_heap_destroy(h);
+        return(0);
+    }
+
+    return(h);
+}
+
+// Call with the lock held.
+static int
+cf_queue_priority_heap_push(cf_queue_priority *q, void *ptr, int64_t pri, cf_queue_priority_handle *handle)
+{
+    cf_queue_priority_heap *h = q->heap;
+
+    if (h->n_free == 0 && 0 != cf_queue_priority_heap_grow(h))
+        return(-1);
+
+    uint32_t slot = h->free_slots[--h->n_free];
+    uint32_t i = q->n_heap++;
+
+    memcpy(&h->elements[slot * h->elementsz], ptr, h->elementsz);
+
+    h->entries[i].pri = pri;
+    h->entries[i].seq = h->seq++;
+    h->entries[i].slot = slot;
+    cf_queue_priority_heap_up(h, i);
+
+    if (handle)
+        *handle = ((uint64_t)h->generation[slot] << 32) | slot;
+
+    return(0);
+}
+
+// Call with the lock held - copy out and remove the element at heap position i.
+static void
+cf_queue_priority_heap_remove(cf_queue_priority *q, uint32_t i, void *buf)
+{
+    cf_queue_priority_heap *h = q->heap;
+    uint32_t slot = h->entries[i].slot;
+
+    memcpy(buf, &h->elements[slot * h->elementsz], h->elementsz);
+
+    h->pos[slot] = UINT32_MAX;
+    h->generation[slot]++;
+    h->free_slots[h->n_free++] = slot;
+
+    uint32_t n = --q->n_heap;
+
+    if (i < n) {
+        // The last entry fills the hole, and moves whichever way it must.
+        h->entries[i] = h->entries[n];
+        h->pos[h->entries[i].slot] = i;
+
+        if (i > 0 && cf_queue_priority_entry_before(&h->entries[i], &h->entries[(i - 1) / CF_Q_PRI_HEAP_D]))
+            cf_queue_priority_heap_up(h, i);
+        else
+            cf_queue_priority_heap_down(h, n, i);
+    }
+}
+
+static int
+cf_queue_priority_cmp_seq(const void *a, const void *b)
+{
+    uint64_t x = (*(cf_queue_priority_entry * const *)a)->seq;
+    uint64_t y = (*(cf_queue_priority_entry * const *)b)->seq;
+    return (x > y) - (x < y);
+}
+
+// Call with the lock held - as cf_queue_priority_reduce_pop(), over the
+// elements sharing the lowest priority, in push order.
+static int
+cf_queue_priority_heap_reduce_pop(cf_queue_priority *q, void *buf, cf_queue_reduce_fn cb, void *udata)
+{
+    cf_queue_priority_heap *h = q->heap;
+
+    if (q->n_heap == 0)
+        return(CF_QUEUE_NOMATCH);
+
+    // Entries of the root's priority form a subtree at the root - collect
+    // them depth first, then put them in push order. Neither can outnumber
+    // the slots, so the scratch arrays grown with the heap always fit.
+    cf_queue_priority_entry **found = h->found;
+    uint32_t *stack = h->stack;
+    int64_t pri = h->entries[0].pri;
+    uint32_t n_found = 0;
+    uint32_t n_stack = 0;
+
+    stack[n_stack++] = 0;
+
+    while (n_stack) {
+        uint32_t i = stack[--n_stack];
+
+        found[n_found++] = &h->entries[i];
+
+        for (uint32_t c = (i * CF_Q_PRI_HEAP_D) + 1; c <= (i * CF_Q_PRI_HEAP_D) + CF_Q_PRI_HEAP_D && c < q->n_heap; c++) {
+            if (h->entries[c].pri == pri)
+                stack[n_stack++] = c;
+        }
+    }
+
+    qsort(found, n_found, sizeof(cf_queue_priority_entry *), cf_queue_priority_cmp_seq);
+
+    int64_t best = -1;
+
+    for (uint32_t i = 0; i < n_found; i++) {
+        int rv = cb(&h->elements[found[i]->slot * h->elementsz], udata);
+
+        if (rv == -1) {
+            best = found[i] - h->entries;
+            break;
+        }
+        else if (rv == -2) {
+            best = found[i] - h->entries;
+        }
+    }
+
+    if (best < 0)
+        return(CF_QUEUE_NOMATCH);
+
+    cf_queue_priority_heap_remove(q, (uint32_t)best, buf);
+    return(0);
+}
+
+/******************************************************************************
+ * FAIR
+ ******************************************************************************/
+
+static inline cf_queue *
+cf_queue_priority_lane(cf_queue_priority *q, int lane)
+{
+    return lane == 0 ? q->high_q : (lane == 1 ? q->medium_q : q->low_q);
+}
+
+static void
+cf_queue_priority_fair_destroy(cf_queue_priority_fair *f)
+{
+    for (int i = 0; i < 3; i++) {
+        if (f->stamps[i])
+            cf_queue_destroy(f->stamps[i]);
+    }
+    cf_free(f);
+}
+
+// Call with the lock held - the lane to pop from next, or -1 if all are
+// empty. A lane keeps its turn until its credit runs out or it empties.
+static int
+cf_queue_priority_fair_next(cf_queue_priority *q)
+{
+    cf_queue_priority_fair *f = q->fair;
+
+    // Enough steps to come back round to the starting lane with new credit.
+    for (int i = 0; i < 4; i++) {
+        if (f->credit && CF_Q_SZ(cf_queue_priority_lane(q, f->lane)))
+            return(f->lane);
+
+        f->lane = (f->lane + 1) % 3;
+        f->credit = f->weights[f->lane];
+    }
+
+    return(-1);
+}
+
+// Call with the lock held - account for an element about to be removed from
+// a lane, at offset in the lane. Its stamp is as far into the stamps.
+static void
+cf_queue_priority_fair_popped(cf_queue_priority *q, int lane, uint64_t offset)
+{
+    cf_queue_priority_fair *f = q->fair;
+    cf_queue *stamps = f->stamps[lane];
+    uint64_t stamp;
+
+    offset = stamps->read_offset + (offset - cf_queue_priority_lane(q, lane)->read_offset);
+
+    memcpy(&stamp, CF_Q_ELEM_PTR(stamps, offset), sizeof(uint64_t));
+    cf_queue_delete_offset(stamps, offset);
+
+    uint64_t now = cf_getus();
+    uint64_t wait = now > stamp ? now - stamp : 0;
+
+    f->credit--;
+    f->popped[lane]++;
+    f->wait_us[lane] += wait;
+
+    if (wait > f->wait_us_max[lane])
+        f->wait_us_max[lane] = wait;
+}
+
 /******************************************************************************
  * FUNCTIONS
  ******************************************************************************/
@@ -28,6 +390,9 @@ cf_queue_priority * cf_queue_priority_create(size_t elementsz, bool threadsafe)
     if (!q) return(0);
     
     q->threadsafe = threadsafe;
+    q->heap = NULL;
+    q->n_heap = 0;
+    q->fair = NULL;
     q->low_q = cf_queue_create(elementsz, false);
     if (!q->low_q)      goto Fail1;
     q->medium_q = cf_queue_create(elementsz, false);
@@ -59,11 +424,87 @@ Fail1:
     return(0);
 }
 
+cf_queue_priority * cf_queue_priority_create_heap(size_t elementsz, bool threadsafe)
+{
+    cf_queue_priority *q = cf_malloc(sizeof(cf_queue_priority));
+    if (!q) return(0);
+
+    q->threadsafe = threadsafe;
+    q->low_q = NULL;
+    q->medium_q = NULL;
+    q->high_q = NULL;
+    q->n_heap = 0;
+    q->fair = NULL;
+    q->heap = cf_queue_priority_heap_create(elementsz);
+    if (!q->heap)       goto Fail1;
+
+    if (threadsafe == false)
+        return(q);
+
+    if (0 != pthread_mutex_init(&q->LOCK, NULL))
+        goto Fail2;
+
+    if (0 != pthread_cond_init(&q->CV, NULL))
+        goto Fail3;
+
+    return(q);
+
+Fail3:
+    pthread_mutex_destroy(&q->LOCK);
+Fail2:
+    cf_queue_priority_heap_destroy(q->heap);
+Fail1:
+    cf_free(q);
+    return(0);
+}
+
+cf_queue_priority * cf_queue_priority_create_fair(size_t elementsz, bool threadsafe,
+        unsigned int high_weight, unsigned int medium_weight, unsigned int low_weight)
+{
+    if (high_weight == 0 || medium_weight == 0 || low_weight == 0)
+        return(0);
+
+    cf_queue_priority *q = cf_queue_priority_create(elementsz, threadsafe);
+    if (!q) return(0);
+
+    cf_queue_priority_fair *f = cf_malloc(sizeof(cf_queue_priority_fair));
+    if (!f) goto Fail1;
+
+    memset(f, 0, sizeof(cf_queue_priority_fair));
+    f->weights[0] = high_weight;
+    f->weights[1] = medium_weight;
+    f->weights[2] = low_weight;
+    f->lane = 0;
+    f->credit = high_weight;
+
+    for (int i = 0; i < 3; i++) {
+        if (! (f->stamps[i] = cf_queue_create(sizeof(uint64_t), false)))
+            goto Fail2;
+    }
+
+    q->fair = f;
+    return(q);
+
+Fail2:
+    cf_queue_priority_fair_destroy(f);
+Fail1:
+    cf_queue_priority_destroy(q);
+    return(0);
+}
+
 void cf_queue_priority_destroy(cf_queue_priority *q)
 {
-    cf_queue_destroy(q->high_q);
-    cf_queue_destroy(q->medium_q);
-    cf_queue_destroy(q->low_q);
+    if (q->fair)
+        cf_queue_priority_fair_destroy(q->fair);
+
+    if (q->heap) {
+        cf_queue_priority_heap_destroy(q->heap);
+    }
+    else {
+        cf_queue_destroy(q->high_q);
+        cf_queue_destroy(q->medium_q);
+        cf_queue_destroy(q->low_q);
+    }
     if (q->threadsafe) {
         pthread_mutex_destroy(&q->LOCK);
         pthread_cond_destroy(&q->CV);
@@ -77,7 +518,9 @@ int cf_queue_priority_push(cf_queue_priority *q, void *ptr, int pri)
 		return(-1);
     
     int rv;
-    if (pri == CF_QUEUE_PRIORITY_HIGH)
+    if (q->heap)
+        rv = cf_queue_priority_heap_push(q, ptr, pri, NULL);
+    else if (pri == CF_QUEUE_PRIORITY_HIGH)
         rv = cf_queue_push(q->high_q, ptr);
     else if (pri == CF_QUEUE_PRIORITY_MEDIUM)
         rv = cf_queue_push(q->medium_q, ptr);
@@ -86,6 +529,17 @@ int cf_queue_priority_push(cf_queue_priority *q, void *ptr, int pri)
     else {
         rv = -1;
     }
+
+    if (rv == 0 && q->fair) {
+        // Stamps stay in step with the lane - undo the push if we can't stamp.
+        cf_queue *lane = cf_queue_priority_lane(q, pri - 1);
+        uint64_t now = cf_getus();
+
+        if (0 != cf_queue_push(q->fair->stamps[pri - 1], &now)) {
+            cf_queue_delete_offset(lane, lane->write_offset - 1);
+            rv = -1;
+        }
+    }
 	
     if (rv == 0 && q->threadsafe)
         pthread_cond_signal(&q->CV);
@@ -126,7 +580,25 @@ int cf_queue_priority_pop(cf_queue_priority *q, void *buf, int ms_wait)
     }
     
     int rv;
-    if (CF_Q_SZ(q->high_q))
+    if (q->heap) {
+        if (q->n_heap) {
+            cf_queue_priority_heap_remove(q, 0, buf);
+            rv = CF_QUEUE_OK;
+        }
+        else rv = CF_QUEUE_EMPTY;
+    }
+    else if (q->fair) {
+        int lane = cf_queue_priority_fair_next(q);
+
+        if (lane >= 0) {
+            cf_queue *lq = cf_queue_priority_lane(q, lane);
+
+            cf_queue_priority_fair_popped(q, lane, lq->read_offset);
+            rv = cf_queue_pop(lq, buf, 0);
+        }
+        else rv = CF_QUEUE_EMPTY;
+    }
+    else if (CF_Q_SZ(q->high_q))
         rv = cf_queue_pop(q->high_q, buf, 0);
     else if (CF_Q_SZ(q->medium_q))
         rv = cf_queue_pop(q->medium_q, buf, 0);
@@ -146,9 +618,14 @@ int cf_queue_priority_sz(cf_queue_priority *q)
     int rv = 0;
     if (q->threadsafe)
         pthread_mutex_lock(&q->LOCK);
-    rv += cf_queue_sz(q->high_q);
-    rv += cf_queue_sz(q->medium_q);
-    rv += cf_queue_sz(q->low_q);
+    if (q->heap) {
+        rv = q->n_heap;
+    }
+    else {
+        rv += cf_queue_sz(q->high_q);
+        rv += cf_queue_sz(q->medium_q);
+        rv += cf_queue_sz(q->low_q);
+    }
     if (q->threadsafe)
         pthread_mutex_unlock(&q->LOCK);
     return(rv);
@@ -173,6 +650,15 @@ int cf_queue_priority_reduce_pop(cf_queue_priority *priority_q,  void *buf, cf_q
         return(-1);
 	
     int rv = 0;
+
+    if (priority_q->heap) {
+        rv = cf_queue_priority_heap_reduce_pop(priority_q, buf, cb, udata);
+
+        if (priority_q->threadsafe && (0 != pthread_mutex_unlock(&priority_q->LOCK)))
+            return(-1);
+
+        return(rv);
+    }
 	
     cf_queue *queues[3];
     queues[0] = priority_q->high_q;
@@ -180,9 +666,19 @@ int cf_queue_priority_reduce_pop(cf_queue_priority *priority_q,  void *buf, cf_q
     queues[2] = priority_q->low_q;
 	
     cf_queue *q;
-    int found_index = -1;
+    uint64_t found_index = 0;
+    bool found = false;
+    int q_itr = 0;
+
+    // A fair queue traverses the lane whose turn it is.
+    if (priority_q->fair) {
+        q_itr = cf_queue_priority_fair_next(priority_q);
+
+        if (q_itr < 0)
+            q_itr = 3;
+    }
 	
-    for (int q_itr = 0; q_itr < 3; q_itr++)
+    for ( ; q_itr < 3; q_itr++)
     {
         q = queues[q_itr];
 		
@@ -193,21 +689,26 @@ int cf_queue_priority_reduce_pop(cf_queue_priority *priority_q,  void *buf, cf_q
             // will change the read and write offset, so this is simpler for now
             // can optimize if necessary later....
 			
-            for (uint i = q->read_offset ;
+            for (uint64_t i = q->read_offset ;
 				 i < q->write_offset ;
 				 i++)
             {
+                if (CF_Q_ELEM_DEAD(q, i)) {
+                    continue;
+                }
 				
                 rv = cb(CF_Q_ELEM_PTR(q, i), udata);
 				
                 // rv == 0 is normal case, just increment to next point
                 if (rv == -1) {
                     found_index = i;
+                    found = true;
                     break; // found what it was looking for, so break
                 }
                 else if (rv == -2) {
                     // found new candidate, but keep looking for one better
                     found_index = i;
+                    found = true;
                 }
 				
             };
@@ -216,9 +717,13 @@ int cf_queue_priority_reduce_pop(cf_queue_priority *priority_q,  void *buf, cf_q
         }
     }
 	
-    if (found_index >= 0) {
+    if (found) {
         // found an element, so memcpy to buf, delete from q, and return
         memcpy(buf, CF_Q_ELEM_PTR(q, found_index), q->elementsz);
+
+        if (priority_q->fair)
+            cf_queue_priority_fair_popped(priority_q, q_itr, found_index);
+
         cf_queue_delete_offset(q, found_index);
     }
 	
@@ -226,8 +731,81 @@ int cf_queue_priority_reduce_pop(cf_queue_priority *priority_q,  void *buf, cf_q
         return(-1);
     }
 	
-    if (found_index == -1)
+    if (! found)
         return(CF_QUEUE_NOMATCH);
 	
     return(0);
 }
+
+int cf_queue_priority_push_handle(cf_queue_priority *q, void *ptr, int64_t pri, cf_queue_priority_handle *handle)
+{
+    if (! q->heap)
+        return(-1);
+
+    if (q->threadsafe && (0 != pthread_mutex_lock(&q->LOCK)))
+        return(-1);
+
+    int rv = cf_queue_priority_heap_push(q, ptr, pri, handle);
+
+    if (rv == 0 && q->threadsafe)
+        pthread_cond_signal(&q->CV);
+
+    if (q->threadsafe && (0 != pthread_mutex_unlock(&q->LOCK)))
+        return(-1);
+
+    return(rv);
+}
+
+int cf_queue_priority_reprioritize(cf_queue_priority *q, cf_queue_priority_handle handle, int64_t pri)
+{
+    if (! q->heap)
+        return(-1);
+
+    if (q->threadsafe && (0 != pthread_mutex_lock(&q->LOCK)))
+        return(-1);
+
+    cf_queue_priority_heap *h = q->heap;
+    uint32_t slot = (uint32_t)handle;
+    int rv = CF_QUEUE_NOMATCH;
+
+    if (slot < h->capacity && h->generation[slot] == (uint32_t)(handle >> 32) &&
+            h->pos[slot] != UINT32_MAX) {
+        uint32_t i = h->pos[slot];
+        int64_t old = h->entries[i].pri;
+
+        h->entries[i].pri = pri;
+
+        if (pri < old)
+            cf_queue_priority_heap_up(h, i);
+        else
+            cf_queue_priority_heap_down(h, q->n_heap, i);
+
+        rv = 0;
+    }
+
+    if (q->threadsafe && (0 != pthread_mutex_unlock(&q->LOCK)))
+        return(-1);
+
+    return(rv);
+}
+
+int cf_queue_priority_get_stats(cf_queue_priority *q, cf_queue_priority_lane_stats stats[3])
+{
+    if (! q->fair)
+        return(-1);
+
+    if (q->threadsafe && (0 != pthread_mutex_lock(&q->LOCK)))
+        return(-1);
+
+    for (int i = 0; i < 3; i++) {
+        stats[i].depth = CF_Q_SZ(cf_queue_priority_lane(q, i));
+        stats[i].popped = q->fair->popped[i];
+        stats[i].wait_us = q->fair->wait_us[i];
+        stats[i].wait_us_max = q->fair->wait_us_max[i];
+    }
+
+    if (q->threadsafe && (0 != pthread_mutex_unlock(&q->LOCK)))
+        return(-1);
+
+    return(0);
+}
@@ -30,22 +30,125 @@
 
 #include <citrusleaf/cf_rchash.h>
 
+#include <sched.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include <aerospike/as_thread_pool.h>
 #include <citrusleaf/alloc.h>
 #include <citrusleaf/cf_atomic.h>
+#include <citrusleaf/cf_bits.h>
+#include <citrusleaf/cf_hash.h>
+
+/******************************************************************************
+ * CONSTANTS
+ ******************************************************************************/
+
+// MT_MANYLOCK lock stripes per online core, and the most any table gets.
+#define CF_RCHASH_STRIPES_PER_CPU 4
+#define CF_RCHASH_MAX_STRIPES 1024
+
+// Old buckets an operation moves to the new table while a resize is on.
+#define CF_RCHASH_MIGRATE_BUCKETS 4
+
+// Lock-free gets that keep colliding with writers give up and lock.
+#define CF_RCHASH_READ_RETRIES 16
+
+// Retired elements and references a table collects before it waits out its
+// readers and frees them.
+#define CF_RCHASH_RETIRE_BATCH 256
+
+// Buckets a parallel reduce walks per hold of a lock covering the table.
+#define CF_RCHASH_REDUCE_BATCH 64
+
+// What lock-free readers follow - table pointers, chain links and objects -
+// writers publish with release stores and readers load with acquire loads.
+#define CF_RCHASH_LOAD_P(_p) ((void *)cf_atomic_p_load((cf_atomic_p *)&(_p), CF_ATOMIC_ACQUIRE))
+#define CF_RCHASH_STORE_P(_p, _v) cf_atomic_p_store((cf_atomic_p *)&(_p), (cf_atomic_p)(_v), CF_ATOMIC_RELEASE)
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+
+/**
+ * A stripe covers every bucket whose index is congruent to the stripe's index
+ * mod n_stripes. Since n_stripes divides every table length, a key is in the
+ * same stripe in the old and new tables during a resize, and each stripe
+ * migrates its own old buckets under its own lock.
+ */
+struct cf_rchash_stripe_s {
+	pthread_mutex_t		lock;
+	uint32_t			migrate;	// old buckets of this stripe migrated so far
+	cf_atomic32			seq;		// odd while a writer holds the stripe
+} __attribute__ ((aligned(64)));
+
+/**
+ * Lock-free readers count themselves in by epoch parity, in a slot picked per
+ * thread so readers on different cores don't share a line.
+ */
+typedef struct cf_rchash_reader_s {
+	cf_atomic32			active[2];
+} __attribute__ ((aligned(64))) cf_rchash_reader;
+
+typedef struct cf_rchash_retired_s {
+	void *				p;
+	bool				object;		// a reference the table held, not memory it owned
+} cf_rchash_retired;
+
+/**
+ * Epoch-based reclamation for CF_RCHASH_CR_LOCKFREE_READ. Writers retire what
+ * they unlink rather than freeing it. Once enough is retired, the epoch
+ * flips, and when no reader is left in the old epoch nobody can still hold a
+ * pointer into what was retired before the flip. Until then the table's
+ * reference keeps every object a reader can find alive, so a reader may
+ * reserve it.
+ */
+struct cf_rchash_reclaim_s {
+	cf_atomic32			epoch;
+	uint32_t			n_readers;		// power of 2
+	pthread_mutex_t		sync_lock 		// one grace period at a time
+						__attribute__ ((aligned(64)));
+	pthread_mutex_t		retire_lock;	// protects the retired list
+	cf_rchash_retired *	retired;
+	uint32_t			n_retired;
+	uint32_t			retired_cap;
+	cf_rchash_reader	readers[];
+};
+
+/**
+ * A parallel reduce - partition p walks units p * n_units / n_partitions up
+ * to the next partition's first, on its own copy of the udata if there are
+ * copies.
+ */
+typedef struct cf_rchash_reduce_job_s {
+	cf_rchash *				h;
+	cf_rchash_reduce_fn		reduce_fn;
+	uint32_t				n_units;
+	uint32_t				n_partitions;
+	void *					udata;
+	size_t					udata_size;
+	uint8_t *				udatas;			// udata_size bytes per partition
+	int *					rvs;			// per partition
+	cf_atomic32				stop;
+} cf_rchash_reduce_job;
+
+/******************************************************************************
+ * GLOBALS
+ ******************************************************************************/
+
+static cf_atomic32 g_reader_slots = 0;
+static __thread uint32_t t_reader_slot = 0;	// 1-based, 0 until first read
 
 /******************************************************************************
  * FUNCTION DECLS
  ******************************************************************************/
 
+void cf_rchash_free(cf_rchash *h, void *object);
 void cf_rchash_destroy_v(cf_rchash *h);
-void cf_rchash_reduce_delete_v(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata);
-int cf_rchash_reduce_v(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata);
 int cf_rchash_delete_v(cf_rchash *h, void *key, uint32_t key_len);
 int cf_rchash_get_v(cf_rchash *h, void *key, uint32_t key_len, void **object);
 int cf_rchash_put_unique_v(cf_rchash *h, void *key, uint32_t key_len, void *object);
@@ -54,40 +157,539 @@ uint32_t cf_rchash_get_size_v(cf_rchash *h);
 void cf_rchash_destroy_elements_v(cf_rchash *h);
 void cf_rchash_dump_v(cf_rchash *h);
 
+static int cf_rchash_migrate_bucket(cf_rchash *h, cf_rchash_elem_f *old_he);
+static int cf_rchash_migrate_bucket_v(cf_rchash *h, cf_rchash_elem_v *old_he);
+static int cf_rchash_reduce_bucket(cf_rchash *h, cf_rchash_elem_f *list_he, cf_rchash_reduce_fn reduce_fn, void *udata);
+static int cf_rchash_reduce_bucket_v(cf_rchash *h, cf_rchash_elem_v *list_he, cf_rchash_reduce_fn reduce_fn, void *udata);
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ ******************************************************************************/
+
+static inline size_t cf_rchash_elem_size(cf_rchash *h) {
+	return h->key_len == 0 ?
+			sizeof(cf_rchash_elem_v) : sizeof(cf_rchash_elem_f) + h->key_len;
+}
+
+static inline void *cf_rchash_elem_alloc(cf_rchash *h) {
+	return h->slab ? cf_slab_alloc(h->slab) : cf_malloc(cf_rchash_elem_size(h));
+}
+
+static inline void cf_rchash_elem_free(cf_rchash *h, void *e) {
+	if (h->slab) {
+		cf_slab_free(h->slab, e);
+	}
+	else {
+		cf_free(e);
+	}
+}
+
+static inline cf_rchash_elem_f *get_bucket(cf_rchash *h, void *table, uint i) {
+    return( (cf_rchash_elem_f * ) (
+                ((uint8_t *) table) +
+                ((sizeof(cf_rchash_elem_f) + h->key_len) * i)
+             )
+           );
+}
+
+static inline cf_rchash_elem_v *get_bucket_v(cf_rchash *h, void *table, uint i) {
+    return ( (cf_rchash_elem_v *)
+               (
+                 ((uint8_t *)table) + (sizeof(cf_rchash_elem_v) * i)
+               )
+           );
+}
+
+// Never more stripes than buckets.
+static uint32_t cf_rchash_stripe_count(uint32_t sz) {
+	return cf_pow2_per_cpu(CF_RCHASH_STRIPES_PER_CPU, sz < CF_RCHASH_MAX_STRIPES ? sz : CF_RCHASH_MAX_STRIPES);
+}
+
+// Writers make the stripe's sequence number odd while they change anything
+// in it, so lock-free readers know to retry.
+static inline void cf_rchash_write_begin(cf_rchash *h, uint32_t s) {
+	if (h->reclaim) {
+		cf_atomic32 *seq = &h->stripes[s].seq;
+
+		cf_atomic32_store(seq, cf_atomic32_load(seq, CF_ATOMIC_RELAXED) + 1, CF_ATOMIC_RELAXED);
+		cf_atomic_fence(CF_ATOMIC_RELEASE);
+	}
+}
+
+static inline void cf_rchash_write_end(cf_rchash *h, uint32_t s) {
+	if (h->reclaim) {
+		cf_atomic32 *seq = &h->stripes[s].seq;
+
+		cf_atomic32_store(seq, cf_atomic32_load(seq, CF_ATOMIC_RELAXED) + 1, CF_ATOMIC_RELEASE);
+	}
+}
+
+static cf_rchash_reclaim *cf_rchash_reclaim_create() {
+	uint32_t n = cf_pow2_per_cpu(CF_RCHASH_STRIPES_PER_CPU, CF_RCHASH_MAX_STRIPES);
+	size_t sz = sizeof(cf_rchash_reclaim) + (sizeof(cf_rchash_reader) * n);
+	cf_rchash_reclaim *rc = cf_valloc(sz);
+
+	if (! rc) {
+		return(0);
+	}
+
+	memset(rc, 0, sz);
+	rc->n_readers = n;
+	pthread_mutex_init(&rc->sync_lock, 0);
+	pthread_mutex_init(&rc->retire_lock, 0);
+	return(rc);
+}
+
+static inline void cf_rchash_dispose(cf_rchash *h, void *p, bool object) {
+	if (object) {
+		cf_rchash_free(h, p);
+	}
+	else {
+		cf_rchash_elem_free(h, p);
+	}
+}
+
+// Flip the epoch and wait until no reader is left in the old one. Caller
+// holds sync_lock.
+static void cf_rchash_wait_readers(cf_rchash_reclaim *rc) {
+	uint32_t old = cf_atomic32_get(rc->epoch) & 1;
+
+	// Locked, so everything unlinked so far is visible before the flip.
+	cf_atomic32_incr(&rc->epoch);
+
+	for (uint32_t i = 0; i < rc->n_readers; i++) {
+		while (cf_atomic32_get(rc->readers[i].active[old]) != 0) {
+			sched_yield();
+		}
+	}
+}
+
+// Free everything retired so far. Whoever holds sync_lock is already doing
+// it, so a busy table doesn't stack up writers waiting on readers.
+static void cf_rchash_reclaim_retired(cf_rchash *h) {
+	cf_rchash_reclaim *rc = h->reclaim;
+
+	if (pthread_mutex_trylock(&rc->sync_lock) != 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&rc->retire_lock);
+
+	cf_rchash_retired *retired = rc->retired;
+	uint32_t n_retired = rc->n_retired;
+
+	rc->retired = 0;
+	rc->n_retired = 0;
+	rc->retired_cap = 0;
+
+	pthread_mutex_unlock(&rc->retire_lock);
+
+	cf_rchash_wait_readers(rc);
+	pthread_mutex_unlock(&rc->sync_lock);
+
+	for (uint32_t i = 0; i < n_retired; i++) {
+		cf_rchash_dispose(h, retired[i].p, retired[i].object);
+	}
+
+	cf_free(retired);
+}
+
+// Free p - or, with lock-free readers, once none of them can reach it.
+static void cf_rchash_retire(cf_rchash *h, void *p, bool object) {
+	cf_rchash_reclaim *rc = h->reclaim;
+
+	if (! rc) {
+		cf_rchash_dispose(h, p, object);
+		return;
+	}
+
+	pthread_mutex_lock(&rc->retire_lock);
+
+	if (rc->n_retired == rc->retired_cap) {
+		uint32_t cap = rc->retired_cap ? rc->retired_cap * 2 : CF_RCHASH_RETIRE_BATCH;
+		cf_rchash_retired *retired = cf_realloc(rc->retired, sizeof(cf_rchash_retired) * cap);
+
+		// Can't defer it - wait out the readers here instead.
+		if (! retired) {
+			pthread_mutex_unlock(&rc->retire_lock);
+			pthread_mutex_lock(&rc->sync_lock);
+			cf_rchash_wait_readers(rc);
+			pthread_mutex_unlock(&rc->sync_lock);
+			cf_rchash_dispose(h, p, object);
+			return;
+		}
+
+		rc->retired = retired;
+		rc->retired_cap = cap;
+	}
+
+	rc->retired[rc->n_retired].p = p;
+	rc->retired[rc->n_retired].object = object;
+	rc->n_retired++;
+
+	pthread_mutex_unlock(&rc->retire_lock);
+}
+
+static inline cf_rchash_reader *cf_rchash_read_enter(cf_rchash_reclaim *rc, uint32_t *e_r) {
+	if (t_reader_slot == 0) {
+		t_reader_slot = (uint32_t)cf_atomic32_incr(&g_reader_slots);
+	}
+
+	cf_rchash_reader *r = &rc->readers[t_reader_slot & (rc->n_readers - 1)];
+
+	// If the epoch flipped between reading it and counting in, the flipper
+	// may already have checked our slot - count in again under the new one.
+	while (true) {
+		uint32_t e = cf_atomic32_get(rc->epoch) & 1;
+
+		cf_atomic32_incr(&r->active[e]);
+
+		if ((cf_atomic32_get(rc->epoch) & 1) == e) {
+			*e_r = e;
+			return(r);
+		}
+
+		cf_atomic32_decr(&r->active[e]);
+	}
+}
+
+static inline void cf_rchash_read_exit(cf_rchash_reader *r, uint32_t e) {
+	cf_atomic32_decr(&r->active[e]);
+}
+
+static inline pthread_mutex_t *cf_rchash_lock(cf_rchash *h, uint32_t hash) {
+	pthread_mutex_t *l = 0;
+
+	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
+		l = &h->biglock;
+	}
+	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
+		l = &h->stripes[hash & (h->n_stripes - 1)].lock;
+	}
+	if (l)     pthread_mutex_lock( l );
+
+	cf_rchash_write_begin(h, hash & (h->n_stripes - 1));
+	return(l);
+}
+
+// Only resizes swap tables, and they hold every lock while doing it, so any
+// one lock is enough to read the table pointers.
+static void cf_rchash_lock_all(cf_rchash *h) {
+	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
+		pthread_mutex_lock(&h->biglock);
+	}
+	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
+		for (uint32_t s = 0; s < h->n_stripes; s++) {
+			pthread_mutex_lock(&h->stripes[s].lock);
+		}
+	}
+
+	for (uint32_t s = 0; s < h->n_stripes; s++) {
+		cf_rchash_write_begin(h, s);
+	}
+}
+
+static void cf_rchash_unlock_all(cf_rchash *h) {
+	for (uint32_t s = 0; s < h->n_stripes; s++) {
+		cf_rchash_write_end(h, s);
+	}
+
+	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
+		pthread_mutex_unlock(&h->biglock);
+	}
+	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
+		for (uint32_t s = 0; s < h->n_stripes; s++) {
+			pthread_mutex_unlock(&h->stripes[s].lock);
+		}
+	}
+}
+
+// MT_MANYLOCK tables count in a sharded counter, so puts and deletes under
+// different stripes don't all write one cache line.
+static inline void cf_rchash_elements_incr(cf_rchash *h) {
+	if (h->counter)
+		cf_counter_add(h->counter, 1);
+	else
+		h->elements++;
+}
+
+// The partitions of a parallel reduce delete under different locks, or none,
+// so only the biglock keeps deletes from racing.
+static inline void cf_rchash_elements_decr(cf_rchash *h) {
+	if (h->counter)
+		cf_counter_add(h->counter, -1);
+	else if (! (h->flags & CF_RCHASH_CR_MT_BIGLOCK))
+		cf_atomic32_fetch_add(&h->elements, -1, CF_ATOMIC_RELAXED);
+	else
+		h->elements--;
+}
+
+// A read racing with puts and deletes can come out below zero.
+static inline uint32_t cf_rchash_elements(cf_rchash *h) {
+	if (! h->counter)
+		return(cf_atomic32_load(&h->elements, CF_ATOMIC_RELAXED));
+
+	int64_t n = cf_counter_read(h->counter);
+
+	return(n > 0 ? (uint32_t)n : 0);
+}
+
+// Double the table. The old table stays in place and its buckets drain into
+// the new one from cf_rchash_migrate() - only the pointer swap holds the
+// locks, and the new table is allocated before taking them.
+static void cf_rchash_resize_start(cf_rchash *h) {
+	uint table_len = h->table_len;
+
+	if (table_len > UINT32_MAX / 2) {
+		return;
+	}
+
+	void *table = cf_calloc((size_t)table_len * 2, cf_rchash_elem_size(h));
+
+	if (! table) {
+		return;
+	}
+
+	cf_rchash_lock_all(h);
+
+	// Somebody else got here first.
+	if (h->old_table || h->table_len != table_len) {
+		cf_rchash_unlock_all(h);
+		cf_free(table);
+		return;
+	}
+
+	// Lock-free readers load each length before its pointer, so publish the
+	// pointers first - a reader never indexes a table past its end.
+	CF_RCHASH_STORE_P(h->old_table, h->table);
+	cf_atomic32_store((cf_atomic32 *)&h->old_table_len, table_len, CF_ATOMIC_RELEASE);
+	CF_RCHASH_STORE_P(h->table, table);
+	cf_atomic32_store((cf_atomic32 *)&h->table_len, table_len * 2, CF_ATOMIC_RELEASE);
+
+	for (uint32_t s = 0; s < h->n_stripes; s++) {
+		h->stripes[s].migrate = 0;
+	}
+
+	cf_atomic32_set(&h->stripes_migrated, 0);
+
+	cf_rchash_unlock_all(h);
+}
+
+static void cf_rchash_resize_finish(cf_rchash *h) {
+	cf_rchash_lock_all(h);
+
+	void *old_table = h->old_table;
+
+	cf_atomic32_store((cf_atomic32 *)&h->old_table_len, 0, CF_ATOMIC_RELAXED);
+	CF_RCHASH_STORE_P(h->old_table, 0);
+
+	cf_rchash_unlock_all(h);
+
+	cf_rchash_retire(h, old_table, false);
+
+	if (h->reclaim) {
+		cf_rchash_reclaim_retired(h);
+	}
+}
+
+// Move up to CF_RCHASH_MIGRATE_BUCKETS of stripe s's old buckets to the new
+// table. Caller holds the stripe's lock. Returns true if that finished the
+// last stripe - the caller then calls cf_rchash_resize_finish() once it has
+// dropped its lock.
+static bool cf_rchash_migrate(cf_rchash *h, uint32_t s) {
+	cf_rchash_stripe *stripe = &h->stripes[s];
+	uint32_t n = h->old_table_len / h->n_stripes;
+
+	if (stripe->migrate == n) {
+		return false;
+	}
+
+	for (int i = 0; i < CF_RCHASH_MIGRATE_BUCKETS && stripe->migrate < n; i++) {
+		uint b = s + (stripe->migrate * h->n_stripes);
+		int rv = h->key_len == 0 ?
+				cf_rchash_migrate_bucket_v(h, get_bucket_v(h, h->old_table, b)) :
+				cf_rchash_migrate_bucket(h, get_bucket(h, h->old_table, b));
+
+		// Out of memory - the bucket stays behind and lookups still find it
+		// there. A later operation retries.
+		if (rv != CF_RCHASH_OK) {
+			return false;
+		}
+
+		stripe->migrate++;
+	}
+
+	return stripe->migrate == n &&
+			(uint32_t)cf_atomic32_incr(&h->stripes_migrated) == h->n_stripes;
+}
+
+// Every operation ends here. While a resize is on, it first moves a few more
+// of its stripe's old buckets, and operations that added an element check
+// whether the table has outgrown its buckets.
+static void cf_rchash_unlock(cf_rchash *h, uint32_t hash, pthread_mutex_t *l, bool added) {
+	bool finished = h->old_table && cf_rchash_migrate(h, hash & (h->n_stripes - 1));
+
+	cf_rchash_write_end(h, hash & (h->n_stripes - 1));
+
+	if (l)	pthread_mutex_unlock(l);
+
+	if (h->reclaim && h->reclaim->n_retired >= CF_RCHASH_RETIRE_BATCH) {
+		cf_rchash_reclaim_retired(h);
+	}
+
+	if (finished) {
+		cf_rchash_resize_finish(h);
+	}
+	else if (added && (h->flags & CF_RCHASH_CR_RESIZE) && ! h->old_table &&
+			cf_rchash_elements(h) > h->table_len) {
+		cf_rchash_resize_start(h);
+	}
+}
+
+// Built-in hashes, with cf_rchash_hash_fn's signature.
+static uint32_t cf_rchash_hash_crc32c(void *key, uint32_t key_len) {
+	return cf_hash_crc32c(key, key_len);
+}
+
+static uint32_t cf_rchash_hash_wy(void *key, uint32_t key_len) {
+	return cf_hash_wy32(key, key_len);
+}
+
+static uint32_t cf_rchash_hash_digest(void *key, uint32_t key_len) {
+	return cf_hash_digest(key, key_len);
+}
+
+// Walk buckets first, first + step, ... of a table. When step divides every
+// table length an element never leaves that set - stripes, for instance - so
+// walking one set at a time under its lock, its old buckets then its new
+// ones, visits each element once, even if a resize starts, moves along or
+// finishes between sets.
+static int cf_rchash_reduce_table(cf_rchash *h, void *table, uint table_len, uint32_t first, uint32_t step, cf_rchash_reduce_fn reduce_fn, void *udata) {
+	for (uint i = first; i < table_len; i += step) {
+		int rv = h->key_len == 0 ?
+				cf_rchash_reduce_bucket_v(h, get_bucket_v(h, table, i), reduce_fn, udata) :
+				cf_rchash_reduce_bucket(h, get_bucket(h, table, i), reduce_fn, udata);
+
+		if (rv != CF_RCHASH_OK) {
+			return rv;
+		}
+	}
+
+	return CF_RCHASH_OK;
+}
+
+// A parallel reduce walks units - buckets mod the table length when it
+// started (old table length, mid-resize), which only grows by doubling -
+// under the one lock covering each. Without MT_MANYLOCK one lock and stripe
+// cover everything, and are held for CF_RCHASH_REDUCE_BATCH units at a time.
+static void cf_rchash_reduce_partition(void *udata, uint32_t p) {
+	cf_rchash_reduce_job *job = (cf_rchash_reduce_job *)udata;
+	cf_rchash *h = job->h;
+	void *part_udata = job->udatas ? job->udatas + ((size_t)p * job->udata_size) : job->udata;
+	uint32_t u = (uint32_t)(((uint64_t)p * job->n_units) / job->n_partitions);
+	uint32_t end = (uint32_t)(((uint64_t)(p + 1) * job->n_units) / job->n_partitions);
+	uint32_t batch = (h->flags & CF_RCHASH_CR_MT_MANYLOCK) ? 1 : CF_RCHASH_REDUCE_BATCH;
+	int rv = CF_RCHASH_OK;
+
+	while (u < end && rv == CF_RCHASH_OK && cf_atomic32_get(job->stop) == 0) {
+		uint32_t first = u;
+		uint32_t batch_end = end - u > batch ? u + batch : end;
+		pthread_mutex_t *l = cf_rchash_lock(h, first);
+
+		for ( ; u < batch_end && rv == CF_RCHASH_OK; u++) {
+			if (h->old_table) {
+				rv = cf_rchash_reduce_table(h, h->old_table, h->old_table_len, u, job->n_units, job->reduce_fn, part_udata);
+			}
+
+			if (rv == CF_RCHASH_OK) {
+				rv = cf_rchash_reduce_table(h, h->table, h->table_len, u, job->n_units, job->reduce_fn, part_udata);
+			}
+		}
+
+		cf_rchash_unlock(h, first, l, false);
+	}
+
+	if (rv != CF_RCHASH_OK) {
+		job->rvs[p] = rv;
+		cf_atomic32_set(&job->stop, 1);
+	}
+}
+
 /******************************************************************************
  * FUNCTIONS
  ******************************************************************************/
 
 int cf_rchash_create(cf_rchash **h_r, cf_rchash_hash_fn h_fn, cf_rchash_destructor_fn d_fn, uint32_t key_len, uint32_t sz, uint flags) {
 	cf_rchash *h;
+	uint hash_flags = flags & (CF_RCHASH_CR_HASH_CRC32C | CF_RCHASH_CR_HASH_WY | CF_RCHASH_CR_HASH_DIGEST);
+
+	// More than one built-in hash leaves none.
+	if (hash_flags) {
+		h_fn = hash_flags == CF_RCHASH_CR_HASH_CRC32C ? cf_rchash_hash_crc32c :
+				hash_flags == CF_RCHASH_CR_HASH_WY ? cf_rchash_hash_wy :
+				hash_flags == CF_RCHASH_CR_HASH_DIGEST ? cf_rchash_hash_digest : 0;
+	}
+
+	if (((flags & CF_RCHASH_CR_MT_BIGLOCK) && (flags & CF_RCHASH_CR_MT_MANYLOCK)) || sz == 0 ||
+			((flags & CF_RCHASH_CR_LOCKFREE_READ) && key_len == 0) || ! h_fn) {
+		*h_r = 0;
+		return(CF_RCHASH_ERR);
+	}
 
 	h = cf_malloc(sizeof(cf_rchash));
 	if (!h)	return(CF_RCHASH_ERR);
 
+	h->n_stripes = (flags & CF_RCHASH_CR_MT_MANYLOCK) ? cf_rchash_stripe_count(sz) : 1;
+
+	// Round up so every stripe owns the same number of buckets.
+	sz = (sz + h->n_stripes - 1) & ~(h->n_stripes - 1);
+
 	h->elements = 0;
 	h->table_len = sz;
 	h->key_len = key_len;
 	h->flags = flags;
 	h->h_fn = h_fn;
 	h->d_fn = d_fn;
+	h->old_table_len = 0;
+	h->old_table = 0;
+	h->stripes_migrated = 0;
 
-	if ((flags & CF_RCHASH_CR_MT_BIGLOCK) && (flags & CF_RCHASH_CR_MT_MANYLOCK)) {
-		*h_r = 0;
+	h->table = cf_calloc(sz, cf_rchash_elem_size(h));
+
+	if (!h->table) {
+		cf_free(h);
 		return(CF_RCHASH_ERR);
 	}
 
-	if (key_len == 0)
-        h->table = cf_calloc(sz, sizeof(cf_rchash_elem_v));
-    else
-        h->table = cf_calloc(sz, sizeof(cf_rchash_elem_f) + key_len);
-    
-	if (!h->table) {
+	h->stripes = cf_valloc(sizeof(cf_rchash_stripe) * h->n_stripes);
+
+	if (! h->stripes) {
+		cf_free(h->table);
 		cf_free(h);
+		*h_r = 0;
 		return(CF_RCHASH_ERR);
 	}
 
+	memset(h->stripes, 0, sizeof(cf_rchash_stripe) * h->n_stripes);
+
+	h->reclaim = 0;
+
+	if (flags & CF_RCHASH_CR_LOCKFREE_READ) {
+		h->reclaim = cf_rchash_reclaim_create();
+
+		if (! h->reclaim) {
+			cf_free(h->stripes);
+			cf_free(h->table);
+			cf_free(h);
+			*h_r = 0;
+			return(CF_RCHASH_ERR);
+		}
+	}
+
 	if (flags & CF_RCHASH_CR_MT_BIGLOCK) {
 		if (0 != pthread_mutex_init ( &h->biglock, 0) ) {
+			cf_free(h->reclaim);
+			cf_free(h->stripes);
 			cf_free(h->table);
 			cf_free(h);
 			return(CF_RCHASH_ERR);
@@ -95,20 +697,39 @@ int cf_rchash_create(cf_rchash **h_r, cf_rchash_hash_fn h_fn, cf_rchash_destruct
 	}
 	else
 		memset( &h->biglock, 0, sizeof( h->biglock ) );
-	
+
 	if (flags & CF_RCHASH_CR_MT_MANYLOCK) {
-		h->lock_table = cf_malloc( sizeof(pthread_mutex_t) * sz);
-		if (! h->lock_table) {
-			cf_free(h);
+		for (uint32_t s = 0; s < h->n_stripes; s++) {
+			pthread_mutex_init( &h->stripes[s].lock, 0 );
+		}
+	}
+
+	h->slab = 0;
+	h->counter = 0;
+
+	if (flags & CF_RCHASH_CR_MT_MANYLOCK) {
+		h->counter = cf_counter_create(0);
+
+		if (! h->counter) {
+			cf_rchash_destroy(h);
 			*h_r = 0;
 			return(CF_RCHASH_ERR);
 		}
-		for (uint i=0;i<sz;i++) {
-			pthread_mutex_init( &(h->lock_table[i]), 0 );
+	}
+
+	// Only the biglock serializes every free - stripes, parallel reduce
+	// deletes and deferred frees all free concurrently.
+	if (flags & CF_RCHASH_CR_SLAB) {
+		bool mt = ! (flags & CF_RCHASH_CR_MT_BIGLOCK) || (flags & CF_RCHASH_CR_LOCKFREE_READ);
+
+		h->slab = cf_slab_create(cf_rchash_elem_size(h), mt ? CF_SLAB_MT : 0);
+
+		if (! h->slab) {
+			cf_rchash_destroy(h);
+			*h_r = 0;
+			return(CF_RCHASH_ERR);
 		}
 	}
-	else
-		h->lock_table = 0;
 
 	*h_r = h;
 
@@ -122,127 +743,285 @@ void cf_rchash_free(cf_rchash *h, void *object) {
 	}
 }
 
-static inline cf_rchash_elem_f *get_bucket(cf_rchash *h, uint i) {
-    return( (cf_rchash_elem_f * ) (
-                ((uint8_t *) h->table) +
-                ((sizeof(cf_rchash_elem_f) + h->key_len) * i) 
-             )
-           );
-}
-
 uint32_t cf_rchash_get_size(cf_rchash *h) {
     if (h->key_len == 0)    return(cf_rchash_get_size_v(h));
-    
+
     uint32_t sz = 0;
-    
+
     if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
     	pthread_mutex_lock(&h->biglock);
     	sz = h->elements;
     	pthread_mutex_unlock(&h->biglock);
     }
     else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-    	sz = cf_atomic32_get(h->elements);
+    	sz = cf_rchash_elements(h);
     }
     else {
     	sz = h->elements;
     }
 
-// interesting working code to spin through a table, taking locks, to find the exact size
-// written for manylock case only
-#if 0    
-	uint32_t validate_size = 0;
+    return(sz);
+
+}
 
-	for (uint i=0; i<h->table_len ; i++) {
+// Field by field rather than memcpy() and memset(), so a lock-free reader
+// never sees a torn next pointer, and the key goes in before the object.
+static inline void cf_rchash_elem_copy(cf_rchash *h, cf_rchash_elem_f *dst, cf_rchash_elem_f *src, cf_rchash_elem_f *next) {
+	memcpy(dst->key, src->key, h->key_len);
+	CF_RCHASH_STORE_P(dst->object, src->object);
+	CF_RCHASH_STORE_P(dst->next, next);
+}
 
-		pthread_mutex_t *l = &(h->lock_table[i]);
-		pthread_mutex_lock( l );
+static inline void cf_rchash_elem_clear(cf_rchash_elem_f *e) {
+	CF_RCHASH_STORE_P(e->object, 0);
+	CF_RCHASH_STORE_P(e->next, 0);
+}
 
-		cf_rchash_elem_f *list_he = get_bucket(h, i);
+static inline cf_rchash_elem_f *cf_rchash_find(cf_rchash *h, cf_rchash_elem_f *e, void *key, uint32_t key_len) {
+	// finding an empty bucket means key is not here
+	if ( e->object == 0 ) {
+		return(0);
+	}
 
-		while (list_he) {
-			// null object means unused head pointer
-			if (list_he->object == 0)
-				break;
-			validate_size++;
-			list_he = list_he->next;
+	while (e) {
+		if ( memcmp(key, e->key, key_len) == 0) {
+			return(e);
 		}
-		
-		pthread_mutex_unlock(l);
-		
+		e = e->next;
 	}
-#endif
 
-    return(sz);
-    
+	return(0);
 }
 
-int cf_rchash_put(cf_rchash *h, void *key, uint32_t key_len, void *object) {
-    if (h->key_len == 0)    return(cf_rchash_put_v(h, key, key_len, object));
+// During a resize a key is in the old table until its bucket migrates, and
+// anything added since is in the new one. Caller holds the key's lock.
+static cf_rchash_elem_f *cf_rchash_lookup(cf_rchash *h, uint32_t hash, void *key, uint32_t key_len) {
+	if (h->old_table) {
+		cf_rchash_elem_f *e = cf_rchash_find(h, get_bucket(h, h->old_table, hash % h->old_table_len), key, key_len);
 
-	if (h->key_len != key_len) return(CF_RCHASH_ERR);
+		if (e) {
+			return(e);
+		}
+	}
 
-	// Calculate hash
-	uint hash = h->h_fn(key, key_len);
-	hash %= h->table_len;
+	return(cf_rchash_find(h, get_bucket(h, h->table, hash % h->table_len), key, key_len));
+}
 
-	pthread_mutex_t		*l = 0;
-	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
+// As cf_rchash_find(), but racing writers - every link is an acquire load, so
+// whatever it leads to was written before it was published.
+static inline cf_rchash_elem_f *cf_rchash_find_lockfree(cf_rchash *h, cf_rchash_elem_f *e, void *key, uint32_t key_len) {
+	if (CF_RCHASH_LOAD_P(e->object) == 0) {
+		return(0);
 	}
-	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
+
+	while (e) {
+		if (memcmp(key, e->key, key_len) == 0) {
+			return(e);
+		}
+		e = CF_RCHASH_LOAD_P(e->next);
 	}
-	if (l)     pthread_mutex_lock( l );
-		
-	cf_rchash_elem_f *e = get_bucket(h, hash);
+
+	return(0);
+}
+
+// As cf_rchash_lookup(), but racing writers. Each length is loaded before its
+// table pointer - see cf_rchash_resize_start(). Anything found may be stale,
+// the caller checks the stripe's sequence number before trusting it.
+static cf_rchash_elem_f *cf_rchash_lookup_lockfree(cf_rchash *h, uint32_t hash, void *key, uint32_t key_len) {
+	uint old_table_len = cf_atomic32_load((cf_atomic32 *)&h->old_table_len, CF_ATOMIC_ACQUIRE);
+	void *old_table = CF_RCHASH_LOAD_P(h->old_table);
+
+	if (old_table && old_table_len) {
+		cf_rchash_elem_f *e = cf_rchash_find_lockfree(h, get_bucket(h, old_table, hash % old_table_len), key, key_len);
+
+		if (e) {
+			return(e);
+		}
+	}
+
+	uint table_len = cf_atomic32_load((cf_atomic32 *)&h->table_len, CF_ATOMIC_ACQUIRE);
+	void *table = CF_RCHASH_LOAD_P(h->table);
+
+	return(cf_rchash_find_lockfree(h, get_bucket(h, table, hash % table_len), key, key_len));
+}
+
+// Returns false if writers kept getting in the way and the caller should
+// lock. While counted in as a reader nothing retired can be freed, and the
+// table's reference keeps a found object alive, so it's safe to reserve once
+// the sequence number says it really was in the table.
+static bool cf_rchash_get_lockfree(cf_rchash *h, uint32_t hash, void *key, uint32_t key_len, void **object, int *rv_r) {
+	cf_rchash_stripe *stripe = &h->stripes[hash & (h->n_stripes - 1)];
+	uint32_t e;
+	cf_rchash_reader *r = cf_rchash_read_enter(h->reclaim, &e);
+
+	for (int i = 0; i < CF_RCHASH_READ_RETRIES; i++) {
+		uint32_t seq = cf_atomic32_load(&stripe->seq, CF_ATOMIC_ACQUIRE);
+
+		if (seq & 1) {
+			sched_yield();
+			continue;
+		}
+
+		cf_rchash_elem_f *el = cf_rchash_lookup_lockfree(h, hash, key, key_len);
+		void *o = el ? CF_RCHASH_LOAD_P(el->object) : 0;
+
+		// Keeps the loads above from moving past the re-check.
+		cf_atomic_fence(CF_ATOMIC_ACQUIRE);
+
+		if (cf_atomic32_load(&stripe->seq, CF_ATOMIC_RELAXED) != seq) {
+			continue;
+		}
+
+		if (o && object) {
+			cf_rc_reserve(o);
+			*object = o;
+		}
+
+		cf_rchash_read_exit(r, e);
+		*rv_r = o ? CF_RCHASH_OK : CF_RCHASH_ERR_NOTFOUND;
+		return(true);
+	}
+
+	cf_rchash_read_exit(r, e);
+	return(false);
+}
+
+// New elements always go in the current table.
+static int cf_rchash_insert(cf_rchash *h, uint32_t hash, void *key, void *object) {
+	cf_rchash_elem_f *e_head = get_bucket(h, h->table, hash % h->table_len);
+	cf_rchash_elem_f *e = e_head;
 
 	// most common case should be insert into empty bucket, special case
-	if ( e->object == 0  ) {
-		goto Copy;
+	if ( e_head->object != 0 ) {
+		e = (cf_rchash_elem_f *) cf_rchash_elem_alloc(h);
+		if (!e) return (CF_RCHASH_ERR);
+		// Fill it in before it's linked, for lock-free readers.
+		memcpy(e->key, key, h->key_len);
+		e->object = object;
+		e->next = e_head->next;
+		CF_RCHASH_STORE_P(e_head->next, e);
 	}
+	else {
+		memcpy(e->key, key, h->key_len);
+		CF_RCHASH_STORE_P(e->object, object);
+	}
+
+	cf_rchash_elements_incr(h);
+	return(CF_RCHASH_OK);
+}
 
-	cf_rchash_elem_f *e_head = e;
+static int cf_rchash_remove(cf_rchash *h, cf_rchash_elem_f *e, void *key, uint32_t key_len) {
+	// If bucket empty, def can't delete
+	if ( e->object == 0 ) {
+		return(CF_RCHASH_ERR_NOTFOUND);
+	}
 
-	// This loop might be skippable if you know the key is not already in the hash
-	// (like, you just searched and it's single-threaded)
+	cf_rchash_elem_f *e_prev = 0;
+
+	// Look for the element and destroy if found
 	while (e) {
-#ifdef VALIDATE
-		cf_atomic_int_t rc;
-		if ((rc = cf_rc_count(e->object)) < 1) {
-			as_log_info("cf_rchash %p: internal bad reference count (%d) on %p", h, rc, e->object);
-			if (l)		pthread_mutex_unlock(l);
-			return(CF_RCHASH_ERR);
-		}
-#endif		
-        // in this case we're replacing the previous object with the new object
 		if ( memcmp(e->key, key, key_len) == 0) {
-			cf_rchash_free(h,e->object);
-			e->object = object;
-			if (l)	pthread_mutex_unlock(l);
+			// Found it, kill it
+			cf_rchash_retire(h, e->object, true);
+			// patchup pointers & free element if not head
+			if (e_prev) {
+				CF_RCHASH_STORE_P(e_prev->next, e->next);
+				cf_rchash_retire(h, e, false);
+			}
+			// am at head - more complicated
+			else {
+				// at head with no next - easy peasy!
+				if (0 == e->next) {
+					cf_rchash_elem_clear(e);
+				}
+				// at head with a next - more complicated
+				else {
+					cf_rchash_elem_f *_t = e->next;
+					cf_rchash_elem_copy(h, e, _t, _t->next);
+					cf_rchash_retire(h, _t, false);
+				}
+			}
+
+			cf_rchash_elements_decr(h);
 			return(CF_RCHASH_OK);
 		}
+		e_prev = e;
 		e = e->next;
 	}
 
-	e = (cf_rchash_elem_f *) cf_malloc(sizeof(cf_rchash_elem_f) + key_len);
-	if (!e) return (CF_RCHASH_ERR);
-	e->next = e_head->next;
-	e_head->next = e;
-	
-Copy:
-	memcpy(e->key, key, key_len);
+	return(CF_RCHASH_ERR_NOTFOUND);
+}
 
-	e->object = object;
+// Move one old bucket's elements to their buckets in the new table. Chained
+// elements are relinked as they are - only the old head, which lives in the
+// old table itself, may need a new allocation.
+static int cf_rchash_migrate_bucket(cf_rchash *h, cf_rchash_elem_f *old_he) {
+	if (old_he->object == 0) {
+		return(CF_RCHASH_OK);
+	}
 
-	if (h->flags & CF_RCHASH_CR_MT_MANYLOCK)
-		cf_atomic32_incr(&h->elements);
-	else
-		h->elements++;
-	
-	if (l)		pthread_mutex_unlock(l);
+	cf_rchash_elem_f *e = old_he->next;
+
+	while (e) {
+		cf_rchash_elem_f *next = e->next;
+		cf_rchash_elem_f *e_head = get_bucket(h, h->table, h->h_fn(e->key, h->key_len) % h->table_len);
+
+		if (e_head->object == 0) {
+			cf_rchash_elem_copy(h, e_head, e, 0);
+			cf_rchash_retire(h, e, false);
+		}
+		else {
+			CF_RCHASH_STORE_P(e->next, e_head->next);
+			CF_RCHASH_STORE_P(e_head->next, e);
+		}
+		e = next;
+	}
+
+	CF_RCHASH_STORE_P(old_he->next, 0);
+
+	cf_rchash_elem_f *e_head = get_bucket(h, h->table, h->h_fn(old_he->key, h->key_len) % h->table_len);
+
+	if (e_head->object == 0) {
+		cf_rchash_elem_copy(h, e_head, old_he, 0);
+	}
+	else {
+		e = (cf_rchash_elem_f *) cf_rchash_elem_alloc(h);
+		if (!e) return(CF_RCHASH_ERR);
+		cf_rchash_elem_copy(h, e, old_he, e_head->next);
+		CF_RCHASH_STORE_P(e_head->next, e);
+	}
+
+	cf_rchash_elem_clear(old_he);
 	return(CF_RCHASH_OK);
 }
 
+int cf_rchash_put(cf_rchash *h, void *key, uint32_t key_len, void *object) {
+    if (h->key_len == 0)    return(cf_rchash_put_v(h, key, key_len, object));
+
+	if (h->key_len != key_len) return(CF_RCHASH_ERR);
+
+	// Calculate hash
+	uint32_t hash = h->h_fn(key, key_len);
+
+	pthread_mutex_t *l = cf_rchash_lock(h, hash);
+	int rv = CF_RCHASH_OK;
+
+	cf_rchash_elem_f *e = cf_rchash_lookup(h, hash, key, key_len);
+
+	// in this case we're replacing the previous object with the new object
+	if (e) {
+		void *old_object = e->object;
+		e->object = object;
+		cf_rchash_retire(h, old_object, true);
+	}
+	else {
+		rv = cf_rchash_insert(h, hash, key, object);
+	}
+
+	cf_rchash_unlock(h, hash, l, e == 0);
+	return(rv);
+}
+
 //
 // Put of any sort gobbles the reference count.
 // make sure the incoming reference count is > 0
@@ -253,68 +1032,21 @@ int cf_rchash_put_unique(cf_rchash *h, void *key, uint32_t key_len, void *object
 
 	if (h->key_len != key_len) return(CF_RCHASH_ERR);
 
-#ifdef VALIDATE
-	cf_atomic_int_t rc;
-	if ((rc = cf_rc_count(object)) < 1) {
-		as_log_info("cf_rchash %d: put unique! bad reference count (%d) on %p", h, rc, object);
-		return(CF_RCHASH_ERR);
-	}
-#endif    
-	
 	// Calculate hash
-	uint hash = h->h_fn(key, key_len);
-	hash %= h->table_len;
+	uint32_t hash = h->h_fn(key, key_len);
 
-	pthread_mutex_t		*l = 0;
-	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
-	}
-	if (l)     pthread_mutex_lock( l );
-		
-	cf_rchash_elem_f *e = get_bucket(h, hash);
-
-	// most common case should be insert into empty bucket, special case
-	if ( e->object == 0 ) goto Copy;
-
-	cf_rchash_elem_f *e_head = e;
+	pthread_mutex_t *l = cf_rchash_lock(h, hash);
+	int rv = CF_RCHASH_ERR_FOUND;
 
 	// check for uniqueness of key - if not unique, fail!
-	while (e) {
-#ifdef VALIDATE
-		cf_atomic_int_t rc;
-		if ((rc = cf_rc_count(e->object)) < 1) {
-			as_log_info("cf_rchash %p: internal bad reference count (%d) on %p", h, rc, e->object);
-			if (l)	pthread_mutex_unlock(l);
-			return(CF_RCHASH_ERR);
-		}
-#endif		
-		if ( memcmp(e->key, key, key_len) == 0) {
-			if (l) pthread_mutex_unlock(l);
-			return(CF_RCHASH_ERR_FOUND);
-		}
-		e = e->next;
-	}
+	bool found = cf_rchash_lookup(h, hash, key, key_len) != 0;
 
-	e = (cf_rchash_elem_f *) cf_malloc(sizeof(cf_rchash_elem_f) + key_len);
-	if (!e) return (CF_RCHASH_ERR);
-	e->next = e_head->next;
-	e_head->next = e;
-	
-Copy:
-	memcpy(e->key, key, key_len);
-
-	e->object = object;
-
-	if (h->flags & CF_RCHASH_CR_MT_MANYLOCK)
-		cf_atomic32_incr(&h->elements);
-	else
-		h->elements++;
+	if (! found) {
+		rv = cf_rchash_insert(h, hash, key, object);
+	}
 
-	if (l)		pthread_mutex_unlock(l);
-	return(CF_RCHASH_OK);
+	cf_rchash_unlock(h, hash, l, ! found);
+	return(rv);
 }
 
 int cf_rchash_get(cf_rchash *h, void *key, uint32_t key_len, void **object) {
@@ -322,55 +1054,27 @@ int cf_rchash_get(cf_rchash *h, void *key, uint32_t key_len, void **object) {
     if (h->key_len == 0)    return(cf_rchash_get_v(h,key,key_len,object));
 	if (h->key_len != key_len) return(CF_RCHASH_ERR);
 
-	int rv = CF_RCHASH_ERR;
-	
-	uint hash = h->h_fn(key, key_len);
-	hash %= h->table_len;
+	int rv = CF_RCHASH_ERR_NOTFOUND;
 
-	pthread_mutex_t		*l = 0;
-	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
-	}
-	if (l)     pthread_mutex_lock( l );
-	
-	cf_rchash_elem_f *e = get_bucket(h, hash);
+	uint32_t hash = h->h_fn(key, key_len);
 
-  	// finding an empty bucket means key is not here
-	if ( e->object == 0 ) {
-        rv = CF_RCHASH_ERR_NOTFOUND;
-        goto Out;
+	if (h->reclaim && cf_rchash_get_lockfree(h, hash, key, key_len, object, &rv)) {
+		return(rv);
 	}
-    
-	while (e) {
-#ifdef VALIDATE
-		cf_atomic_int_t rc;
-		if ((rc = cf_rc_count(e->object)) < 1) {
-			as_log_info("cf_rchash %p: internal bad reference count (%d) on %p", h, rc, e->object);
-			if (l)	pthread_mutex_unlock(l);
-			return(CF_RCHASH_ERR);
-		}
-#endif
 
-		if ( memcmp(key, e->key, key_len) == 0) {
-			if (object) {
-				cf_rc_reserve( e->object );
-				*object = e->object;
-			}
-			rv = CF_RCHASH_OK; 
-			goto Out;
+	pthread_mutex_t *l = cf_rchash_lock(h, hash);
+
+	cf_rchash_elem_f *e = cf_rchash_lookup(h, hash, key, key_len);
+
+	if (e) {
+		if (object) {
+			cf_rc_reserve( e->object );
+			*object = e->object;
 		}
-		e = e->next;
+		rv = CF_RCHASH_OK;
 	}
-    
-	rv = CF_RCHASH_ERR_NOTFOUND;
-	
-Out:
-	if (l)
-		pthread_mutex_unlock(l);
 
+	cf_rchash_unlock(h, hash, l, false);
 	return(rv);
 }
 
@@ -379,80 +1083,21 @@ int cf_rchash_delete(cf_rchash *h, void *key, uint32_t key_len) {
 	if (h->key_len != key_len) return(CF_RCHASH_ERR);
 
 	// Calculate hash
-	uint hash = h->h_fn(key, key_len);
-	hash %= h->table_len;
-	int rv = CF_RCHASH_ERR;
+	uint32_t hash = h->h_fn(key, key_len);
+	int rv = CF_RCHASH_ERR_NOTFOUND;
 
     // take lock
-	pthread_mutex_t		*l = 0;
-	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
-	}
-	if (l)     pthread_mutex_lock( l );
-		
-	cf_rchash_elem_f *e = get_bucket(h, hash);
+	pthread_mutex_t *l = cf_rchash_lock(h, hash);
 
-	// If bucket empty, def can't delete
-	if ( e->object == 0 ) {
-		rv = CF_RCHASH_ERR_NOTFOUND;
-		goto Out;
+	if (h->old_table) {
+		rv = cf_rchash_remove(h, get_bucket(h, h->old_table, hash % h->old_table_len), key, key_len);
 	}
 
-	cf_rchash_elem_f *e_prev = 0;
-
-	// Look for the element and destroy if found
-	while (e) {
-		
-#ifdef VALIDATE
-		cf_atomic_int_t rc;
-		if ((rc = cf_rc_count(e->object)) < 1) {
-			as_log_info("cf_rchash %p: internal bad reference count (%d) on %p", h, rc, e->object);
-			if (l)	pthread_mutex_unlock(l);
-			return(CF_RCHASH_ERR);
-		}
-#endif		
-
-		if ( memcmp(e->key, key, key_len) == 0) {
-			// Found it, kill it
-			cf_rchash_free(h, e->object);
-			// patchup pointers & free element if not head
-			if (e_prev) {
-				e_prev->next = e->next;
-				cf_free(e);
-			}
-			// am at head - more complicated
-			else {
-				// at head with no next - easy peasy!
-				if (0 == e->next) {
-					memset(e, 0, sizeof(cf_rchash_elem_f));
-				}
-				// at head with a next - more complicated
-				else {
-					cf_rchash_elem_f *_t = e->next;
-					memcpy(e, e->next, sizeof(cf_rchash_elem_f)+key_len);
-					cf_free(_t);
-				}
-			}
-			
-			if (h->flags & CF_RCHASH_CR_MT_MANYLOCK)
-				cf_atomic32_decr(&h->elements);
-			else
-				h->elements--;
-			
-			rv = CF_RCHASH_OK;
-			goto Out;
-
-		}
-		e_prev = e;
-		e = e->next;
+	if (rv == CF_RCHASH_ERR_NOTFOUND) {
+		rv = cf_rchash_remove(h, get_bucket(h, h->table, hash % h->table_len), key, key_len);
 	}
-	rv = CF_RCHASH_ERR_NOTFOUND;
 
-Out:
-	if (l)	pthread_mutex_unlock(l);
+	cf_rchash_unlock(h, hash, l, false);
 	return(rv);
 }
 
@@ -465,106 +1110,157 @@ Out:
 //         reduce_fn's returned value.
 
 int cf_rchash_reduce(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata) {
-	if (h->key_len == 0) {
-		return cf_rchash_reduce_v(h, reduce_fn, udata);
-	}
+	int rv = CF_RCHASH_OK;
 
 	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
 		pthread_mutex_lock(&h->biglock);
 	}
 
-	for (uint32_t i = 0; i < h->table_len; i++) {
+	for (uint32_t s = 0; s < h->n_stripes && rv == CF_RCHASH_OK; s++) {
 		pthread_mutex_t *l = NULL;
 
 		if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-			l = &(h->lock_table[i]);
+			l = &h->stripes[s].lock;
 			pthread_mutex_lock(l);
 		}
 
-		cf_rchash_elem_f *list_he = get_bucket(h, i);
-		cf_rchash_elem_f *prev_he = NULL;
+		cf_rchash_write_begin(h, s);
+
+		if (h->old_table) {
+			rv = cf_rchash_reduce_table(h, h->old_table, h->old_table_len, s, h->n_stripes, reduce_fn, udata);
+		}
+
+		if (rv == CF_RCHASH_OK) {
+			rv = cf_rchash_reduce_table(h, h->table, h->table_len, s, h->n_stripes, reduce_fn, udata);
+		}
+
+		cf_rchash_write_end(h, s);
+
+		if (l) {
+			pthread_mutex_unlock(l);
+		}
+	}
+
+	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
+		pthread_mutex_unlock(&h->biglock);
+	}
+
+	if (h->reclaim) {
+		cf_rchash_reclaim_retired(h);
+	}
+
+	return rv;
+}
+
+int cf_rchash_reduce_parallel(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata, size_t udata_size, cf_rchash_combine_fn combine_fn, as_thread_pool *pool, uint32_t n_partitions) {
+	cf_rchash_reduce_job job = {
+			.h = h, .reduce_fn = reduce_fn, .udata = udata, .udata_size = udata_size
+	};
+
+	// Resizes hold every lock, so any one will do.
+	pthread_mutex_t *l = cf_rchash_lock(h, 0);
+	job.n_units = h->old_table ? h->old_table_len : h->table_len;
+	cf_rchash_write_end(h, 0);
+	if (l)	pthread_mutex_unlock(l);
+
+	if (n_partitions == 0) {
+		n_partitions = 1;
+	}
+	if (n_partitions > job.n_units) {
+		n_partitions = job.n_units;
+	}
+	job.n_partitions = n_partitions;
+
+	job.rvs = cf_calloc(n_partitions, sizeof(int));
+	if (! job.rvs) return CF_RCHASH_ERR;
+
+	if (udata_size) {
+		job.udatas = cf_malloc(udata_size * n_partitions);
+
+		if (! job.udatas) {
+			cf_free(job.rvs);
+			return CF_RCHASH_ERR;
+		}
+
+		for (uint32_t p = 0; p < n_partitions; p++) {
+			memcpy(job.udatas + ((size_t)p * udata_size), udata, udata_size);
+		}
+	}
+
+	int rv = as_thread_pool_run_partitions(pool, cf_rchash_reduce_partition, &job, n_partitions) == 0 ?
+			CF_RCHASH_OK : CF_RCHASH_ERR;
+
+	for (uint32_t p = 0; p < n_partitions; p++) {
+		if (rv == CF_RCHASH_OK) {
+			rv = job.rvs[p];
+		}
+		if (job.udatas && combine_fn) {
+			combine_fn(udata, job.udatas + ((size_t)p * udata_size));
+		}
+	}
+
+	if (job.udatas) cf_free(job.udatas);
+	cf_free(job.rvs);
 
-		while (list_he) {
-			if (! list_he->object) {
-				// Nothing (more) in this row.
-				break;
-			}
+	if (h->reclaim) {
+		cf_rchash_reclaim_retired(h);
+	}
 
-#ifdef VALIDATE
-			cf_atomic_int_t rc;
-			if ((rc = cf_rc_count(list_he->object)) < 1) {
-				as_log_info("cf_rchash %p: internal bad reference count (%d) on %p", h, rc, list_he->object);
-				if (l)	pthread_mutex_unlock(l);
-				return;
-			}
-#endif		
+	return rv;
+}
 
-			int rv = reduce_fn(list_he->key, h->key_len, list_he->object, udata);
+static int cf_rchash_reduce_bucket(cf_rchash *h, cf_rchash_elem_f *list_he, cf_rchash_reduce_fn reduce_fn, void *udata) {
+	cf_rchash_elem_f *prev_he = NULL;
 
-			if (rv == CF_RCHASH_OK) {
-				// Most common case - keep going.
-				prev_he = list_he;
-				list_he = list_he->next;
-			}
-			else if (rv == CF_RCHASH_REDUCE_DELETE) {
-				cf_rchash_free(h, list_he->object);
+	while (list_he) {
+		if (! list_he->object) {
+			// Nothing (more) in this row.
+			break;
+		}
 
-				if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-					cf_atomic32_decr(&h->elements);
-				}
-				else {
-					h->elements--;
-				}
+		int rv = reduce_fn(list_he->key, h->key_len, list_he->object, udata);
 
-				if (prev_he) {
-					prev_he->next = list_he->next;
-					cf_free(list_he);
-					list_he = prev_he->next;
-				}
-				else {
-					// At head with no next.
-					if (! list_he->next) {
-						memset(list_he, 0, sizeof(cf_rchash_elem_f));
-						list_he = NULL;
-					}
-					// At head with a next. Copy next into current and free
-					// next. prev_he stays NULL, list_he stays unchanged.
-					else {
-						cf_rchash_elem_f *_t = list_he->next;
-						memcpy(list_he, list_he->next, sizeof(cf_rchash_elem_f) + h->key_len);
-						cf_free(_t);
-					}
-				}
+		if (rv == CF_RCHASH_OK) {
+			// Most common case - keep going.
+			prev_he = list_he;
+			list_he = list_he->next;
+		}
+		else if (rv == CF_RCHASH_REDUCE_DELETE) {
+			cf_rchash_retire(h, list_he->object, true);
+			cf_rchash_elements_decr(h);
+
+			if (prev_he) {
+				CF_RCHASH_STORE_P(prev_he->next, list_he->next);
+				cf_rchash_retire(h, list_he, false);
+				list_he = prev_he->next;
 			}
 			else {
-				// Stop iterating.
-				if (l) {
-					pthread_mutex_unlock(l);
+				// At head with no next.
+				if (! list_he->next) {
+					cf_rchash_elem_clear(list_he);
+					list_he = NULL;
 				}
-
-				if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
-					pthread_mutex_unlock(&h->biglock);
+				// At head with a next. Copy next into current and free
+				// next. prev_he stays NULL, list_he stays unchanged.
+				else {
+					cf_rchash_elem_f *_t = list_he->next;
+					cf_rchash_elem_copy(h, list_he, _t, _t->next);
+					cf_rchash_retire(h, _t, false);
 				}
-
-				return rv;
 			}
 		}
-
-		if (l) {
-			pthread_mutex_unlock(l);
+		else {
+			// Stop iterating.
+			return rv;
 		}
 	}
 
-	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
-		pthread_mutex_unlock(&h->biglock);
-	}
-
 	return CF_RCHASH_OK;
 }
 
-void cf_rchash_destroy_elements(cf_rchash *h) {
-	for (uint i=0;i<h->table_len;i++) {
-        cf_rchash_elem_f *e = get_bucket(h, i);
+static void cf_rchash_destroy_table(cf_rchash *h, void *table, uint table_len) {
+	for (uint i=0;i<table_len;i++) {
+        cf_rchash_elem_f *e = get_bucket(h, table, i);
         if (e->object == 0) continue;
         cf_rchash_free(h, e->object);
         e = e->next; // skip the first, it's in place
@@ -572,11 +1268,22 @@ void cf_rchash_destroy_elements(cf_rchash *h) {
         while (e) {
             cf_rchash_elem_f *t = e->next;
             cf_rchash_free(h, e->object);
-            cf_free(e);
+            if (! h->slab) cf_free(e);
             e = t;
 		}
 	}
+}
+
+void cf_rchash_destroy_elements(cf_rchash *h) {
+	if (h->old_table) {
+		cf_rchash_destroy_table(h, h->old_table, h->old_table_len);
+	}
+	cf_rchash_destroy_table(h, h->table, h->table_len);
 	h->elements = 0;
+
+	if (h->counter) {
+		cf_counter_reset(h->counter);
+	}
 }
 
 void cf_rchash_destroy(cf_rchash *h) {
@@ -587,35 +1294,47 @@ void cf_rchash_destroy(cf_rchash *h) {
 		pthread_mutex_destroy(&h->biglock);
 	}
 	if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-		for (uint i=0;i<h->table_len;i++) {
-			pthread_mutex_destroy(&(h->lock_table[i]));
+		for (uint32_t s = 0; s < h->n_stripes; s++) {
+			pthread_mutex_destroy(&h->stripes[s].lock);
 		}
-		cf_free(h->lock_table);
 	}
 
+	if (h->reclaim) {
+		// No readers left by now - whatever is still retired can go.
+		for (uint32_t i = 0; i < h->reclaim->n_retired; i++) {
+			cf_rchash_dispose(h, h->reclaim->retired[i].p, h->reclaim->retired[i].object);
+		}
+
+		pthread_mutex_destroy(&h->reclaim->sync_lock);
+		pthread_mutex_destroy(&h->reclaim->retire_lock);
+		cf_free(h->reclaim->retired);
+		cf_free(h->reclaim);
+	}
+
+	if (h->slab) {
+		cf_slab_destroy(h->slab);
+	}
+
+	if (h->counter) {
+		cf_counter_destroy(h->counter);
+	}
+
+	cf_free(h->stripes);
+	cf_free(h->old_table);
 	cf_free(h->table);
 	cf_free(h);
 }
 
-inline static cf_rchash_elem_v * get_bucket_v(cf_rchash *h, uint i) {
-    return ( (cf_rchash_elem_v *) 
-               ( 
-                 ((uint8_t *)h->table) + (sizeof(cf_rchash_elem_v) * i)
-               ) 
-           );
-}
-
-
 uint32_t cf_rchash_get_size_v(cf_rchash *h) {
     uint32_t sz = 0;
-    
+
     if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
     	pthread_mutex_lock(&h->biglock);
     	sz = h->elements;
     	pthread_mutex_unlock(&h->biglock);
     }
     else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-    	sz = cf_atomic32_get(h->elements);
+    	sz = cf_rchash_elements(h);
     }
     else {
     	sz = h->elements;
@@ -623,237 +1342,72 @@ uint32_t cf_rchash_get_size_v(cf_rchash *h) {
     return(sz);
 }
 
-
-int cf_rchash_put_v(cf_rchash *h, void *key, uint32_t key_len, void *object) {
-	if ((h->key_len) &&  (h->key_len != key_len) ) return(CF_RCHASH_ERR);
-
-	// Calculate hash
-	uint hash = h->h_fn(key, key_len);
-	hash %= h->table_len;
-
-	pthread_mutex_t		*l = 0;
-	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
+static inline cf_rchash_elem_v *cf_rchash_find_v(cf_rchash_elem_v *e, void *key, uint32_t key_len) {
+	// finding an empty bucket means key is not here
+	if ( e->object == 0 ) {
+		return(0);
 	}
-	if (l)     pthread_mutex_lock( l );
-		
-	cf_rchash_elem_v *e = get_bucket_v(h, hash);
-
-	// most common case should be insert into empty bucket, special case
-	if ( e->object == 0 )
-		goto Copy;
-
-	cf_rchash_elem_v *e_head = e;
 
-	// This loop might be skippable if you know the key is not already in the hash
-	// (like, you just searched and it's single-threaded)
 	while (e) {
-#ifdef VALIDATE
-		cf_atomic_int_t rc;
-		if ((rc = cf_rc_count(e->object)) < 1) {
-			as_log_info("cf_rchash %p: internal bad reference count on %p", h, rc, e->object);
-			if (l)		pthread_mutex_unlock(l);
-			return(CF_RCHASH_ERR);
-		}
-#endif		
-        // in this case we're replacing the previous object with the new object
 		if ( ( key_len == e->key_len ) &&
-			 ( memcmp(e->key, key, key_len) == 0) ) {
-			cf_rchash_free(h,e->object);
-			e->object = object;
-			if (l)	pthread_mutex_unlock(l);
-			return(CF_RCHASH_OK);
+			 ( memcmp(key, e->key, key_len) == 0) ) {
+			return(e);
 		}
 		e = e->next;
 	}
 
-	e = (cf_rchash_elem_v *) cf_malloc(sizeof(cf_rchash_elem_v));
-	if (!e)	return (CF_RCHASH_ERR);
-	e->next = e_head->next;
-	e_head->next = e;
-	
-Copy:
-	e->key = cf_malloc(key_len);
-	if (!e->key) return (CF_RCHASH_ERR);
-	memcpy(e->key, key, key_len);
-	e->key_len = key_len;
-
-	e->object = object;
-
-	h->elements++;
-	if (l)		pthread_mutex_unlock(l);
-	return(CF_RCHASH_OK);
+	return(0);
 }
 
-//
-// Put of any sort gobbles the reference count.
-// make sure the incoming reference count is > 0
-//
-
-int cf_rchash_put_unique_v(cf_rchash *h, void *key, uint32_t key_len, void *object) {
-	if ((h->key_len) &&  (h->key_len != key_len) ) return(CF_RCHASH_ERR);
+static cf_rchash_elem_v *cf_rchash_lookup_v(cf_rchash *h, uint32_t hash, void *key, uint32_t key_len) {
+	if (h->old_table) {
+		cf_rchash_elem_v *e = cf_rchash_find_v(get_bucket_v(h, h->old_table, hash % h->old_table_len), key, key_len);
 
-#ifdef VALIDATE
-	cf_atomic_int_t rc;
-	if ((rc = cf_rc_count(object)) < 1) {
-		as_log_info("cf_rchash %p: put unique! bad reference count (%d) on %p", h, rc, object);
-		return(CF_RCHASH_ERR);
+		if (e) {
+			return(e);
+		}
 	}
-#endif    
-	
-	// Calculate hash
-	uint hash = h->h_fn(key, key_len);
-	hash %= h->table_len;
 
-	pthread_mutex_t		*l = 0;
-	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
-	}
-	if (l)     pthread_mutex_lock( l );
-		
-	cf_rchash_elem_v *e = get_bucket_v(h, hash);
+	return(cf_rchash_find_v(get_bucket_v(h, h->table, hash % h->table_len), key, key_len));
+}
 
-	// most common case should be insert into empty bucket, special case
-	if ( e->object == 0 )
-		goto Copy;
+static int cf_rchash_insert_v(cf_rchash *h, uint32_t hash, void *key, uint32_t key_len, void *object) {
+	void *e_key = cf_malloc(key_len);
+	if (!e_key) return (CF_RCHASH_ERR);
+	memcpy(e_key, key, key_len);
 
-	cf_rchash_elem_v *e_head = e;
+	cf_rchash_elem_v *e_head = get_bucket_v(h, h->table, hash % h->table_len);
+	cf_rchash_elem_v *e = e_head;
 
-	// check for uniqueness of key - if not unique, fail!
-	while (e) {
-#ifdef VALIDATE
-		cf_atomic_int_t rc;
-		if ((rc = cf_rc_count(e->object)) < 1) {
-			as_log_info("cf_rchash %p: internal bad reference count (%d) on %p", h, rc, e->object);
-			if (l)	pthread_mutex_unlock(l);
-			return(CF_RCHASH_ERR);
-		}
-#endif		
-		if ( ( key_len == e->key_len ) &&
-			 ( memcmp(e->key, key, key_len) == 0) ) {
-			if (l) pthread_mutex_unlock(l);
-			return(CF_RCHASH_ERR_FOUND);
+	// most common case should be insert into empty bucket, special case
+	if ( e_head->object != 0 ) {
+		e = (cf_rchash_elem_v *) cf_rchash_elem_alloc(h);
+		if (!e) {
+			cf_free(e_key);
+			return (CF_RCHASH_ERR);
 		}
-		e = e->next;
+		e->next = e_head->next;
+		e_head->next = e;
 	}
 
-	e = (cf_rchash_elem_v *) cf_malloc(sizeof(cf_rchash_elem_v));
-	if (!e)	return (CF_RCHASH_ERR);
-	e->next = e_head->next;
-	e_head->next = e;
-	
-Copy:
-	e->key = cf_malloc(key_len);
-	if (!e->key) return (CF_RCHASH_ERR);
-	memcpy(e->key, key, key_len);
+	e->key = e_key;
 	e->key_len = key_len;
-
 	e->object = object;
 
-	h->elements++;
-	if (l)		pthread_mutex_unlock(l);
+	cf_rchash_elements_incr(h);
 	return(CF_RCHASH_OK);
 }
 
-int cf_rchash_get_v(cf_rchash *h, void *key, uint32_t key_len, void **object) {
-	int rv = CF_RCHASH_ERR;
-	
-	uint hash = h->h_fn(key, key_len);
-	hash %= h->table_len;
-
-	pthread_mutex_t		*l = 0;
-	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
-	}
-	if (l)     pthread_mutex_lock( l );
-	
-	cf_rchash_elem_v *e = get_bucket_v(h, hash);
-
-  	// finding an empty bucket means key is not here
-	if ( e->object == 0 ) {
-        rv = CF_RCHASH_ERR_NOTFOUND;
-        goto Out;
-	}
-    
-	while (e) {
-#ifdef VALIDATE
-		cf_atomic_int_t rc;
-		if ((rc = cf_rc_count(e->object)) < 1) {
-			as_log_info("cf_rchash %p: internal bad reference count (%d) on %p", h, rc, e->object);
-			if (l)	pthread_mutex_unlock(l);
-			return(CF_RCHASH_ERR);
-		}
-#endif		
-
-		if ( ( key_len == e->key_len ) &&
-			 ( memcmp(key, e->key, key_len) == 0) ) {
-			if (object) {
-				cf_rc_reserve( e->object );
-				*object = e->object;
-			}
-			rv = CF_RCHASH_OK; 
-			goto Out;
-		}
-		e = e->next;
-	}
-    
-	rv = CF_RCHASH_ERR_NOTFOUND;
-	
-Out:
-	if (l)
-		pthread_mutex_unlock(l);
-
-	return(rv);
-}
-
-int cf_rchash_delete_v(cf_rchash *h, void *key, uint32_t key_len) {
-	if ((h->key_len) &&  (h->key_len != key_len) ) return(CF_RCHASH_ERR);
-
-	// Calculate hash
-	uint hash = h->h_fn(key, key_len);
-	hash %= h->table_len;
-	int rv = CF_RCHASH_ERR;
-
-	pthread_mutex_t		*l = 0;
-	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
-	}
-	if (l)     pthread_mutex_lock( l );
-		
-	cf_rchash_elem_v *e = get_bucket_v(h, hash);
-
+static int cf_rchash_remove_v(cf_rchash *h, cf_rchash_elem_v *e, void *key, uint32_t key_len) {
 	// If bucket empty, def can't delete
-	if ( ( e->next == 0 ) && (e->key_len == 0) ) {
-		rv = CF_RCHASH_ERR_NOTFOUND;
-		goto Out;
+	if ( e->object == 0 ) {
+		return(CF_RCHASH_ERR_NOTFOUND);
 	}
 
 	cf_rchash_elem_v *e_prev = 0;
 
 	// Look for the element and destroy if found
 	while (e) {
-		
-#ifdef VALIDATE
-		cf_atomic_int_t rc;
-		if ((rc = cf_rc_count(e->object)) < 1) {
-			as_log_info("cf_rchash %p: internal bad reference count (%d) on %p", h, rc, e->object);
-			if (l)	pthread_mutex_unlock(l);
-			return(CF_RCHASH_ERR);
-		}
-#endif		
-
 		if ( ( key_len == e->key_len ) &&
 			 ( memcmp(e->key, key, key_len) == 0) ) {
 			// Found it, kill it
@@ -862,7 +1416,7 @@ int cf_rchash_delete_v(cf_rchash *h, void *key, uint32_t key_len) {
 			// patchup pointers & free element if not head
 			if (e_prev) {
 				e_prev->next = e->next;
-				cf_free(e);
+				cf_rchash_elem_free(h, e);
 			}
 			// am at head - more complicated
 			else {
@@ -874,134 +1428,209 @@ int cf_rchash_delete_v(cf_rchash *h, void *key, uint32_t key_len) {
 				else {
 					cf_rchash_elem_v *_t = e->next;
 					memcpy(e, e->next, sizeof(cf_rchash_elem_v));
-					cf_free(_t);
+					cf_rchash_elem_free(h, _t);
 				}
 			}
-			h->elements--;
-			rv = CF_RCHASH_OK;
-			goto Out;
 
+			cf_rchash_elements_decr(h);
+			return(CF_RCHASH_OK);
 		}
 		e_prev = e;
 		e = e->next;
 	}
-	rv = CF_RCHASH_ERR_NOTFOUND;
 
-Out:
-	if (l)	pthread_mutex_unlock(l);
+	return(CF_RCHASH_ERR_NOTFOUND);
+}
+
+static int cf_rchash_migrate_bucket_v(cf_rchash *h, cf_rchash_elem_v *old_he) {
+	if (old_he->object == 0) {
+		return(CF_RCHASH_OK);
+	}
+
+	cf_rchash_elem_v *e = old_he->next;
+
+	while (e) {
+		cf_rchash_elem_v *next = e->next;
+		cf_rchash_elem_v *e_head = get_bucket_v(h, h->table, h->h_fn(e->key, e->key_len) % h->table_len);
+
+		if (e_head->object == 0) {
+			memcpy(e_head, e, sizeof(cf_rchash_elem_v));
+			e_head->next = 0;
+			cf_rchash_elem_free(h, e);
+		}
+		else {
+			e->next = e_head->next;
+			e_head->next = e;
+		}
+		e = next;
+	}
+
+	old_he->next = 0;
+
+	cf_rchash_elem_v *e_head = get_bucket_v(h, h->table, h->h_fn(old_he->key, old_he->key_len) % h->table_len);
+
+	if (e_head->object == 0) {
+		memcpy(e_head, old_he, sizeof(cf_rchash_elem_v));
+	}
+	else {
+		e = (cf_rchash_elem_v *) cf_rchash_elem_alloc(h);
+		if (!e) return(CF_RCHASH_ERR);
+		memcpy(e, old_he, sizeof(cf_rchash_elem_v));
+		e->next = e_head->next;
+		e_head->next = e;
+	}
+
+	memset(old_he, 0, sizeof(cf_rchash_elem_v));
+	return(CF_RCHASH_OK);
+}
+
+int cf_rchash_put_v(cf_rchash *h, void *key, uint32_t key_len, void *object) {
+	if ((h->key_len) &&  (h->key_len != key_len) ) return(CF_RCHASH_ERR);
+
+	// Calculate hash
+	uint32_t hash = h->h_fn(key, key_len);
+
+	pthread_mutex_t *l = cf_rchash_lock(h, hash);
+	int rv = CF_RCHASH_OK;
+
+	cf_rchash_elem_v *e = cf_rchash_lookup_v(h, hash, key, key_len);
+
+	// in this case we're replacing the previous object with the new object
+	if (e) {
+		cf_rchash_free(h, e->object);
+		e->object = object;
+	}
+	else {
+		rv = cf_rchash_insert_v(h, hash, key, key_len, object);
+	}
+
+	cf_rchash_unlock(h, hash, l, e == 0);
 	return(rv);
 }
 
-// Call the given function (reduce_fn) over every node in the tree.
-// Can be lock-expensive at the moment, until we improve the lockfree code.
-// The value returned by reduce_fn governs behavior as follows:
-//     CF_RCHASH_OK (0) - continue iterating.
-//     CF_RCHASH_REDUCE_DELETE (1) - delete the current node.
-//     Anything else (e.g. CF_RCHASH_ERR) - stop iterating and return
-//         reduce_fn's returned value.
+//
+// Put of any sort gobbles the reference count.
+// make sure the incoming reference count is > 0
+//
 
-int cf_rchash_reduce_v(cf_rchash *h, cf_rchash_reduce_fn reduce_fn, void *udata) {
+int cf_rchash_put_unique_v(cf_rchash *h, void *key, uint32_t key_len, void *object) {
+	if ((h->key_len) &&  (h->key_len != key_len) ) return(CF_RCHASH_ERR);
 
-	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
-		pthread_mutex_lock(&h->biglock);
+	// Calculate hash
+	uint32_t hash = h->h_fn(key, key_len);
+
+	pthread_mutex_t *l = cf_rchash_lock(h, hash);
+	int rv = CF_RCHASH_ERR_FOUND;
+
+	// check for uniqueness of key - if not unique, fail!
+	bool found = cf_rchash_lookup_v(h, hash, key, key_len) != 0;
+
+	if (! found) {
+		rv = cf_rchash_insert_v(h, hash, key, key_len, object);
 	}
 
-	for (uint32_t i = 0; i < h->table_len; i++) {
-		pthread_mutex_t *l = NULL;
+	cf_rchash_unlock(h, hash, l, ! found);
+	return(rv);
+}
 
-		if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-			l = &(h->lock_table[i]);
-			pthread_mutex_lock(l);
+int cf_rchash_get_v(cf_rchash *h, void *key, uint32_t key_len, void **object) {
+	int rv = CF_RCHASH_ERR_NOTFOUND;
+
+	uint32_t hash = h->h_fn(key, key_len);
+
+	pthread_mutex_t *l = cf_rchash_lock(h, hash);
+
+	cf_rchash_elem_v *e = cf_rchash_lookup_v(h, hash, key, key_len);
+
+	if (e) {
+		if (object) {
+			cf_rc_reserve( e->object );
+			*object = e->object;
 		}
+		rv = CF_RCHASH_OK;
+	}
 
-		cf_rchash_elem_v *list_he = get_bucket_v(h, i);
-		cf_rchash_elem_v *prev_he = NULL;
+	cf_rchash_unlock(h, hash, l, false);
+	return(rv);
+}
 
-		while (list_he) {
-			if (list_he->key_len == 0) {
-				// Nothing (more) in this row.
-				break;
-			}
+int cf_rchash_delete_v(cf_rchash *h, void *key, uint32_t key_len) {
+	if ((h->key_len) &&  (h->key_len != key_len) ) return(CF_RCHASH_ERR);
 
-#ifdef VALIDATE
-			cf_atomic_int_t rc;
-			if ((rc = cf_rc_count(list_he->object)) < 1) {
-				as_log_info("cf_rchash %p: internal bad reference count (%d) on %p", h, rc, list_he->object);
-				if (l)	pthread_mutex_unlock(l);
-				return;
-			}
-#endif		
+	// Calculate hash
+	uint32_t hash = h->h_fn(key, key_len);
+	int rv = CF_RCHASH_ERR_NOTFOUND;
 
-			int rv = reduce_fn(list_he->key, list_he->key_len, list_he->object, udata);
+	pthread_mutex_t *l = cf_rchash_lock(h, hash);
 
-			if (rv == CF_RCHASH_OK) {
-				// Most common case - keep going.
-				prev_he = list_he;
-				list_he = list_he->next;
-			}
-			else if (rv == CF_RCHASH_REDUCE_DELETE) {
-				cf_free(list_he->key);
-				cf_rchash_free(h, list_he->object);
+	if (h->old_table) {
+		rv = cf_rchash_remove_v(h, get_bucket_v(h, h->old_table, hash % h->old_table_len), key, key_len);
+	}
 
-				if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-					cf_atomic32_decr(&h->elements);
-				}
-				else {
-					h->elements--;
-				}
+	if (rv == CF_RCHASH_ERR_NOTFOUND) {
+		rv = cf_rchash_remove_v(h, get_bucket_v(h, h->table, hash % h->table_len), key, key_len);
+	}
 
-				if (prev_he) {
-					prev_he->next = list_he->next;
-					cf_free(list_he);
-					list_he = prev_he->next;
-				}
-				else {
-					// At head with no next.
-					if (! list_he->next) {
-						memset(list_he, 0, sizeof(cf_rchash_elem_v));
-						list_he = NULL;
-					}
-					// At head with a next. Copy next into current and free
-					// next. prev_he stays NULL, list_he stays unchanged.
-					else {
-						cf_rchash_elem_v *_t = list_he->next;
-						memcpy(list_he, list_he->next, sizeof(cf_rchash_elem_v));
-						cf_free(_t);
-					}
-				}
+	cf_rchash_unlock(h, hash, l, false);
+	return(rv);
+}
+
+static int cf_rchash_reduce_bucket_v(cf_rchash *h, cf_rchash_elem_v *list_he, cf_rchash_reduce_fn reduce_fn, void *udata) {
+	cf_rchash_elem_v *prev_he = NULL;
+
+	while (list_he) {
+		if (list_he->key_len == 0) {
+			// Nothing (more) in this row.
+			break;
+		}
+
+		int rv = reduce_fn(list_he->key, list_he->key_len, list_he->object, udata);
+
+		if (rv == CF_RCHASH_OK) {
+			// Most common case - keep going.
+			prev_he = list_he;
+			list_he = list_he->next;
+		}
+		else if (rv == CF_RCHASH_REDUCE_DELETE) {
+			cf_free(list_he->key);
+			cf_rchash_free(h, list_he->object);
+			cf_rchash_elements_decr(h);
+
+			if (prev_he) {
+				prev_he->next = list_he->next;
+				cf_rchash_elem_free(h, list_he);
+				list_he = prev_he->next;
 			}
 			else {
-				// Stop iterating.
-				if (l) {
-					pthread_mutex_unlock(l);
+				// At head with no next.
+				if (! list_he->next) {
+					memset(list_he, 0, sizeof(cf_rchash_elem_v));
+					list_he = NULL;
 				}
-
-				if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
-					pthread_mutex_unlock(&h->biglock);
+				// At head with a next. Copy next into current and free
+				// next. prev_he stays NULL, list_he stays unchanged.
+				else {
+					cf_rchash_elem_v *_t = list_he->next;
+					memcpy(list_he, list_he->next, sizeof(cf_rchash_elem_v));
+					cf_rchash_elem_free(h, _t);
 				}
-
-				return rv;
 			}
 		}
-
-		if (l) {
-			pthread_mutex_unlock(l);
+		else {
+			// Stop iterating.
+			return rv;
 		}
 	}
 
-	if (h->flags & CF_RCHASH_CR_MT_BIGLOCK) {
-		pthread_mutex_unlock(&h->biglock);
-	}
-
 	return CF_RCHASH_OK;
 }
 
-void cf_rchash_destroy_elements_v(cf_rchash *h) {
-	for (uint i=0;i<h->table_len;i++) {
-        
-        cf_rchash_elem_v *e = get_bucket_v(h, i);
+static void cf_rchash_destroy_table_v(cf_rchash *h, void *table, uint table_len) {
+	for (uint i=0;i<table_len;i++) {
+
+        cf_rchash_elem_v *e = get_bucket_v(h, table, i);
         if (e->object == 0) continue;
-        
+
         cf_rchash_free(h, e->object);
         cf_free(e->key);
         e = e->next; // skip the first, it's in place
@@ -1010,12 +1639,24 @@ void cf_rchash_destroy_elements_v(cf_rchash *h) {
             cf_rchash_elem_v *t = e->next;
             cf_rchash_free(h, e->object);
             cf_free(e->key);
-            cf_free(e);
+            if (! h->slab) cf_free(e);
             e = t;
 		}
 	}
 }
 
+void cf_rchash_destroy_elements_v(cf_rchash *h) {
+	if (h->old_table) {
+		cf_rchash_destroy_table_v(h, h->old_table, h->old_table_len);
+	}
+	cf_rchash_destroy_table_v(h, h->table, h->table_len);
+	h->elements = 0;
+
+	if (h->counter) {
+		cf_counter_reset(h->counter);
+	}
+}
+
 #ifdef DEBUG_HASH
 
 /*
@@ -1033,6 +1674,9 @@ void cf_rchash_dump(cf_rchash *h)
 	}
 
 	as_log_info("rchash: %p ; flags 0x%08x ; key_len %d ; table_len %d", h, h->flags, h->key_len, h->table_len);
+	if (h->old_table) {
+		as_log_info("resizing from %d buckets - only the new table is shown", h->old_table_len);
+	}
 	if (!(h->flags & CF_RCHASH_CR_MT_MANYLOCK)) {
 		as_log_info("number of elements: %d", h->elements);
 	}
@@ -1043,11 +1687,11 @@ void cf_rchash_dump(cf_rchash *h)
 	for (uint i = 0; i < h->table_len; i++) {
 		pthread_mutex_t *l = 0;
 		if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-			l = &(h->lock_table[i]);
+			l = &h->stripes[i & (h->n_stripes - 1)].lock;
 			pthread_mutex_lock(l);
 		}
 
-		cf_rchash_elem_f *list_he = get_bucket(h, i);
+		cf_rchash_elem_f *list_he = get_bucket(h, h->table, i);
 
 		uint j = 0;
 		while (list_he) {
@@ -1084,6 +1728,9 @@ void cf_rchash_dump_v(cf_rchash *h)
 	}
 
 	as_log_info("rchash: %p ; flags 0x%08x ; key_len %d ; table_len %d", h, h->flags, h->key_len, h->table_len);
+	if (h->old_table) {
+		as_log_info("resizing from %d buckets - only the new table is shown", h->old_table_len);
+	}
 	if (!(h->flags & CF_RCHASH_CR_MT_MANYLOCK)) {
 		as_log_info("number of elements: %d", h->elements);
 	}
@@ -1094,11 +1741,11 @@ void cf_rchash_dump_v(cf_rchash *h)
 	for (uint i = 0; i < h->table_len; i++) {
 		pthread_mutex_t *l = 0;
 		if (h->flags & CF_RCHASH_CR_MT_MANYLOCK) {
-			l = &(h->lock_table[i]);
+			l = &h->stripes[i & (h->n_stripes - 1)].lock;
 			pthread_mutex_lock(l);
 		}
 
-		cf_rchash_elem_v *list_he = get_bucket_v(h, i);
+		cf_rchash_elem_v *list_he = get_bucket_v(h, h->table, i);
 
 		uint j = 0;
 		while (list_he) {
@@ -26,9 +26,1385 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <citrusleaf/cf_shash.h>
+#include <aerospike/as_thread_pool.h>
 #include <citrusleaf/alloc.h>
+#include <citrusleaf/cf_bits.h>
+
+/******************************************************************************
+ * CONSTANTS
+ ******************************************************************************/
+
+// Open addressing control bytes - a full slot holds 7 bits of its hash.
+#define SHASH_CTRL_EMPTY	0x80
+#define SHASH_CTRL_DELETED	0xFE
+
+// Slots are probed a group at a time, groups in triangular order.
+#define SHASH_GROUP_SZ 16
+
+// MT_MANYLOCK open addressing shards, or SHASH_CR_RESIZE stripes, per online
+// core, and the most we'll use.
+#define SHASH_LOCKS_PER_CPU 4
+#define SHASH_MAX_LOCKS 1024
+
+// Old buckets each SHASH_CR_RESIZE operation moves to the new table.
+#define SHASH_MIGRATE_BUCKETS 4
+
+// Default SHASH_CR_RESIZE load, in elements per 100 buckets.
+#define SHASH_MAX_LOAD 100
+
+// Buckets a parallel reduce walks per hold of a lock covering the table.
+#define SHASH_REDUCE_BATCH 64
+
+// Keys a batched get or put hashes and prefetches ahead of resolving them -
+// past the ten or so misses a core keeps in flight, more only costs stack.
+#define SHASH_BATCH_SZ 64
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+
+/**
+ * One independently locked open addressing table. Control bytes come first
+ * in the allocation, then the slots, each holding key then value.
+ */
+struct shash_shard_s {
+	pthread_mutex_t		lock;			// MT_MANYLOCK only
+	uint32_t			n_groups;		// power of 2
+	uint32_t			elements;
+	uint32_t			tombstones;
+	uint8_t *			ctrl;
+	uint8_t *			slots;
+} __attribute__ ((aligned(64)));
+
+/**
+ * A parallel reduce - partition p walks units p * n_units / n_partitions up
+ * to the next partition's first, on its own copy of the udata if there are
+ * copies.
+ */
+typedef struct shash_reduce_job_s {
+	shash *				h;
+	shash_reduce_fn		reduce_fn;
+	bool				delete;
+	uint32_t			n_units;
+	uint32_t			n_partitions;
+	void *				udata;
+	size_t				udata_size;
+	uint8_t *			udatas;			// udata_size bytes per partition
+	int *				rvs;			// per partition
+	cf_atomic32			stop;
+} shash_reduce_job;
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ ******************************************************************************/
+
+static inline uint32_t shash_hash(shash *h, void *key) {
+	return h->key_hash_fn ? h->key_hash_fn(key, h->key_len) : h->h_fn(key);
+}
+
+static inline void *shash_alloc(shash *h, size_t sz) {
+	return (h->flags & SHASH_CR_UNTRACKED) ? malloc(sz) : cf_malloc(sz);
+}
+
+static inline void shash_free(shash *h, void *p) {
+	if (h->flags & SHASH_CR_UNTRACKED)
+		free(p);
+	else
+		cf_free(p);
+}
+
+static inline shash_elem *shash_elem_alloc(shash *h) {
+	return (shash_elem *) (h->slab ? cf_slab_alloc(h->slab) : shash_alloc(h, SHASH_ELEM_SZ(h)));
+}
+
+static inline void shash_elem_free(shash *h, shash_elem *e) {
+	if (h->slab)
+		cf_slab_free(h->slab, e);
+	else
+		shash_free(h, e);
+}
+
+// Power of 2 number of MT_MANYLOCK locks - open addressing shards or resize
+// stripes - and never more than max.
+static uint32_t shash_lock_count(uint32_t max) {
+	return cf_pow2_per_cpu(SHASH_LOCKS_PER_CPU, max < SHASH_MAX_LOCKS ? max : SHASH_MAX_LOCKS);
+}
+
+// Bit i set if control byte i of the group is b.
+static inline uint32_t shash_group_match(const uint8_t *ctrl, uint8_t b) {
+#ifdef __SSE2__
+	__m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)b)));
+#else
+	uint32_t m = 0;
+	for (int i = 0; i < SHASH_GROUP_SZ; i++) {
+		m |= (uint32_t)(ctrl[i] == b) << i;
+	}
+	return m;
+#endif
+}
+
+// Bit i set if slot i of the group is empty or deleted - their high bit.
+static inline uint32_t shash_group_match_free(const uint8_t *ctrl) {
+#ifdef __SSE2__
+	return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+	uint32_t m = 0;
+	for (int i = 0; i < SHASH_GROUP_SZ; i++) {
+		m |= (uint32_t)(ctrl[i] >> 7) << i;
+	}
+	return m;
+#endif
+}
+
+// User hash functions are often weak (truncated pointers, digest bytes) -
+// spread all 32 bits over 64. Low 7 bits go in the control byte, the next
+// ones pick a shard and the top half the home group.
+static inline uint64_t shash_open_hash(shash *h, void *key) {
+	uint64_t x = shash_hash(h, key);
+
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+static inline shash_shard *shash_open_shard(shash *h, uint64_t x) {
+	return &h->shards[(x >> 7) & (h->n_shards - 1)];
+}
+
+static inline uint8_t *shash_open_key(shash *h, shash_shard *s, uint32_t slot) {
+	return s->slots + ((size_t)slot * (h->key_len + h->value_len));
+}
+
+static inline uint32_t shash_open_capacity(shash_shard *s) {
+	return s->n_groups * SHASH_GROUP_SZ;
+}
+
+// Most slots a shard fills, counting tombstones, before a put must clean up
+// or fail.
+static inline uint32_t shash_open_max_used(shash_shard *s) {
+	return shash_open_capacity(s) - (shash_open_capacity(s) / 16);
+}
+
+static inline pthread_mutex_t *shash_open_lock(shash *h, shash_shard *s) {
+	pthread_mutex_t *l = 0;
+
+	if (h->flags & SHASH_CR_MT_BIGLOCK) {
+		l = &h->biglock;
+	}
+	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
+		l = &s->lock;
+	}
+	if (l)     pthread_mutex_lock( l );
+
+	return(l);
+}
+
+// Slot holding key, or -1. If probe_r is set it gets the number of groups
+// scanned.
+static int64_t shash_open_find(shash *h, shash_shard *s, uint64_t x, void *key, uint32_t *probe_r) {
+	uint8_t h2 = (uint8_t)(x & 0x7f);
+	uint32_t mask = s->n_groups - 1;
+	uint32_t g = (uint32_t)(x >> 32) & mask;
+
+	for (uint32_t i = 1; i <= s->n_groups; i++) {
+		uint8_t *ctrl = s->ctrl + ((size_t)g * SHASH_GROUP_SZ);
+		uint32_t m = shash_group_match(ctrl, h2);
+
+		while (m) {
+			uint32_t slot = (g * SHASH_GROUP_SZ) + __builtin_ctz(m);
+
+			if (memcmp(shash_open_key(h, s, slot), key, h->key_len) == 0) {
+				if (probe_r) *probe_r = i;
+				return(slot);
+			}
+			m &= m - 1;
+		}
+
+		// A group with an empty slot ends every probe that reaches it.
+		if (shash_group_match(ctrl, SHASH_CTRL_EMPTY)) {
+			break;
+		}
+
+		g = (g + i) & mask;
+	}
+
+	return(-1);
+}
+
+// First empty or deleted slot on x's probe sequence. Callers make sure there
+// is one.
+static uint32_t shash_open_free_slot(shash_shard *s, uint64_t x) {
+	uint32_t mask = s->n_groups - 1;
+	uint32_t g = (uint32_t)(x >> 32) & mask;
+
+	for (uint32_t i = 1; ; i++) {
+		uint32_t m = shash_group_match_free(s->ctrl + ((size_t)g * SHASH_GROUP_SZ));
+
+		if (m) {
+			return((g * SHASH_GROUP_SZ) + __builtin_ctz(m));
+		}
+
+		g = (g + i) & mask;
+	}
+}
+
+static int shash_open_alloc(shash *h, shash_shard *s, uint32_t n_groups) {
+	size_t n_slots = (size_t)n_groups * SHASH_GROUP_SZ;
+	size_t ctrl_sz = (n_slots + 7) & ~(size_t)7;
+	uint8_t *mem = shash_alloc(h, ctrl_sz + (n_slots * (h->key_len + h->value_len)));
+
+	if (! mem) {
+		return(SHASH_ERR);
+	}
+
+	memset(mem, SHASH_CTRL_EMPTY, n_slots);
+
+	s->n_groups = n_groups;
+	s->elements = 0;
+	s->tombstones = 0;
+	s->ctrl = mem;
+	s->slots = mem + ctrl_sz;
+	return(SHASH_OK);
+}
+
+// Reinsert every element into fresh arrays of n_groups groups - clears out
+// tombstones. Caller holds the shard's lock.
+static int shash_open_rebuild(shash *h, shash_shard *s, uint32_t n_groups) {
+	shash_shard old = *s;
+	uint32_t kv_len = h->key_len + h->value_len;
+
+	if (shash_open_alloc(h, s, n_groups) != SHASH_OK) {
+		*s = old;
+		return(SHASH_ERR);
+	}
+
+	for (uint32_t i = 0; i < shash_open_capacity(&old); i++) {
+		if (old.ctrl[i] & 0x80) {
+			continue;
+		}
+
+		uint8_t *kv = shash_open_key(h, &old, i);
+		uint64_t x = shash_open_hash(h, kv);
+		uint32_t slot = shash_open_free_slot(s, x);
+
+		s->ctrl[slot] = (uint8_t)(x & 0x7f);
+		memcpy(shash_open_key(h, s, slot), kv, kv_len);
+		s->elements++;
+	}
+
+	shash_free(h, old.ctrl);
+	return(SHASH_OK);
+}
+
+static int shash_open_insert(shash *h, shash_shard *s, uint64_t x, void *key, void *value) {
+	uint32_t slot = shash_open_free_slot(s, x);
+
+	if (s->ctrl[slot] == SHASH_CTRL_EMPTY) {
+		if (s->elements + s->tombstones >= shash_open_max_used(s)) {
+			// Clear out tombstones, unless it's full of live elements.
+			if (s->elements >= shash_open_max_used(s) || shash_open_rebuild(h, s, s->n_groups) != SHASH_OK) {
+				return(SHASH_ERR);
+			}
+			slot = shash_open_free_slot(s, x);
+		}
+	}
+	else {
+		s->tombstones--;
+	}
+
+	s->ctrl[slot] = (uint8_t)(x & 0x7f);
+	memcpy(shash_open_key(h, s, slot), key, h->key_len);
+	memcpy(shash_open_key(h, s, slot) + h->key_len, value, h->value_len);
+	s->elements++;
+
+	if (! (h->flags & SHASH_CR_MT_MANYLOCK)) {
+		h->elements++;
+	}
+	return(SHASH_OK);
+}
+
+// A slot can go back to empty if its group has an empty slot - no probe ever
+// went past that group. Otherwise leave a tombstone so probes still do.
+static void shash_open_erase(shash *h, shash_shard *s, uint32_t slot) {
+	uint8_t *group = s->ctrl + (slot & ~(uint32_t)(SHASH_GROUP_SZ - 1));
+
+	if (shash_group_match(group, SHASH_CTRL_EMPTY)) {
+		s->ctrl[slot] = SHASH_CTRL_EMPTY;
+	}
+	else {
+		s->ctrl[slot] = SHASH_CTRL_DELETED;
+		s->tombstones++;
+	}
+
+	s->elements--;
+
+	if (! (h->flags & SHASH_CR_MT_MANYLOCK)) {
+		h->elements--;
+	}
+}
+
+static int shash_open_create(shash *h, uint32_t sz) {
+	// No shard smaller than a group.
+	uint32_t n_shards = (h->flags & SHASH_CR_MT_MANYLOCK) ?
+			shash_lock_count(sz / SHASH_GROUP_SZ) : 1;
+
+	// Enough groups per shard to hold its share at 7/8 load.
+	uint64_t per_shard = ((uint64_t)sz + n_shards - 1) / n_shards;
+	uint64_t want_slots = (per_shard * 8 + 6) / 7;
+	uint32_t n_groups = 1;
+
+	while ((uint64_t)n_groups * SHASH_GROUP_SZ < want_slots) {
+		n_groups *= 2;
+	}
+
+	h->n_shards = n_shards;
+	h->shards = shash_alloc(h, sizeof(shash_shard) * n_shards);
+
+	if (! h->shards) {
+		return(SHASH_ERR);
+	}
+
+	for (uint32_t i = 0; i < n_shards; i++) {
+		if (shash_open_alloc(h, &h->shards[i], n_groups) != SHASH_OK) {
+			for (uint32_t j = 0; j < i; j++) {
+				shash_free(h, h->shards[j].ctrl);
+			}
+			shash_free(h, h->shards);
+			return(SHASH_ERR);
+		}
+
+		if (h->flags & SHASH_CR_MT_MANYLOCK) {
+			pthread_mutex_init(&h->shards[i].lock, 0);
+		}
+	}
+
+	// Bookkeeping only - nothing chained.
+	h->table_len = n_shards * n_groups * SHASH_GROUP_SZ;
+	h->table = 0;
+	h->lock_table = 0;
+	return(SHASH_OK);
+}
+
+static void shash_open_destroy(shash *h) {
+	for (uint32_t i = 0; i < h->n_shards; i++) {
+		if (h->flags & SHASH_CR_MT_MANYLOCK) {
+			pthread_mutex_destroy(&h->shards[i].lock);
+		}
+		shash_free(h, h->shards[i].ctrl);
+	}
+	shash_free(h, h->shards);
+}
+
+// MT_MANYLOCK only - h->elements isn't kept.
+static uint32_t shash_open_get_size(shash *h) {
+	uint32_t elements = 0;
+
+	for (uint32_t i = 0; i < h->n_shards; i++) {
+		pthread_mutex_lock(&h->shards[i].lock);
+		elements += h->shards[i].elements;
+		pthread_mutex_unlock(&h->shards[i].lock);
+	}
+	return(elements);
+}
+
+// Shared by put, put_unique, put_duplicate and put_many. Caller holds the
+// shard's lock.
+static int shash_open_put_locked(shash *h, shash_shard *s, uint64_t x, void *key, void *value, bool replace, bool search) {
+	int64_t slot = search ? shash_open_find(h, s, x, key, 0) : -1;
+
+	if (slot < 0) {
+		return(shash_open_insert(h, s, x, key, value));
+	}
+
+	if (! replace) {
+		return(SHASH_ERR_FOUND);
+	}
+
+	memcpy(shash_open_key(h, s, slot) + h->key_len, value, h->value_len);
+	return(SHASH_OK);
+}
+
+static int shash_open_put(shash *h, void *key, void *value, bool replace, bool search) {
+	uint64_t x = shash_open_hash(h, key);
+	shash_shard *s = shash_open_shard(h, x);
+	pthread_mutex_t *l = shash_open_lock(h, s);
+	int rv = shash_open_put_locked(h, s, x, key, value, replace, search);
+
+	if (l)     pthread_mutex_unlock(l);
+	return(rv);
+}
+
+// Caller holds the shard's lock.
+static int shash_open_get_locked(shash *h, shash_shard *s, uint64_t x, void *key, void *value, bool delete) {
+	int64_t slot = shash_open_find(h, s, x, key, 0);
+
+	if (slot < 0) {
+		return(SHASH_ERR_NOTFOUND);
+	}
+
+	if (value) {
+		memcpy(value, shash_open_key(h, s, slot) + h->key_len, h->value_len);
+	}
+	if (delete) {
+		shash_open_erase(h, s, slot);
+	}
+	return(SHASH_OK);
+}
+
+static int shash_open_get(shash *h, void *key, void *value, bool delete) {
+	uint64_t x = shash_open_hash(h, key);
+	shash_shard *s = shash_open_shard(h, x);
+	pthread_mutex_t *l = shash_open_lock(h, s);
+	int rv = shash_open_get_locked(h, s, x, key, value, delete);
+
+	if (l)     pthread_mutex_unlock(l);
+	return(rv);
+}
+
+static int shash_open_get_vlock(shash *h, void *key, void **value, pthread_mutex_t **vlock) {
+	uint64_t x = shash_open_hash(h, key);
+	shash_shard *s = shash_open_shard(h, x);
+	pthread_mutex_t *l = shash_open_lock(h, s);
+	int64_t slot = shash_open_find(h, s, x, key, 0);
+
+	if (slot < 0) {
+		if (l)     pthread_mutex_unlock(l);
+		if (vlock) *vlock = 0;
+		return(SHASH_ERR_NOTFOUND);
+	}
+
+	*value = shash_open_key(h, s, slot) + h->key_len;
+	if (vlock) *vlock = l;
+	return(SHASH_OK);
+}
+
+static int shash_open_update(shash *h, void *key, void *value_old, void *value_new, shash_update_fn update_fn, void *udata) {
+	uint64_t x = shash_open_hash(h, key);
+	shash_shard *s = shash_open_shard(h, x);
+	pthread_mutex_t *l = shash_open_lock(h, s);
+	int rv = SHASH_OK;
+	int64_t slot = shash_open_find(h, s, x, key, 0);
+
+	if (slot >= 0) {
+		if (value_old) {
+			memcpy(value_old, shash_open_key(h, s, slot) + h->key_len, h->value_len);
+		}
+		(update_fn)(key, value_old, value_new, udata);
+		memcpy(shash_open_key(h, s, slot) + h->key_len, value_new, h->value_len);
+	}
+	else {
+		(update_fn)(key, NULL, value_new, udata);
+		rv = shash_open_insert(h, s, x, key, value_new);
+	}
+
+	if (l)     pthread_mutex_unlock(l);
+	return(rv);
+}
+
+static int shash_open_delete(shash *h, void *key, bool locked) {
+	uint64_t x = shash_open_hash(h, key);
+	shash_shard *s = shash_open_shard(h, x);
+	pthread_mutex_t *l = locked ? 0 : shash_open_lock(h, s);
+	int64_t slot = shash_open_find(h, s, x, key, 0);
+
+	if (slot >= 0) {
+		shash_open_erase(h, s, slot);
+	}
+
+	if (l)     pthread_mutex_unlock(l);
+	return(slot >= 0 ? SHASH_OK : SHASH_ERR_NOTFOUND);
+}
+
+// Elements don't move when others are erased, so deleting mid-walk is safe.
+// Caller holds the shard's lock.
+static int shash_open_reduce_shard(shash *h, shash_shard *s, shash_reduce_fn reduce_fn, void *udata, bool delete) {
+	for (uint32_t slot = 0; slot < shash_open_capacity(s); slot++) {
+		if (s->ctrl[slot] & 0x80) {
+			continue;
+		}
+
+		uint8_t *kv = shash_open_key(h, s, slot);
+
+		int rv = reduce_fn(kv, kv + h->key_len, udata);
+
+		if (delete && rv == SHASH_REDUCE_DELETE) {
+			shash_open_erase(h, s, slot);
+		}
+		else if (rv != 0) {
+			return(rv);
+		}
+	}
+
+	return(0);
+}
+
+static int shash_open_reduce(shash *h, shash_reduce_fn reduce_fn, void *udata, bool delete) {
+	int rv = 0;
+
+	if (h->flags & SHASH_CR_MT_BIGLOCK) {
+		pthread_mutex_lock( &h->biglock);
+	}
+
+	for (uint32_t i = 0; i < h->n_shards && rv == 0; i++) {
+		shash_shard *s = &h->shards[i];
+
+		if (h->flags & SHASH_CR_MT_MANYLOCK) {
+			pthread_mutex_lock(&s->lock);
+		}
+
+		rv = shash_open_reduce_shard(h, s, reduce_fn, udata, delete);
+
+		if (h->flags & SHASH_CR_MT_MANYLOCK) {
+			pthread_mutex_unlock(&s->lock);
+		}
+	}
+
+	if (h->flags & SHASH_CR_MT_BIGLOCK)
+		pthread_mutex_unlock(&h->biglock);
+
+	return(rv);
+}
+
+static void shash_open_deleteall(shash *h, bool locked) {
+	if (! locked && (h->flags & SHASH_CR_MT_BIGLOCK)) {
+		pthread_mutex_lock(&h->biglock);
+	}
+
+	for (uint32_t i = 0; i < h->n_shards; i++) {
+		shash_shard *s = &h->shards[i];
+		bool lock = ! locked && (h->flags & SHASH_CR_MT_MANYLOCK);
+
+		if (lock) pthread_mutex_lock(&s->lock);
+
+		memset(s->ctrl, SHASH_CTRL_EMPTY, shash_open_capacity(s));
+		s->elements = 0;
+		s->tombstones = 0;
+
+		if (lock) pthread_mutex_unlock(&s->lock);
+	}
+
+	h->elements = 0;
+
+	if (! locked && (h->flags & SHASH_CR_MT_BIGLOCK)) {
+		pthread_mutex_unlock(&h->biglock);
+	}
+}
+
+static void shash_open_shard_stats(shash *h, shash_shard *s, shash_stats *stats, uint64_t *probe_sum) {
+	stats->slots += shash_open_capacity(s);
+	stats->bytes += sizeof(shash_shard) + shash_open_capacity(s) + ((size_t)shash_open_capacity(s) * (h->key_len + h->value_len));
+
+	for (uint32_t slot = 0; slot < shash_open_capacity(s); slot++) {
+		if (s->ctrl[slot] & 0x80) {
+			continue;
+		}
+
+		uint8_t *kv = shash_open_key(h, s, slot);
+		uint32_t probe = 0;
+
+		shash_open_find(h, s, shash_open_hash(h, kv), kv, &probe);
+		stats->elements++;
+		*probe_sum += probe;
+
+		if (probe > stats->probe_max) {
+			stats->probe_max = probe;
+		}
+	}
+}
+
+static void shash_open_get_stats(shash *h, shash_stats *stats, uint64_t *probe_sum) {
+	if (h->flags & SHASH_CR_MT_BIGLOCK) {
+		pthread_mutex_lock( &h->biglock);
+	}
+
+	for (uint32_t i = 0; i < h->n_shards; i++) {
+		shash_shard *s = &h->shards[i];
+
+		if (h->flags & SHASH_CR_MT_MANYLOCK) {
+			pthread_mutex_lock(&s->lock);
+		}
+
+		shash_open_shard_stats(h, s, stats, probe_sum);
+
+		if (h->flags & SHASH_CR_MT_MANYLOCK) {
+			pthread_mutex_unlock(&s->lock);
+		}
+	}
+
+	if (h->flags & SHASH_CR_MT_BIGLOCK)
+		pthread_mutex_unlock(&h->biglock);
+}
+
+static inline shash_elem *shash_bucket(shash *h, void *table, uint i) {
+	return (shash_elem *) (((uint8_t *)table) + (SHASH_ELEM_SZ(h) * i));
+}
+
+// Chained tables' buckets are striped over the locks - bucket i belongs to
+// stripe i % shash_stripes(). Without SHASH_CR_RESIZE there's a lock per
+// bucket, with it every table size is a multiple of the (power of 2) stripe
+// count, so a hash's stripe never changes as the table grows.
+static inline uint32_t shash_stripes(shash *h) {
+	return (h->flags & SHASH_CR_MT_MANYLOCK) ? h->lock_table_len : 1;
+}
+
+static inline uint32_t shash_stripe(shash *h, uint32_t hash) {
+	return (h->flags & SHASH_CR_RESIZE) ?
+			hash & (shash_stripes(h) - 1) : hash % shash_stripes(h);
+}
+
+static inline pthread_mutex_t *shash_lock(shash *h, uint32_t hash) {
+	pthread_mutex_t *l = 0;
+
+	if (h->flags & SHASH_CR_MT_BIGLOCK) {
+		l = &h->biglock;
+	}
+	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
+		l = &h->lock_table[shash_stripe(h, hash)];
+	}
+	if (l)     pthread_mutex_lock( l );
+
+	return(l);
+}
+
+// Only resizes swap tables, and they hold every lock while doing it.
+static void shash_lock_all(shash *h) {
+	if (h->flags & SHASH_CR_MT_BIGLOCK) {
+		pthread_mutex_lock(&h->biglock);
+	}
+	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
+		for (uint32_t s = 0; s < h->lock_table_len; s++) {
+			pthread_mutex_lock(&h->lock_table[s]);
+		}
+	}
+}
+
+static void shash_unlock_all(shash *h) {
+	if (h->flags & SHASH_CR_MT_BIGLOCK) {
+		pthread_mutex_unlock(&h->biglock);
+	}
+	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
+		for (uint32_t s = 0; s < h->lock_table_len; s++) {
+			pthread_mutex_unlock(&h->lock_table[s]);
+		}
+	}
+}
+
+// MT_MANYLOCK tables count in a sharded counter, so puts and deletes under
+// different locks don't all write one cache line.
+static inline void shash_elements_incr(shash *h) {
+	if (h->counter)
+		cf_counter_add(h->counter, 1);
+	else
+		h->elements++;
+}
+
+// The partitions of a parallel reduce delete under different locks, or none,
+// so only the biglock keeps deletes from racing.
+static inline void shash_elements_decr(shash *h) {
+	if (h->counter)
+		cf_counter_add(h->counter, -1);
+	else if (! (h->flags & SHASH_CR_MT_BIGLOCK))
+		cf_atomic32_decr((cf_atomic32 *)&h->elements);
+	else
+		h->elements--;
+}
+
+// A read racing with puts and deletes can come out below zero.
+static inline uint32_t shash_elements(shash *h) {
+	if (! h->counter)
+		return(cf_atomic32_get(h->elements));
+
+	int64_t n = cf_counter_read(h->counter);
+
+	return(n > 0 ? (uint32_t)n : 0);
+}
+
+// Move one old bucket's elements to their buckets in the new table. Chained
+// elements are relinked as they are. The old head lives in the old table
+// itself, so it's the one that may need an allocation - move it first, so
+// running out of memory leaves the bucket whole.
+static int shash_migrate_bucket(shash *h, shash_elem *old_he) {
+	uint32_t kv_len = h->key_len + h->value_len;
+
+	if (old_he->in_use == false) {
+		return(SHASH_OK);
+	}
+
+	shash_elem *e_head = shash_bucket(h, h->table, shash_hash(h, SHASH_ELEM_KEY_PTR(h, old_he)) % h->table_len);
+	shash_elem *e = e_head;
+
+	if (e_head->in_use) {
+		e = shash_elem_alloc(h);
+		if (!e) return(SHASH_ERR);
+		e->next = e_head->next;
+		e_head->next = e;
+	}
+
+	memcpy(e->data, old_he->data, kv_len);
+	e->in_use = true;
+
+	e = old_he->next;
+	old_he->in_use = false;
+	old_he->next = 0;
+
+	while (e) {
+		shash_elem *next = e->next;
+
+		e_head = shash_bucket(h, h->table, shash_hash(h, SHASH_ELEM_KEY_PTR(h, e)) % h->table_len);
+
+		if (e_head->in_use == false) {
+			memcpy(e_head->data, e->data, kv_len);
+			e_head->in_use = true;
+			shash_elem_free(h, e);
+		}
+		else {
+			e->next = e_head->next;
+			e_head->next = e;
+		}
+		e = next;
+	}
+
+	return(SHASH_OK);
+}
+
+// Bucket for hash in the current table. While a resize is on, hash's old
+// bucket moves over first, so the current table has everything with hash's
+// key. Caller holds hash's lock. Returns 0 if out of memory.
+static inline shash_elem *shash_get_bucket(shash *h, uint32_t hash) {
+	if (h->old_table &&
+			shash_migrate_bucket(h, shash_bucket(h, h->old_table, hash % h->old_table_len)) != SHASH_OK) {
+		return(0);
+	}
+
+	return(shash_bucket(h, h->table, hash % h->table_len));
+}
+
+// Double the table. The old table stays in place and drains into the new one
+// a few buckets per operation - only the pointer swap holds the locks, and
+// the new table is allocated before taking them.
+static void shash_resize_start(shash *h) {
+	uint table_len = h->table_len;
+
+	if (table_len > UINT32_MAX / 2) {
+		return;
+	}
+
+	size_t sz = (size_t)table_len * 2 * SHASH_ELEM_SZ(h);
+	void *table = shash_alloc(h, sz);
+
+	if (! table) {
+		return;
+	}
+
+	// Every head unused, with no next.
+	memset(table, 0, sz);
+
+	shash_lock_all(h);
+
+	// Somebody else got here first.
+	if (h->old_table || h->table_len != table_len) {
+		shash_unlock_all(h);
+		shash_free(h, table);
+		return;
+	}
+
+	h->old_table = h->table;
+	h->old_table_len = table_len;
+	h->table = table;
+	h->table_len = table_len * 2;
+
+	for (uint32_t s = 0; s < shash_stripes(h); s++) {
+		h->migrate[s] = 0;
+	}
+
+	cf_atomic32_set(&h->locks_migrated, 0);
+
+	shash_unlock_all(h);
+}
+
+// Every old bucket is empty by now.
+static void shash_resize_finish(shash *h) {
+	shash_lock_all(h);
+
+	void *old_table = h->old_table;
+
+	// A deleteall may have beaten us to it.
+	if (old_table && (uint32_t)cf_atomic32_get(h->locks_migrated) == shash_stripes(h)) {
+		h->old_table = 0;
+		h->old_table_len = 0;
+	}
+	else {
+		old_table = 0;
+	}
+
+	shash_unlock_all(h);
+
+	if (old_table) {
+		shash_free(h, old_table);
+	}
+}
+
+// Move up to SHASH_MIGRATE_BUCKETS of stripe s's old buckets to the new
+// table. Caller holds the stripe's lock. Returns true if that finished the
+// last stripe - the caller then calls shash_resize_finish() once it has
+// dropped its lock.
+static bool shash_migrate(shash *h, uint32_t s) {
+	uint32_t n_stripes = shash_stripes(h);
+	uint32_t n = h->old_table_len / n_stripes;
+
+	if (h->migrate[s] == n) {
+		return false;
+	}
+
+	for (int i = 0; i < SHASH_MIGRATE_BUCKETS && h->migrate[s] < n; i++) {
+		// Out of memory - the bucket stays behind for a later operation.
+		if (shash_migrate_bucket(h, shash_bucket(h, h->old_table, s + (h->migrate[s] * n_stripes))) != SHASH_OK) {
+			return false;
+		}
+
+		h->migrate[s]++;
+	}
+
+	return h->migrate[s] == n &&
+			(uint32_t)cf_atomic32_incr(&h->locks_migrated) == n_stripes;
+}
+
+// Chained operations that took a key's lock end here. While a resize is on,
+// it first moves a few more of the stripe's old buckets, and operations that
+// added an element check whether the table has outgrown its buckets.
+static void shash_unlock(shash *h, uint32_t hash, pthread_mutex_t *l, bool added) {
+	bool finished = h->old_table && shash_migrate(h, shash_stripe(h, hash));
+
+	if (l)     pthread_mutex_unlock(l);
+
+	if (finished) {
+		shash_resize_finish(h);
+	}
+	else if (added && (h->flags & SHASH_CR_RESIZE) && ! h->old_table &&
+			(uint64_t)shash_elements(h) * 100 > (uint64_t)h->table_len * h->max_load) {
+		shash_resize_start(h);
+	}
+}
+
+// Shared by put and put_many. Caller holds hash's lock.
+static int shash_put_locked(shash *h, uint32_t hash, void *key, void *value, bool *added) {
+	shash_elem *e = shash_get_bucket(h, hash);
+	if (!e) {
+		return (SHASH_ERR);
+	}
+
+	// most common case should be insert into empty bucket, special case
+	if ( e->in_use == false )
+		goto Copy;
+
+	shash_elem *e_head = e;
+
+	// This loop might be skippable if you know the key is not already in the hash
+	// (like, you just searched and it's single-threaded)	
+	while (e) {
+		if (memcmp(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len) == 0) {
+			memcpy(SHASH_ELEM_VALUE_PTR(h, e), value, h->value_len);
+			return(SHASH_OK);
+		}
+		e = e->next;
+	}
+
+	e = shash_elem_alloc(h);
+	if (!e) {
+		return (SHASH_ERR);
+	}
+
+	e->next = e_head->next;
+	e_head->next = e;
+	
+Copy:
+	memcpy(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len);
+	memcpy(SHASH_ELEM_VALUE_PTR(h, e), value, h->value_len);
+	e->in_use = true;
+	shash_elements_incr(h);
+	*added = true;
+	return(SHASH_OK);	
+}
+
+// Shared by get and get_many. Caller holds hash's lock.
+static int shash_get_locked(shash *h, uint32_t hash, void *key, void *value) {
+	shash_elem *e = shash_get_bucket(h, hash);
+
+	if (!e) {
+		return(SHASH_ERR);
+	}
+
+	if (e->in_use == false) {
+		return(SHASH_ERR_NOTFOUND);
+	}
+
+	do {
+		if (memcmp(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len) == 0) {
+			if (NULL != value)
+			    memcpy(value, SHASH_ELEM_VALUE_PTR(h, e), h->value_len);
+			return(SHASH_OK);
+		}
+		e = e->next;
+	} while (e);
+
+	return(SHASH_ERR_NOTFOUND);
+}
+
+static int shash_reduce_bucket(shash *h, shash_elem *list_he, shash_reduce_fn reduce_fn, void *udata) {
+	while (list_he) {
+
+		// not in use is common at head pointer - unused bucket
+		if (list_he->in_use == false)
+			break;
+
+		int rv = reduce_fn(	SHASH_ELEM_KEY_PTR(h, list_he), SHASH_ELEM_VALUE_PTR(h, list_he), udata);
+		if (0 != rv) {
+			return(rv);
+		}
+
+		list_he = list_he->next;
+	}
+
+	return(0);
+}
+
+static int shash_reduce_delete_bucket(shash *h, shash_elem *list_he, shash_reduce_fn reduce_fn, void *udata) {
+	shash_elem *prev_he = 0;
+
+	while (list_he) {
+		// This kind of structure might have the head as an empty element,
+		// that's a signal to move along
+		if (list_he->in_use == false)
+			break;
+
+		int rv = reduce_fn( SHASH_ELEM_KEY_PTR(h, list_he), SHASH_ELEM_VALUE_PTR(h, list_he), udata);
+
+		// Delete is requested
+		// Leave the pointers in a "next" state
+		if (rv == SHASH_REDUCE_DELETE) {
+
+			shash_elements_decr(h);
+
+			// patchup pointers & free element if not head
+			if (prev_he) {
+				prev_he->next = list_he->next;
+				shash_elem_free(h, list_he);
+				list_he = prev_he->next;
+			}
+			// am at head - more complicated
+			else {
+				// at head with no next - easy peasy!
+				if (0 == list_he->next) {
+					list_he->in_use = false;
+					list_he = 0;
+				}
+				// at head with a next - more complicated -
+				// copy next into current and free next
+				// (the old trick of how to delete from a singly
+				// linked list without a prev pointer)
+				// Somewhat confusingly, prev_he stays 0
+				// and list_he stays where it is
+				else {
+					shash_elem *_t = list_he->next;
+					memcpy(list_he, list_he->next, SHASH_ELEM_SZ(h) );
+					shash_elem_free(h, _t);
+				}
+			}
+		}
+		else if (0 != rv) {
+			return(rv);
+		}
+		else { // don't delete, just forward everything
+			prev_he = list_he;
+			list_he = list_he->next;
+		}
+	}
+
+	return(0);
+}
+
+// Walk buckets first, first + step, ... of the old table, then the new one.
+// When step divides every table length an element never leaves that set -
+// stripes, for instance - so walking one set at a time under its lock visits
+// each element once, even if a resize starts, moves along or finishes
+// between sets.
+static int shash_reduce_buckets(shash *h, uint32_t first, uint32_t step, shash_reduce_fn reduce_fn, void *udata, bool delete) {
+	int rv = 0;
+
+	if (h->old_table) {
+		for (uint i = first; i < h->old_table_len && rv == 0; i += step) {
+			shash_elem *list_he = shash_bucket(h, h->old_table, i);
+
+			rv = delete ? shash_reduce_delete_bucket(h, list_he, reduce_fn, udata) :
+					shash_reduce_bucket(h, list_he, reduce_fn, udata);
+		}
+	}
+
+	for (uint i = first; i < h->table_len && rv == 0; i += step) {
+		shash_elem *list_he = shash_bucket(h, h->table, i);
+
+		rv = delete ? shash_reduce_delete_bucket(h, list_he, reduce_fn, udata) :
+				shash_reduce_bucket(h, list_he, reduce_fn, udata);
+	}
+
+	return(rv);
+}
+
+static int shash_reduce_all(shash *h, shash_reduce_fn reduce_fn, void *udata, bool delete) {
+	int rv = 0;
+
+	if (h->flags & SHASH_CR_MT_BIGLOCK) {
+		pthread_mutex_lock( &h->biglock);
+	}
+
+	for (uint32_t s = 0; s < shash_stripes(h) && rv == 0; s++) {
+
+		pthread_mutex_t *l = 0;
+		if (h->flags & SHASH_CR_MT_MANYLOCK) {
+			l = &(h->lock_table[s]);
+			pthread_mutex_lock( l );
+		}
+
+		rv = shash_reduce_buckets(h, s, shash_stripes(h), reduce_fn, udata, delete);
+
+		if (l)	pthread_mutex_unlock(l);
+	}
+
+	if (h->flags & SHASH_CR_MT_BIGLOCK)
+		pthread_mutex_unlock(&h->biglock);
+
+	return(rv);
+}
+
+// A parallel reduce walks units - chained tables' buckets mod the table
+// length when it started (old table length, mid-resize), which only grows by
+// doubling, or open addressing shards - under the one lock covering each.
+// Where one lock covers everything, it's held for SHASH_REDUCE_BATCH units
+// at a time - short enough to let writers in, long enough not to pay for a
+// lock round trip per bucket.
+static void shash_reduce_partition(void *udata, uint32_t p) {
+	shash_reduce_job *job = (shash_reduce_job *)udata;
+	shash *h = job->h;
+	void *part_udata = job->udatas ? job->udatas + ((size_t)p * job->udata_size) : job->udata;
+	uint32_t u = (uint32_t)(((uint64_t)p * job->n_units) / job->n_partitions);
+	uint32_t end = (uint32_t)(((uint64_t)(p + 1) * job->n_units) / job->n_partitions);
+	uint32_t batch = (h->flags & SHASH_CR_MT_MANYLOCK) ? 1 : SHASH_REDUCE_BATCH;
+	int rv = 0;
+
+	while (u < end && rv == 0 && cf_atomic32_get(job->stop) == 0) {
+		uint32_t batch_end = end - u > batch ? u + batch : end;
+		pthread_mutex_t *l = (h->flags & SHASH_CR_OPEN) ?
+				shash_open_lock(h, &h->shards[u]) : shash_lock(h, u);
+
+		for ( ; u < batch_end && rv == 0; u++) {
+			rv = (h->flags & SHASH_CR_OPEN) ?
+					shash_open_reduce_shard(h, &h->shards[u], job->reduce_fn, part_udata, job->delete) :
+					shash_reduce_buckets(h, u, job->n_units, job->reduce_fn, part_udata, job->delete);
+		}
+
+		if (l)     pthread_mutex_unlock(l);
+	}
+
+	if (rv != 0) {
+		job->rvs[p] = rv;
+		cf_atomic32_set(&job->stop, 1);
+	}
+}
+
+static int shash_reduce_parallel_all(shash *h, shash_reduce_fn reduce_fn, void *udata, size_t udata_size, shash_combine_fn combine_fn, as_thread_pool *pool, uint32_t n_partitions, bool delete) {
+	shash_reduce_job job = {
+			.h = h, .reduce_fn = reduce_fn, .delete = delete,
+			.udata = udata, .udata_size = udata_size
+	};
+
+	if (h->flags & SHASH_CR_OPEN) {
+		job.n_units = h->n_shards;
+	}
+	else {
+		// Resizes hold every lock, so any one will do.
+		pthread_mutex_t *l = shash_lock(h, 0);
+		job.n_units = h->old_table ? h->old_table_len : h->table_len;
+		if (l)     pthread_mutex_unlock(l);
+	}
+
+	if (n_partitions == 0) {
+		n_partitions = 1;
+	}
+	if (n_partitions > job.n_units) {
+		n_partitions = job.n_units;
+	}
+	job.n_partitions = n_partitions;
+
+	job.rvs = (int *)shash_alloc(h, sizeof(int) * n_partitions);
+	if (! job.rvs) return(SHASH_ERR);
+	memset(job.rvs, 0, sizeof(int) * n_partitions);
+
+	if (udata_size) {
+		job.udatas = (uint8_t *)shash_alloc(h, udata_size * n_partitions);
+
+		if (! job.udatas) {
+			shash_free(h, job.rvs);
+			return(SHASH_ERR);
+		}
+
+		for (uint32_t p = 0; p < n_partitions; p++) {
+			memcpy(job.udatas + ((size_t)p * udata_size), udata, udata_size);
+		}
+	}
+
+	int rv = as_thread_pool_run_partitions(pool, shash_reduce_partition, &job, n_partitions) == 0 ? 0 : SHASH_ERR;
+
+	for (uint32_t p = 0; p < n_partitions; p++) {
+		if (rv == 0) {
+			rv = job.rvs[p];
+		}
+		if (job.udatas && combine_fn) {
+			combine_fn(udata, job.udatas + ((size_t)p * udata_size));
+		}
+	}
+
+	if (job.udatas) shash_free(h, job.udatas);
+	shash_free(h, job.rvs);
+
+	return(rv);
+}
+
+static void shash_stats_table(shash *h, void *table, uint table_len, uint32_t s, shash_stats *stats, uint64_t *probe_sum) {
+	for (uint i = s; i < table_len; i += shash_stripes(h)) {
+		shash_elem *list_he = shash_bucket(h, table, i);
+		uint32_t probe = 0;
+
+		while (list_he && list_he->in_use) {
+			probe++;
+			stats->elements++;
+			*probe_sum += probe;
+
+			// Everything past the head was allocated separately - a
+			// slab's chunks are counted whole.
+			if (probe > 1 && ! h->slab) {
+				stats->bytes += SHASH_ELEM_SZ(h);
+			}
+
+			list_he = list_he->next;
+		}
+
+		if (probe > stats->probe_max) {
+			stats->probe_max = probe;
+		}
+	}
+}
+
+// Free every chained element and mark every head unused. A slab's elements
+// all go at once, after.
+static void shash_clear_table(shash *h, void *table, uint table_len) {
+	shash_elem *e_table = table;
+	for (uint i=0;i<table_len;i++) {
+		if (e_table->next && h->slab) {
+			e_table->next = NULL;
+		}
+		else if (e_table->next) {
+			shash_elem *e = e_table->next;
+			shash_elem *t;
+			while (e) {
+				t = e->next;
+				shash_elem_free(h, e);
+				e = t;
+			}
+			// The head element of each hash bucket overflow chain also
+			// contains data. But we should not free it as it is 
+			// allocated as part of the overall hash table. So, just mark
+			// it so that it is re-used.
+			e_table->next = NULL;
+		}
+		e_table->in_use = false;
+		e_table = (shash_elem *) (((uint8_t *)e_table) + SHASH_ELEM_SZ(h));
+	}
+}
+
+// Empty the table, ending any resize. Caller holds every lock.
+static void shash_clear(shash *h) {
+	shash_clear_table(h, h->table, h->table_len);
+
+	if (h->old_table) {
+		shash_clear_table(h, h->old_table, h->old_table_len);
+		shash_free(h, h->old_table);
+		h->old_table = 0;
+		h->old_table_len = 0;
+	}
+
+	if (h->slab) {
+		cf_slab_reset(h->slab);
+	}
+
+	if (h->counter) {
+		cf_counter_reset(h->counter);
+	}
+
+	h->elements = 0;
+}
+
+// Start loading [p, p + sz) - elements and slots needn't be line aligned.
+// The prefetch helpers must be inlined - gcc counts a function that only
+// prefetches as const, and drops calls to it whose result is unused.
+static inline __attribute__((always_inline)) void shash_prefetch(const void *p, size_t sz) {
+	__builtin_prefetch(p);
+	__builtin_prefetch((const uint8_t *)p + sz - 1);
+}
+
+// Start loading where a batched get or put will look for x - the chained
+// bucket heads (old and new, mid-resize) or the open addressing home group's
+// control bytes. This reads the table without its lock, but prefetching a
+// stale address is harmless.
+static inline __attribute__((always_inline)) void shash_batch_prefetch(shash *h, uint64_t x) {
+	if (h->flags & SHASH_CR_OPEN) {
+		shash_shard *s = shash_open_shard(h, x);
+
+		shash_prefetch(s->ctrl + ((size_t)((uint32_t)(x >> 32) & (s->n_groups - 1)) * SHASH_GROUP_SZ), SHASH_GROUP_SZ);
+		return;
+	}
+
+	void *old_table = h->old_table;
+	uint old_table_len = h->old_table_len;
+
+	if (old_table && old_table_len) {
+		shash_prefetch(shash_bucket(h, old_table, (uint32_t)x % old_table_len), SHASH_ELEM_SZ(h));
+	}
+
+	shash_prefetch(shash_bucket(h, h->table, (uint32_t)x % h->table_len), SHASH_ELEM_SZ(h));
+}
+
+// Once the control bytes are in - start loading the slot of x's first match
+// in its home group, usually the key itself. Caller holds the shard's lock.
+static inline __attribute__((always_inline)) void shash_open_prefetch_slot(shash *h, shash_shard *s, uint64_t x) {
+	uint32_t g = (uint32_t)(x >> 32) & (s->n_groups - 1);
+	uint32_t m = shash_group_match(s->ctrl + ((size_t)g * SHASH_GROUP_SZ), (uint8_t)(x & 0x7f));
+
+	if (m) {
+		shash_prefetch(shash_open_key(h, s, (g * SHASH_GROUP_SZ) + __builtin_ctz(m)), h->key_len + h->value_len);
+	}
+}
+
+// Once the bucket head is in - start loading the next element if the head
+// isn't hash's key, which at load 1 is about a third of the time. Caller
+// holds hash's lock.
+static inline __attribute__((always_inline)) void shash_prefetch_chain(shash *h, uint32_t hash, void *key) {
+	shash_elem *e = shash_bucket(h, h->table, hash % h->table_len);
+
+	if (e->in_use && e->next && memcmp(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len) != 0) {
+		shash_prefetch(e->next, SHASH_ELEM_SZ(h));
+	}
+}
+
+// Shared by get_many and put_many. Each SHASH_BATCH_SZ keys are hashed and
+// prefetched, then resolved in order of lock - a stable sort, so keys sharing
+// a lock keep their order - taking each lock once per run of keys.
+static int shash_batch(shash *h, uint8_t *keys, uint32_t n, uint8_t *values, int *results, bool put) {
+	bool open = (h->flags & SHASH_CR_OPEN) != 0;
+	uint64_t xs[SHASH_BATCH_SZ];
+	uint32_t ids[SHASH_BATCH_SZ];
+	uint8_t order[SHASH_BATCH_SZ];
+	int rvs[SHASH_BATCH_SZ];
+	int rv = SHASH_OK;
+
+	for (uint32_t base = 0; base < n; base += SHASH_BATCH_SZ) {
+		uint32_t m = n - base < SHASH_BATCH_SZ ? n - base : SHASH_BATCH_SZ;
+
+		for (uint32_t i = 0; i < m; i++) {
+			void *key = keys + ((size_t)(base + i) * h->key_len);
+			uint64_t x = open ? shash_open_hash(h, key) : shash_hash(h, key);
+			uint32_t id = open ? (uint32_t)((x >> 7) & (h->n_shards - 1)) :
+					(h->flags & SHASH_CR_MT_MANYLOCK) ? shash_stripe(h, (uint32_t)x) : 0;
+
+			shash_batch_prefetch(h, x);
+			xs[i] = x;
+			ids[i] = id;
+
+			// With one lock nothing moves.
+			uint32_t j = i;
+
+			while (j > 0 && ids[order[j - 1]] > id) {
+				order[j] = order[j - 1];
+				j--;
+			}
+			order[j] = (uint8_t)i;
+		}
+
+		for (uint32_t r = 0; r < m; ) {
+			uint32_t id = ids[order[r]];
+			uint32_t end = r + 1;
+
+			while (end < m && ids[order[end]] == id) {
+				end++;
+			}
+
+			if (open) {
+				shash_shard *s = &h->shards[id];
+				pthread_mutex_t *l = shash_open_lock(h, s);
+
+				for (uint32_t k = r; k < end; k++) {
+					shash_open_prefetch_slot(h, s, xs[order[k]]);
+				}
+
+				for (uint32_t k = r; k < end; k++) {
+					uint32_t i = order[k];
+					void *key = keys + ((size_t)(base + i) * h->key_len);
+					void *value = values ? values + ((size_t)(base + i) * h->value_len) : 0;
+
+					rvs[i] = put ? shash_open_put_locked(h, s, xs[i], key, value, true, true) :
+							shash_open_get_locked(h, s, xs[i], key, value, false);
+				}
+
+				if (l)     pthread_mutex_unlock(l);
+			}
+			else {
+				uint32_t hash = (uint32_t)xs[order[r]];
+				pthread_mutex_t *l = shash_lock(h, hash);
+				bool added = false;
+
+				for (uint32_t k = r; k < end; k++) {
+					uint32_t i = order[k];
+
+					shash_prefetch_chain(h, (uint32_t)xs[i], keys + ((size_t)(base + i) * h->key_len));
+				}
+
+				for (uint32_t k = r; k < end; k++) {
+					uint32_t i = order[k];
+					void *key = keys + ((size_t)(base + i) * h->key_len);
+					void *value = values ? values + ((size_t)(base + i) * h->value_len) : 0;
+
+					rvs[i] = put ? shash_put_locked(h, (uint32_t)xs[i], key, value, &added) :
+							shash_get_locked(h, (uint32_t)xs[i], key, value);
+				}
+
+				shash_unlock(h, hash, l, added);
+			}
+
+			r = end;
+		}
+
+		for (uint32_t i = 0; i < m; i++) {
+			if (rv == SHASH_OK) {
+				rv = rvs[i];
+			}
+			if (results) {
+				results[base + i] = rvs[i];
+			}
+		}
+	}
+
+	return(rv);
+}
 
 /******************************************************************************
  * FUNCTIONS
@@ -56,15 +1432,83 @@ int shash_create(shash **h_r, shash_hash_fn h_fn, uint32_t key_len, uint32_t val
 	h->value_len = value_len;
 	h->flags = flags;
 	h->h_fn = h_fn;
-
-	if ((flags & SHASH_CR_MT_BIGLOCK) && (flags & SHASH_CR_MT_MANYLOCK)) {
+	h->key_hash_fn = 0;
+	h->lock_table_len = 0;
+	h->max_load = SHASH_MAX_LOAD;
+	h->old_table_len = 0;
+	h->old_table = 0;
+	h->migrate = 0;
+	h->locks_migrated = 0;
+	h->slab = 0;
+	h->counter = 0;
+
+	uint hash_flags = flags & (SHASH_CR_HASH_CRC32C | SHASH_CR_HASH_WY | SHASH_CR_HASH_DIGEST);
+
+	if (hash_flags == SHASH_CR_HASH_CRC32C)
+		h->key_hash_fn = cf_hash_crc32c;
+	else if (hash_flags == SHASH_CR_HASH_WY)
+		h->key_hash_fn = cf_hash_wy32;
+	else if (hash_flags == SHASH_CR_HASH_DIGEST)
+		h->key_hash_fn = cf_hash_digest;
+
+	// Note more than one built-in hash leaves none set.
+	if (((flags & SHASH_CR_MT_BIGLOCK) && (flags & SHASH_CR_MT_MANYLOCK)) ||
+			((flags & SHASH_CR_OPEN) && (flags & (SHASH_CR_RESIZE | SHASH_CR_SLAB))) ||
+			(hash_flags ? ! h->key_hash_fn : ! h_fn)) {
+		shash_free(h, h);
 		*h_r = 0;
 		return(SHASH_ERR);
 	}
+
+	if (flags & SHASH_CR_OPEN) {
+		if ((flags & SHASH_CR_MT_BIGLOCK) && 0 != pthread_mutex_init( &h->biglock, 0 )) {
+			shash_free(h, h);
+			*h_r = 0;
+			return(SHASH_ERR);
+		}
+
+		if (shash_open_create(h, sz) != SHASH_OK) {
+			if (flags & SHASH_CR_MT_BIGLOCK) pthread_mutex_destroy(&h->biglock);
+			shash_free(h, h);
+			*h_r = 0;
+			return(SHASH_ERR);
+		}
+
+		*h_r = h;
+		return(SHASH_OK);
+	}
+
+	h->n_shards = 0;
+	h->shards = 0;
+
+	if (flags & SHASH_CR_MT_MANYLOCK) {
+		h->lock_table_len = sz;
+	}
+
+	// Lock stripes instead of a lock per bucket, and a table that's a
+	// multiple of them.
+	if (flags & SHASH_CR_RESIZE) {
+		if (sz == 0) sz = 1;
+
+		if (flags & SHASH_CR_MT_MANYLOCK) {
+			h->lock_table_len = shash_lock_count(sz);
+			sz = ((sz + h->lock_table_len - 1) / h->lock_table_len) * h->lock_table_len;
+		}
+
+		h->table_len = sz;
+		h->migrate = (uint32_t *) shash_alloc(h, sizeof(uint32_t) * shash_stripes(h));
+		if (!h->migrate) {
+			shash_free(h, h);
+			*h_r = 0;
+			return(SHASH_ERR);
+		}
+	}
 	
 	h->table = (shash_elem *) (mem_tracked ? cf_malloc(sz * SHASH_ELEM_SZ(h)) : malloc(sz * SHASH_ELEM_SZ(h)));
 
 	if (!h->table) {
+		if (h->migrate)
+		  shash_free(h, h->migrate);
 		if (mem_tracked) 
 		  cf_free(h);
 		else
@@ -83,6 +1527,8 @@ int shash_create(shash **h_r, shash_hash_fn h_fn, uint32_t key_len, uint32_t val
 	
 	if (flags & SHASH_CR_MT_BIGLOCK) {
 		if (0 != pthread_mutex_init ( &h->biglock, 0) ) {
+			if (h->migrate)
+			  shash_free(h, h->migrate);
 			if (mem_tracked) {
 				cf_free(h->table);
 				cf_free(h);
@@ -97,8 +1543,10 @@ int shash_create(shash **h_r, shash_hash_fn h_fn, uint32_t key_len, uint32_t val
 		memset( (void *) &h->biglock, 0, sizeof( h->biglock ) );
 	
 	if (flags & SHASH_CR_MT_MANYLOCK) {
-		h->lock_table = (pthread_mutex_t *) (mem_tracked ? cf_malloc( sizeof(pthread_mutex_t) * sz) : malloc( sizeof(pthread_mutex_t) * sz));
+		h->lock_table = (pthread_mutex_t *) (mem_tracked ? cf_malloc( sizeof(pthread_mutex_t) * h->lock_table_len) : malloc( sizeof(pthread_mutex_t) * h->lock_table_len));
 		if (! h->lock_table) {
+			if (h->migrate)
+			  shash_free(h, h->migrate);
 			if (mem_tracked)
 			  cf_free(h);
 			else
@@ -106,51 +1554,68 @@ int shash_create(shash **h_r, shash_hash_fn h_fn, uint32_t key_len, uint32_t val
 			*h_r = 0;
 			return(SHASH_ERR);
 		}
-		for (uint i=0;i<sz;i++) {
+		for (uint i=0;i<h->lock_table_len;i++) {
 			pthread_mutex_init( &(h->lock_table[i]), 0 );
 		}
 	}
 	else
 		h->lock_table = 0;
 
+	if (flags & SHASH_CR_MT_MANYLOCK) {
+		h->counter = cf_counter_create(mem_tracked ? 0 : CF_COUNTER_UNTRACKED);
+		if (! h->counter) {
+			shash_destroy(h);
+			*h_r = 0;
+			return(SHASH_ERR);
+		}
+	}
+
+	// Only the biglock serializes every free - parallel reduce deletes and
+	// MT_MANYLOCK stripes free concurrently.
+	if (flags & SHASH_CR_SLAB) {
+		uint slab_flags = (flags & SHASH_CR_MT_BIGLOCK) ? 0 : CF_SLAB_MT;
+
+		if (! mem_tracked)
+			slab_flags |= CF_SLAB_UNTRACKED;
+
+		h->slab = cf_slab_create(SHASH_ELEM_SZ(h), slab_flags);
+		if (! h->slab) {
+			shash_destroy(h);
+			*h_r = 0;
+			return(SHASH_ERR);
+		}
+	}
+
 	*h_r = h;
 
 	return(SHASH_OK);
 }
 
+int shash_set_max_load(shash *h, uint32_t max_load) {
+	if (! (h->flags & SHASH_CR_RESIZE) || max_load == 0) {
+		return(SHASH_ERR);
+	}
+
+	h->max_load = max_load;
+	return(SHASH_OK);
+}
+
 /**
- * If MANYLOCK, then the elements counter will be wrong because there's no single
- * lock to use to protect. We've got a choice to use an atomic to make sure
- * the get_size call is fast in that case (thus slowing down every access), or
- * running the list and make get_size slow.
- * Choose making get_size slow in the case, but retaining parallelism
+ * If MANYLOCK, there's no single lock to protect an elements count with. A
+ * single atomic would have every put and delete bounce one cache line
+ * between cores, and walking the table makes get_size O(table) - so chained
+ * tables keep a sharded cf_counter, and get_size sums its shards. The open
+ * table's shards each count their own elements under their locks.
  */
 uint32_t shash_get_size(shash *h) {
     uint32_t elements = 0;
 	
-	if (h->flags & SHASH_CR_MT_MANYLOCK) {
-        
-        for (uint i=0; i<h->table_len ; i++) {
-            
-            pthread_mutex_t *l = &(h->lock_table[i]);
-            pthread_mutex_lock( l );
-            
-            shash_elem *list_he = (shash_elem *) ( ((uint8_t *)h->table) + (SHASH_ELEM_SZ(h) * i));
-            while (list_he) {
-                
-                // not in use is common at head pointer - unused bucket
-                if (list_he->in_use == false) 
-                    break;
-                
-                elements++;
-                
-                list_he = list_he->next;
-            }
-    
-            pthread_mutex_unlock(l);
-    
-        }
+	if ((h->flags & SHASH_CR_MT_MANYLOCK) && (h->flags & SHASH_CR_OPEN)) {
+		elements = shash_open_get_size(h);
+	}
 
+	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
+		elements = shash_elements(h);
     }
     
     else if (h->flags & SHASH_CR_MT_BIGLOCK) {
@@ -165,78 +1630,92 @@ uint32_t shash_get_size(shash *h) {
 	return(elements);
 }
 
-int shash_put(shash *h, void *key, void *value) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
+int shash_get_stats(shash *h, shash_stats *stats) {
+	uint64_t probe_sum = 0;
 
-	// Calculate hash
-	uint hash = h->h_fn(key);
-	hash %= h->table_len;
+	memset(stats, 0, sizeof(shash_stats));
+
+	if (h->flags & SHASH_CR_OPEN) {
+		shash_open_get_stats(h, stats, &probe_sum);
+		goto Out;
+	}
+
+	if (h->flags & SHASH_CR_MT_BIGLOCK) {
+		pthread_mutex_lock( &h->biglock);
+	}
+
+	for (uint32_t s = 0; s < shash_stripes(h); s++) {
+
+		pthread_mutex_t *l = 0;
+		if (h->flags & SHASH_CR_MT_MANYLOCK) {
+			l = &(h->lock_table[s]);
+			pthread_mutex_lock( l );
+		}
+
+		if (h->old_table) {
+			shash_stats_table(h, h->old_table, h->old_table_len, s, stats, &probe_sum);
+		}
+		shash_stats_table(h, h->table, h->table_len, s, stats, &probe_sum);
 
-	pthread_mutex_t		*l = 0;
-	if (h->flags & SHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
+		if (l)	pthread_mutex_unlock(l);
 	}
-	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
+
+	stats->slots = h->table_len + h->old_table_len;
+	stats->bytes += (size_t)stats->slots * SHASH_ELEM_SZ(h);
+
+	if (h->flags & SHASH_CR_MT_MANYLOCK) {
+		stats->bytes += (size_t)h->lock_table_len * sizeof(pthread_mutex_t);
 	}
-	if (l)     pthread_mutex_lock( l );
-		
-	shash_elem *e = (shash_elem *) ( ((uint8_t *)h->table) + (SHASH_ELEM_SZ(h) * hash));	
 
-	// most common case should be insert into empty bucket, special case
-	if ( e->in_use == false )
-		goto Copy;
+	if (h->slab) {
+		stats->bytes += cf_slab_bytes(h->slab);
+	}
 
-	shash_elem *e_head = e;
+	if (h->flags & SHASH_CR_MT_BIGLOCK)
+		pthread_mutex_unlock(&h->biglock);
 
-	// This loop might be skippable if you know the key is not already in the hash
-	// (like, you just searched and it's single-threaded)	
-	while (e) {
-		if (memcmp(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len) == 0) {
-			memcpy(SHASH_ELEM_VALUE_PTR(h, e), value, h->value_len);
-			if (l)     pthread_mutex_unlock(l);
-			return(SHASH_OK);
-		}
-		e = e->next;
+Out:
+	if (stats->elements) {
+		stats->probe_mean = (double)probe_sum / stats->elements;
 	}
 
-	e = (shash_elem *) (mem_tracked ? cf_malloc(SHASH_ELEM_SZ(h)) : malloc(SHASH_ELEM_SZ(h)));
-	if (!e) {
-		if (l)     pthread_mutex_unlock( l );
-		return (SHASH_ERR);
+	return(SHASH_OK);
+}
+
+int shash_put(shash *h, void *key, void *value) {
+	if (h->flags & SHASH_CR_OPEN) {
+		return(shash_open_put(h, key, value, true, true));
 	}
 
-	e->next = e_head->next;
-	e_head->next = e;
-	
-Copy:
-	memcpy(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len);
-	memcpy(SHASH_ELEM_VALUE_PTR(h, e), value, h->value_len);
-	e->in_use = true;
-	h->elements++;
-	if (l)	pthread_mutex_unlock( l );
-	return(SHASH_OK);	
+	// Calculate hash
+	uint hash = shash_hash(h, key);
+	bool added = false;
+
+	pthread_mutex_t		*l = shash_lock(h, hash);
+
+	int rv = shash_put_locked(h, hash, key, value, &added);
+
+	shash_unlock(h, hash, l, added);
+	return(rv);
 }
 
 // Fail if there's already a value there
 
 int shash_put_unique(shash *h, void *key, void *value) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
+	if (h->flags & SHASH_CR_OPEN) {
+		return(shash_open_put(h, key, value, false, true));
+	}
 
 	// Calculate hash
-	uint hash = h->h_fn(key);
-	hash %= h->table_len;
+	uint hash = shash_hash(h, key);
 
-	pthread_mutex_t		*l = 0;
-	if (h->flags & SHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
-	}
-	if (l)     pthread_mutex_lock( l );
+	pthread_mutex_t		*l = shash_lock(h, hash);
 		
-	shash_elem *e = (shash_elem *) ( ((uint8_t *)h->table) + (SHASH_ELEM_SZ(h) * hash));	
+	shash_elem *e = shash_get_bucket(h, hash);
+	if (!e) {
+		shash_unlock(h, hash, l, false);
+		return (SHASH_ERR);
+	}
 
 	// most common case should be insert into empty bucket, special case
 	if ( e->in_use == false ) {
@@ -247,15 +1726,15 @@ int shash_put_unique(shash *h, void *key, void *value) {
 
 	while (e) {
 		if (memcmp(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len) == 0) {
-			if (l)     pthread_mutex_unlock(l);
+			shash_unlock(h, hash, l, false);
 			return(SHASH_ERR_FOUND);
 		}
 		e = e->next;
 	}
 
-	e = (shash_elem *) (mem_tracked ? cf_malloc(SHASH_ELEM_SZ(h)) : malloc(SHASH_ELEM_SZ(h)));
+	e = shash_elem_alloc(h);
 	if (!e) {
-		if (l)     pthread_mutex_unlock( l );
+		shash_unlock(h, hash, l, false);
 		return (SHASH_ERR);
 	}
 
@@ -266,8 +1745,8 @@ Copy:
 	memcpy(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len);
 	memcpy(SHASH_ELEM_VALUE_PTR(h, e), value, h->value_len);
 	e->in_use = true;
-	h->elements++;
-	if (l)	pthread_mutex_unlock( l );
+	shash_elements_incr(h);
+	shash_unlock(h, hash, l, true);
 	return(SHASH_OK);	
 
 }
@@ -278,30 +1757,29 @@ Copy:
  * presence of the key is not searched for.
  */
 int shash_put_duplicate(shash *h, void *key, void *value) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
+	if (h->flags & SHASH_CR_OPEN) {
+		return(shash_open_put(h, key, value, false, false));
+	}
 
 	// Calculate hash
-	uint hash = h->h_fn(key);
-	hash %= h->table_len;
+	uint hash = shash_hash(h, key);
 
-	pthread_mutex_t		*l = 0;
-	if (h->flags & SHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
-	}
-	if (l)     pthread_mutex_lock( l );
+	pthread_mutex_t		*l = shash_lock(h, hash);
 		
-	shash_elem *e = (shash_elem *) ( ((uint8_t *)h->table) + (SHASH_ELEM_SZ(h) * hash));	
+	shash_elem *e = shash_get_bucket(h, hash);
+	if (!e) {
+		shash_unlock(h, hash, l, false);
+		return (SHASH_ERR);
+	}
+
 	shash_elem *e_head = e;
 	// most common case should be insert into empty bucket, special case
 	if ( e->in_use == false )
 		goto Copy;
 
-	e = (shash_elem *) (mem_tracked ? cf_malloc(SHASH_ELEM_SZ(h)) : malloc(SHASH_ELEM_SZ(h)));
+	e = shash_elem_alloc(h);
 	if (!e) {
-		if (l)     pthread_mutex_unlock( l );
+		shash_unlock(h, hash, l, false);
 		return (SHASH_ERR);
 	}
 
@@ -312,71 +1790,61 @@ Copy:
 	memcpy(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len);
 	memcpy(SHASH_ELEM_VALUE_PTR(h, e), value, h->value_len);
 	e->in_use = true;
-	h->elements++;
-	if (l)	pthread_mutex_unlock( l );
+	shash_elements_incr(h);
+	shash_unlock(h, hash, l, true);
 	return(SHASH_OK);	
 }
 
 int shash_get(shash *h, void *key, void *value) {
-	int rv = SHASH_ERR;
-
-	uint hash = h->h_fn(key);
-	hash %= h->table_len;
-
-	pthread_mutex_t *l = 0;
-	if (h->flags & SHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
+	if (h->flags & SHASH_CR_OPEN) {
+		return(shash_open_get(h, key, value, false));
 	}
-	if (l)     pthread_mutex_lock( l );
 
-	shash_elem *e = (shash_elem *) (((byte *)h->table) + (SHASH_ELEM_SZ(h) * hash));
+	uint hash = shash_hash(h, key);
 
-	if (e->in_use == false) {
-		rv = SHASH_ERR_NOTFOUND;
-		goto Out;
-	}
+	pthread_mutex_t *l = shash_lock(h, hash);
 
-	do {
-		if (memcmp(SHASH_ELEM_KEY_PTR(h, e), key, h->key_len) == 0) {
-			if (NULL != value)
-			    memcpy(value, SHASH_ELEM_VALUE_PTR(h, e), h->value_len);
-			rv = SHASH_OK; 
-			goto Out;
-		}
-		e = e->next;
-	} while (e);
-	rv = SHASH_ERR_NOTFOUND;
+	int rv = shash_get_locked(h, hash, key, value);
 
-Out:
-	if (l) pthread_mutex_unlock(l);
+	shash_unlock(h, hash, l, false);
 
 	return(rv);
 }
 
+int shash_get_many(shash *h, void *keys, uint32_t n, void *values, int *results) {
+	return(shash_batch(h, (uint8_t *)keys, n, (uint8_t *)values, results, false));
+}
+
+int shash_put_many(shash *h, void *keys, uint32_t n, void *values, int *results) {
+	if (! values) {
+		return(SHASH_ERR);
+	}
+
+	return(shash_batch(h, (uint8_t *)keys, n, (uint8_t *)values, results, true));
+}
+
 /**
  * Note that the vlock is passed back only when the return code is SHASH_OK.
  * In the case where nothing is found, no lock is held.
  * It might be better to do it the other way, but you can change it later if you want
  */
 int shash_get_vlock(shash *h, void *key, void **value, pthread_mutex_t **vlock) {
+	if (h->flags & SHASH_CR_OPEN) {
+		return(shash_open_get_vlock(h, key, value, vlock));
+	}
+
 	int rv = SHASH_ERR;
 	
-	uint hash = h->h_fn(key);
-	hash %= h->table_len;
+	uint hash = shash_hash(h, key);
 
-	pthread_mutex_t		*l = 0;
-	if (h->flags & SHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
-	}
-	if (l)     pthread_mutex_lock( l );
+	pthread_mutex_t		*l = shash_lock(h, hash);
 	
-	shash_elem *e = (shash_elem *) ( ((byte *)h->table) + (SHASH_ELEM_SZ(h) * hash));	
+	shash_elem *e = shash_get_bucket(h, hash);
+
+	if (!e) {
+		rv = SHASH_ERR;
+		goto Out;
+	}
 
 	if (e->in_use == false) {
 		rv = SHASH_ERR_NOTFOUND;
@@ -419,24 +1887,23 @@ Out:
  * The user data can be anything.
  */
 int shash_update(shash *h, void *key, void *value_old, void *value_new, shash_update_fn update_fn, void *udata) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
+	if (h->flags & SHASH_CR_OPEN) {
+		return(shash_open_update(h, key, value_old, value_new, update_fn, udata));
+	}
 
-	uint hash = h->h_fn(key);
-	hash %= h->table_len;
+	uint hash = shash_hash(h, key);
 	int rv = SHASH_OK;
 
-	pthread_mutex_t *l = 0;
-	if (h->flags & SHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
-	}
-	if (l)     pthread_mutex_lock( l );
+	pthread_mutex_t *l = shash_lock(h, hash);
 
-	shash_elem *e = (shash_elem *) (((byte *)h->table) + (SHASH_ELEM_SZ(h) * hash));
+	shash_elem *e = shash_get_bucket(h, hash);
 	shash_elem *e_head = e;
 
+	if (!e) {
+		shash_unlock(h, hash, l, false);
+		return (SHASH_ERR);
+	}
+
 	if (e->in_use == false) {
 		value_old = NULL;
 		goto Update;
@@ -459,9 +1926,9 @@ Update:
 	// Write the new value into the hash table.
 
 	if (!value_old && !e) {
-		e = (shash_elem *) (mem_tracked ? cf_malloc(SHASH_ELEM_SZ(h)) : malloc(SHASH_ELEM_SZ(h)));
+		e = shash_elem_alloc(h);
 		if (!e) {
-			if (l)     pthread_mutex_unlock( l );
+			shash_unlock(h, hash, l, false);
 			return (SHASH_ERR);
 		}
 
@@ -475,31 +1942,30 @@ Update:
 	e->in_use = true;
 
 	if (!value_old)
-	  h->elements++;
+	  shash_elements_incr(h);
 
-	if (l) pthread_mutex_unlock(l);
+	shash_unlock(h, hash, l, !value_old);
 
 	return(rv);
 }
 
 int shash_delete(shash *h, void *key) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
+	if (h->flags & SHASH_CR_OPEN) {
+		return(shash_open_delete(h, key, false));
+	}
 
 	// Calculate hash
-	uint hash = h->h_fn(key);
-	hash %= h->table_len;
+	uint hash = shash_hash(h, key);
 	int rv = SHASH_ERR;
 
-	pthread_mutex_t		*l = 0;
-	if (h->flags & SHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
-	}
-	if (l)     pthread_mutex_lock( l );
+	pthread_mutex_t		*l = shash_lock(h, hash);
 		
-	shash_elem *e = (shash_elem *) ( ((uint8_t *)h->table) + (SHASH_ELEM_SZ(h) * hash));	
+	shash_elem *e = shash_get_bucket(h, hash);
+
+	if (!e) {
+		rv = SHASH_ERR;
+		goto Out;
+	}
 
 	// If bucket empty, def can't delete
 	if ( e->in_use == false ) {
@@ -516,10 +1982,7 @@ int shash_delete(shash *h, void *key) {
 			// patchup pointers & free element if not head
 			if (e_prev) {
 				e_prev->next = e->next;
-				if (mem_tracked)
-				  cf_free(e);
-				else
-				  free(e);				
+				shash_elem_free(h, e);
 			}
 			// am at head - more complicated
 			else {
@@ -531,13 +1994,10 @@ int shash_delete(shash *h, void *key) {
 				else {
 					shash_elem *_t = e->next;
 					memcpy(e, e->next, SHASH_ELEM_SZ(h) );
-					if (mem_tracked)
-					  cf_free(_t);
-					else
-					  free(_t);
+					shash_elem_free(h, _t);
 				}
 			}
-			h->elements--;
+			shash_elements_decr(h);
 			rv = SHASH_OK;
 			goto Out;
 
@@ -548,8 +2008,7 @@ int shash_delete(shash *h, void *key) {
 	rv = SHASH_ERR_NOTFOUND;
 
 Out:
-	if (l) 
-		pthread_mutex_unlock(l);
+	shash_unlock(h, hash, l, false);
 	return(rv);	
 	
 
@@ -560,13 +2019,17 @@ Out:
 // doing multiple helper functions may be better...
 
 int shash_delete_lockfree(shash *h, void *key) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
+	if (h->flags & SHASH_CR_OPEN) {
+		return(shash_open_delete(h, key, true));
+	}
 
 	// Calculate hash
-	uint hash = h->h_fn(key);
-	hash %= h->table_len;
+	uint hash = shash_hash(h, key);
 
-	shash_elem *e = (shash_elem *) ( ((uint8_t *)h->table) + (SHASH_ELEM_SZ(h) * hash));	
+	shash_elem *e = shash_get_bucket(h, hash);
+
+	if (!e)
+		return( SHASH_ERR );
 
 	// If bucket empty, def can't delete
 	if ( e->in_use == false )
@@ -581,10 +2044,7 @@ int shash_delete_lockfree(shash *h, void *key) {
 			// patchup pointers & free element if not head
 			if (e_prev) {
 				e_prev->next = e->next;
-				if (mem_tracked)
-				  cf_free(e);
-				else
-				  free(e);
+				shash_elem_free(h, e);
 			}
 			// am at head - more complicated
 			else {
@@ -596,13 +2056,10 @@ int shash_delete_lockfree(shash *h, void *key) {
 				else {
 					shash_elem *_t = e->next;
 					memcpy(e, e->next, SHASH_ELEM_SZ(h) );
-					if (mem_tracked)
-					  cf_free(_t);
-					else
-					  free(_t);
+					shash_elem_free(h, _t);
 				}
 			}
-			h->elements--;
+			shash_elements_decr(h);
 			return( SHASH_OK );
 		}
 		e_prev = e;
@@ -615,23 +2072,22 @@ int shash_delete_lockfree(shash *h, void *key) {
 }
 
 int shash_get_and_delete(shash *h, void *key, void *value) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
+	if (h->flags & SHASH_CR_OPEN) {
+		return(shash_open_get(h, key, value, true));
+	}
 
 	// Calculate hash
-	uint hash = h->h_fn(key);
-	hash %= h->table_len;
+	uint hash = shash_hash(h, key);
 	int rv = SHASH_ERR;
 
-	pthread_mutex_t		*l = 0;
-	if (h->flags & SHASH_CR_MT_BIGLOCK) {
-		l = &h->biglock;
-	}
-	else if (h->flags & SHASH_CR_MT_MANYLOCK) {
-		l = & (h->lock_table[hash]);
-	}
-	if (l)     pthread_mutex_lock( l );
+	pthread_mutex_t		*l = shash_lock(h, hash);
 		
-	shash_elem *e = (shash_elem *) ( ((uint8_t *)h->table) + (SHASH_ELEM_SZ(h) * hash));	
+	shash_elem *e = shash_get_bucket(h, hash);
+
+	if (!e) {
+		rv = SHASH_ERR;
+		goto Out;
+	}
 
 	// If bucket empty, def can't delete
 	if ( e->in_use == false ) {
@@ -652,10 +2108,7 @@ int shash_get_and_delete(shash *h, void *key, void *value) {
 			// patchup pointers & free element if not head
 			if (e_prev) {
 				e_prev->next = e->next;
-				if (mem_tracked)
-				  cf_free(e);
-				else
-				  free(e);
+				shash_elem_free(h, e);
 			}
 			// am at head - more complicated
 			else {
@@ -667,13 +2120,10 @@ int shash_get_and_delete(shash *h, void *key, void *value) {
 				else {
 					shash_elem *_t = e->next;
 					memcpy(e, e->next, SHASH_ELEM_SZ(h) );
-					if (mem_tracked)
-					  cf_free(_t);
-					else
-					  free(_t);
+					shash_elem_free(h, _t);
 				}
 			}
-			h->elements--;
+			shash_elements_decr(h);
 			rv = SHASH_OK;
 			goto Out;
 
@@ -684,8 +2134,7 @@ int shash_get_and_delete(shash *h, void *key, void *value) {
 	rv = SHASH_ERR_NOTFOUND;
 
 Out:
-	if (l)
-		pthread_mutex_unlock( l );
+	shash_unlock(h, hash, l, false);
 		
 	return(rv);	
 	
@@ -699,44 +2148,11 @@ Out:
  * if there was one that didn't return zero.
  */
 int shash_reduce(shash *h, shash_reduce_fn reduce_fn, void *udata) {
-	int rv = 0;
-	
-	if (h->flags & SHASH_CR_MT_BIGLOCK) {
-		pthread_mutex_lock( &h->biglock);
-	}
-
-	for (uint i=0; i<h->table_len ; i++) {
-		
-		pthread_mutex_t *l = 0;
-		if (h->flags & SHASH_CR_MT_MANYLOCK) {
-			l = &(h->lock_table[i]);
-			pthread_mutex_lock( l );
-		}
-		
-		shash_elem *list_he = (shash_elem *) ( ((uint8_t *)h->table) + (SHASH_ELEM_SZ(h) * i));
-		while (list_he) {
-			
-			// not in use is common at head pointer - unused bucket
-			if (list_he->in_use == false)
-				break;
-			
-			rv = reduce_fn(	SHASH_ELEM_KEY_PTR(h, list_he), SHASH_ELEM_VALUE_PTR(h, list_he), udata);
-			if (0 != rv) {
-                if (l) pthread_mutex_unlock(l);
-				goto Out;
-			}
-			
-			list_he = list_he->next;
-		}
-
-		if (l)	pthread_mutex_unlock(l);
-
+	if (h->flags & SHASH_CR_OPEN) {
+		return(shash_open_reduce(h, reduce_fn, udata, false));
 	}
-Out:
-	if (h->flags & SHASH_CR_MT_BIGLOCK)
-		pthread_mutex_unlock(&h->biglock);
 
-	return(rv);
+	return(shash_reduce_all(h, reduce_fn, udata, false));
 }
 
 /**
@@ -747,90 +2163,19 @@ Out:
  * negative numbers are errors
  */
 int shash_reduce_delete(shash *h, shash_reduce_fn reduce_fn, void *udata) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
-	int rv = 0;
-	
-	if (h->flags & SHASH_CR_MT_BIGLOCK) {
-		pthread_mutex_lock( &h->biglock);
+	if (h->flags & SHASH_CR_OPEN) {
+		return(shash_open_reduce(h, reduce_fn, udata, true));
 	}
-	
-	for (uint i=0; i<h->table_len ; i++) {
 
-		pthread_mutex_t *l = 0;
-		if (h->flags & SHASH_CR_MT_MANYLOCK) {
-			l = &(h->lock_table[i]);
-			pthread_mutex_lock( l );
-		}
-		
-		shash_elem *list_he = (shash_elem *) ( ((uint8_t *)h->table) + (SHASH_ELEM_SZ(h) * i));
-		shash_elem *prev_he = 0;
-		
-		while (list_he) {
-			// This kind of structure might have the head as an empty element,
-			// that's a signal to move along
-			if (list_he->in_use == false)
-				break;
-			
-			rv = reduce_fn( SHASH_ELEM_KEY_PTR(h, list_he), SHASH_ELEM_VALUE_PTR(h, list_he), udata);
-			
-			// Delete is requested
-			// Leave the pointers in a "next" state
-			if (rv == SHASH_REDUCE_DELETE) {
-
-                h->elements--;
-                
-				// patchup pointers & free element if not head
-				if (prev_he) {
-					prev_he->next = list_he->next;
-					if (mem_tracked)
-					  cf_free(list_he);
-					else
-					  free(list_he);					
-					list_he = prev_he->next;
-				}
-				// am at head - more complicated
-				else {
-					// at head with no next - easy peasy!
-					if (0 == list_he->next) {
-						list_he->in_use = false;
-						list_he = 0;
-					}
-					// at head with a next - more complicated -
-					// copy next into current and free next
-					// (the old trick of how to delete from a singly
-					// linked list without a prev pointer)
-					// Somewhat confusingly, prev_he stays 0
-					// and list_he stays where it is
-					else {
-						shash_elem *_t = list_he->next;
-						memcpy(list_he, list_he->next, SHASH_ELEM_SZ(h) );
-						if (mem_tracked)
-						  cf_free(_t);
-						else
-						  free(_t);
-					}
-				}
-				rv = 0;
-			}
-			else if (0 != rv) {
-				if (l)	pthread_mutex_unlock(l);
-				goto Out;
-			}
-			else { // don't delete, just forward everything
-				prev_he = list_he;
-				list_he = list_he->next;
-			}	
-		}
-		
-		if (l) pthread_mutex_unlock(l);
-	}
+	return(shash_reduce_all(h, reduce_fn, udata, true));
+}
 
-Out:
+int shash_reduce_parallel(shash *h, shash_reduce_fn reduce_fn, void *udata, size_t udata_size, shash_combine_fn combine_fn, as_thread_pool *pool, uint32_t n_partitions) {
+	return(shash_reduce_parallel_all(h, reduce_fn, udata, udata_size, combine_fn, pool, n_partitions, false));
+}
 
-	if (h->flags & SHASH_CR_MT_BIGLOCK)
-		pthread_mutex_unlock( &h->biglock);
-	
-	return(rv);
+int shash_reduce_delete_parallel(shash *h, shash_reduce_fn reduce_fn, void *udata, size_t udata_size, shash_combine_fn combine_fn, as_thread_pool *pool, uint32_t n_partitions) {
+	return(shash_reduce_parallel_all(h, reduce_fn, udata, udata_size, combine_fn, pool, n_partitions, true));
 }
 
 /**
@@ -838,39 +2183,33 @@ Out:
  * knows this is going to be single threaded
  */
 void shash_deleteall_lockfree(shash *h) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
-
-	shash_elem *e_table = h->table;
-	for (uint i=0;i<h->table_len;i++) {
-		if (e_table->next) {
-			shash_elem *e = e_table->next;
-			shash_elem *t;
-			while (e) {
-				t = e->next;
-				if (mem_tracked)
-				  cf_free(e);
-				else
-				  free(e);
-				e = t;
-			}
-			// The head element of each hash bucket overflow chain also
-			// contains data. But we should not free it as it is 
-			// allocated as part of the overall hash table. So, just mark
-			// it so that it is re-used.
-			e_table->next = NULL;
-		}
-		e_table->in_use = false;
-		e_table = (shash_elem *) (((uint8_t *)e_table) + SHASH_ELEM_SZ(h));
+	if (h->flags & SHASH_CR_OPEN) {
+		shash_open_deleteall(h, true);
+		return;
 	}
-	h->elements = 0;
+
+	shash_clear(h);
 }
 
 void shash_deleteall(shash *h) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
-	
+	if (h->flags & SHASH_CR_OPEN) {
+		shash_open_deleteall(h, false);
+		return;
+	}
+
+	// Tables may be swapped, or the slab reset - hold everything.
+	if (h->flags & (SHASH_CR_RESIZE | SHASH_CR_SLAB)) {
+		shash_lock_all(h);
+		shash_clear(h);
+		shash_unlock_all(h);
+		return;
+	}
+
 	pthread_mutex_t *big_lock = 0;
+	int64_t removed = 0;
 	if (h->flags & SHASH_CR_MT_BIGLOCK) {
 		big_lock = &h->biglock;
+		pthread_mutex_lock(big_lock);
 	}
 	
 	shash_elem *e_table = h->table;
@@ -886,10 +2225,8 @@ void shash_deleteall(shash *h) {
 			shash_elem *t;
 			while (e) {
 				t = e->next;
-				if (mem_tracked)
-				  cf_free(e);
-				else
-				  free(e);
+				shash_elem_free(h, e);
+				removed++;
 				e = t;
 			}
 			// The head element of each hash bucket overflow chain also
@@ -898,12 +2235,20 @@ void shash_deleteall(shash *h) {
 			// it so that it is re-used.
 			e_table->next = NULL;
 		}
+		if (e_table->in_use) {
+			removed++;
+		}
 		e_table->in_use = false;
 		if (l) {
 			pthread_mutex_unlock(l);
 		}
 		e_table = (shash_elem *) (((uint8_t *)e_table) + SHASH_ELEM_SZ(h));
 	}
+	// Buckets emptied while other threads put into the rest - take off what
+	// went, rather than zero what came in meanwhile.
+	if (h->counter) {
+		cf_counter_add(h->counter, -removed);
+	}
 	h->elements = 0;
 	if (big_lock) {
 		pthread_mutex_unlock(big_lock);
@@ -915,30 +2260,25 @@ void shash_deleteall(shash *h) {
  * Destroy a simple hash table. 
  */
 void shash_destroy(shash *h) {
-	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
-
-	shash_elem * e_table = (shash_elem *) h->table;
-	for (uint i=0;i<h->table_len;i++) {
-		if (e_table->next) {
-			shash_elem *e = e_table->next;
-			shash_elem *t;
-			while (e) {
-				t = e->next;
-				if (mem_tracked)
-				  cf_free(e);
-				else
-				  free(e);
-				e = t;
-			}
+	if (h->flags & SHASH_CR_OPEN) {
+		shash_open_destroy(h);
+		if (h->flags & SHASH_CR_MT_BIGLOCK) {
+			pthread_mutex_destroy(&h->biglock);
 		}
-		e_table = (shash_elem *) (((uint8_t *)e_table) + SHASH_ELEM_SZ(h));
+		shash_free(h, h);
+		return;
 	}
 
+	bool mem_tracked = !(h->flags & SHASH_CR_UNTRACKED);
+
+	// Frees the old table, if resizing.
+	shash_clear(h);
+
 	if (h->flags & SHASH_CR_MT_BIGLOCK) {
 		pthread_mutex_destroy(&h->biglock);
 	}
 	if (h->flags & SHASH_CR_MT_MANYLOCK) {
-		for (uint i=0;i<h->table_len;i++) {
+		for (uint i=0;i<h->lock_table_len;i++) {
 			pthread_mutex_destroy(&(h->lock_table[i]));
 		}
 		if (mem_tracked)
@@ -947,6 +2287,18 @@ void shash_destroy(shash *h) {
 		  free(h->lock_table);
 	}
 
+	if (h->migrate) {
+		shash_free(h, h->migrate);
+	}
+
+	if (h->slab) {
+		cf_slab_destroy(h->slab);
+	}
+
+	if (h->counter) {
+		cf_counter_destroy(h->counter);
+	}
+
 	if (mem_tracked) {
 		cf_free(h->table);
 		cf_free(h);
@@ -954,4 +2306,4 @@ void shash_destroy(shash *h) {
 		free(h->table);
 		free(h);
 	}
-}	
+}
@@ -0,0 +1,259 @@
+/* 
+ * Copyright 2008-2015 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <citrusleaf/alloc.h>
+#include <citrusleaf/cf_atomic.h>
+#include <citrusleaf/cf_bits.h>
+#include <citrusleaf/cf_slab.h>
+
+/******************************************************************************
+ * CONSTANTS
+ ******************************************************************************/
+
+// Objects are aligned as malloc() would align them, as are the first objects
+// of each chunk, after the chunk's link.
+#define CF_SLAB_ALIGN 16
+
+// Chunks are about this big, unless objects are so big that fewer than
+// CF_SLAB_MIN_CHUNK_OBJS would fit.
+#define CF_SLAB_CHUNK_SZ (64 * 1024)
+#define CF_SLAB_MIN_CHUNK_OBJS 16
+
+// Objects a magazine holds - it fills or drains half of them at a time, so a
+// thread alternating alloc and free never touches the shared free list.
+#define CF_SLAB_MAG_SZ 64
+
+// Magazines per online core, and the most a slab gets.
+#define CF_SLAB_MAGS_PER_CPU 2
+#define CF_SLAB_MAX_MAGS 256
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+
+struct cf_slab_mag_s {
+	pthread_mutex_t		lock;
+	uint32_t			n;
+	void *				objs[CF_SLAB_MAG_SZ];
+} __attribute__ ((aligned(64)));
+
+/******************************************************************************
+ * GLOBALS
+ ******************************************************************************/
+
+// Which magazine of every slab the thread uses - 0 until it first needs one.
+static cf_atomic32 g_slab_threads = 0;
+static __thread uint32_t g_slab_thread = 0;
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ ******************************************************************************/
+
+static inline void *cf_slab_mem_alloc(cf_slab *s, size_t sz) {
+	return (s->flags & CF_SLAB_UNTRACKED) ? malloc(sz) : cf_malloc(sz);
+}
+
+static inline void cf_slab_mem_free(cf_slab *s, void *p) {
+	if (s->flags & CF_SLAB_UNTRACKED)
+		free(p);
+	else
+		cf_free(p);
+}
+
+static inline cf_slab_mag *cf_slab_get_mag(cf_slab *s) {
+	if (g_slab_thread == 0) {
+		g_slab_thread = (uint32_t)cf_atomic32_incr(&g_slab_threads);
+	}
+
+	return &s->mags[g_slab_thread & (s->n_mags - 1)];
+}
+
+// Next object off the free list, or else never used - from a new chunk if
+// need be. Caller holds the slab lock, if there is one.
+static void *cf_slab_take(cf_slab *s) {
+	void *p = s->free_list;
+
+	if (p) {
+		s->free_list = *(void **)p;
+		return(p);
+	}
+
+	if (s->carve == s->carve_end) {
+		size_t objs_sz = (size_t)s->chunk_objs * s->obj_sz;
+		uint8_t *chunk = (uint8_t *)cf_slab_mem_alloc(s, CF_SLAB_ALIGN + objs_sz);
+
+		if (! chunk) {
+			return(0);
+		}
+
+		*(uint8_t **)chunk = s->chunks;
+		s->chunks = chunk;
+		s->n_chunks++;
+		s->carve = chunk + CF_SLAB_ALIGN;
+		s->carve_end = s->carve + objs_sz;
+	}
+
+	p = s->carve;
+	s->carve += s->obj_sz;
+	return(p);
+}
+
+static inline void cf_slab_give(cf_slab *s, void *p) {
+	*(void **)p = s->free_list;
+	s->free_list = p;
+}
+
+/******************************************************************************
+ * FUNCTIONS
+ ******************************************************************************/
+
+cf_slab *cf_slab_create(size_t obj_sz, uint flags) {
+	bool mem_tracked = ! (flags & CF_SLAB_UNTRACKED);
+	cf_slab *s = (cf_slab *)(mem_tracked ? cf_malloc(sizeof(cf_slab)) : malloc(sizeof(cf_slab)));
+
+	if (! s) {
+		return(0);
+	}
+
+	memset(s, 0, sizeof(cf_slab));
+	s->obj_sz = obj_sz ? (obj_sz + CF_SLAB_ALIGN - 1) & ~(size_t)(CF_SLAB_ALIGN - 1) : CF_SLAB_ALIGN;
+	s->chunk_objs = (uint32_t)((CF_SLAB_CHUNK_SZ - CF_SLAB_ALIGN) / s->obj_sz);
+	s->flags = flags;
+
+	if (s->chunk_objs < CF_SLAB_MIN_CHUNK_OBJS) {
+		s->chunk_objs = CF_SLAB_MIN_CHUNK_OBJS;
+	}
+
+	if (flags & CF_SLAB_MT) {
+		s->n_mags = cf_pow2_per_cpu(CF_SLAB_MAGS_PER_CPU, CF_SLAB_MAX_MAGS);
+		s->mags = (cf_slab_mag *)cf_slab_mem_alloc(s, sizeof(cf_slab_mag) * s->n_mags);
+
+		if (! s->mags) {
+			cf_slab_mem_free(s, s);
+			return(0);
+		}
+
+		pthread_mutex_init(&s->lock, 0);
+
+		for (uint32_t i = 0; i < s->n_mags; i++) {
+			pthread_mutex_init(&s->mags[i].lock, 0);
+			s->mags[i].n = 0;
+		}
+	}
+
+	return(s);
+}
+
+void cf_slab_destroy(cf_slab *s) {
+	cf_slab_reset(s);
+
+	if (s->flags & CF_SLAB_MT) {
+		for (uint32_t i = 0; i < s->n_mags; i++) {
+			pthread_mutex_destroy(&s->mags[i].lock);
+		}
+
+		pthread_mutex_destroy(&s->lock);
+		cf_slab_mem_free(s, s->mags);
+	}
+
+	cf_slab_mem_free(s, s);
+}
+
+void *cf_slab_alloc(cf_slab *s) {
+	if (! (s->flags & CF_SLAB_MT)) {
+		return(cf_slab_take(s));
+	}
+
+	cf_slab_mag *m = cf_slab_get_mag(s);
+
+	pthread_mutex_lock(&m->lock);
+
+	if (m->n == 0) {
+		pthread_mutex_lock(&s->lock);
+
+		while (m->n < CF_SLAB_MAG_SZ / 2) {
+			void *p = cf_slab_take(s);
+
+			if (! p) {
+				break;
+			}
+
+			m->objs[m->n++] = p;
+		}
+
+		pthread_mutex_unlock(&s->lock);
+	}
+
+	void *p = m->n ? m->objs[--m->n] : 0;
+
+	pthread_mutex_unlock(&m->lock);
+	return(p);
+}
+
+void cf_slab_free(cf_slab *s, void *p) {
+	if (! (s->flags & CF_SLAB_MT)) {
+		cf_slab_give(s, p);
+		return;
+	}
+
+	cf_slab_mag *m = cf_slab_get_mag(s);
+
+	pthread_mutex_lock(&m->lock);
+
+	if (m->n == CF_SLAB_MAG_SZ) {
+		pthread_mutex_lock(&s->lock);
+
+		while (m->n > CF_SLAB_MAG_SZ / 2) {
+			cf_slab_give(s, m->objs[--m->n]);
+		}
+
+		pthread_mutex_unlock(&s->lock);
+	}
+
+	m->objs[m->n++] = p;
+
+	pthread_mutex_unlock(&m->lock);
+}
+
+void cf_slab_reset(cf_slab *s) {
+	for (uint32_t i = 0; i < s->n_mags; i++) {
+		s->mags[i].n = 0;
+	}
+
+	while (s->chunks) {
+		uint8_t *next = *(uint8_t **)s->chunks;
+
+		cf_slab_mem_free(s, s->chunks);
+		s->chunks = next;
+	}
+
+	s->n_chunks = 0;
+	s->free_list = 0;
+	s->carve = 0;
+	s->carve_end = 0;
+}
+
+size_t cf_slab_bytes(cf_slab *s) {
+	return (size_t)s->n_chunks * (CF_SLAB_ALIGN + ((size_t)s->chunk_objs * s->obj_sz));
+}
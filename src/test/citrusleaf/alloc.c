@@ -0,0 +1,268 @@
+#include "../test.h"
+
+#include <aerospike/as_arraylist.h>
+#include <aerospike/as_hashmap.h>
+#include <aerospike/as_integer.h>
+#include <aerospike/as_msgpack.h>
+#include <aerospike/as_serializer.h>
+#include <aerospike/as_string.h>
+#include <citrusleaf/alloc.h>
+#include <citrusleaf/cf_queue.h>
+#include <pthread.h>
+#include <string.h>
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define N_BLOCKS 2000
+#define N_WORKERS 4
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+// Allocates in one arena and frees what another thread allocated in the
+// next, checking the contents made it across.
+static void*
+swap_run(void* udata)
+{
+	cf_alloc_hooks* hooks = cf_alloc_cache_hooks();
+	uint32_t* failed = udata;
+	uint8_t* blocks[64] = { NULL };
+
+	for (uint32_t i = 0; i < N_BLOCKS * 10; i++) {
+		uint32_t j = i % 64;
+		size_t sz = 1 + ((i * 37) % 600);
+
+		if (blocks[j]) {
+			if (blocks[j][0] != (uint8_t)j) {
+				(*failed)++;
+			}
+			hooks->free(blocks[j]);
+		}
+
+		blocks[j] = hooks->malloc(sz, (cf_alloc_arena)(i % CF_ALLOC_N_ARENAS));
+		memset(blocks[j], (uint8_t)j, sz);
+	}
+
+	for (uint32_t j = 0; j < 64; j++) {
+		hooks->free(blocks[j]);
+	}
+	return NULL;
+}
+
+// Takes and drops reservations on a shared region, the last of them with
+// cf_rc_releaseandfree() if it's the one that gets the count to zero.
+static void*
+rc_run(void* udata)
+{
+	uint32_t* o = udata;
+
+	for (uint32_t i = 0; i < N_BLOCKS * 50; i++) {
+		cf_rc_reserve(o);
+		cf_rc_release(o);
+	}
+
+	cf_rc_releaseandfree(o);
+	return NULL;
+}
+
+/******************************************************************************
+ * TEST CASES
+ *****************************************************************************/
+
+TEST( alloc_cache, "built-in caching allocator keeps blocks whole across sizes, arenas and threads" ) {
+	cf_alloc_hooks* hooks = cf_alloc_cache_hooks();
+	static uint8_t* blocks[N_BLOCKS];
+
+	// Every size up to past the biggest class, each block aligned and
+	// disjoint from the rest.
+	for (uint32_t i = 0; i < N_BLOCKS; i++) {
+		size_t sz = (i * 7) % 5000;
+
+		blocks[i] = hooks->malloc(sz, (cf_alloc_arena)(i % CF_ALLOC_N_ARENAS));
+		assert_not_null(blocks[i]);
+		assert_int_eq((uintptr_t)blocks[i] % 16, 0);
+		memset(blocks[i], (uint8_t)i, sz);
+	}
+
+	for (uint32_t i = 0; i < N_BLOCKS; i++) {
+		size_t sz = (i * 7) % 5000;
+
+		for (size_t b = 0; b < sz; b++) {
+			assert_int_eq(blocks[i][b], (uint8_t)i);
+		}
+
+		// Growing keeps the contents.
+		blocks[i] = hooks->realloc(blocks[i], sz + 3000, CF_ALLOC_ARENA_DEFAULT);
+		assert_not_null(blocks[i]);
+
+		if (sz) {
+			assert_int_eq(blocks[i][sz - 1], (uint8_t)i);
+		}
+		hooks->free(blocks[i]);
+	}
+
+	uint64_t* z = hooks->calloc(100, sizeof(uint64_t), CF_ALLOC_ARENA_QUEUE);
+	assert_not_null(z);
+
+	for (int i = 0; i < 100; i++) {
+		assert_int_eq(z[i], 0);
+	}
+	hooks->free(z);
+
+	assert_null(hooks->calloc(SIZE_MAX / 2, 4, CF_ALLOC_ARENA_DEFAULT));
+
+	void* page = hooks->valloc(10000, CF_ALLOC_ARENA_DEFAULT);
+	assert_not_null(page);
+	assert_int_eq((uintptr_t)page % 4096, 0);
+	hooks->free(page);
+
+	uint32_t failed[N_WORKERS] = { 0 };
+	pthread_t threads[N_WORKERS];
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		pthread_create(&threads[i], NULL, swap_run, &failed[i]);
+	}
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		pthread_join(threads[i], NULL);
+		assert_int_eq(failed[i], 0);
+	}
+}
+
+TEST( alloc_hooked, "msgpack, hashmap and queue run on the built-in allocator installed as hooks" ) {
+	as_serializer ser;
+	as_buffer b;
+	as_val* out = NULL;
+	char* dup;
+	int popped = -1;
+	bool same;
+
+	// Nothing allocated in between may outlive the hooks, so check after.
+	cf_hook_alloc(cf_alloc_cache_hooks());
+
+	as_hashmap* m = as_hashmap_new(32);
+	as_arraylist* l = as_arraylist_new(8, 8);
+
+	for (int i = 0; i < 100; i++) {
+		char key[16];
+		sprintf(key, "key-%d", i);
+		as_hashmap_set(m, (as_val*)as_string_new_strdup(key), (as_val*)as_integer_new(i));
+		as_arraylist_append_str(l, key);
+	}
+	as_hashmap_set(m, (as_val*)as_string_new_strdup("list"), (as_val*)l);
+
+	as_msgpack_init(&ser);
+	as_buffer_init(&b);
+	as_serializer_serialize(&ser, (as_val*)m, &b);
+	as_serializer_deserialize(&ser, &b, &out);
+	as_buffer_destroy(&b);
+	as_serializer_destroy(&ser);
+
+	same = out && as_val_type(out) == AS_MAP && as_hashmap_size((as_hashmap*)out) == 101;
+
+	as_val_destroy(out);
+	as_hashmap_destroy(m);
+
+	cf_queue* q = cf_queue_create(sizeof(int), true);
+
+	for (int i = 0; i < 1000; i++) {
+		cf_queue_push(q, &i);
+	}
+	cf_queue_pop(q, &popped, CF_QUEUE_NOWAIT);
+	cf_queue_destroy(q);
+
+	dup = cf_strdup("abc");
+	same = same && strcmp(dup, "abc") == 0;
+	cf_free(dup);
+
+	cf_hook_alloc(NULL);
+
+	assert_true(same);
+	assert_int_eq(popped, 0);
+}
+
+TEST( alloc_rc, "cf_rc regions count reservations across threads and free on the last release" ) {
+	static uint64_t* objs[N_BLOCKS];
+
+	for (uint32_t i = 0; i < N_BLOCKS; i++) {
+		objs[i] = cf_rc_alloc(sizeof(uint64_t) * (1 + i % 40));
+		assert_not_null(objs[i]);
+		assert_int_eq((uintptr_t)objs[i] % 8, 0);
+		assert_int_eq(cf_rc_count(objs[i]), 1);
+		objs[i][i % 40] = i;
+	}
+
+	for (uint32_t i = 0; i < N_BLOCKS; i++) {
+		assert_int_eq(objs[i][i % 40], i);
+		assert_int_eq(cf_rc_reserve(objs[i]), 2);
+		assert_int_eq(cf_rc_release(objs[i]), 1);
+		assert_int_eq(cf_rc_releaseandfree(objs[i]), 0);
+	}
+
+	// Every worker drops one reservation and the last one frees it.
+	uint32_t* shared = cf_rc_alloc(sizeof(uint32_t));
+	pthread_t threads[N_WORKERS];
+
+	for (int i = 1; i < N_WORKERS; i++) {
+		cf_rc_reserve(shared);
+	}
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		pthread_create(&threads[i], NULL, rc_run, shared);
+	}
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+}
+
+TEST( alloc_rc_biased, "biased cf_rc regions count plainly until shared, then atomically" ) {
+	uint32_t* o = cf_rc_alloc_biased(sizeof(uint32_t));
+	pthread_t threads[N_WORKERS];
+
+	assert_not_null(o);
+	assert_int_eq(cf_rc_count(o), 1);
+	assert_int_eq(cf_rc_reserve(o), 2);
+	assert_int_eq(cf_rc_reserve(o), 3);
+	assert_int_eq(cf_rc_release(o), 2);
+	assert_int_eq(cf_rc_count(o), 2);
+
+	// One reservation for each worker, on top of ours.
+	for (int i = 2; i < N_WORKERS; i++) {
+		cf_rc_reserve(o);
+	}
+	cf_rc_reserve(o);
+
+	cf_rc_share(o);
+	assert_int_eq(cf_rc_count(o), N_WORKERS + 1);
+	cf_rc_share(o);
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		pthread_create(&threads[i], NULL, rc_run, o);
+	}
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	assert_int_eq(cf_rc_count(o), 1);
+	assert_int_eq(cf_rc_releaseandfree(o), 0);
+
+	// Biased to the last reservation, which frees it.
+	o = cf_rc_alloc_biased(64);
+	assert_int_eq(cf_rc_releaseandfree(o), 0);
+}
+
+/******************************************************************************
+ * TEST SUITE
+ *****************************************************************************/
+
+SUITE( citrusleaf_alloc, "cf_alloc" ) {
+    suite_add( alloc_cache );
+    suite_add( alloc_hooked );
+    suite_add( alloc_rc );
+    suite_add( alloc_rc_biased );
+}
@@ -0,0 +1,147 @@
+#include "../test.h"
+
+#include <citrusleaf/cf_atomic.h>
+#include <pthread.h>
+#include <sched.h>
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+	cf_atomic32 seq;
+	uint32_t payload[8];
+	uint32_t failed;
+} mailbox;
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define N_HANDOFFS 20000
+#define N_ROUNDS 200000
+#define N_WORKERS 4
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+// Fills the payload with the round number, then publishes the round.
+static void*
+publish_run(void* udata)
+{
+	mailbox* m = udata;
+
+	for (uint32_t r = 1; r <= N_HANDOFFS; r++) {
+		// Wait for the reader to take the last round.
+		while (cf_atomic32_load(&m->seq, CF_ATOMIC_ACQUIRE) != (r - 1) * 2) {
+			sched_yield();
+		}
+
+		for (int i = 0; i < 8; i++) {
+			m->payload[i] = r;
+		}
+		cf_atomic32_store(&m->seq, (r * 2) - 1, CF_ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+// Checks each published payload is whole, then hands the mailbox back.
+static void*
+consume_run(void* udata)
+{
+	mailbox* m = udata;
+
+	for (uint32_t r = 1; r <= N_HANDOFFS; r++) {
+		while (cf_atomic32_load(&m->seq, CF_ATOMIC_ACQUIRE) != (r * 2) - 1) {
+			sched_yield();
+		}
+
+		for (int i = 0; i < 8; i++) {
+			if (m->payload[i] != r) {
+				m->failed++;
+			}
+		}
+		cf_atomic32_store(&m->seq, r * 2, CF_ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static void*
+count_run(void* udata)
+{
+	cf_atomic64* count = udata;
+
+	for (int i = 0; i < N_ROUNDS; i++) {
+		cf_atomic64_fetch_add(count, 1, CF_ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+/******************************************************************************
+ * TEST CASES
+ *****************************************************************************/
+
+TEST( atomic_ordered_ops, "ordered loads, stores, adds and cas return what the full-barrier calls do" ) {
+	cf_atomic32 a = 0;
+	cf_atomic64 b = 0;
+
+	cf_atomic32_store(&a, 5, CF_ATOMIC_RELEASE);
+	assert_int_eq(cf_atomic32_load(&a, CF_ATOMIC_ACQUIRE), 5);
+	assert_int_eq(cf_atomic32_fetch_add(&a, 3, CF_ATOMIC_RELAXED), 5);
+	assert_int_eq(cf_atomic32_fetch_add(&a, -8, CF_ATOMIC_ACQ_REL), 8);
+	assert_int_eq(cf_atomic32_load(&a, CF_ATOMIC_SEQ_CST), 0);
+
+	// Swaps on a match and returns the prior value either way.
+	assert_int_eq(cf_atomic32_cas_mo(&a, 1, 7, CF_ATOMIC_ACQ_REL), 0);
+	assert_int_eq(cf_atomic32_load(&a, CF_ATOMIC_RELAXED), 0);
+	assert_int_eq(cf_atomic32_cas_mo(&a, 0, 7, CF_ATOMIC_RELEASE), 0);
+	assert_int_eq(cf_atomic32_load(&a, CF_ATOMIC_RELAXED), 7);
+	assert_int_eq(cf_atomic32_add(&a, 1), 8);
+
+	cf_atomic64_store(&b, 1ULL << 40, CF_ATOMIC_SEQ_CST);
+	assert_true(cf_atomic64_fetch_add(&b, 1, CF_ATOMIC_RELAXED) == 1ULL << 40);
+	assert_true(cf_atomic64_cas_mo(&b, (1ULL << 40) + 1, 3, CF_ATOMIC_SEQ_CST) == (1ULL << 40) + 1);
+	assert_true(cf_atomic64_load(&b, CF_ATOMIC_ACQUIRE) == 3);
+
+	cf_atomic_int c = 0;
+	cf_atomic_int_fetch_add(&c, 2, CF_ATOMIC_RELAXED);
+	assert_int_eq(cf_atomic_int_load(&c, CF_ATOMIC_RELAXED), 2);
+
+	cf_atomic64 count = 0;
+	pthread_t threads[N_WORKERS];
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		pthread_create(&threads[i], NULL, count_run, (void*)&count);
+	}
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	// Relaxed adds still don't lose any.
+	assert_true(cf_atomic64_load(&count, CF_ATOMIC_RELAXED) == (uint64_t)N_WORKERS * N_ROUNDS);
+}
+
+TEST( atomic_publish, "a release store publishes everything written before it to an acquire load" ) {
+	static mailbox m;
+	pthread_t publisher;
+	pthread_t consumer;
+
+	pthread_create(&consumer, NULL, consume_run, &m);
+	pthread_create(&publisher, NULL, publish_run, &m);
+	pthread_join(publisher, NULL);
+	pthread_join(consumer, NULL);
+
+	assert_int_eq(m.failed, 0);
+	assert_int_eq(cf_atomic32_load(&m.seq, CF_ATOMIC_RELAXED), N_HANDOFFS * 2);
+}
+
+/******************************************************************************
+ * TEST SUITE
+ *****************************************************************************/
+
+SUITE( citrusleaf_atomic, "cf_atomic" ) {
+    suite_add( atomic_ordered_ops );
+    suite_add( atomic_publish );
+}
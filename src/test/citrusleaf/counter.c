@@ -0,0 +1,88 @@
+#include "../test.h"
+
+#include <citrusleaf/cf_counter.h>
+#include <pthread.h>
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define N_ADDS 100000
+#define N_WORKERS 4
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+// Even workers count up by 3 and odd ones down by 1, each on its own shard
+// unless there are more workers than shards.
+static void*
+add_run(void* udata)
+{
+	cf_counter* c = ((void**)udata)[0];
+	int64_t step = (int64_t)(uintptr_t)((void**)udata)[1];
+
+	for (int i = 0; i < N_ADDS; i++) {
+		cf_counter_add(c, step);
+	}
+	return NULL;
+}
+
+/******************************************************************************
+ * TEST CASES
+ *****************************************************************************/
+
+TEST( counter_basic, "cf_counter shards sit on their own lines and sum to what was added" ) {
+	cf_counter* c = cf_counter_create(0);
+
+	assert_not_null(c);
+	assert_true(c->n_shards >= 1 && (c->n_shards & (c->n_shards - 1)) == 0);
+	assert_int_eq((uintptr_t)c->shards % CF_COUNTER_LINE_SZ, 0);
+	assert_int_eq(sizeof(cf_counter_shard), CF_COUNTER_LINE_SZ);
+	assert_int_eq(cf_counter_read(c), 0);
+
+	cf_counter_add(c, 5);
+	cf_counter_add(c, -7);
+	assert_true(cf_counter_read(c) == -2);
+
+	cf_counter_add(c, 1LL << 33);
+	assert_true(cf_counter_read(c) == (1LL << 33) - 2);
+
+	cf_counter_reset(c);
+	assert_int_eq(cf_counter_read(c), 0);
+	cf_counter_destroy(c);
+
+	c = cf_counter_create(CF_COUNTER_UNTRACKED);
+	assert_not_null(c);
+	cf_counter_add(c, 1);
+	assert_int_eq(cf_counter_read(c), 1);
+	cf_counter_destroy(c);
+}
+
+TEST( counter_mt, "cf_counter loses no adds from threads sharing it" ) {
+	cf_counter* c = cf_counter_create(0);
+	void* args[N_WORKERS][2];
+	pthread_t threads[N_WORKERS];
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		args[i][0] = c;
+		args[i][1] = (void*)(uintptr_t)(i & 1 ? -1 : 3);
+		pthread_create(&threads[i], NULL, add_run, args[i]);
+	}
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	assert_true(cf_counter_read(c) == (int64_t)N_ADDS * (3 - 1) * (N_WORKERS / 2));
+	cf_counter_destroy(c);
+}
+
+/******************************************************************************
+ * TEST SUITE
+ *****************************************************************************/
+
+SUITE( citrusleaf_counter, "cf_counter" ) {
+    suite_add( counter_basic );
+    suite_add( counter_mt );
+}
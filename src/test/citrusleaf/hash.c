@@ -0,0 +1,160 @@
+#include "../test.h"
+
+#include <citrusleaf/cf_hash.h>
+#include <citrusleaf/cf_rchash.h>
+#include <citrusleaf/cf_shash.h>
+#include <string.h>
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define N_KEYS 4096
+#define N_BUCKETS 1024
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+// Bit at a time - slow but obviously right.
+static uint32_t
+crc32c_ref(const uint8_t* p, size_t len)
+{
+	uint32_t crc = ~0U;
+
+	while (len--) {
+		crc ^= *p++;
+
+		for (int i = 0; i < 8; i++) {
+			crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+		}
+	}
+	return ~crc;
+}
+
+// Longest chain if N_KEYS keys, 16 bytes apart like heap pointers, went in
+// N_BUCKETS buckets.
+static uint32_t
+max_chain(cf_hash_fn fn)
+{
+	uint32_t counts[N_BUCKETS] = { 0 };
+	uint32_t max = 0;
+
+	for (uint64_t i = 0; i < N_KEYS; i++) {
+		uint64_t ptr = 0x7f0000001000ULL + (i * 16);
+		uint32_t b = fn(&ptr, sizeof(ptr)) % N_BUCKETS;
+
+		if (++counts[b] > max) {
+			max = counts[b];
+		}
+	}
+	return max;
+}
+
+static void
+rchash_destroy_fn(void* object)
+{
+}
+
+/******************************************************************************
+ * TEST CASES
+ *****************************************************************************/
+
+TEST( hash_crc32c, "cf_hash_crc32c matches the reference CRC32C at every length and alignment" ) {
+	uint8_t buf[256 + 8];
+
+	assert_int_eq(cf_hash_crc32c("123456789", 9), 0xE3069283);
+	assert_int_eq(cf_hash_crc32c("", 0), 0);
+
+	for (size_t i = 0; i < sizeof(buf); i++) {
+		buf[i] = (uint8_t)(i * 131 + 7);
+	}
+
+	for (size_t off = 0; off < 8; off++) {
+		for (size_t len = 0; len <= 256; len++) {
+			assert_int_eq(cf_hash_crc32c(buf + off, len), crc32c_ref(buf + off, len));
+		}
+	}
+}
+
+TEST( hash_wy, "cf_hash_wy64 covers every length and spreads aligned pointers" ) {
+	uint8_t buf[200] = { 0 };
+
+	// Every length takes a different path through the mix - no two agree.
+	for (size_t len = 1; len < sizeof(buf); len++) {
+		assert_true(cf_hash_wy64(buf, len) != cf_hash_wy64(buf, len - 1));
+	}
+
+	// Flipping any one bit changes the hash.
+	for (size_t bit = 0; bit < 64 * 8; bit++) {
+		uint64_t h = cf_hash_wy64(buf, 64);
+		buf[bit / 8] ^= 1 << (bit % 8);
+		assert_true(cf_hash_wy64(buf, 64) != h);
+		buf[bit / 8] ^= 1 << (bit % 8);
+	}
+
+	// Truncated pointers fill 1 bucket in 16 - these shouldn't be far off 4
+	// per bucket.
+	assert_true(max_chain(cf_hash_wy32) <= 16);
+	assert_true(max_chain(cf_hash_crc32c) <= 16);
+}
+
+TEST( hash_digest, "cf_hash_digest uses digest bytes past the partition id" ) {
+	uint8_t d[20];
+
+	for (int i = 0; i < 20; i++) {
+		d[i] = (uint8_t)i;
+	}
+
+	assert_int_eq(cf_hash_digest(d, sizeof(d)), 0x0b0a0908);
+	assert_int_eq(cf_hash_digest(d, 8), cf_hash_wy32(d, 8));
+}
+
+TEST( hash_tables, "shash and cf_rchash use the built-in hash picked at create" ) {
+	shash* sh;
+	cf_rchash* rh;
+
+	assert_int_eq(shash_create(&sh, NULL, sizeof(uint64_t), sizeof(uint64_t), 64, 0), SHASH_ERR);
+	assert_int_eq(shash_create(&sh, NULL, sizeof(uint64_t), sizeof(uint64_t), 64, SHASH_CR_HASH_WY | SHASH_CR_HASH_CRC32C), SHASH_ERR);
+	assert_int_eq(shash_create(&sh, NULL, sizeof(uint64_t), sizeof(uint64_t), 64, SHASH_CR_HASH_WY | SHASH_CR_RESIZE), SHASH_OK);
+
+	for (uint64_t k = 0; k < N_KEYS; k++) {
+		assert_int_eq(shash_put(sh, &k, &k), SHASH_OK);
+	}
+
+	for (uint64_t k = 0; k < N_KEYS; k++) {
+		uint64_t v;
+		assert_int_eq(shash_get(sh, &k, &v), SHASH_OK);
+		assert_true(v == k);
+	}
+
+	shash_destroy(sh);
+
+	assert_int_eq(cf_rchash_create(&rh, NULL, rchash_destroy_fn, 0, 64, CF_RCHASH_CR_HASH_WY | CF_RCHASH_CR_HASH_DIGEST), CF_RCHASH_ERR);
+	assert_int_eq(cf_rchash_create(&rh, NULL, rchash_destroy_fn, 0, 64, CF_RCHASH_CR_HASH_CRC32C | CF_RCHASH_CR_RESIZE), CF_RCHASH_OK);
+
+	char key[32];
+
+	for (uint32_t k = 0; k < N_KEYS; k++) {
+		int len = sprintf(key, "key-%u", k);
+		assert_int_eq(cf_rchash_put(rh, key, len, cf_rc_alloc(8)), CF_RCHASH_OK);
+	}
+
+	for (uint32_t k = 0; k < N_KEYS; k++) {
+		int len = sprintf(key, "key-%u", k);
+		assert_int_eq(cf_rchash_get(rh, key, len, NULL), CF_RCHASH_OK);
+	}
+
+	cf_rchash_destroy(rh);
+}
+
+/******************************************************************************
+ * TEST SUITE
+ *****************************************************************************/
+
+SUITE( citrusleaf_hash, "cf_hash" ) {
+    suite_add( hash_crc32c );
+    suite_add( hash_wy );
+    suite_add( hash_digest );
+    suite_add( hash_tables );
+}
@@ -0,0 +1,478 @@
+#include "../test.h"
+
+#include <citrusleaf/cf_atomic.h>
+#include <citrusleaf/cf_queue.h>
+#include <citrusleaf/cf_clock.h>
+#include <unistd.h>
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+	cf_queue* q;
+	int ms_wait;
+	cf_atomic32* n_popped;
+	int rv;
+	cf_clock waited_us;
+} consumer;
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+// Pops one element, waiting as long as it's told to.
+static void*
+queue_consumer(void* udata)
+{
+	consumer* c = udata;
+	cf_clock start = cf_getus();
+	int v;
+
+	c->rv = cf_queue_pop(c->q, &v, c->ms_wait);
+	c->waited_us = cf_getus() - start;
+
+	if (c->rv == CF_QUEUE_OK) {
+		cf_atomic32_incr(c->n_popped);
+	}
+	return NULL;
+}
+
+// Waits up to 2 seconds for a counter to reach n.
+static bool
+queue_reaches(cf_atomic32* count, uint32_t n)
+{
+	for (int i = 0; i < 2000 && cf_atomic32_get(*count) != n; i++) {
+		usleep(1000);
+	}
+	return cf_atomic32_get(*count) == n;
+}
+
+// Starts n consumers popping q forever, and waits for them all to park.
+static bool
+queue_park_consumers(cf_queue* q, consumer* c, pthread_t* threads, uint32_t n, cf_atomic32* n_popped)
+{
+	for (uint32_t i = 0; i < n; i++) {
+		c[i].q = q;
+		c[i].ms_wait = CF_QUEUE_FOREVER;
+		c[i].n_popped = n_popped;
+		pthread_create(&threads[i], NULL, queue_consumer, &c[i]);
+	}
+	return queue_reaches(&q->n_waiters, n);
+}
+
+/******************************************************************************
+ * TEST CASES
+ *****************************************************************************/
+
+TEST( queue_fifo, "cf_queue push/pop order across resize" ) {
+	cf_queue* q = cf_queue_create(sizeof(int), true);
+
+	for (int i = 0; i < 1000; i++) {
+		assert_int_eq(cf_queue_push(q, &i), CF_QUEUE_OK);
+	}
+	assert_int_eq(cf_queue_sz(q), 1000);
+
+	for (int i = 0; i < 1000; i++) {
+		int v;
+		assert_int_eq(cf_queue_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_OK);
+		assert_int_eq(v, i);
+	}
+
+	int v;
+	assert_int_eq(cf_queue_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_EMPTY);
+	cf_queue_destroy(q);
+}
+
+TEST( queue_batch, "cf_queue push_n/pop_n across wrap and resize" ) {
+	cf_queue* q = cf_queue_create(sizeof(int), true);
+	int next_push = 0;
+	int next_pop = 0;
+
+	for (int i = 0; i < 60; i++, next_push++) {
+		cf_queue_push(q, &next_push);
+	}
+
+	int out[128];
+	assert_int_eq(cf_queue_pop_n(q, out, 50, CF_QUEUE_NOWAIT), 50);
+	for (int i = 0; i < 50; i++, next_pop++) {
+		assert_int_eq(out[i], next_pop);
+	}
+
+	// Wraps past the end of the 64 element allocation.
+	int in[100];
+	for (int i = 0; i < 30; i++, next_push++) {
+		in[i] = next_push;
+	}
+	assert_int_eq(cf_queue_push_n(q, in, 30), CF_QUEUE_OK);
+	assert_int_eq(cf_queue_sz(q), 40);
+
+	// Forces a resize of a wrapped queue.
+	for (int i = 0; i < 100; i++, next_push++) {
+		in[i] = next_push;
+	}
+	assert_int_eq(cf_queue_push_n(q, in, 100), CF_QUEUE_OK);
+	assert_int_eq(cf_queue_sz(q), 140);
+
+	int n;
+	while ((n = cf_queue_pop_n(q, out, 128, CF_QUEUE_NOWAIT)) > 0) {
+		for (int i = 0; i < n; i++, next_pop++) {
+			assert_int_eq(out[i], next_pop);
+		}
+	}
+	assert_int_eq(n, CF_QUEUE_EMPTY);
+	assert_int_eq(next_pop, next_push);
+	cf_queue_destroy(q);
+}
+
+TEST( queue_wrap_delete, "cf_queue resize and delete with wrapped contents" ) {
+	cf_queue* q = cf_queue_create(sizeof(int), true);
+	int next_push = 0;
+	int v;
+
+	for (int i = 0; i < 60; i++, next_push++) {
+		cf_queue_push(q, &next_push);
+	}
+	for (int i = 0; i < 58; i++) {
+		cf_queue_pop(q, &v, CF_QUEUE_NOWAIT);
+	}
+
+	// Six elements before the end of the allocation, six wrapped to the front.
+	for (int i = 0; i < 10; i++, next_push++) {
+		cf_queue_push(q, &next_push);
+	}
+
+	// Deletes across the wrap point, from either end.
+	v = 61;
+	assert_int_eq(cf_queue_delete(q, &v, true), CF_QUEUE_OK);
+	v = 66;
+	assert_int_eq(cf_queue_delete(q, &v, true), CF_QUEUE_OK);
+	assert_int_eq(cf_queue_sz(q), 10);
+
+	// Forces a resize of the wrapped queue.
+	for (int i = 0; i < 100; i++, next_push++) {
+		cf_queue_push(q, &next_push);
+	}
+	assert_int_eq(cf_queue_sz(q), 110);
+
+	for (int expect = 58; expect < next_push; expect++) {
+		if (expect == 61 || expect == 66) {
+			continue;
+		}
+		assert_int_eq(cf_queue_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_OK);
+		assert_int_eq(v, expect);
+	}
+	assert_int_eq(cf_queue_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_EMPTY);
+	cf_queue_destroy(q);
+}
+
+TEST( queue_push_head, "cf_queue push_head wraps below the read offset" ) {
+	cf_queue* q = cf_queue_create(sizeof(int), true);
+
+	// Alternate ends - the head side wraps around the allocation repeatedly.
+	for (int i = 0; i < 200; i++) {
+		int v = -i;
+		assert_int_eq(cf_queue_push_head(q, &v), CF_QUEUE_OK);
+		v = i + 1000;
+		assert_int_eq(cf_queue_push(q, &v), CF_QUEUE_OK);
+	}
+	assert_int_eq(cf_queue_sz(q), 400);
+
+	int v;
+	for (int i = 199; i >= 0; i--) {
+		assert_int_eq(cf_queue_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_OK);
+		assert_int_eq(v, -i);
+	}
+	for (int i = 0; i < 200; i++) {
+		assert_int_eq(cf_queue_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_OK);
+		assert_int_eq(v, i + 1000);
+	}
+	assert_int_eq(cf_queue_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_EMPTY);
+	cf_queue_destroy(q);
+}
+
+static int queue_delete_odd_reduce(void* buf, void* udata) {
+	return (*(int*)buf % 2) ? -2 : 0;
+}
+
+TEST( queue_tombstones, "cf_queue mid-queue deletes are skipped and compacted" ) {
+	cf_queue* q = cf_queue_create(sizeof(int), true);
+
+	for (int i = 0; i < 64; i++) {
+		cf_queue_push(q, &i);
+	}
+
+	// Each reduce deletes the first odd element - all mid-queue but the last.
+	for (int i = 0; i < 32; i++) {
+		assert_int_eq(cf_queue_reduce(q, queue_delete_odd_reduce, NULL), 0);
+	}
+	assert_int_eq(cf_queue_sz(q), 32);
+
+	// The queue is full of live elements and tombstones - forces compaction.
+	for (int i = 64; i < 96; i += 2) {
+		cf_queue_push(q, &i);
+	}
+	assert_int_eq(cf_queue_sz(q), 48);
+
+	int out[16];
+	int expect = 0;
+	int n;
+	while ((n = cf_queue_pop_n(q, out, 16, CF_QUEUE_NOWAIT)) > 0) {
+		for (int i = 0; i < n; i++, expect += 2) {
+			assert_int_eq(out[i], expect);
+		}
+	}
+	assert_int_eq(expect, 96);
+	cf_queue_destroy(q);
+}
+
+TEST( queue_indexed, "indexed cf_queue matches a plain queue op for op" ) {
+	cf_queue* plain = cf_queue_create(sizeof(int), false);
+	cf_queue* q = cf_queue_create_indexed(sizeof(int), false);
+	assert_not_null(q);
+
+	srand(42);
+
+	// Values from a small range, so there are plenty of duplicates and hits.
+	for (int op = 0; op < 20000; op++) {
+		int v = rand() % 300;
+		int a, b;
+
+		switch (rand() % 6) {
+		case 0:
+			assert_int_eq(cf_queue_push_unique(q, &v), cf_queue_push_unique(plain, &v));
+			break;
+		case 1:
+			cf_queue_push(q, &v);
+			cf_queue_push(plain, &v);
+			break;
+		case 2:
+			cf_queue_push_head(q, &v);
+			cf_queue_push_head(plain, &v);
+			break;
+		case 3:
+			assert_int_eq(cf_queue_delete(q, &v, v % 2 == 0), cf_queue_delete(plain, &v, v % 2 == 0));
+			break;
+		case 4:
+			a = cf_queue_pop(q, &a, CF_QUEUE_NOWAIT) == CF_QUEUE_OK ? a : -1;
+			b = cf_queue_pop(plain, &b, CF_QUEUE_NOWAIT) == CF_QUEUE_OK ? b : -1;
+			assert_int_eq(a, b);
+			break;
+		default:
+			cf_queue_reduce(q, queue_delete_odd_reduce, NULL);
+			cf_queue_reduce(plain, queue_delete_odd_reduce, NULL);
+			break;
+		}
+		assert_int_eq(cf_queue_sz(q), cf_queue_sz(plain));
+	}
+
+	int a, b;
+	while (cf_queue_pop(plain, &b, CF_QUEUE_NOWAIT) == CF_QUEUE_OK) {
+		assert_int_eq(cf_queue_pop(q, &a, CF_QUEUE_NOWAIT), CF_QUEUE_OK);
+		assert_int_eq(a, b);
+	}
+	assert_int_eq(cf_queue_sz(q), 0);
+	cf_queue_destroy(plain);
+	cf_queue_destroy(q);
+}
+
+TEST( queue_bounded, "bounded mutex queue refuses to grow" ) {
+	cf_queue* q = cf_queue_create_bounded(sizeof(int), 100, 0);
+
+	for (int i = 0; i < 100; i++) {
+		assert_int_eq(cf_queue_push(q, &i), CF_QUEUE_OK);
+	}
+
+	int i = 100;
+	assert_int_eq(cf_queue_push(q, &i), CF_QUEUE_ERR);
+	assert_int_eq(cf_queue_sz(q), 100);
+	cf_queue_destroy(q);
+}
+
+TEST( queue_lockfree, "lock-free ring push/pop and full/empty" ) {
+	cf_queue* q = cf_queue_create_bounded(sizeof(int), 100, CF_QUEUE_LOCKFREE);
+	assert_not_null(q);
+
+	// Capacity is rounded up to a power of two.
+	assert_int_eq(q->capacity, 128);
+
+	// The ring holds the elements - there's no element array.
+	assert_null(q->queue);
+
+	for (int i = 0; i < 128; i++) {
+		assert_int_eq(cf_queue_push(q, &i), CF_QUEUE_OK);
+	}
+
+	int i = 128;
+	assert_int_eq(cf_queue_push(q, &i), CF_QUEUE_ERR);
+	assert_int_eq(cf_queue_sz(q), 128);
+	assert_int_eq(cf_queue_push_head(q, &i), CF_QUEUE_ERR);
+
+	for (int i = 0; i < 128; i++) {
+		int v;
+		assert_int_eq(cf_queue_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_OK);
+		assert_int_eq(v, i);
+	}
+
+	int v;
+	assert_int_eq(cf_queue_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_EMPTY);
+
+	cf_clock start = cf_getms();
+	assert_int_eq(cf_queue_pop(q, &v, 50), CF_QUEUE_EMPTY);
+	assert_true(cf_getms() - start >= 40);
+
+	cf_queue_destroy(q);
+}
+
+static void*
+lockfree_producer(void* udata)
+{
+	cf_queue* q = udata;
+
+	for (int i = 1; i <= 10000; i++) {
+		while (cf_queue_push(q, &i) != CF_QUEUE_OK) {
+			;
+		}
+	}
+	return NULL;
+}
+
+TEST( queue_lockfree_threads, "lock-free ring with a parked consumer" ) {
+	cf_queue* q = cf_queue_create_bounded(sizeof(int), 64, CF_QUEUE_LOCKFREE);
+	pthread_t producers[2];
+
+	for (int i = 0; i < 2; i++) {
+		pthread_create(&producers[i], NULL, lockfree_producer, q);
+	}
+
+	uint64_t sum = 0;
+
+	for (int i = 0; i < 20000; i++) {
+		int v;
+		assert_int_eq(cf_queue_pop(q, &v, CF_QUEUE_FOREVER), CF_QUEUE_OK);
+		sum += v;
+	}
+
+	for (int i = 0; i < 2; i++) {
+		pthread_join(producers[i], NULL);
+	}
+
+	assert_int_eq(sum, 2 * (10000 * 10001 / 2));
+	assert_int_eq(cf_queue_sz(q), 0);
+	cf_queue_destroy(q);
+}
+
+TEST( queue_wake_one, "each push releases exactly one blocked consumer" ) {
+	cf_queue* queues[] = {
+		cf_queue_create(sizeof(int), true),
+		cf_queue_create_bounded(sizeof(int), 64, CF_QUEUE_LOCKFREE)
+	};
+
+	for (int k = 0; k < 2; k++) {
+		cf_queue* q = queues[k];
+		consumer c[4];
+		pthread_t threads[4];
+		cf_atomic32 n_popped = 0;
+
+		assert_true(queue_park_consumers(q, c, threads, 4, &n_popped));
+
+		for (uint32_t i = 1; i <= 4; i++) {
+			int v = (int)i;
+
+			assert_int_eq(cf_queue_push(q, &v), CF_QUEUE_OK);
+			assert_true(queue_reaches(&n_popped, i));
+
+			// Nobody else came out of the wait for it.
+			usleep(20 * 1000);
+			assert_int_eq(cf_atomic32_get(n_popped), i);
+			assert_int_eq(cf_atomic32_get(q->n_waiters), 4 - i);
+		}
+
+		for (int i = 0; i < 4; i++) {
+			pthread_join(threads[i], NULL);
+			assert_int_eq(c[i].rv, CF_QUEUE_OK);
+		}
+		assert_int_eq(cf_queue_sz(q), 0);
+		cf_queue_destroy(q);
+	}
+}
+
+TEST( queue_timed_pop, "timed pop comes back empty only after its deadline" ) {
+	cf_queue* q = cf_queue_create(sizeof(int), true);
+	cf_atomic32 n_popped = 0;
+	consumer c = { .q = q, .ms_wait = 100, .n_popped = &n_popped };
+	pthread_t thread;
+
+	// Nothing pushed.
+	queue_consumer(&c);
+	assert_int_eq(c.rv, CF_QUEUE_EMPTY);
+	assert_true(c.waited_us >= 99 * 1000);
+
+	// Pushes it mostly loses to us - each wakes it for nothing, and it must
+	// go back to waiting out the rest of its time.
+	pthread_create(&thread, NULL, queue_consumer, &c);
+	assert_true(queue_reaches(&q->n_waiters, 1));
+
+	for (int i = 0; i < 50; i++) {
+		int v = i;
+
+		cf_queue_push(q, &v);
+		cf_queue_pop(q, &v, CF_QUEUE_NOWAIT);
+		usleep(1000);
+	}
+
+	pthread_join(thread, NULL);
+
+	if (c.rv == CF_QUEUE_EMPTY) {
+		assert_true(c.waited_us >= 99 * 1000);
+	}
+	else {
+		assert_int_eq(c.rv, CF_QUEUE_OK);
+	}
+	cf_queue_destroy(q);
+}
+
+TEST( queue_push_n_wake, "push_n releases as many blocked consumers as it pushed" ) {
+	cf_queue* q = cf_queue_create(sizeof(int), true);
+	consumer c[4];
+	pthread_t threads[4];
+	cf_atomic32 n_popped = 0;
+	int elems[] = { 1, 2, 3 };
+
+	assert_true(queue_park_consumers(q, c, threads, 4, &n_popped));
+
+	assert_int_eq(cf_queue_push_n(q, elems, 3), CF_QUEUE_OK);
+	assert_true(queue_reaches(&n_popped, 3));
+	usleep(20 * 1000);
+	assert_int_eq(cf_atomic32_get(n_popped), 3);
+	assert_int_eq(cf_atomic32_get(q->n_waiters), 1);
+
+	assert_int_eq(cf_queue_push_n(q, elems, 1), CF_QUEUE_OK);
+	assert_true(queue_reaches(&n_popped, 4));
+
+	for (int i = 0; i < 4; i++) {
+		pthread_join(threads[i], NULL);
+		assert_int_eq(c[i].rv, CF_QUEUE_OK);
+	}
+	assert_int_eq(cf_queue_sz(q), 0);
+	cf_queue_destroy(q);
+}
+
+/******************************************************************************
+ * TEST SUITE
+ *****************************************************************************/
+
+SUITE( citrusleaf_queue, "cf_queue" ) {
+    suite_add( queue_fifo );
+    suite_add( queue_batch );
+    suite_add( queue_wrap_delete );
+    suite_add( queue_push_head );
+    suite_add( queue_tombstones );
+    suite_add( queue_indexed );
+    suite_add( queue_bounded );
+    suite_add( queue_lockfree );
+    suite_add( queue_lockfree_threads );
+    suite_add( queue_wake_one );
+    suite_add( queue_timed_pop );
+    suite_add( queue_push_n_wake );
+}
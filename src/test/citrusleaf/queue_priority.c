@@ -0,0 +1,268 @@
+#include "../test.h"
+
+#include <citrusleaf/cf_queue_priority.h>
+#include <unistd.h>
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+	int64_t pri;
+	uint32_t seq;
+} item;
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static uint32_t
+next_rand(uint32_t* seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 17;
+	*seed ^= *seed << 5;
+	return *seed;
+}
+
+// Candidate on every element, so the last visited wins.
+static int
+last_cb(void* buf, void* udata)
+{
+	(*(uint32_t*)udata)++;
+	return -2;
+}
+
+static int
+seq_cb(void* buf, void* udata)
+{
+	return ((item*)buf)->seq == *(uint32_t*)udata ? -1 : 0;
+}
+
+/******************************************************************************
+ * TEST CASES
+ *****************************************************************************/
+
+TEST( queue_priority_lanes, "cf_queue_priority pops high, medium then low lanes" ) {
+	cf_queue_priority* q = cf_queue_priority_create(sizeof(int), true);
+	int v;
+
+	v = 3; cf_queue_priority_push(q, &v, CF_QUEUE_PRIORITY_LOW);
+	v = 2; cf_queue_priority_push(q, &v, CF_QUEUE_PRIORITY_MEDIUM);
+	v = 1; cf_queue_priority_push(q, &v, CF_QUEUE_PRIORITY_HIGH);
+	v = 4; cf_queue_priority_push(q, &v, CF_QUEUE_PRIORITY_HIGH);
+
+	assert_int_eq(cf_queue_priority_sz(q), 4);
+
+	int expect[] = { 1, 4, 2, 3 };
+
+	for (int i = 0; i < 4; i++) {
+		assert_int_eq(cf_queue_priority_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_OK);
+		assert_int_eq(v, expect[i]);
+	}
+	assert_int_eq(cf_queue_priority_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_EMPTY);
+	cf_queue_priority_destroy(q);
+}
+
+TEST( queue_priority_heap, "heap cf_queue_priority pops by priority, FIFO within one" ) {
+	cf_queue_priority* q = cf_queue_priority_create_heap(sizeof(item), true);
+	uint32_t seed = 12345;
+	uint32_t seq = 0;
+	item last = { .pri = INT64_MIN, .seq = 0 };
+	int n_popped = 0;
+
+	// Pushes with a few pops mixed in - each pop can't beat the last, unless
+	// something better was pushed since.
+	for (int round = 0; round < 20; round++) {
+		for (int i = 0; i < 500; i++) {
+			item it = { .pri = next_rand(&seed) % 16, .seq = seq++ };
+			assert_int_eq(cf_queue_priority_push(q, &it, (int)it.pri), 0);
+		}
+
+		last.pri = INT64_MIN;
+
+		for (int i = 0; i < 200; i++) {
+			item it;
+			assert_int_eq(cf_queue_priority_pop(q, &it, CF_QUEUE_NOWAIT), CF_QUEUE_OK);
+			assert_true(it.pri > last.pri || (it.pri == last.pri && it.seq > last.seq));
+			last = it;
+			n_popped++;
+		}
+	}
+
+	assert_int_eq(cf_queue_priority_sz(q), 20 * 300);
+
+	last.pri = INT64_MIN;
+
+	while (cf_queue_priority_pop(q, &last, CF_QUEUE_NOWAIT) == CF_QUEUE_OK) {
+		n_popped++;
+	}
+	assert_int_eq(n_popped, 20 * 500);
+	assert_int_eq(cf_queue_priority_sz(q), 0);
+	cf_queue_priority_destroy(q);
+}
+
+TEST( queue_priority_reprioritize, "heap cf_queue_priority reprioritizes by handle" ) {
+	cf_queue_priority* q = cf_queue_priority_create_heap(sizeof(item), false);
+	cf_queue_priority_handle handles[1000];
+	int64_t pris[1000];
+	uint32_t seed = 999;
+
+	for (uint32_t i = 0; i < 1000; i++) {
+		item it = { .pri = 1000 + (next_rand(&seed) % 1000), .seq = i };
+		pris[i] = it.pri;
+		assert_int_eq(cf_queue_priority_push_handle(q, &it, it.pri, &handles[i]), 0);
+	}
+
+	// Move some up, some down - deadlines, say.
+	for (uint32_t i = 0; i < 1000; i += 3) {
+		pris[i] = next_rand(&seed) % 3000;
+		assert_int_eq(cf_queue_priority_reprioritize(q, handles[i], pris[i]), 0);
+	}
+
+	item last = { .pri = INT64_MIN, .seq = 0 };
+
+	for (uint32_t i = 0; i < 1000; i++) {
+		item it;
+		assert_int_eq(cf_queue_priority_pop(q, &it, CF_QUEUE_NOWAIT), CF_QUEUE_OK);
+
+		// Popped with the priority it was moved to, in order.
+		int64_t pri = pris[it.seq];
+		assert_true(pri > last.pri || (pri == last.pri && it.seq > last.seq));
+		last.pri = pri;
+		last.seq = it.seq;
+	}
+
+	// Popped elements' handles don't match, even once slots are reused.
+	item it = { .pri = 5, .seq = 0 };
+	assert_int_eq(cf_queue_priority_push_handle(q, &it, 5, NULL), 0);
+	assert_int_eq(cf_queue_priority_reprioritize(q, handles[0], 1), CF_QUEUE_NOMATCH);
+
+	cf_queue_priority_destroy(q);
+}
+
+TEST( queue_priority_heap_reduce_pop, "heap cf_queue_priority reduce_pop visits the top priority in order" ) {
+	cf_queue_priority* q = cf_queue_priority_create_heap(sizeof(item), true);
+	uint32_t n_visited = 0;
+
+	for (uint32_t i = 0; i < 100; i++) {
+		item it = { .pri = i % 4, .seq = i };
+		assert_int_eq(cf_queue_priority_push(q, &it, (int)it.pri), 0);
+	}
+
+	// Last of the 25 at priority 0.
+	item it;
+	assert_int_eq(cf_queue_priority_reduce_pop(q, &it, last_cb, &n_visited), 0);
+	assert_int_eq(n_visited, 25);
+	assert_int_eq(it.seq, 96);
+
+	// Not at the top priority.
+	uint32_t want = 41;
+	assert_int_eq(cf_queue_priority_reduce_pop(q, &it, seq_cb, &want), CF_QUEUE_NOMATCH);
+
+	want = 44;
+	assert_int_eq(cf_queue_priority_reduce_pop(q, &it, seq_cb, &want), 0);
+	assert_int_eq(it.seq, 44);
+
+	assert_int_eq(cf_queue_priority_pop(q, &it, CF_QUEUE_NOWAIT), CF_QUEUE_OK);
+	assert_int_eq(it.seq, 0);
+	assert_int_eq(cf_queue_priority_sz(q), 97);
+	cf_queue_priority_destroy(q);
+}
+
+TEST( queue_priority_fair, "fair cf_queue_priority shares pops by lane weight" ) {
+	cf_queue_priority* q = cf_queue_priority_create_fair(sizeof(int), true, 4, 2, 1);
+	cf_queue_priority_lane_stats stats[3];
+	int v;
+
+	assert_null(cf_queue_priority_create_fair(sizeof(int), true, 4, 0, 1));
+
+	for (int i = 0; i < 70; i++) {
+		v = CF_QUEUE_PRIORITY_HIGH; cf_queue_priority_push(q, &v, v);
+		v = CF_QUEUE_PRIORITY_MEDIUM; cf_queue_priority_push(q, &v, v);
+		v = CF_QUEUE_PRIORITY_LOW; cf_queue_priority_push(q, &v, v);
+	}
+
+	usleep(5000);
+
+	// Rounds of 4 high, 2 medium, 1 low.
+	int round[] = { 1, 1, 1, 1, 2, 2, 3 };
+	int n_popped[4] = { 0 };
+
+	for (int i = 0; i < 70; i++) {
+		assert_int_eq(cf_queue_priority_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_OK);
+		assert_int_eq(v, round[i % 7]);
+		n_popped[v]++;
+	}
+	assert_int_eq(n_popped[1], 40);
+	assert_int_eq(n_popped[2], 20);
+	assert_int_eq(n_popped[3], 10);
+
+	assert_int_eq(cf_queue_priority_get_stats(q, stats), 0);
+	assert_int_eq(stats[0].depth, 30);
+	assert_int_eq(stats[0].popped, 40);
+	assert_int_eq(stats[2].depth, 60);
+	assert_int_eq(stats[2].popped, 10);
+	assert_true(stats[2].wait_us_max >= 5000);
+	assert_true(stats[2].wait_us >= 10 * 5000);
+
+	// Empty lanes give up their turn.
+	while (stats[0].depth + stats[1].depth != 0) {
+		assert_int_eq(cf_queue_priority_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_OK);
+		assert_int_eq(cf_queue_priority_get_stats(q, stats), 0);
+	}
+
+	uint32_t n_low = stats[2].depth;
+
+	for (uint32_t i = 0; i < n_low; i++) {
+		assert_int_eq(cf_queue_priority_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_OK);
+		assert_int_eq(v, CF_QUEUE_PRIORITY_LOW);
+	}
+	assert_int_eq(cf_queue_priority_pop(q, &v, CF_QUEUE_NOWAIT), CF_QUEUE_EMPTY);
+
+	assert_int_eq(cf_queue_priority_get_stats(q, stats), 0);
+	assert_int_eq(stats[0].popped + stats[1].popped + stats[2].popped, 210);
+	assert_int_eq(stats[2].depth, 0);
+	cf_queue_priority_destroy(q);
+}
+
+TEST( queue_priority_fair_reduce_pop, "fair cf_queue_priority reduce_pop takes turns too" ) {
+	cf_queue_priority* q = cf_queue_priority_create_fair(sizeof(item), false, 1, 1, 1);
+	uint32_t n_visited = 0;
+	item it;
+
+	for (uint32_t i = 0; i < 9; i++) {
+		it.pri = (i % 3) + 1;
+		it.seq = i;
+		cf_queue_priority_push(q, &it, (int)it.pri);
+	}
+
+	// Each lane in turn - last candidate of each.
+	for (int lane = 1; lane <= 3; lane++) {
+		n_visited = 0;
+		assert_int_eq(cf_queue_priority_reduce_pop(q, &it, last_cb, &n_visited), 0);
+		assert_int_eq(n_visited, 3);
+		assert_int_eq(it.pri, lane);
+		assert_int_eq(it.seq, 6 + lane - 1);
+	}
+
+	// Stamps stayed in step - the rest pop in order.
+	for (uint32_t i = 0; i < 6; i++) {
+		assert_int_eq(cf_queue_priority_pop(q, &it, CF_QUEUE_NOWAIT), CF_QUEUE_OK);
+		assert_int_eq(it.seq, i);
+	}
+	cf_queue_priority_destroy(q);
+}
+
+/******************************************************************************
+ * TEST SUITE
+ *****************************************************************************/
+
+SUITE( citrusleaf_queue_priority, "cf_queue_priority" ) {
+    suite_add( queue_priority_lanes );
+    suite_add( queue_priority_heap );
+    suite_add( queue_priority_reprioritize );
+    suite_add( queue_priority_heap_reduce_pop );
+    suite_add( queue_priority_fair );
+    suite_add( queue_priority_fair_reduce_pop );
+}
@@ -0,0 +1,420 @@
+#include "../test.h"
+
+#include <aerospike/as_thread_pool.h>
+#include <citrusleaf/cf_rchash.h>
+#include <pthread.h>
+#include <stdio.h>
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+	cf_rchash* h;
+	uint32_t base;
+	uint32_t n;
+	uint32_t failed;
+} worker;
+
+typedef struct {
+	cf_rchash* h;
+	cf_atomic32* done;
+	uint32_t failed;
+} reader;
+
+typedef struct {
+	uint32_t n;
+	uint64_t sum;
+} tally;
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define N_KEYS 20000
+#define N_WORKERS 4
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static cf_atomic32 n_destroyed;
+
+static uint32_t
+key_hash_fn(void* key, uint32_t key_len)
+{
+	uint32_t h = 2166136261u;
+
+	for (uint32_t i = 0; i < key_len; i++) {
+		h = (h ^ ((uint8_t*)key)[i]) * 16777619u;
+	}
+	return h;
+}
+
+static void
+object_destroy(void* object)
+{
+	cf_atomic32_incr(&n_destroyed);
+}
+
+static uint32_t*
+object_new(uint32_t v)
+{
+	uint32_t* o = cf_rc_alloc(sizeof(uint32_t));
+	*o = v;
+	return o;
+}
+
+// True if key k maps to an object holding k.
+static bool
+has_key(cf_rchash* h, uint32_t k)
+{
+	uint32_t* o = NULL;
+
+	if (cf_rchash_get(h, &k, sizeof(k), (void**)&o) != CF_RCHASH_OK) {
+		return false;
+	}
+
+	bool ok = *o == k;
+
+	// Might outlive the table's reference to it.
+	if (cf_rc_release(o) == 0) {
+		object_destroy(o);
+		cf_rc_free(o);
+	}
+	return ok;
+}
+
+static int
+count_cb(void* key, uint32_t keylen, void* object, void* udata)
+{
+	(*(uint32_t*)udata)++;
+	return CF_RCHASH_OK;
+}
+
+static int
+delete_odd_cb(void* key, uint32_t keylen, void* object, void* udata)
+{
+	return *(uint32_t*)object & 1 ? CF_RCHASH_REDUCE_DELETE : CF_RCHASH_OK;
+}
+
+static int
+tally_cb(void* key, uint32_t keylen, void* object, void* udata)
+{
+	tally* t = udata;
+
+	t->n++;
+	t->sum += *(uint32_t*)object;
+	return CF_RCHASH_OK;
+}
+
+static void
+tally_combine(void* udata, void* part_udata)
+{
+	tally* t = udata;
+	tally* part = part_udata;
+
+	t->n += part->n;
+	t->sum += part->sum;
+}
+
+static void*
+worker_run(void* udata)
+{
+	worker* w = udata;
+
+	for (uint32_t k = w->base; k < w->base + w->n; k++) {
+		if (cf_rchash_put_unique(w->h, &k, sizeof(k), object_new(k)) != CF_RCHASH_OK) {
+			w->failed++;
+		}
+	}
+
+	for (uint32_t k = w->base; k < w->base + w->n; k++) {
+		if (! has_key(w->h, k)) {
+			w->failed++;
+		}
+		if ((k & 1) && cf_rchash_delete(w->h, &k, sizeof(k)) != CF_RCHASH_OK) {
+			w->failed++;
+		}
+	}
+	return NULL;
+}
+
+// Keys below N_KEYS are only ever replaced, never deleted, so must always be
+// found, holding their own key.
+static void*
+reader_run(void* udata)
+{
+	reader* r = udata;
+	uint32_t seed = 17;
+
+	while (cf_atomic32_get(*r->done) == 0) {
+		for (int i = 0; i < 1000; i++) {
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+
+			if (! has_key(r->h, seed % N_KEYS)) {
+				r->failed++;
+			}
+		}
+	}
+	return NULL;
+}
+
+/******************************************************************************
+ * TEST CASES
+ *****************************************************************************/
+
+TEST( rchash_resize, "cf_rchash grows past its initial size and keeps every key" ) {
+	cf_rchash* h;
+
+	n_destroyed = 0;
+	assert_int_eq(cf_rchash_create(&h, key_hash_fn, object_destroy, sizeof(uint32_t), 16, CF_RCHASH_CR_RESIZE), CF_RCHASH_OK);
+
+	for (uint32_t k = 0; k < N_KEYS; k++) {
+		assert_int_eq(cf_rchash_put(h, &k, sizeof(k), object_new(k)), CF_RCHASH_OK);
+	}
+
+	assert_true(h->table_len >= N_KEYS / 2);
+	assert_int_eq(cf_rchash_get_size(h), N_KEYS);
+
+	// Replacing releases the old object, wherever it lives mid-resize.
+	uint32_t k = 7;
+	assert_int_eq(cf_rchash_put(h, &k, sizeof(k), object_new(k)), CF_RCHASH_OK);
+	assert_int_eq(n_destroyed, 1);
+
+	uint32_t* dup = object_new(k);
+	assert_int_eq(cf_rchash_put_unique(h, &k, sizeof(k), dup), CF_RCHASH_ERR_FOUND);
+	cf_rc_free(dup);
+
+	for (k = 0; k < N_KEYS; k++) {
+		assert_true(has_key(h, k));
+	}
+
+	for (k = 0; k < N_KEYS; k += 2) {
+		assert_int_eq(cf_rchash_delete(h, &k, sizeof(k)), CF_RCHASH_OK);
+	}
+
+	uint32_t n = 0;
+	cf_rchash_reduce(h, count_cb, &n);
+	assert_int_eq(n, N_KEYS / 2);
+	assert_int_eq(cf_rchash_get_size(h), N_KEYS / 2);
+
+	cf_rchash_destroy(h);
+	assert_int_eq(n_destroyed, N_KEYS + 1);
+}
+
+TEST( rchash_resize_manylock, "cf_rchash resizes under concurrent striped puts, gets and deletes" ) {
+	cf_rchash* h;
+	worker w[N_WORKERS];
+	pthread_t threads[N_WORKERS];
+
+	assert_int_eq(cf_rchash_create(&h, key_hash_fn, NULL, sizeof(uint32_t), 64, CF_RCHASH_CR_RESIZE | CF_RCHASH_CR_MT_MANYLOCK), CF_RCHASH_OK);
+	assert_true(h->n_stripes >= 1 && (h->n_stripes & (h->n_stripes - 1)) == 0);
+	assert_int_eq(h->table_len % h->n_stripes, 0);
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		w[i] = (worker){ .h = h, .base = i * N_KEYS, .n = N_KEYS };
+		pthread_create(&threads[i], NULL, worker_run, &w[i]);
+	}
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		pthread_join(threads[i], NULL);
+		assert_int_eq(w[i].failed, 0);
+	}
+
+	assert_int_eq(cf_rchash_get_size(h), N_WORKERS * N_KEYS / 2);
+
+	for (uint32_t k = 0; k < N_WORKERS * N_KEYS; k++) {
+		assert_true(has_key(h, k) == ((k & 1) == 0));
+	}
+
+	cf_rchash_destroy(h);
+}
+
+TEST( rchash_resize_var, "cf_rchash resizes variable-length keys and reduces mid-migration" ) {
+	cf_rchash* h;
+	char key[32];
+
+	n_destroyed = 0;
+	assert_int_eq(cf_rchash_create(&h, key_hash_fn, object_destroy, 0, 8, CF_RCHASH_CR_RESIZE | CF_RCHASH_CR_MT_BIGLOCK), CF_RCHASH_OK);
+
+	for (uint32_t k = 0; k < N_KEYS; k++) {
+		int len = sprintf(key, "key-%u", k);
+		assert_int_eq(cf_rchash_put_unique(h, key, len, object_new(k)), CF_RCHASH_OK);
+	}
+
+	// Most likely caught between tables - reduce must see each element once.
+	cf_rchash_reduce(h, delete_odd_cb, NULL);
+	assert_int_eq(cf_rchash_get_size(h), N_KEYS / 2);
+	assert_int_eq(n_destroyed, N_KEYS / 2);
+
+	for (uint32_t k = 0; k < N_KEYS; k++) {
+		int len = sprintf(key, "key-%u", k);
+		int rv = cf_rchash_get(h, key, len, NULL);
+		assert_int_eq(rv, (k & 1) ? CF_RCHASH_ERR_NOTFOUND : CF_RCHASH_OK);
+	}
+
+	cf_rchash_destroy(h);
+	assert_int_eq(n_destroyed, N_KEYS);
+}
+
+TEST( rchash_lockfree_read, "cf_rchash lock-free gets race replaces, deletes and resizes" ) {
+	cf_rchash* h;
+	reader r[N_WORKERS];
+	pthread_t threads[N_WORKERS];
+	cf_atomic32 done = 0;
+
+	assert_int_eq(cf_rchash_create(&h, key_hash_fn, object_destroy, 0, 64, CF_RCHASH_CR_LOCKFREE_READ), CF_RCHASH_ERR);
+
+	n_destroyed = 0;
+	assert_int_eq(cf_rchash_create(&h, key_hash_fn, object_destroy, sizeof(uint32_t), 64, CF_RCHASH_CR_RESIZE | CF_RCHASH_CR_MT_MANYLOCK | CF_RCHASH_CR_LOCKFREE_READ), CF_RCHASH_OK);
+
+	for (uint32_t k = 0; k < N_KEYS; k++) {
+		cf_rchash_put(h, &k, sizeof(k), object_new(k));
+	}
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		r[i] = (reader){ .h = h, .done = &done };
+		pthread_create(&threads[i], NULL, reader_run, &r[i]);
+	}
+
+	// Replace every reader key, and grow the table past two more doublings
+	// with keys that come and go.
+	uint32_t n_created = N_KEYS;
+
+	for (uint32_t k = 0; k < N_KEYS; k++) {
+		cf_rchash_put(h, &k, sizeof(k), object_new(k));
+
+		uint32_t k2 = N_KEYS + k * 3;
+
+		for (uint32_t j = 0; j < 3; j++) {
+			uint32_t kj = k2 + j;
+			cf_rchash_put(h, &kj, sizeof(kj), object_new(kj));
+		}
+
+		if (k & 1) {
+			cf_rchash_delete(h, &k2, sizeof(k2));
+		}
+
+		n_created += 4;
+	}
+
+	cf_atomic32_set(&done, 1);
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		pthread_join(threads[i], NULL);
+		assert_int_eq(r[i].failed, 0);
+	}
+
+	assert_int_eq(cf_rchash_get_size(h), N_KEYS * 4 - N_KEYS / 2);
+
+	cf_rchash_destroy(h);
+	assert_int_eq(n_destroyed, n_created);
+}
+
+TEST( rchash_parallel_reduce, "cf_rchash parallel reduce visits and deletes every element once" ) {
+	uint flags[] = {
+			CF_RCHASH_CR_MT_BIGLOCK,
+			CF_RCHASH_CR_MT_MANYLOCK | CF_RCHASH_CR_RESIZE,
+			CF_RCHASH_CR_MT_MANYLOCK | CF_RCHASH_CR_RESIZE | CF_RCHASH_CR_LOCKFREE_READ
+	};
+	as_thread_pool pool;
+
+	assert_int_eq(as_thread_pool_init(&pool, N_WORKERS), 0);
+
+	for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+		cf_rchash* h;
+
+		n_destroyed = 0;
+		assert_int_eq(cf_rchash_create(&h, key_hash_fn, object_destroy, sizeof(uint32_t), 64, flags[i]), CF_RCHASH_OK);
+
+		for (uint32_t k = 0; k < N_KEYS; k++) {
+			assert_int_eq(cf_rchash_put(h, &k, sizeof(k), object_new(k)), CF_RCHASH_OK);
+		}
+
+		tally t = { 0 };
+		assert_int_eq(cf_rchash_reduce_parallel(h, tally_cb, &t, sizeof(t), tally_combine, &pool, 16), CF_RCHASH_OK);
+		assert_int_eq(t.n, N_KEYS);
+		assert_true(t.sum == (uint64_t)N_KEYS * (N_KEYS - 1) / 2);
+
+		assert_int_eq(cf_rchash_reduce_parallel(h, delete_odd_cb, NULL, 0, NULL, &pool, 16), CF_RCHASH_OK);
+		assert_int_eq(cf_rchash_get_size(h), N_KEYS / 2);
+		assert_int_eq(n_destroyed, N_KEYS / 2);
+
+		for (uint32_t k = 0; k < N_KEYS; k++) {
+			assert_true(has_key(h, k) == ((k & 1) == 0));
+		}
+
+		cf_rchash_destroy(h);
+		assert_int_eq(n_destroyed, N_KEYS);
+	}
+
+	as_thread_pool_destroy(&pool);
+}
+
+TEST( rchash_slab, "cf_rchash chain elements from a slab survive concurrent churn and destroy" ) {
+	cf_rchash* h;
+	worker w[N_WORKERS];
+	pthread_t threads[N_WORKERS];
+
+	n_destroyed = 0;
+	assert_int_eq(cf_rchash_create(&h, key_hash_fn, object_destroy, sizeof(uint32_t), 64, CF_RCHASH_CR_RESIZE | CF_RCHASH_CR_MT_MANYLOCK | CF_RCHASH_CR_LOCKFREE_READ | CF_RCHASH_CR_SLAB), CF_RCHASH_OK);
+	assert_true(h->slab != NULL);
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		w[i] = (worker){ .h = h, .base = i * N_KEYS, .n = N_KEYS };
+		pthread_create(&threads[i], NULL, worker_run, &w[i]);
+	}
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		pthread_join(threads[i], NULL);
+		assert_int_eq(w[i].failed, 0);
+	}
+
+	assert_int_eq(cf_rchash_get_size(h), N_WORKERS * N_KEYS / 2);
+
+	for (uint32_t k = 0; k < N_WORKERS * N_KEYS; k++) {
+		assert_true(has_key(h, k) == ((k & 1) == 0));
+	}
+
+	cf_rchash_destroy(h);
+	assert_int_eq(n_destroyed, N_WORKERS * N_KEYS);
+
+	// Variable-length keys, in a table too small not to chain.
+	char key[32];
+
+	n_destroyed = 0;
+	assert_int_eq(cf_rchash_create(&h, key_hash_fn, object_destroy, 0, 16, CF_RCHASH_CR_MT_BIGLOCK | CF_RCHASH_CR_SLAB), CF_RCHASH_OK);
+
+	for (uint32_t k = 0; k < N_KEYS; k++) {
+		int len = sprintf(key, "key-%u", k);
+		assert_int_eq(cf_rchash_put(h, key, len, object_new(k)), CF_RCHASH_OK);
+	}
+
+	assert_int_eq(cf_rchash_reduce(h, delete_odd_cb, NULL), CF_RCHASH_OK);
+	assert_int_eq(cf_rchash_get_size(h), N_KEYS / 2);
+
+	for (uint32_t k = 0; k < N_KEYS; k++) {
+		int len = sprintf(key, "key-%u", k);
+		int rv = cf_rchash_get(h, key, len, NULL);
+		assert_int_eq(rv, (k & 1) ? CF_RCHASH_ERR_NOTFOUND : CF_RCHASH_OK);
+	}
+
+	cf_rchash_destroy(h);
+	assert_int_eq(n_destroyed, N_KEYS);
+}
+
+/******************************************************************************
+ * TEST SUITE
+ *****************************************************************************/
+
+SUITE( citrusleaf_rchash, "cf_rchash" ) {
+    suite_add( rchash_resize );
+    suite_add( rchash_resize_manylock );
+    suite_add( rchash_resize_var );
+    suite_add( rchash_lockfree_read );
+    suite_add( rchash_parallel_reduce );
+    suite_add( rchash_slab );
+}
@@ -0,0 +1,665 @@
+#include "../test.h"
+
+#include <aerospike/as_thread_pool.h>
+#include <citrusleaf/cf_shash.h>
+#include <pthread.h>
+#include <string.h>
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+	shash* h;
+	uint32_t base;
+	uint32_t n;
+	uint32_t failed;
+} worker;
+
+typedef struct {
+	uint32_t limit;		// count keys below this
+	uint32_t n;
+	uint64_t sum;
+} tally;
+
+typedef struct {
+	shash* h;
+	cf_atomic32* done;
+} writer;
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define N_KEYS 20000
+#define N_WORKERS 4
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static uint32_t
+key_hash_fn(void* key)
+{
+	return *(uint32_t*)key * 2654435761u;
+}
+
+// Every key in one bucket - long probes.
+static uint32_t
+bad_hash_fn(void* key)
+{
+	return 7;
+}
+
+static int
+sum_cb(void* key, void* value, void* udata)
+{
+	*(uint64_t*)udata += *(uint64_t*)value;
+	return 0;
+}
+
+static int
+delete_odd_cb(void* key, void* value, void* udata)
+{
+	return *(uint32_t*)key & 1 ? SHASH_REDUCE_DELETE : 0;
+}
+
+static void
+add_update_fn(void* key, void* value_old, void* value_new, void* udata)
+{
+	*(uint64_t*)value_new = (value_old ? *(uint64_t*)value_old : 0) + *(uint64_t*)udata;
+}
+
+static int
+tally_cb(void* key, void* value, void* udata)
+{
+	tally* t = udata;
+
+	if (*(uint32_t*)key < t->limit) {
+		t->n++;
+		t->sum += *(uint64_t*)value;
+	}
+	return 0;
+}
+
+static void
+tally_combine(void* udata, void* part_udata)
+{
+	tally* t = udata;
+	tally* part = part_udata;
+
+	t->n += part->n;
+	t->sum += part->sum;
+}
+
+static int
+stop_cb(void* key, void* value, void* udata)
+{
+	return *(uint32_t*)key == 1234 ? -5 : 0;
+}
+
+// Puts and deletes keys at and above N_KEYS, growing the table, until done.
+static void*
+writer_run(void* udata)
+{
+	writer* w = udata;
+
+	for (uint32_t k = N_KEYS; cf_atomic32_get(*w->done) == 0; k++) {
+		uint64_t v = k;
+		shash_put(w->h, &k, &v);
+
+		if (k & 1) {
+			uint32_t d = k - 1;
+			shash_delete(w->h, &d);
+		}
+	}
+	return NULL;
+}
+
+static void*
+worker_run(void* udata)
+{
+	worker* w = udata;
+
+	for (uint32_t k = w->base; k < w->base + w->n; k++) {
+		uint64_t v = k;
+
+		if (shash_put_unique(w->h, &k, &v) != SHASH_OK) {
+			w->failed++;
+		}
+	}
+
+	for (uint32_t k = w->base; k < w->base + w->n; k++) {
+		uint64_t v = 0;
+
+		if (shash_get(w->h, &k, &v) != SHASH_OK || v != k) {
+			w->failed++;
+		}
+		if ((k & 1) && shash_delete(w->h, &k) != SHASH_OK) {
+			w->failed++;
+		}
+	}
+	return NULL;
+}
+
+/******************************************************************************
+ * TEST CASES
+ *****************************************************************************/
+
+TEST( shash_open_basic, "open addressing shash puts, gets, updates and deletes" ) {
+	shash* h;
+
+	assert_int_eq(shash_create(&h, key_hash_fn, sizeof(uint32_t), sizeof(uint64_t), N_KEYS, SHASH_CR_OPEN | SHASH_CR_MT_BIGLOCK), SHASH_OK);
+
+	uint64_t sum = 0;
+
+	for (uint32_t k = 0; k < N_KEYS; k++) {
+		uint64_t v = k;
+		assert_int_eq(shash_put_unique(h, &k, &v), SHASH_OK);
+		sum += k;
+	}
+
+	assert_int_eq(shash_get_size(h), N_KEYS);
+
+	uint32_t k = 7;
+	uint64_t v = 0;
+	assert_int_eq(shash_put_unique(h, &k, &v), SHASH_ERR_FOUND);
+	assert_int_eq(shash_get(h, &k, &v), SHASH_OK);
+	assert_int_eq(v, 7);
+
+	// Replace in place, then add through update.
+	v = 70;
+	assert_int_eq(shash_put(h, &k, &v), SHASH_OK);
+	uint64_t add = 5;
+	uint64_t v_old, v_new;
+	assert_int_eq(shash_update(h, &k, &v_old, &v_new, add_update_fn, &add), SHASH_OK);
+	assert_int_eq(v_old, 70);
+
+	uint64_t* vp;
+	pthread_mutex_t* vlock;
+	assert_int_eq(shash_get_vlock(h, &k, (void**)&vp, &vlock), SHASH_OK);
+	assert_int_eq(*vp, 75);
+	*vp = 7;
+	pthread_mutex_unlock(vlock);
+
+	k = N_KEYS;
+	assert_int_eq(shash_get_vlock(h, &k, (void**)&vp, &vlock), SHASH_ERR_NOTFOUND);
+	assert_true(vlock == NULL);
+
+	uint64_t total = 0;
+	assert_int_eq(shash_reduce(h, sum_cb, &total), 0);
+	assert_true(total == sum);
+
+	assert_int_eq(shash_reduce_delete(h, delete_odd_cb, NULL), 0);
+	assert_int_eq(shash_get_size(h), N_KEYS / 2);
+
+	for (k = 0; k < N_KEYS; k++) {
+		int rv = shash_get(h, &k, NULL);
+		assert_int_eq(rv, (k & 1) ? SHASH_ERR_NOTFOUND : SHASH_OK);
+	}
+
+	k = 8;
+	assert_int_eq(shash_get_and_delete(h, &k, &v), SHASH_OK);
+	assert_int_eq(v, 8);
+	assert_int_eq(shash_delete(h, &k), SHASH_ERR_NOTFOUND);
+
+	shash_deleteall(h);
+	assert_int_eq(shash_get_size(h), 0);
+	assert_int_eq(shash_get(h, &k, NULL), SHASH_ERR_NOTFOUND);
+
+	shash_destroy(h);
+}
+
+TEST( shash_open_full, "open addressing shash refuses puts past 15/16 and reuses tombstones" ) {
+	shash* h;
+	shash_stats stats;
+
+	// Collisions on every key - probes must walk every group.
+	assert_int_eq(shash_create(&h, bad_hash_fn, sizeof(uint32_t), sizeof(uint64_t), 100, SHASH_CR_OPEN), SHASH_OK);
+
+	uint32_t n = 0;
+
+	for (uint32_t k = 0; ; k++) {
+		uint64_t v = k;
+		if (shash_put(h, &k, &v) != SHASH_OK) {
+			break;
+		}
+		n++;
+	}
+
+	assert_int_eq(shash_get_stats(h, &stats), SHASH_OK);
+	assert_int_eq(stats.elements, n);
+	assert_int_eq(n, stats.slots - stats.slots / 16);
+	assert_true(n >= 100);
+	assert_int_eq(stats.probe_max, stats.slots / 16);
+
+	for (uint32_t k = 0; k < n; k++) {
+		assert_int_eq(shash_get(h, &k, NULL), SHASH_OK);
+	}
+
+	// Deleting from full groups leaves tombstones, which later puts reuse or
+	// rebuild away.
+	for (uint32_t k = 0; k < n; k += 2) {
+		assert_int_eq(shash_delete(h, &k), SHASH_OK);
+	}
+
+	for (uint32_t k = n; k < n + n / 2; k++) {
+		uint64_t v = k;
+		assert_int_eq(shash_put(h, &k, &v), SHASH_OK);
+	}
+
+	for (uint32_t k = 0; k < n + n / 2; k++) {
+		int rv = shash_get(h, &k, NULL);
+		assert_int_eq(rv, (k < n && (k & 1) == 0) ? SHASH_ERR_NOTFOUND : SHASH_OK);
+	}
+
+	shash_destroy(h);
+}
+
+TEST( shash_open_manylock, "open addressing shash shards under concurrent puts, gets and deletes" ) {
+	shash* h;
+	worker w[N_WORKERS];
+	pthread_t threads[N_WORKERS];
+
+	assert_int_eq(shash_create(&h, key_hash_fn, sizeof(uint32_t), sizeof(uint64_t), N_WORKERS * N_KEYS, SHASH_CR_OPEN | SHASH_CR_MT_MANYLOCK), SHASH_OK);
+	assert_true(h->n_shards >= 1 && (h->n_shards & (h->n_shards - 1)) == 0);
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		w[i] = (worker){ .h = h, .base = i * N_KEYS, .n = N_KEYS };
+		pthread_create(&threads[i], NULL, worker_run, &w[i]);
+	}
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		pthread_join(threads[i], NULL);
+		assert_int_eq(w[i].failed, 0);
+	}
+
+	assert_int_eq(shash_get_size(h), N_WORKERS * N_KEYS / 2);
+
+	for (uint32_t k = 0; k < N_WORKERS * N_KEYS; k++) {
+		int rv = shash_get(h, &k, NULL);
+		assert_int_eq(rv, (k & 1) ? SHASH_ERR_NOTFOUND : SHASH_OK);
+	}
+
+	shash_destroy(h);
+}
+
+TEST( shash_stats_chained, "shash_get_stats counts chain positions in a chained table" ) {
+	shash* h;
+	shash_stats stats;
+
+	assert_int_eq(shash_create(&h, bad_hash_fn, sizeof(uint32_t), sizeof(uint64_t), 16, SHASH_CR_MT_MANYLOCK), SHASH_OK);
+
+	for (uint32_t k = 0; k < 4; k++) {
+		uint64_t v = k;
+		assert_int_eq(shash_put(h, &k, &v), SHASH_OK);
+	}
+
+	assert_int_eq(shash_get_stats(h, &stats), SHASH_OK);
+	assert_int_eq(stats.elements, 4);
+	assert_int_eq(stats.slots, 16);
+	assert_int_eq(stats.probe_max, 4);
+	assert_true(stats.probe_mean == 2.5);
+
+	shash_destroy(h);
+}
+
+TEST( shash_resize, "resizing shash grows past its initial size and keeps every key" ) {
+	shash* h;
+
+	assert_int_eq(shash_create(&h, key_hash_fn, sizeof(uint32_t), sizeof(uint64_t), 16, SHASH_CR_OPEN | SHASH_CR_RESIZE), SHASH_ERR);
+	assert_int_eq(shash_create(&h, key_hash_fn, sizeof(uint32_t), sizeof(uint64_t), 16, SHASH_CR_RESIZE), SHASH_OK);
+
+	uint64_t sum = 0;
+
+	for (uint32_t k = 0; k < N_KEYS; k++) {
+		uint64_t v = k;
+		assert_int_eq(shash_put(h, &k, &v), SHASH_OK);
+		sum += k;
+	}
+
+	// Never more than a bucket's worth of elements per bucket.
+	assert_true(h->table_len >= N_KEYS / 2);
+	assert_int_eq(shash_get_size(h), N_KEYS);
+
+	uint32_t k = 7;
+	uint64_t v = 0;
+	assert_int_eq(shash_put_unique(h, &k, &v), SHASH_ERR_FOUND);
+
+	for (k = 0; k < N_KEYS; k++) {
+		assert_int_eq(shash_get(h, &k, &v), SHASH_OK);
+		assert_int_eq(v, k);
+	}
+
+	uint64_t total = 0;
+	assert_int_eq(shash_reduce(h, sum_cb, &total), 0);
+	assert_true(total == sum);
+
+	for (k = 0; k < N_KEYS; k += 2) {
+		assert_int_eq(shash_delete(h, &k), SHASH_OK);
+	}
+
+	assert_int_eq(shash_get_size(h), N_KEYS / 2);
+
+	shash_deleteall(h);
+	assert_int_eq(shash_get_size(h), 0);
+
+	k = 1;
+	assert_int_eq(shash_get(h, &k, NULL), SHASH_ERR_NOTFOUND);
+
+	shash_destroy(h);
+}
+
+TEST( shash_resize_load, "resizing shash honors its max load and reduces mid-migration" ) {
+	shash* h;
+	shash_stats stats;
+
+	assert_int_eq(shash_create(&h, key_hash_fn, sizeof(uint32_t), sizeof(uint64_t), 8, SHASH_CR_RESIZE | SHASH_CR_MT_BIGLOCK), SHASH_OK);
+	assert_int_eq(shash_set_max_load(h, 0), SHASH_ERR);
+	assert_int_eq(shash_set_max_load(h, 400), SHASH_OK);
+
+	for (uint32_t k = 0; k < N_KEYS; k++) {
+		uint64_t add = k;
+		uint64_t v_new;
+		assert_int_eq(shash_update(h, &k, NULL, &v_new, add_update_fn, &add), SHASH_OK);
+	}
+
+	assert_int_eq(shash_get_size(h), N_KEYS);
+	assert_true(h->table_len >= N_KEYS / 8 && h->table_len < N_KEYS / 2);
+
+	// Most likely caught between tables - reduce must see each element once.
+	assert_int_eq(shash_reduce_delete(h, delete_odd_cb, NULL), 0);
+	assert_int_eq(shash_get_size(h), N_KEYS / 2);
+
+	assert_int_eq(shash_get_stats(h, &stats), SHASH_OK);
+	assert_int_eq(stats.elements, N_KEYS / 2);
+
+	for (uint32_t k = 0; k < N_KEYS; k++) {
+		uint64_t* vp;
+		pthread_mutex_t* vlock;
+		int rv = shash_get_vlock(h, &k, (void**)&vp, &vlock);
+
+		assert_int_eq(rv, (k & 1) ? SHASH_ERR_NOTFOUND : SHASH_OK);
+
+		if (rv == SHASH_OK) {
+			assert_int_eq(*vp, k);
+			pthread_mutex_unlock(vlock);
+		}
+	}
+
+	shash_destroy(h);
+}
+
+TEST( shash_resize_manylock, "resizing shash grows under concurrent striped puts, gets and deletes" ) {
+	shash* h;
+	worker w[N_WORKERS];
+	pthread_t threads[N_WORKERS];
+
+	assert_int_eq(shash_create(&h, key_hash_fn, sizeof(uint32_t), sizeof(uint64_t), 64, SHASH_CR_RESIZE | SHASH_CR_MT_MANYLOCK), SHASH_OK);
+	assert_true(h->lock_table_len >= 1 && (h->lock_table_len & (h->lock_table_len - 1)) == 0);
+	assert_int_eq(h->table_len % h->lock_table_len, 0);
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		w[i] = (worker){ .h = h, .base = i * N_KEYS, .n = N_KEYS };
+		pthread_create(&threads[i], NULL, worker_run, &w[i]);
+	}
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		pthread_join(threads[i], NULL);
+		assert_int_eq(w[i].failed, 0);
+	}
+
+	assert_int_eq(shash_get_size(h), N_WORKERS * N_KEYS / 2);
+	assert_true(h->table_len >= N_WORKERS * N_KEYS / 4);
+
+	for (uint32_t k = 0; k < N_WORKERS * N_KEYS; k++) {
+		int rv = shash_get(h, &k, NULL);
+		assert_int_eq(rv, (k & 1) ? SHASH_ERR_NOTFOUND : SHASH_OK);
+	}
+
+	shash_destroy(h);
+}
+
+TEST( shash_parallel_reduce, "shash parallel reduce visits every element once in every table kind" ) {
+	uint flags[] = {
+			0,
+			SHASH_CR_MT_BIGLOCK | SHASH_CR_RESIZE,
+			SHASH_CR_MT_MANYLOCK,
+			SHASH_CR_MT_MANYLOCK | SHASH_CR_RESIZE,
+			SHASH_CR_MT_MANYLOCK | SHASH_CR_OPEN
+	};
+	as_thread_pool pool;
+
+	assert_int_eq(as_thread_pool_init(&pool, N_WORKERS), 0);
+
+	for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+		shash* h;
+
+		assert_int_eq(shash_create(&h, key_hash_fn, sizeof(uint32_t), sizeof(uint64_t), (flags[i] & SHASH_CR_RESIZE) ? 64 : N_KEYS, flags[i]), SHASH_OK);
+
+		for (uint32_t k = 0; k < N_KEYS; k++) {
+			uint64_t v = k;
+			assert_int_eq(shash_put(h, &k, &v), SHASH_OK);
+		}
+
+		// Partitions each count into their own copy.
+		tally t = { .limit = N_KEYS };
+		assert_int_eq(shash_reduce_parallel(h, tally_cb, &t, sizeof(t), tally_combine, &pool, 16), 0);
+		assert_int_eq(t.n, N_KEYS);
+		assert_true(t.sum == (uint64_t)N_KEYS * (N_KEYS - 1) / 2);
+
+		// No pool - the caller runs every partition.
+		t = (tally){ .limit = N_KEYS };
+		assert_int_eq(shash_reduce_parallel(h, tally_cb, &t, sizeof(t), tally_combine, NULL, 3), 0);
+		assert_int_eq(t.n, N_KEYS);
+
+		assert_int_eq(shash_reduce_parallel(h, stop_cb, NULL, 0, NULL, &pool, 16), -5);
+
+		assert_int_eq(shash_reduce_delete_parallel(h, delete_odd_cb, NULL, 0, NULL, &pool, 16), 0);
+		assert_int_eq(shash_get_size(h), N_KEYS / 2);
+
+		for (uint32_t k = 0; k < N_KEYS; k++) {
+			int rv = shash_get(h, &k, NULL);
+			assert_int_eq(rv, (k & 1) ? SHASH_ERR_NOTFOUND : SHASH_OK);
+		}
+
+		shash_destroy(h);
+	}
+
+	as_thread_pool_destroy(&pool);
+}
+
+TEST( shash_parallel_reduce_writers, "shash parallel reduce lets writers in and sees each element once as the table grows" ) {
+	uint flags[] = {
+			SHASH_CR_MT_BIGLOCK | SHASH_CR_RESIZE,
+			SHASH_CR_MT_MANYLOCK | SHASH_CR_RESIZE
+	};
+	as_thread_pool pool;
+
+	assert_int_eq(as_thread_pool_init(&pool, N_WORKERS), 0);
+
+	for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+		shash* h;
+		cf_atomic32 done = 0;
+		writer w;
+		pthread_t thread;
+
+		assert_int_eq(shash_create(&h, key_hash_fn, sizeof(uint32_t), sizeof(uint64_t), 64, flags[i]), SHASH_OK);
+
+		for (uint32_t k = 0; k < N_KEYS; k++) {
+			uint64_t v = k;
+			assert_int_eq(shash_put(h, &k, &v), SHASH_OK);
+		}
+
+		w = (writer){ .h = h, .done = &done };
+		pthread_create(&thread, NULL, writer_run, &w);
+
+		// The writer never touches keys below N_KEYS.
+		for (int n = 0; n < 20; n++) {
+			tally t = { .limit = N_KEYS };
+			assert_int_eq(shash_reduce_parallel(h, tally_cb, &t, sizeof(t), tally_combine, &pool, 8), 0);
+			assert_int_eq(t.n, N_KEYS);
+			assert_true(t.sum == (uint64_t)N_KEYS * (N_KEYS - 1) / 2);
+		}
+
+		cf_atomic32_set(&done, 1);
+		pthread_join(thread, NULL);
+
+		shash_destroy(h);
+	}
+
+	as_thread_pool_destroy(&pool);
+}
+
+TEST( shash_many, "shash batched gets and puts match single-key ones in every table kind" ) {
+	uint flags[] = {
+			0,
+			SHASH_CR_MT_BIGLOCK | SHASH_CR_RESIZE,
+			SHASH_CR_MT_MANYLOCK,
+			SHASH_CR_MT_MANYLOCK | SHASH_CR_RESIZE,
+			SHASH_CR_MT_BIGLOCK | SHASH_CR_OPEN,
+			SHASH_CR_MT_MANYLOCK | SHASH_CR_OPEN
+	};
+	uint32_t batch_sizes[] = { 1, 7, 64, 65, 1000 };
+	static uint32_t keys[2 * N_KEYS];
+	static uint64_t values[2 * N_KEYS];
+	static int results[2 * N_KEYS];
+	static uint64_t expect[2 * N_KEYS];
+
+	for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+		shash* h;
+
+		assert_int_eq(shash_create(&h, key_hash_fn, sizeof(uint32_t), sizeof(uint64_t), (flags[i] & SHASH_CR_RESIZE) ? 64 : 2 * N_KEYS, flags[i]), SHASH_OK);
+
+		// Batches of every size, each key put twice in a row - the second
+		// value wins.
+		uint32_t k = 0;
+
+		for (uint32_t b = 0; k < N_KEYS; b++) {
+			uint32_t n = batch_sizes[b % 5];
+
+			for (uint32_t j = 0; j < n; j++) {
+				keys[j] = k + (j / 2);
+				values[j] = ((uint64_t)(k + (j / 2)) << 1) | (j & 1);
+			}
+
+			assert_int_eq(shash_put_many(h, keys, n, values, results), SHASH_OK);
+
+			for (uint32_t j = 0; j < n; j++) {
+				assert_int_eq(results[j], SHASH_OK);
+				expect[keys[j]] = values[j];
+			}
+
+			k += (n + 1) / 2;
+		}
+
+		assert_int_eq(shash_get_size(h), k);
+
+		// Every other key is missing.
+		for (uint32_t j = 0; j < 2 * k; j++) {
+			keys[j] = (j & 1) ? k + j : j / 2;
+		}
+
+		memset(values, 0, sizeof(values));
+		assert_int_eq(shash_get_many(h, keys, 2 * k, values, results), SHASH_ERR_NOTFOUND);
+
+		for (uint32_t j = 0; j < 2 * k; j++) {
+			if (j & 1) {
+				assert_int_eq(results[j], SHASH_ERR_NOTFOUND);
+			}
+			else {
+				uint64_t v = 0;
+
+				assert_int_eq(results[j], SHASH_OK);
+				assert_int_eq(shash_get(h, &keys[j], &v), SHASH_OK);
+				assert_true(values[j] == v);
+				assert_true(v == expect[keys[j]]);
+			}
+		}
+
+		assert_int_eq(shash_get_many(h, keys, 1, NULL, NULL), SHASH_OK);
+
+		shash_destroy(h);
+	}
+}
+
+TEST( shash_slab, "shash chain elements from a slab survive concurrent churn and go back on deleteall" ) {
+	shash* h;
+	shash_stats stats;
+	worker w[N_WORKERS];
+	pthread_t threads[N_WORKERS];
+
+	assert_int_eq(shash_create(&h, key_hash_fn, sizeof(uint32_t), sizeof(uint64_t), 64, SHASH_CR_OPEN | SHASH_CR_SLAB), SHASH_ERR);
+
+	// Few buckets - nearly everything is chained.
+	assert_int_eq(shash_create(&h, key_hash_fn, sizeof(uint32_t), sizeof(uint64_t), 64, SHASH_CR_MT_MANYLOCK | SHASH_CR_SLAB), SHASH_OK);
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		w[i] = (worker){ .h = h, .base = i * N_KEYS, .n = N_KEYS };
+		pthread_create(&threads[i], NULL, worker_run, &w[i]);
+	}
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		pthread_join(threads[i], NULL);
+		assert_int_eq(w[i].failed, 0);
+	}
+
+	for (uint32_t k = 0; k < N_WORKERS * N_KEYS; k++) {
+		uint64_t v = 0;
+		int rv = shash_get(h, &k, &v);
+		assert_int_eq(rv, (k & 1) ? SHASH_ERR_NOTFOUND : SHASH_OK);
+		assert_true((k & 1) || v == k);
+	}
+
+	assert_int_eq(shash_get_stats(h, &stats), SHASH_OK);
+	assert_int_eq(stats.elements, N_WORKERS * N_KEYS / 2);
+	assert_true(stats.bytes >= (size_t)stats.elements * SHASH_ELEM_SZ(h));
+
+	shash_deleteall(h);
+
+	assert_int_eq(shash_get_stats(h, &stats), SHASH_OK);
+	assert_int_eq(stats.elements, 0);
+	assert_int_eq(cf_slab_bytes(h->slab), 0);
+
+	shash_destroy(h);
+
+	// Resizing, with reduce deletes handing elements back.
+	assert_int_eq(shash_create(&h, key_hash_fn, sizeof(uint32_t), sizeof(uint64_t), 16, SHASH_CR_RESIZE | SHASH_CR_MT_BIGLOCK | SHASH_CR_SLAB), SHASH_OK);
+
+	for (int round = 0; round < 2; round++) {
+		for (uint32_t k = 0; k < N_KEYS; k++) {
+			uint64_t v = k;
+			assert_int_eq(shash_put(h, &k, &v), SHASH_OK);
+		}
+
+		assert_int_eq(shash_reduce_delete(h, delete_odd_cb, NULL), SHASH_OK);
+		assert_int_eq(shash_get_size(h), N_KEYS / 2);
+
+		uint64_t sum = 0;
+		assert_int_eq(shash_reduce(h, sum_cb, &sum), SHASH_OK);
+		assert_true(sum == (uint64_t)(N_KEYS / 2) * (N_KEYS / 2 - 1));
+
+		shash_deleteall(h);
+		assert_int_eq(shash_get_size(h), 0);
+	}
+
+	shash_destroy(h);
+}
+
+/******************************************************************************
+ * TEST SUITE
+ *****************************************************************************/
+
+SUITE( citrusleaf_shash, "shash" ) {
+    suite_add( shash_open_basic );
+    suite_add( shash_open_full );
+    suite_add( shash_open_manylock );
+    suite_add( shash_stats_chained );
+    suite_add( shash_resize );
+    suite_add( shash_resize_load );
+    suite_add( shash_resize_manylock );
+    suite_add( shash_parallel_reduce );
+    suite_add( shash_parallel_reduce_writers );
+    suite_add( shash_many );
+    suite_add( shash_slab );
+}
@@ -0,0 +1,141 @@
+#include "../test.h"
+
+#include <citrusleaf/cf_slab.h>
+#include <pthread.h>
+#include <string.h>
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+	cf_slab* slab;
+	uint32_t id;
+	uint32_t failed;
+} churner;
+
+/******************************************************************************
+ * CONSTANTS
+ *****************************************************************************/
+
+#define N_OBJS 10000
+#define N_WORKERS 4
+#define OBJ_SZ 40
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+// Holds up to 256 objects stamped with its id, freeing and allocating in
+// bursts, and checks nobody else wrote over them meanwhile.
+static void*
+churn_run(void* udata)
+{
+	churner* c = udata;
+	uint32_t* held[256] = { NULL };
+
+	for (uint32_t i = 0; i < N_OBJS * 10; i++) {
+		uint32_t j = (i * 7) % 256;
+
+		if (held[j]) {
+			for (int w = 0; w < OBJ_SZ / 4; w++) {
+				if (held[j][w] != c->id) {
+					c->failed++;
+				}
+			}
+			cf_slab_free(c->slab, held[j]);
+			held[j] = NULL;
+		}
+
+		if ((i & 3) != 0) {
+			held[j] = cf_slab_alloc(c->slab);
+
+			for (int w = 0; w < OBJ_SZ / 4; w++) {
+				held[j][w] = c->id;
+			}
+		}
+	}
+
+	for (int j = 0; j < 256; j++) {
+		if (held[j]) {
+			cf_slab_free(c->slab, held[j]);
+		}
+	}
+	return NULL;
+}
+
+/******************************************************************************
+ * TEST CASES
+ *****************************************************************************/
+
+TEST( slab_basic, "cf_slab hands out aligned, distinct objects and recycles freed ones" ) {
+	cf_slab* s = cf_slab_create(OBJ_SZ, 0);
+	static void* objs[N_OBJS];
+
+	assert_not_null(s);
+	assert_int_eq(s->obj_sz, 48);
+
+	for (int i = 0; i < N_OBJS; i++) {
+		objs[i] = cf_slab_alloc(s);
+		assert_not_null(objs[i]);
+		assert_int_eq((uintptr_t)objs[i] % 16, 0);
+		memset(objs[i], i & 0xFF, OBJ_SZ);
+	}
+
+	size_t bytes = cf_slab_bytes(s);
+	assert_true(bytes >= (size_t)N_OBJS * 48);
+
+	for (int i = 0; i < N_OBJS; i++) {
+		assert_int_eq(((uint8_t*)objs[i])[OBJ_SZ - 1], i & 0xFF);
+	}
+
+	// Freed objects come back before any new chunk.
+	for (int i = 0; i < N_OBJS; i += 2) {
+		cf_slab_free(s, objs[i]);
+	}
+
+	for (int i = 0; i < N_OBJS; i += 2) {
+		assert_not_null(cf_slab_alloc(s));
+	}
+
+	assert_int_eq(cf_slab_bytes(s), bytes);
+
+	cf_slab_reset(s);
+	assert_int_eq(cf_slab_bytes(s), 0);
+	assert_not_null(cf_slab_alloc(s));
+
+	cf_slab_destroy(s);
+}
+
+TEST( slab_mt, "cf_slab magazines never hand one object to two threads" ) {
+	cf_slab* s = cf_slab_create(OBJ_SZ, CF_SLAB_MT);
+	churner c[N_WORKERS];
+	pthread_t threads[N_WORKERS];
+
+	assert_not_null(s);
+	assert_true(s->n_mags >= 1 && (s->n_mags & (s->n_mags - 1)) == 0);
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		c[i] = (churner){ .slab = s, .id = i + 1 };
+		pthread_create(&threads[i], NULL, churn_run, &c[i]);
+	}
+
+	for (int i = 0; i < N_WORKERS; i++) {
+		pthread_join(threads[i], NULL);
+		assert_int_eq(c[i].failed, 0);
+	}
+
+	// At most 256 objects held per thread, plus what magazines keep.
+	assert_true(cf_slab_bytes(s) < 1024 * 1024);
+
+	cf_slab_destroy(s);
+}
+
+/******************************************************************************
+ * TEST SUITE
+ *****************************************************************************/
+
+SUITE( citrusleaf_slab, "cf_slab" ) {
+    suite_add( slab_basic );
+    suite_add( slab_mt );
+}
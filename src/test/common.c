@@ -16,9 +16,23 @@ PLAN( common ) {
 
     plan_add( password );
     plan_add( string_builder );
+    plan_add( thread_pool );
 	
     /**
      * msgpack - tests msgpack
      */
 	plan_add( msgpack_roundtrip );
+
+    /**
+     * citrusleaf - tests containers
+     */
+    plan_add( citrusleaf_atomic );
+    plan_add( citrusleaf_alloc );
+    plan_add( citrusleaf_queue );
+    plan_add( citrusleaf_queue_priority );
+    plan_add( citrusleaf_rchash );
+    plan_add( citrusleaf_shash );
+    plan_add( citrusleaf_hash );
+    plan_add( citrusleaf_slab );
+    plan_add( citrusleaf_counter );
 }
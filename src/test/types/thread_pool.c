@@ -0,0 +1,724 @@
+#include "../test.h"
+
+#include <aerospike/as_thread_pool.h>
+#include <citrusleaf/cf_atomic.h>
+#include <citrusleaf/cf_clock.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+/******************************************************************************
+ * TYPES
+ *****************************************************************************/
+
+typedef struct {
+	as_thread_pool* pool;
+	cf_atomic32 n_run;
+} tree;
+
+typedef struct {
+	tree* t;
+	uint32_t depth;
+} node;
+
+typedef struct {
+	as_thread_pool* pool;
+	volatile bool open;
+	cf_atomic32 n_run;
+	volatile bool queued;
+} gate;
+
+typedef struct {
+	cf_atomic32 n_arrived;
+	cf_atomic32 in_slot[8];
+} slot_check;
+
+typedef struct {
+	uint64_t due_us;
+	uint64_t fired_us;
+	cf_atomic32* order;
+	uint32_t rank;
+} timed;
+
+/******************************************************************************
+ * STATIC FUNCTIONS
+ *****************************************************************************/
+
+static void
+count_task(void* udata)
+{
+	cf_atomic32_incr((cf_atomic32*)udata);
+}
+
+// Each node queues its two children from inside the pool.
+static void
+tree_task(void* udata)
+{
+	node* n = udata;
+
+	cf_atomic32_incr(&n->t->n_run);
+
+	if (n->depth > 0) {
+		n[1].t = n->t;
+		n[1].depth = n->depth - 1;
+		as_thread_pool_queue_task(n->t->pool, tree_task, &n[1]);
+
+		n[1 << n->depth].t = n->t;
+		n[1 << n->depth].depth = n->depth - 1;
+		as_thread_pool_queue_task(n->t->pool, tree_task, &n[1 << n->depth]);
+	}
+}
+
+// Counts tasks run on threads named by the pool.
+static void
+named_task(void* udata)
+{
+	char name[16] = "aspool-";
+#if defined(__linux__)
+	pthread_getname_np(pthread_self(), name, sizeof(name));
+#endif
+	if (strncmp(name, "aspool-", 7) == 0) {
+		cf_atomic32_incr((cf_atomic32*)udata);
+	}
+}
+
+static void
+timed_task(void* udata)
+{
+	timed* t = udata;
+
+	t->fired_us = cf_getus();
+	t->rank = (uint32_t)cf_atomic32_incr(t->order);
+}
+
+// Holds its thread until the gate opens.
+static void
+gate_task(void* udata)
+{
+	gate* g = udata;
+
+	while (! g->open) {
+		usleep(1000);
+	}
+	cf_atomic32_incr(&g->n_run);
+}
+
+static void
+gate_count_task(void* udata)
+{
+	cf_atomic32_incr(&((gate*)udata)->n_run);
+}
+
+static void*
+gate_queue_fn(void* udata)
+{
+	gate* g = udata;
+
+	as_thread_pool_queue_task(g->pool, gate_count_task, g);
+	g->queued = true;
+	return NULL;
+}
+
+// Init a one-thread pool with its thread held and its queue full.
+static int
+gate_pool_init(as_thread_pool* pool, gate* g, as_thread_pool_overflow overflow)
+{
+	as_thread_pool_config config;
+
+	as_thread_pool_config_init(&config);
+	config.thread_size = 1;
+	config.queue_limit = 4;
+	config.overflow = overflow;
+
+	g->pool = pool;
+	g->open = false;
+	g->n_run = 0;
+	g->queued = false;
+
+	int rc = as_thread_pool_init_config(pool, &config);
+
+	rc = rc ? rc : as_thread_pool_queue_task(pool, gate_task, g);
+
+	// Let the thread take it.
+	usleep(20 * 1000);
+
+	for (int i = 0; rc == 0 && i < 4; i++) {
+		rc = as_thread_pool_queue_task(pool, gate_count_task, g);
+	}
+	return rc;
+}
+
+static void*
+gate_open_fn(void* udata)
+{
+	usleep(20 * 1000);
+	((gate*)udata)->open = true;
+	return NULL;
+}
+
+// Notes the slot in its thread's name, then holds the thread till 4 arrive.
+static void
+slot_task(void* udata)
+{
+	slot_check* c = udata;
+	char name[16] = "";
+#if defined(__linux__)
+	pthread_getname_np(pthread_self(), name, sizeof(name));
+#endif
+	char* dash = strrchr(name, '-');
+	int slot = dash ? atoi(dash + 1) : -1;
+
+	if (slot >= 0 && slot < 8) {
+		cf_atomic32_incr(&c->in_slot[slot]);
+	}
+	cf_atomic32_incr(&c->n_arrived);
+
+	for (int i = 0; i < 2000 && cf_atomic32_get(c->n_arrived) < 4; i++) {
+		usleep(1000);
+	}
+}
+
+// Shrinks an 8 thread pool to 4 - idle or busy - and checks slots 0-3 are
+// the ones left running.
+static bool
+shrink_keeps_low_slots(as_thread_pool_config* config, bool busy)
+{
+	as_thread_pool pool;
+	gate g = { .pool = &pool, .open = false, .n_run = 0, .queued = false };
+	slot_check c;
+	pthread_t opener;
+
+	memset(&c, 0, sizeof(c));
+	config->thread_size = 8;
+	config->name_prefix = "aspool";
+
+	if (as_thread_pool_init_config(&pool, config) != 0) {
+		return false;
+	}
+
+	if (busy) {
+		for (int i = 0; i < 8; i++) {
+			as_thread_pool_queue_task(&pool, gate_task, &g);
+		}
+		pthread_create(&opener, NULL, gate_open_fn, &g);
+	}
+
+	bool ok = as_thread_pool_resize(&pool, 4) == 0;
+
+	if (busy) {
+		pthread_join(opener, NULL);
+	}
+
+	for (int i = 0; i < 4; i++) {
+		as_thread_pool_queue_task(&pool, slot_task, &c);
+	}
+	as_thread_pool_destroy(&pool);
+
+	for (int i = 0; i < 8; i++) {
+		ok = ok && cf_atomic32_get(c.in_slot[i]) == (i < 4 ? 1 : 0);
+	}
+	return ok;
+}
+
+static void*
+square_fn(void* udata)
+{
+	uintptr_t x = (uintptr_t)udata;
+	return (void*)(x * x);
+}
+
+static void*
+slow_fn(void* udata)
+{
+	usleep((uint32_t)(uintptr_t)udata * 1000);
+	return udata;
+}
+
+typedef struct {
+	as_future** futures;
+	uint32_t n_futures;
+	int rc;
+} any_waiter;
+
+static void*
+wait_any_fn(void* udata)
+{
+	any_waiter* w = udata;
+	w->rc = as_future_wait_any(w->futures, w->n_futures, 5000);
+	return NULL;
+}
+
+static void*
+add_one_fn(void* result, void* udata)
+{
+	return (void*)((uintptr_t)result + 1);
+}
+
+/******************************************************************************
+ * TEST CASES
+ *****************************************************************************/
+
+TEST( thread_pool_drain, "shared queue pool runs queued tasks before destroy returns" ) {
+	as_thread_pool pool;
+	cf_atomic32 n_run = 0;
+
+	assert_int_eq(as_thread_pool_init(&pool, 4), 0);
+
+	for (int i = 0; i < 10000; i++) {
+		assert_int_eq(as_thread_pool_queue_task(&pool, count_task, (void*)&n_run), 0);
+	}
+
+	assert_int_eq(as_thread_pool_destroy(&pool), 0);
+	assert_int_eq(n_run, 10000);
+}
+
+TEST( thread_pool_ws_tree, "work-stealing pool runs a spawned task tree" ) {
+	as_thread_pool pool;
+	tree t = { .pool = &pool, .n_run = 0 };
+
+	// A tree of depth d is laid out in 2^(d+1) - 1 nodes, preorder.
+	uint32_t depth = 12;
+	uint32_t n_nodes = (1 << (depth + 1)) - 1;
+	node* nodes = malloc(n_nodes * sizeof(node));
+
+	assert_int_eq(as_thread_pool_init_mode(&pool, 4, AS_THREAD_POOL_WORK_STEALING), 0);
+
+	nodes[0].t = &t;
+	nodes[0].depth = depth;
+	assert_int_eq(as_thread_pool_queue_task(&pool, tree_task, &nodes[0]), 0);
+
+	for (int i = 0; i < 10000 && t.n_run < n_nodes; i++) {
+		usleep(1000);
+	}
+	assert_int_eq(t.n_run, n_nodes);
+
+	assert_int_eq(as_thread_pool_destroy(&pool), 0);
+	free(nodes);
+}
+
+TEST( thread_pool_ws_drain, "work-stealing pool drains deques on resize and destroy" ) {
+	as_thread_pool pool;
+	tree t = { .pool = &pool, .n_run = 0 };
+	uint32_t depth = 10;
+	uint32_t n_nodes = (1 << (depth + 1)) - 1;
+	uint32_t n_trees = 8;
+	node* nodes = malloc(n_trees * n_nodes * sizeof(node));
+
+	assert_int_eq(as_thread_pool_init_mode(&pool, 2, AS_THREAD_POOL_WORK_STEALING), 0);
+	assert_int_eq(as_thread_pool_resize(&pool, 6), 0);
+
+	for (uint32_t i = 0; i < n_trees; i++) {
+		node* root = &nodes[i * n_nodes];
+		root->t = &t;
+		root->depth = depth;
+		assert_int_eq(as_thread_pool_queue_task(&pool, tree_task, root), 0);
+
+		if (i == n_trees / 2) {
+			assert_int_eq(as_thread_pool_resize(&pool, 1), 0);
+		}
+	}
+
+	// Doesn't wait for the trees - the workers have to finish them on the way out.
+	assert_int_eq(as_thread_pool_destroy(&pool), 0);
+	assert_int_eq(t.n_run, n_trees * n_nodes);
+	free(nodes);
+}
+
+TEST( thread_pool_futures, "futures wait for results, singly and together" ) {
+	as_thread_pool pool;
+	as_future* futures[100];
+
+	assert_int_eq(as_thread_pool_init(&pool, 4), 0);
+
+	for (uintptr_t i = 0; i < 100; i++) {
+		futures[i] = as_thread_pool_submit(&pool, square_fn, (void*)i);
+		assert_not_null(futures[i]);
+	}
+	assert_int_eq(as_future_wait_all(futures, 100, -1), 0);
+
+	for (uintptr_t i = 0; i < 100; i++) {
+		assert_int_eq((uintptr_t)as_future_wait(futures[i]), i * i);
+		as_future_release(futures[i]);
+	}
+
+	// Released futures are recycled.
+	as_future* f = as_thread_pool_submit(&pool, square_fn, (void*)7);
+	as_future* g = as_thread_pool_submit(&pool, square_fn, (void*)8);
+	assert_int_eq((uintptr_t)as_future_wait(f), 49);
+	assert_int_eq((uintptr_t)as_future_wait(g), 64);
+	as_future_release(f);
+	as_future_release(g);
+
+	assert_int_eq(as_thread_pool_destroy(&pool), 0);
+}
+
+TEST( thread_pool_future_timeout, "future waits time out and wait_any picks the finished one" ) {
+	as_thread_pool pool;
+	void* result = NULL;
+
+	assert_int_eq(as_thread_pool_init(&pool, 2), 0);
+
+	as_future* slow[2];
+	slow[0] = as_thread_pool_submit(&pool, slow_fn, (void*)500);
+	slow[1] = as_thread_pool_submit(&pool, slow_fn, (void*)50);
+
+	assert_int_eq(as_future_wait_timeout(slow[0], 10, &result), -1);
+	assert_int_eq(as_future_wait_any(slow, 2, 10), -1);
+	assert_int_eq(as_future_wait_any(slow, 2, -1), 1);
+	assert_int_eq(as_future_wait_timeout(slow[1], 0, &result), 0);
+	assert_int_eq((uintptr_t)result, 50);
+	assert_int_eq(as_future_wait_all(slow, 2, 5000), 0);
+
+	as_future_release(slow[0]);
+	as_future_release(slow[1]);
+	assert_int_eq(as_thread_pool_destroy(&pool), 0);
+}
+
+TEST( thread_pool_future_wait_any, "every wait_any caller wakes on the first of its futures" ) {
+	as_thread_pool pool;
+	as_future* futures[20];
+	any_waiter waiters[3];
+	pthread_t threads[3];
+
+	assert_int_eq(as_thread_pool_init(&pool, 20), 0);
+
+	for (uint32_t i = 0; i < 20; i++) {
+		futures[i] = as_thread_pool_submit(&pool, slow_fn, (void*)(uintptr_t)(i == 13 ? 50 : 300));
+		assert_not_null(futures[i]);
+	}
+
+	// More futures than wait_any links on its stack, and several callers
+	// linked to each.
+	for (uint32_t i = 0; i < 3; i++) {
+		waiters[i].futures = futures;
+		waiters[i].n_futures = 20;
+		waiters[i].rc = -2;
+		assert_int_eq(pthread_create(&threads[i], NULL, wait_any_fn, &waiters[i]), 0);
+	}
+
+	assert_int_eq(as_future_wait_any(&futures[12], 2, 5000), 1);
+
+	for (uint32_t i = 0; i < 3; i++) {
+		pthread_join(threads[i], NULL);
+		assert_int_eq(waiters[i].rc, 13);
+	}
+
+	// Done already - no waiting, and the others are left unlinked.
+	assert_int_eq(as_future_wait_any(futures, 20, 0), 13);
+	assert_int_eq(as_future_wait_all(futures, 20, 5000), 0);
+
+	for (uint32_t i = 0; i < 20; i++) {
+		as_future_release(futures[i]);
+	}
+	assert_int_eq(as_thread_pool_destroy(&pool), 0);
+}
+
+TEST( thread_pool_config, "configured pool places, names and resizes its threads" ) {
+	as_thread_pool pool;
+	as_thread_pool_config config;
+	cf_atomic32 n_run = 0;
+
+	// Invalid configs.
+	as_thread_pool_config_init(&config);
+	config.thread_size = 2;
+	config.placement = AS_THREAD_POOL_PLACE_CPUS;
+	assert_int_eq(as_thread_pool_init_config(&pool, &config), -4);
+
+	as_thread_pool_config_init(&config);
+	config.thread_size = 2;
+	config.mode = AS_THREAD_POOL_WORK_STEALING;
+	config.placement = AS_THREAD_POOL_PLACE_NODE;
+	config.node_queues = true;
+	assert_int_eq(as_thread_pool_init_config(&pool, &config), -4);
+
+	// Per-node sub-pools, resized down and up.
+	as_thread_pool_config_init(&config);
+	config.thread_size = 3;
+	config.placement = AS_THREAD_POOL_PLACE_COMPACT;
+	config.stack_size = 256 * 1024;
+	config.name_prefix = "aspool";
+	config.node_queues = true;
+	assert_int_eq(as_thread_pool_init_config(&pool, &config), 0);
+
+	for (int i = 0; i < 1000; i++) {
+		assert_int_eq(as_thread_pool_queue_task(&pool, named_task, (void*)&n_run), 0);
+	}
+
+	assert_int_eq(as_thread_pool_resize(&pool, 1), 0);
+
+	for (int i = 0; i < 1000; i++) {
+		assert_int_eq(as_thread_pool_queue_task(&pool, named_task, (void*)&n_run), 0);
+	}
+
+	assert_int_eq(as_thread_pool_resize(&pool, 4), 0);
+
+	for (int i = 0; i < 1000; i++) {
+		assert_int_eq(as_thread_pool_queue_task(&pool, named_task, (void*)&n_run), 0);
+	}
+
+	assert_int_eq(as_thread_pool_destroy(&pool), 0);
+	assert_int_eq(n_run, 3000);
+
+	// Work stealing, pinned to a listed CPU.
+	uint32_t cpus[] = { 0 };
+	tree t = { .pool = &pool, .n_run = 0 };
+	node* nodes = malloc(sizeof(node) << 10);
+
+	as_thread_pool_config_init(&config);
+	config.thread_size = 2;
+	config.mode = AS_THREAD_POOL_WORK_STEALING;
+	config.placement = AS_THREAD_POOL_PLACE_CPUS;
+	config.cpus = cpus;
+	config.n_cpus = 1;
+	assert_int_eq(as_thread_pool_init_config(&pool, &config), 0);
+
+	nodes[0].t = &t;
+	nodes[0].depth = 9;
+	assert_int_eq(as_thread_pool_queue_task(&pool, tree_task, &nodes[0]), 0);
+
+	assert_int_eq(as_thread_pool_destroy(&pool), 0);
+	assert_int_eq(t.n_run, (1 << 10) - 1);
+	free(nodes);
+}
+
+TEST( thread_pool_shrink_slots, "shrinking a configured pool stops the threads in the highest slots" ) {
+	as_thread_pool_config config;
+
+	for (int busy = 0; busy < 2; busy++) {
+		as_thread_pool_config_init(&config);
+		config.placement = AS_THREAD_POOL_PLACE_COMPACT;
+		assert_true(shrink_keeps_low_slots(&config, busy));
+
+		as_thread_pool_config_init(&config);
+		config.placement = AS_THREAD_POOL_PLACE_COMPACT;
+		config.node_queues = true;
+		assert_true(shrink_keeps_low_slots(&config, busy));
+
+		as_thread_pool_config_init(&config);
+		config.mode = AS_THREAD_POOL_WORK_STEALING;
+		config.placement = AS_THREAD_POOL_PLACE_COMPACT;
+		assert_true(shrink_keeps_low_slots(&config, busy));
+	}
+}
+
+TEST( thread_pool_timers, "scheduled tasks fire in order, never early, and cancel" ) {
+	as_thread_pool pool;
+	cf_atomic32 order = 0;
+	cf_atomic32 n_ticks = 0;
+	timed timers[4];
+	uint64_t delays_ms[4] = { 40, 10, 25, 60 };
+
+	assert_int_eq(as_thread_pool_init(&pool, 2), 0);
+
+	as_thread_pool_timer handles[4];
+
+	for (int i = 0; i < 4; i++) {
+		timers[i].order = &order;
+		timers[i].rank = 0;
+		timers[i].due_us = cf_getus() + (delays_ms[i] * 1000);
+		handles[i] = as_thread_pool_schedule(&pool, timed_task, &timers[i], delays_ms[i] * 1000);
+		assert_true(handles[i] != 0);
+	}
+
+	as_thread_pool_timer periodic = as_thread_pool_schedule_periodic(&pool, count_task, (void*)&n_ticks, 5000, 5000);
+	assert_true(periodic != 0);
+
+	// Cancel the last, twice.
+	assert_int_eq(as_thread_pool_cancel(&pool, handles[3]), 0);
+	assert_int_eq(as_thread_pool_cancel(&pool, handles[3]), -1);
+
+	usleep(100 * 1000);
+
+	assert_int_eq(as_thread_pool_cancel(&pool, periodic), 0);
+	assert_true(n_ticks >= 5);
+
+	// Fired ones can't be cancelled.
+	assert_int_eq(as_thread_pool_cancel(&pool, handles[0]), -1);
+
+	assert_int_eq(timers[1].rank, 1);
+	assert_int_eq(timers[2].rank, 2);
+	assert_int_eq(timers[0].rank, 3);
+	assert_int_eq(timers[3].rank, 0);
+
+	for (int i = 0; i < 3; i++) {
+		assert_true(timers[i].fired_us >= timers[i].due_us);
+	}
+
+	// No more ticks once cancelled, bar one already queued.
+	usleep(10 * 1000);
+	uint32_t ticks = n_ticks;
+	usleep(30 * 1000);
+	assert_int_eq(n_ticks, ticks);
+
+	// Spread past level 0 of the wheel.
+	timed spread[100];
+	cf_atomic32 spread_order = 0;
+
+	for (int i = 0; i < 100; i++) {
+		spread[i].order = &spread_order;
+		spread[i].rank = 0;
+		spread[i].due_us = cf_getus() + (i * 3000);
+		assert_true(as_thread_pool_schedule(&pool, timed_task, &spread[i], i * 3000) != 0);
+	}
+
+	usleep(350 * 1000);
+	assert_int_eq(spread_order, 100);
+
+	for (int i = 0; i < 100; i++) {
+		assert_true(spread[i].rank != 0);
+		assert_true(spread[i].fired_us >= spread[i].due_us);
+	}
+
+	// Pending timers are dropped on destroy.
+	assert_true(as_thread_pool_schedule(&pool, timed_task, &timers[3], 1000 * 1000 * 1000) != 0);
+	assert_int_eq(as_thread_pool_destroy(&pool), 0);
+	assert_int_eq(timers[3].rank, 0);
+}
+
+TEST( thread_pool_bounded, "bounded pool rejects, runs in caller or blocks at its limit" ) {
+	as_thread_pool pool;
+	as_thread_pool_stats stats;
+	gate g;
+
+	// Fail fast.
+	assert_int_eq(gate_pool_init(&pool, &g, AS_THREAD_POOL_REJECT), 0);
+	assert_int_eq(as_thread_pool_queue_task(&pool, gate_count_task, &g), -3);
+
+	as_thread_pool_get_stats(&pool, &stats);
+	assert_int_eq(stats.depth, 4);
+	assert_int_eq(stats.admitted, 5);
+	assert_int_eq(stats.rejected, 1);
+	assert_int_eq(stats.caller_ran, 0);
+
+	g.open = true;
+	assert_int_eq(as_thread_pool_destroy(&pool), 0);
+	assert_int_eq(g.n_run, 5);
+
+	// Caller runs.
+	assert_int_eq(gate_pool_init(&pool, &g, AS_THREAD_POOL_CALLER_RUNS), 0);
+	assert_int_eq(as_thread_pool_queue_task(&pool, gate_count_task, &g), 0);
+	assert_int_eq(g.n_run, 1);
+
+	as_thread_pool_get_stats(&pool, &stats);
+	assert_int_eq(stats.rejected, 1);
+	assert_int_eq(stats.caller_ran, 1);
+
+	g.open = true;
+	assert_int_eq(as_thread_pool_destroy(&pool), 0);
+	assert_int_eq(g.n_run, 6);
+
+	// Block until there's room.
+	pthread_t thread;
+
+	assert_int_eq(gate_pool_init(&pool, &g, AS_THREAD_POOL_BLOCK), 0);
+	assert_int_eq(pthread_create(&thread, NULL, gate_queue_fn, &g), 0);
+
+	usleep(20 * 1000);
+	assert_true(! g.queued);
+
+	g.open = true;
+	pthread_join(thread, NULL);
+	assert_true(g.queued);
+
+	assert_int_eq(as_thread_pool_destroy(&pool), 0);
+	assert_int_eq(g.n_run, 6);
+
+	as_thread_pool_get_stats(&pool, &stats);
+	assert_int_eq(stats.depth, 0);
+	assert_int_eq(stats.admitted, 6);
+	assert_int_eq(stats.rejected, 0);
+
+	// Timer firings go past the limit, not onto the timer thread.
+	assert_int_eq(gate_pool_init(&pool, &g, AS_THREAD_POOL_BLOCK), 0);
+	assert_true(as_thread_pool_schedule(&pool, gate_count_task, &g, 1000) != 0);
+
+	usleep(30 * 1000);
+	assert_int_eq(g.n_run, 0);
+
+	as_thread_pool_get_stats(&pool, &stats);
+	assert_int_eq(stats.depth, 5);
+	assert_int_eq(stats.caller_ran, 0);
+
+	g.open = true;
+	assert_int_eq(as_thread_pool_destroy(&pool), 0);
+	assert_int_eq(g.n_run, 6);
+}
+
+TEST( thread_pool_future_then, "continuations chain on futures, before and after they finish" ) {
+	as_thread_pool pool;
+
+	assert_int_eq(as_thread_pool_init_mode(&pool, 2, AS_THREAD_POOL_WORK_STEALING), 0);
+
+	// Continuation added while the task is still running.
+	as_future* f = as_thread_pool_submit(&pool, slow_fn, (void*)100);
+	as_future* g = as_future_then(f, add_one_fn, NULL);
+	as_future* h = as_future_then(g, add_one_fn, NULL);
+
+	assert_not_null(g);
+	assert_not_null(h);
+	assert_null(as_future_then(f, add_one_fn, NULL));
+	assert_int_eq((uintptr_t)as_future_wait(h), 102);
+
+	// Continuation added after the task is done.
+	as_future* k = as_future_then(f, add_one_fn, NULL);
+	assert_int_eq((uintptr_t)as_future_wait(k), 101);
+
+	as_future_release(f);
+	as_future_release(g);
+	as_future_release(h);
+	as_future_release(k);
+	assert_int_eq(as_thread_pool_destroy(&pool), 0);
+}
+
+TEST( thread_pool_future_then_destroy, "continuations queued or added across destroy still run" ) {
+	as_thread_pool pool;
+	as_thread_pool_stats stats;
+	cf_atomic32 n_run = 0;
+
+	assert_int_eq(as_thread_pool_init(&pool, 1), 0);
+
+	// The worker finishes f after destroy queues its shutdown task, so g is
+	// queued behind it.
+	as_future* f = as_thread_pool_submit(&pool, slow_fn, (void*)50);
+	as_future* g = as_future_then(f, add_one_fn, NULL);
+
+	assert_not_null(g);
+	assert_int_eq(as_thread_pool_destroy(&pool), 0);
+	assert_int_eq((uintptr_t)as_future_wait(g), 51);
+
+	// Once destroyed, continuations run in place and nothing else queues.
+	as_future* h = as_future_then(g, add_one_fn, NULL);
+
+	assert_not_null(h);
+	assert_int_eq((uintptr_t)as_future_wait(h), 52);
+	assert_true(as_thread_pool_queue_task(&pool, count_task, (void*)&n_run) != 0);
+	assert_null(as_thread_pool_submit(&pool, slow_fn, NULL));
+	assert_int_eq(n_run, 0);
+
+	as_thread_pool_get_stats(&pool, &stats);
+	assert_int_eq(stats.admitted, 2);
+	assert_int_eq(stats.depth, 0);
+
+	as_future_release(f);
+	as_future_release(g);
+	as_future_release(h);
+}
+
+/******************************************************************************
+ * TEST SUITE
+ *****************************************************************************/
+
+SUITE( thread_pool, "as_thread_pool" ) {
+    suite_add( thread_pool_drain );
+    suite_add( thread_pool_ws_tree );
+    suite_add( thread_pool_ws_drain );
+    suite_add( thread_pool_futures );
+    suite_add( thread_pool_future_timeout );
+    suite_add( thread_pool_future_wait_any );
+    suite_add( thread_pool_future_then );
+    suite_add( thread_pool_future_then_destroy );
+    suite_add( thread_pool_config );
+    suite_add( thread_pool_shrink_slots );
+    suite_add( thread_pool_timers );
+    suite_add( thread_pool_bounded );
+}